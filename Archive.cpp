@@ -0,0 +1,755 @@
+/*--------------------------------------------------------------------------------
+
+	Archive.cpp
+
+	Provides a chunked, compressed archive for storing a world of terrain
+	tiles in one file, with random access to any chunk of any tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include "Archive.h"
+#include "Parallel.h"
+#include "Arena.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define RICE_ESCAPE		12		// Quotients this large are sent as raw bytes instead
+#define RICE_MAX_K		7
+#define RICE_RESCALE	64		// Halve the adaptive stats this often, to follow local detail
+
+typedef struct tagBITWRITER
+{
+	BYTE*	pbOut;
+	DWORD	dwPos;
+	DWORD	dwAcc;
+	int		iBits;
+} BITWRITER;
+
+typedef struct tagBITREADER
+{
+	const BYTE*	pbIn;
+	DWORD		dwSize;
+	DWORD		dwPos;
+	DWORD		dwAcc;
+	int			iBits;
+} BITREADER;
+
+//------------------------------------------
+//	Append iCount (<= 24) bits, MSB first
+//------------------------------------------
+static void PutBits( BITWRITER& writer, DWORD dwValue, int iCount )
+{
+	writer.dwAcc = ( writer.dwAcc << iCount ) | ( dwValue & ( ( 1 << iCount ) - 1 ) );
+	writer.iBits += iCount;
+
+	while ( writer.iBits >= 8 )
+	{
+		writer.iBits -= 8;
+		writer.pbOut[writer.dwPos++] = (BYTE)( writer.dwAcc >> writer.iBits );
+	}
+}
+
+static DWORD GetBits( BITREADER& reader, int iCount )
+{
+	while ( reader.iBits < iCount )
+	{
+		reader.dwAcc = ( reader.dwAcc << 8 ) | ( reader.dwPos < reader.dwSize ? reader.pbIn[reader.dwPos] : 0 );
+		reader.dwPos++;
+		reader.iBits += 8;
+	}
+
+	reader.iBits -= iCount;
+
+	return ( reader.dwAcc >> reader.iBits ) & ( ( 1 << iCount ) - 1 );
+}
+
+//----------------------------------------------------------------------
+//	Median edge predictor (as LOCO-I), picks the left or upper
+//	neighbour across an edge and a planar estimate on smooth ground
+//----------------------------------------------------------------------
+static int Predict( const BYTE* pbCells, int iWidth, int iX, int iY )
+{
+	if ( iY == 0 )
+	{
+		return iX == 0 ? 128 : pbCells[iX - 1];
+	}
+
+	if ( iX == 0 )
+	{
+		return pbCells[( iY - 1 ) * iWidth];
+	}
+
+	int iA = pbCells[iY * iWidth + iX - 1];
+	int iB = pbCells[( iY - 1 ) * iWidth + iX];
+	int iC = pbCells[( iY - 1 ) * iWidth + iX - 1];
+	int iMin = iA < iB ? iA : iB;
+	int iMax = iA > iB ? iA : iB;
+
+	if ( iC >= iMax )
+	{
+		return iMin;
+	}
+
+	if ( iC <= iMin )
+	{
+		return iMax;
+	}
+
+	return iA + iB - iC;
+}
+
+//--------------------------------------------------------------
+//	Rice parameter for the running mean of coded residuals
+//--------------------------------------------------------------
+static int RiceK( int iSum, int iCount )
+{
+	int iK = 0;
+
+	while ( iK < RICE_MAX_K && ( iCount << iK ) < iSum )
+	{
+		iK++;
+	}
+
+	return iK;
+}
+
+//------------------------------------------
+//
+//	CLASS: CTileArchive implementation
+//
+//------------------------------------------
+CTileArchive::CTileArchive()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pbView = NULL;
+	m_pIndex = NULL;
+	m_pbScratch = NULL;
+	m_pdwSizes = NULL;
+	m_szError[0] = 0;
+
+	SYSTEM_INFO info;
+
+	GetSystemInfo( &info );
+	m_dwGranularity = info.dwAllocationGranularity;
+
+	Reset();
+}
+
+CTileArchive::~CTileArchive()
+{
+	Close();
+}
+
+void CTileArchive::Reset()
+{
+	m_bWriting = FALSE;
+	m_iChunksX = 0;
+	m_ullEnd = 0;
+
+	memset( &m_header, 0, sizeof(m_header) );
+}
+
+LPCSTR CTileArchive::GetError()
+{
+	return m_szError;
+}
+
+int CTileArchive::ChunksPerTile()
+{
+	return m_iChunksX * m_iChunksX;
+}
+
+ARCHIVECHUNK* CTileArchive::Chunk( int iTileX, int iTileY, int iChunk )
+{
+	return &m_pIndex[( iTileY * (int)m_header.dwTilesX + iTileX ) * ChunksPerTile() + iChunk];
+}
+
+//	Entries in the header's index, or 0 if it would pass ARCHIVE_MAX_INDEX
+//	bytes, which also keeps Chunk's int arithmetic in range
+//---------------------------------------------------------------------------
+int CTileArchive::IndexEntries()
+{
+	ULONGLONG ullEntries = (ULONGLONG)m_header.dwTilesX * m_header.dwTilesY * ChunksPerTile();
+
+	if ( ullEntries * sizeof(ARCHIVECHUNK) > ARCHIVE_MAX_INDEX )
+	{
+		return 0;
+	}
+
+	return (int)ullEntries;
+}
+
+//-------------------------------------------------------------------------
+//	Start a new archive for a world of iTilesX * iTilesY tiles, replacing
+//	any existing file
+//-------------------------------------------------------------------------
+BOOL CTileArchive::Create( LPCSTR szFilename, int iTilesX, int iTilesY, int iTileSq )
+{
+	Close();
+
+	m_hFile = CreateFile( szFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+	{
+		sprintf( m_szError, "Unable to create %.200s", szFilename );
+		return FALSE;
+	}
+
+	m_header.dwMagic = ARCHIVE_MAGIC;
+	m_header.dwVersion = ARCHIVE_VERSION;
+	m_header.dwTilesX = iTilesX;
+	m_header.dwTilesY = iTilesY;
+	m_header.dwTileSq = iTileSq;
+	m_header.dwChunkSq = ARCHIVE_CHUNK;
+
+	m_iChunksX = ( iTileSq + ARCHIVE_CHUNK - 1 ) / ARCHIVE_CHUNK;
+
+	int iEntries = iTilesX > 0 && iTilesY > 0 ? IndexEntries() : 0;
+
+	if ( iEntries == 0 )
+	{
+		sprintf( m_szError, "A world of %d by %d tiles does not fit an archive", iTilesX, iTilesY );
+		Close();
+		return FALSE;
+	}
+
+	m_pIndex = new ARCHIVECHUNK[iEntries];
+
+	if ( m_pIndex == NULL )
+	{
+		sprintf( m_szError, "Out of memory for the index of %.200s", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	memset( m_pIndex, 0, sizeof(ARCHIVECHUNK) * iEntries );
+
+	m_ullEnd = sizeof(ARCHIVEHEADER) + sizeof(ARCHIVECHUNK) * (ULONGLONG)iEntries;
+	m_bWriting = TRUE;
+
+	//	Reserve the header and index, they are rewritten on Close
+	//---------------------------------------------------------------
+	if ( !WriteIndex() )
+	{
+		Close();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------
+//	Open an archive to add tiles to, creating it if it does not exist
+//
+//	An existing archive must have the same world and tile size
+//------------------------------------------------------------------------
+BOOL CTileArchive::OpenForWrite( LPCSTR szFilename, int iTilesX, int iTilesY, int iTileSq )
+{
+	Close();
+
+	m_hFile = CreateFile( szFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+	{
+		return Create( szFilename, iTilesX, iTilesY, iTileSq );
+	}
+
+	DWORD dwRead = 0;
+
+	if ( !ReadFile( m_hFile, &m_header, sizeof(m_header), &dwRead, NULL ) || dwRead != sizeof(m_header)
+		|| m_header.dwMagic != ARCHIVE_MAGIC || m_header.dwVersion != ARCHIVE_VERSION || m_header.dwChunkSq != ARCHIVE_CHUNK
+		|| m_header.dwTilesX != (DWORD)iTilesX || m_header.dwTilesY != (DWORD)iTilesY || m_header.dwTileSq != (DWORD)iTileSq )
+	{
+		sprintf( m_szError, "%.200s is not a matching tile archive", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	m_iChunksX = ( iTileSq + ARCHIVE_CHUNK - 1 ) / ARCHIVE_CHUNK;
+
+	int iEntries = IndexEntries();
+
+	if ( iEntries == 0 )
+	{
+		sprintf( m_szError, "A world of %d by %d tiles does not fit an archive", iTilesX, iTilesY );
+		Close();
+		return FALSE;
+	}
+
+	m_pIndex = new ARCHIVECHUNK[iEntries];
+
+	if ( m_pIndex == NULL )
+	{
+		sprintf( m_szError, "Out of memory for the index of %.200s", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	if ( !ReadFile( m_hFile, m_pIndex, sizeof(ARCHIVECHUNK) * iEntries, &dwRead, NULL ) || dwRead != sizeof(ARCHIVECHUNK) * iEntries )
+	{
+		sprintf( m_szError, "%.200s has a truncated index", szFilename );
+		delete [] m_pIndex;
+		Close();
+		return FALSE;
+	}
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSizeLow = GetFileSize( m_hFile, &dwSizeHigh );
+
+	m_ullEnd = ( (ULONGLONG)dwSizeHigh << 32 ) | dwSizeLow;
+	m_bWriting = TRUE;
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------------
+//	Open an archive for reading, the header and index are memory mapped
+//	and the index is used in place
+//---------------------------------------------------------------------
+BOOL CTileArchive::Open( LPCSTR szFilename )
+{
+	Close();
+
+	m_hFile = CreateFile( szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+	{
+		sprintf( m_szError, "Unable to open %.200s", szFilename );
+		return FALSE;
+	}
+
+	DWORD dwSizeHigh = 0;
+	DWORD dwSizeLow = GetFileSize( m_hFile, &dwSizeHigh );
+
+	m_ullEnd = ( (ULONGLONG)dwSizeHigh << 32 ) | dwSizeLow;
+
+	DWORD dwRead = 0;
+
+	if ( !ReadFile( m_hFile, &m_header, sizeof(m_header), &dwRead, NULL ) || dwRead != sizeof(m_header) )
+	{
+		memset( &m_header, 0, sizeof(m_header) );
+	}
+
+	m_iChunksX = m_header.dwChunkSq == ARCHIVE_CHUNK && m_header.dwTileSq <= GRID_MAX_SIZE ? ( m_header.dwTileSq + ARCHIVE_CHUNK - 1 ) / ARCHIVE_CHUNK : 0;
+
+	int iEntries = IndexEntries();
+	DWORD dwIndexEnd = sizeof(ARCHIVEHEADER) + sizeof(ARCHIVECHUNK) * iEntries;
+
+	if ( m_header.dwMagic != ARCHIVE_MAGIC || m_header.dwVersion != ARCHIVE_VERSION || m_iChunksX == 0 || iEntries == 0 || dwIndexEnd > m_ullEnd )
+	{
+		sprintf( m_szError, "%.200s is not a tile archive", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	//	Only the header and index are mapped for good, chunks are mapped
+	//	a window at a time as they are read
+	//----------------------------------------------------------------------
+	m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	m_pbView = m_hMapping != NULL ? (BYTE*)MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, dwIndexEnd ) : NULL;
+
+	if ( m_pbView == NULL )
+	{
+		sprintf( m_szError, "Unable to map %.200s", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	m_pIndex = (ARCHIVECHUNK*)( m_pbView + sizeof(ARCHIVEHEADER) );
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------
+//	Close the archive, writers store their index back to the file
+//-------------------------------------------------------------------
+BOOL CTileArchive::Close()
+{
+	BOOL bResult = TRUE;
+
+	if ( m_bWriting )
+	{
+		bResult = WriteIndex();
+		delete [] m_pIndex;
+	}
+
+	if ( m_pbView != NULL )
+	{
+		UnmapViewOfFile( m_pbView );
+	}
+
+	if ( m_hMapping != NULL )
+	{
+		CloseHandle( m_hMapping );
+	}
+
+	if ( m_hFile != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( m_hFile );
+	}
+
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pbView = NULL;
+	m_pIndex = NULL;
+
+	Reset();
+
+	return bResult;
+}
+
+BOOL CTileArchive::WriteIndex()
+{
+	DWORD dwWritten;
+	DWORD dwIndexSize = sizeof(ARCHIVECHUNK) * m_header.dwTilesX * m_header.dwTilesY * ChunksPerTile();
+
+	SetFilePointer( m_hFile, 0, NULL, FILE_BEGIN );
+
+	if ( !WriteFile( m_hFile, &m_header, sizeof(m_header), &dwWritten, NULL ) || dwWritten != sizeof(m_header)
+		|| !WriteFile( m_hFile, m_pIndex, dwIndexSize, &dwWritten, NULL ) || dwWritten != dwIndexSize )
+	{
+		sprintf( m_szError, "Unable to write archive index" );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL CTileArchive::HasTile( int iTileX, int iTileY )
+{
+	if ( m_pIndex == NULL || iTileX < 0 || iTileY < 0 || iTileX >= (int)m_header.dwTilesX || iTileY >= (int)m_header.dwTilesY )
+	{
+		return FALSE;
+	}
+
+	return Chunk( iTileX, iTileY, 0 )->dwSize != 0;
+}
+
+//-----------------------------------------------------------------
+//	Compress and append every chunk of a tile
+//
+//	Chunks compress in parallel into scratch, then are appended in
+//	order so the file layout does not depend on thread timing
+//-----------------------------------------------------------------
+BOOL CTileArchive::WriteTile( int iTileX, int iTileY, CTerrain* pTerrain )
+{
+	if ( !m_bWriting || iTileX < 0 || iTileY < 0 || iTileX >= (int)m_header.dwTilesX || iTileY >= (int)m_header.dwTilesY
+		|| pTerrain->TileSize() != (int)m_header.dwTileSq )
+	{
+		sprintf( m_szError, "Tile %d,%d does not fit this archive", iTileX, iTileY );
+		return FALSE;
+	}
+
+	int iChunks = ChunksPerTile();
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+
+	m_pTerrain = pTerrain;
+	m_pbScratch = (BYTE*)pArena->Alloc( iChunks * ARCHIVE_CHUNK_BOUND );
+	m_pdwSizes = (DWORD*)pArena->Alloc( sizeof(DWORD) * iChunks );
+
+	if ( m_pbScratch == NULL || m_pdwSizes == NULL )
+	{
+		sprintf( m_szError, "Out of memory compressing tile %d,%d", iTileX, iTileY );
+		return FALSE;
+	}
+
+	ParallelFor( iChunks, CompressTask, this );
+
+	BOOL bResult = TRUE;
+	LONG lOffsetHigh = (LONG)( m_ullEnd >> 32 );
+
+	SetFilePointer( m_hFile, (LONG)( m_ullEnd & 0xFFFFFFFF ), &lOffsetHigh, FILE_BEGIN );
+
+	for ( int iChunk = 0; iChunk < iChunks && bResult; iChunk++ )
+	{
+		DWORD dwWritten = 0;
+		ARCHIVECHUNK* pChunk = Chunk( iTileX, iTileY, iChunk );
+
+		bResult = WriteFile( m_hFile, m_pbScratch + iChunk * ARCHIVE_CHUNK_BOUND, m_pdwSizes[iChunk], &dwWritten, NULL ) && dwWritten == m_pdwSizes[iChunk];
+
+		pChunk->dwOffsetLow = (DWORD)( m_ullEnd & 0xFFFFFFFF );
+		pChunk->dwOffsetHigh = (DWORD)( m_ullEnd >> 32 );
+		pChunk->dwSize = m_pdwSizes[iChunk];
+
+		m_ullEnd += m_pdwSizes[iChunk];
+	}
+
+	if ( !bResult )
+	{
+		sprintf( m_szError, "Unable to write tile %d,%d", iTileX, iTileY );
+	}
+
+	m_pbScratch = NULL;
+	m_pdwSizes = NULL;
+
+	return bResult;
+}
+
+void CTileArchive::CompressTask( int iIndex, int iWorker, void* pContext )
+{
+	CTileArchive* pThis = (CTileArchive*)pContext;
+	BYTE abCells[ARCHIVE_CHUNK * ARCHIVE_CHUNK];
+
+	int iTileSq = (int)pThis->m_header.dwTileSq;
+	int iX0 = ( iIndex % pThis->m_iChunksX ) * ARCHIVE_CHUNK;
+	int iY0 = ( iIndex / pThis->m_iChunksX ) * ARCHIVE_CHUNK;
+	int iWidth = iX0 + ARCHIVE_CHUNK > iTileSq ? iTileSq - iX0 : ARCHIVE_CHUNK;
+	int iHeight = iY0 + ARCHIVE_CHUNK > iTileSq ? iTileSq - iY0 : ARCHIVE_CHUNK;
+
+	for ( int iY = 0; iY < iHeight; iY++ )
+	{
+		for ( int iX = 0; iX < iWidth; iX++ )
+		{
+			abCells[iY * iWidth + iX] = pThis->m_pTerrain->Grid( iX0 + iX, iY0 + iY );
+		}
+	}
+
+	pThis->m_pdwSizes[iIndex] = CompressChunk( abCells, iWidth, iHeight, pThis->m_pbScratch + iIndex * ARCHIVE_CHUNK_BOUND );
+}
+
+//------------------------------------------------------------
+//	Decode one chunk straight from a window mapped over it
+//
+//	pbCells receives the chunk row-major, ARCHIVE_CHUNK wide
+//	(edge chunks of odd sized tiles are narrower)
+//------------------------------------------------------------
+BOOL CTileArchive::ReadChunk( int iTileX, int iTileY, int iChunkX, int iChunkY, BYTE* pbCells )
+{
+	if ( m_pbView == NULL || !HasTile( iTileX, iTileY ) || iChunkX < 0 || iChunkY < 0 || iChunkX >= m_iChunksX || iChunkY >= m_iChunksX )
+	{
+		sprintf( m_szError, "No chunk %d,%d in tile %d,%d", iChunkX, iChunkY, iTileX, iTileY );
+		return FALSE;
+	}
+
+	int iTileSq = (int)m_header.dwTileSq;
+	int iWidth = ( iChunkX + 1 ) * ARCHIVE_CHUNK > iTileSq ? iTileSq - iChunkX * ARCHIVE_CHUNK : ARCHIVE_CHUNK;
+	int iHeight = ( iChunkY + 1 ) * ARCHIVE_CHUNK > iTileSq ? iTileSq - iChunkY * ARCHIVE_CHUNK : ARCHIVE_CHUNK;
+
+	ARCHIVECHUNK* pChunk = Chunk( iTileX, iTileY, iChunkY * m_iChunksX + iChunkX );
+	ULONGLONG ullOffset = ( (ULONGLONG)pChunk->dwOffsetHigh << 32 ) | pChunk->dwOffsetLow;
+
+	if ( pChunk->dwSize == 0 || ullOffset + pChunk->dwSize > m_ullEnd )
+	{
+		sprintf( m_szError, "Chunk %d,%d of tile %d,%d is missing or lies outside the archive", iChunkX, iChunkY, iTileX, iTileY );
+		return FALSE;
+	}
+
+	//	Windows must start on the allocation granularity, so the chunk
+	//	sits dwLead bytes in
+	//----------------------------------------------------------------------
+	ULONGLONG ullWindow = ullOffset - ullOffset % m_dwGranularity;
+	DWORD dwLead = (DWORD)( ullOffset - ullWindow );
+	BYTE* pbWindow = (BYTE*)MapViewOfFile( m_hMapping, FILE_MAP_READ, (DWORD)( ullWindow >> 32 ), (DWORD)( ullWindow & 0xFFFFFFFF ), dwLead + pChunk->dwSize );
+
+	if ( pbWindow == NULL )
+	{
+		sprintf( m_szError, "Unable to map chunk %d,%d of tile %d,%d", iChunkX, iChunkY, iTileX, iTileY );
+		return FALSE;
+	}
+
+	BOOL bDecoded = DecompressChunk( pbWindow + dwLead, pChunk->dwSize, iWidth, iHeight, pbCells );
+
+	UnmapViewOfFile( pbWindow );
+
+	if ( !bDecoded )
+	{
+		sprintf( m_szError, "Chunk %d,%d of tile %d,%d is corrupt", iChunkX, iChunkY, iTileX, iTileY );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//----------------------------------------------------
+//	Decode a whole tile, its chunks in parallel
+//----------------------------------------------------
+BOOL CTileArchive::ReadTile( int iTileX, int iTileY, CTerrain* pTerrain )
+{
+	if ( !HasTile( iTileX, iTileY ) || pTerrain->TileSize() != (int)m_header.dwTileSq )
+	{
+		sprintf( m_szError, "No tile %d,%d of this size in the archive", iTileX, iTileY );
+		return FALSE;
+	}
+
+	m_pTerrain = pTerrain;
+	m_iTileX = iTileX;
+	m_iTileY = iTileY;
+	m_lFailures = 0;
+
+	ParallelFor( ChunksPerTile(), DecompressTask, this );
+
+	InvalidateRect( NULL, NULL, TRUE );
+
+	return m_lFailures == 0;
+}
+
+void CTileArchive::DecompressTask( int iIndex, int iWorker, void* pContext )
+{
+	CTileArchive* pThis = (CTileArchive*)pContext;
+	BYTE abCells[ARCHIVE_CHUNK * ARCHIVE_CHUNK];
+
+	int iChunkX = iIndex % pThis->m_iChunksX;
+	int iChunkY = iIndex / pThis->m_iChunksX;
+
+	if ( !pThis->ReadChunk( pThis->m_iTileX, pThis->m_iTileY, iChunkX, iChunkY, abCells ) )
+	{
+		InterlockedIncrement( &pThis->m_lFailures );
+		return;
+	}
+
+	int iTileSq = (int)pThis->m_header.dwTileSq;
+	int iX0 = iChunkX * ARCHIVE_CHUNK;
+	int iY0 = iChunkY * ARCHIVE_CHUNK;
+	int iWidth = iX0 + ARCHIVE_CHUNK > iTileSq ? iTileSq - iX0 : ARCHIVE_CHUNK;
+	int iHeight = iY0 + ARCHIVE_CHUNK > iTileSq ? iTileSq - iY0 : ARCHIVE_CHUNK;
+
+	for ( int iY = 0; iY < iHeight; iY++ )
+	{
+		for ( int iX = 0; iX < iWidth; iX++ )
+		{
+			pThis->m_pTerrain->Grid( iX0 + iX, iY0 + iY ) = abCells[iY * iWidth + iX];
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+//	Compress a chunk, returns the compressed size
+//
+//	Each residual from the predictor is zigzag mapped and Rice coded with a
+//	parameter tracking the running mean, so no tables are stored. If that
+//	does not beat the raw cells, the raw cells are stored instead.
+//
+//	pbOut must hold ARCHIVE_CHUNK_BOUND bytes
+//----------------------------------------------------------------------------
+DWORD CTileArchive::CompressChunk( const BYTE* pbCells, int iWidth, int iHeight, BYTE* pbOut )
+{
+	BITWRITER writer;
+	int iSum = 4;
+	int iCount = 1;
+	DWORD dwRaw = (DWORD)( iWidth * iHeight );
+
+	writer.pbOut = pbOut;
+	writer.dwPos = 0;
+	writer.dwAcc = 0;
+	writer.iBits = 0;
+
+	for ( int iY = 0; iY < iHeight && writer.dwPos < dwRaw; iY++ )
+	{
+		for ( int iX = 0; iX < iWidth; iX++ )
+		{
+			int iResidual = (signed char)(BYTE)( pbCells[iY * iWidth + iX] - Predict( pbCells, iWidth, iX, iY ) );
+			DWORD dwZig = iResidual >= 0 ? (DWORD)( iResidual << 1 ) : (DWORD)( ( -iResidual << 1 ) - 1 );
+			int iK = RiceK( iSum, iCount );
+			DWORD dwQuotient = dwZig >> iK;
+
+			if ( dwQuotient < RICE_ESCAPE )
+			{
+				PutBits( writer, ( 1 << ( dwQuotient + 1 ) ) - 2, dwQuotient + 1 );
+				PutBits( writer, dwZig, iK );
+			}
+			else
+			{
+				PutBits( writer, ( 1 << RICE_ESCAPE ) - 1, RICE_ESCAPE );
+				PutBits( writer, dwZig, 8 );
+			}
+
+			iSum += dwZig;
+			iCount++;
+
+			if ( iCount == RICE_RESCALE )
+			{
+				iSum >>= 1;
+				iCount >>= 1;
+			}
+		}
+	}
+
+	if ( writer.iBits > 0 )
+	{
+		PutBits( writer, 0, 8 - writer.iBits );
+	}
+
+	if ( writer.dwPos >= dwRaw )
+	{
+		memcpy( pbOut, pbCells, dwRaw );
+		return dwRaw;
+	}
+
+	return writer.dwPos;
+}
+
+BOOL CTileArchive::DecompressChunk( const BYTE* pbIn, DWORD dwSize, int iWidth, int iHeight, BYTE* pbCells )
+{
+	DWORD dwRaw = (DWORD)( iWidth * iHeight );
+
+	if ( dwSize == dwRaw )
+	{
+		memcpy( pbCells, pbIn, dwRaw );
+		return TRUE;
+	}
+
+	BITREADER reader;
+	int iSum = 4;
+	int iCount = 1;
+
+	reader.pbIn = pbIn;
+	reader.dwSize = dwSize;
+	reader.dwPos = 0;
+	reader.dwAcc = 0;
+	reader.iBits = 0;
+
+	for ( int iY = 0; iY < iHeight; iY++ )
+	{
+		for ( int iX = 0; iX < iWidth; iX++ )
+		{
+			int iK = RiceK( iSum, iCount );
+			DWORD dwQuotient = 0;
+			DWORD dwZig;
+
+			while ( dwQuotient < RICE_ESCAPE && GetBits( reader, 1 ) )
+			{
+				dwQuotient++;
+			}
+
+			if ( dwQuotient < RICE_ESCAPE )
+			{
+				dwZig = ( dwQuotient << iK ) | GetBits( reader, iK );
+			}
+			else
+			{
+				dwZig = GetBits( reader, 8 );
+			}
+
+			if ( dwZig > 255 || reader.dwPos > dwSize + 1 )
+			{
+				return FALSE;
+			}
+
+			int iResidual = ( dwZig & 1 ) ? -(int)( ( dwZig + 1 ) >> 1 ) : (int)( dwZig >> 1 );
+
+			pbCells[iY * iWidth + iX] = (BYTE)( Predict( pbCells, iWidth, iX, iY ) + iResidual );
+
+			iSum += dwZig;
+			iCount++;
+
+			if ( iCount == RICE_RESCALE )
+			{
+				iSum >>= 1;
+				iCount >>= 1;
+			}
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,129 @@
+/*--------------------------------------------------------------------------------
+
+	Archive.h
+
+	Provides a chunked, compressed archive for storing a world of terrain
+	tiles in one file, with random access to any chunk of any tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define ARCHIVE_MAGIC		0x52414754		// 'TGAR'
+#define ARCHIVE_VERSION		1
+#define ARCHIVE_CHUNK		64				// Chunks are ARCHIVE_CHUNK^2 cells
+#define ARCHIVE_CHUNK_BOUND	( ARCHIVE_CHUNK * ARCHIVE_CHUNK * 4 + 16 )	// Worst case compressed chunk
+#define ARCHIVE_MAX_INDEX	0x40000000		// Largest index in bytes, held in memory or mapped whole
+
+//	File layout:	ARCHIVEHEADER
+//					ARCHIVECHUNK index[dwTilesX * dwTilesY * chunks per tile]
+//					chunk data...
+//
+//	The index entry for a chunk is found directly from its tile and chunk
+//	coordinates, a dwSize of 0 marks a chunk never written and a dwSize of
+//	ARCHIVE_CHUNK^2 a chunk stored uncompressed
+//-------------------------------------------------------------------------------
+typedef struct tagARCHIVEHEADER
+{
+	DWORD	dwMagic;
+	DWORD	dwVersion;
+	DWORD	dwTilesX;		// World size in tiles
+	DWORD	dwTilesY;
+	DWORD	dwTileSq;		// Cells along a tile edge
+	DWORD	dwChunkSq;		// Cells along a chunk edge
+} ARCHIVEHEADER;
+
+typedef struct tagARCHIVECHUNK
+{
+	DWORD	dwOffsetLow;
+	DWORD	dwOffsetHigh;
+	DWORD	dwSize;
+} ARCHIVECHUNK;
+
+//------------------------------------------------------------------------------
+//	A tile archive
+//
+//	Each chunk is compressed on its own with a median edge predictor and
+//	adaptive Rice coding of the residuals, which suits smooth heightfields
+//	well. Readers map the index, and each chunk read maps a window over
+//	just that chunk, so finding a chunk is one index lookup, decoding it
+//	touches nothing else, and an archive of any size fits the address
+//	space. Whole tiles compress and decompress their chunks in parallel.
+//------------------------------------------------------------------------------
+class CTileArchive
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CTileArchive();
+	virtual ~CTileArchive();
+
+	//----------------------------
+	//	CTileArchive Interface
+	//----------------------------
+	BOOL Create( LPCSTR szFilename, int iTilesX, int iTilesY, int iTileSq );
+	BOOL OpenForWrite( LPCSTR szFilename, int iTilesX, int iTilesY, int iTileSq );
+	BOOL Open( LPCSTR szFilename );
+	BOOL Close();
+
+	BOOL WriteTile( int iTileX, int iTileY, CTerrain* pTerrain );
+	BOOL ReadTile( int iTileX, int iTileY, CTerrain* pTerrain );
+	BOOL ReadChunk( int iTileX, int iTileY, int iChunkX, int iChunkY, BYTE* pbCells );
+	BOOL HasTile( int iTileX, int iTileY );
+
+	int ChunksPerTile();
+	LPCSTR GetError();
+
+	//	The codec, cells are row-major, iWidth * iHeight
+	//------------------------------------------------------
+	static DWORD CompressChunk( const BYTE* pbCells, int iWidth, int iHeight, BYTE* pbOut );
+	static BOOL DecompressChunk( const BYTE* pbIn, DWORD dwSize, int iWidth, int iHeight, BYTE* pbCells );
+
+private:
+	static void CompressTask( int iIndex, int iWorker, void* pContext );
+	static void DecompressTask( int iIndex, int iWorker, void* pContext );
+
+	ARCHIVECHUNK* Chunk( int iTileX, int iTileY, int iChunk );
+	int IndexEntries();
+	BOOL WriteIndex();
+	void Reset();
+
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	BYTE* m_pbView;				// Header and index when open for reading
+	DWORD m_dwGranularity;		// Chunk windows start at a multiple of it
+	BOOL m_bWriting;
+
+	ARCHIVEHEADER m_header;
+	ARCHIVECHUNK* m_pIndex;		// Points into the view, or owned when writing
+	int m_iChunksX;
+	ULONGLONG m_ullEnd;
+
+	//	Per-tile state for the parallel tasks
+	//-------------------------------------------
+	CTerrain* m_pTerrain;
+	BYTE* m_pbScratch;
+	DWORD* m_pdwSizes;
+	int m_iTileX;
+	int m_iTileY;
+	volatile LONG m_lFailures;
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,254 @@
+/*--------------------------------------------------------------------------------
+
+	Arena.cpp
+
+	Provides a reusable arena of aligned scratch memory, so repeated runs
+	can take their temporary grids without going back to the heap
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include "Arena.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef MEM_LARGE_PAGES
+#define MEM_LARGE_PAGES 0x20000000
+#endif
+
+#define ARENA_GRANULARITY	( 64 * 1024 )		// VirtualAlloc reserves in these anyway
+
+typedef SIZE_T (WINAPI *PFNGETLARGEPAGEMINIMUM)( void );
+
+static DWORD s_dwTlsIndex = TlsAlloc();
+static BOOL s_bLargePages = FALSE;
+
+//-------------------------------------------
+//
+//	CLASS: CScratchArena implementation
+//
+//-------------------------------------------
+CScratchArena::CScratchArena()
+{
+	m_iBlocks = 0;
+	m_iBlock = 0;
+	m_dwUsed = 0;
+}
+
+CScratchArena::~CScratchArena()
+{
+	Free();
+}
+
+//-------------------------------------------------------------------
+//	Take dwBytes of scratch, aligned to ARENA_ALIGN
+//
+//	The memory is not cleared and stays valid until the arena is
+//	rewound past it. Returns NULL if the system is out of memory.
+//-------------------------------------------------------------------
+void* CScratchArena::Alloc( DWORD dwBytes )
+{
+	dwBytes = ( dwBytes + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
+
+	for ( ;; )
+	{
+		while ( m_iBlock < m_iBlocks )
+		{
+			ARENABLOCK& block = m_aBlocks[m_iBlock];
+
+			if ( block.dwSize - m_dwUsed >= dwBytes )
+			{
+				void* pvResult = block.pbBase + m_dwUsed;
+
+				m_dwUsed += dwBytes;
+
+				return pvResult;
+			}
+
+			m_iBlock++;
+			m_dwUsed = 0;
+		}
+
+		if ( !AddBlock( dwBytes ) )
+		{
+			return NULL;
+		}
+	}
+}
+
+ARENAMARK CScratchArena::Mark()
+{
+	ARENAMARK mark;
+
+	mark.iBlock = m_iBlock;
+	mark.dwUsed = m_dwUsed;
+
+	return mark;
+}
+
+void CScratchArena::Rewind( const ARENAMARK& mark )
+{
+	m_iBlock = mark.iBlock;
+	m_dwUsed = mark.dwUsed;
+}
+
+//----------------------------------------------
+//	Give every block back to the system
+//----------------------------------------------
+void CScratchArena::Free()
+{
+	for ( int iBlock = 0; iBlock < m_iBlocks; iBlock++ )
+	{
+		VirtualFree( m_aBlocks[iBlock].pbBase, 0, MEM_RELEASE );
+	}
+
+	m_iBlocks = 0;
+	m_iBlock = 0;
+	m_dwUsed = 0;
+}
+
+int CScratchArena::BlockCount()
+{
+	return m_iBlocks;
+}
+
+DWORD CScratchArena::Capacity()
+{
+	DWORD dwCapacity = 0;
+
+	for ( int iBlock = 0; iBlock < m_iBlocks; iBlock++ )
+	{
+		dwCapacity += m_aBlocks[iBlock].dwSize;
+	}
+
+	return dwCapacity;
+}
+
+//---------------------------------------------------------------------
+//	Add a block big enough for dwBytes
+//
+//	Blocks at least double the capacity each time, so an arena reaches
+//	its working size in a handful of steps and then stops growing
+//---------------------------------------------------------------------
+BOOL CScratchArena::AddBlock( DWORD dwBytes )
+{
+	if ( m_iBlocks == ARENA_MAX_BLOCKS )
+	{
+		return FALSE;
+	}
+
+	DWORD dwSize = Capacity();
+
+	dwSize = dwSize < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : dwSize;
+	dwSize = dwSize < dwBytes ? dwBytes : dwSize;
+
+	BYTE* pbBase = NULL;
+	DWORD dwLargePage = s_bLargePages ? LargePageSize() : 0;
+
+	if ( dwLargePage != 0 )
+	{
+		DWORD dwLargeSize = ( dwSize + dwLargePage - 1 ) / dwLargePage * dwLargePage;
+
+		pbBase = (BYTE*)VirtualAlloc( NULL, dwLargeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+
+		if ( pbBase != NULL )
+		{
+			dwSize = dwLargeSize;
+		}
+	}
+
+	//	Large pages are often unavailable once memory is fragmented,
+	//	ordinary pages always do
+	//------------------------------------------------------------------
+	if ( pbBase == NULL )
+	{
+		dwSize = ( dwSize + ARENA_GRANULARITY - 1 ) / ARENA_GRANULARITY * ARENA_GRANULARITY;
+
+		pbBase = (BYTE*)VirtualAlloc( NULL, dwSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+	}
+
+	if ( pbBase == NULL )
+	{
+		return FALSE;
+	}
+
+	m_aBlocks[m_iBlocks].pbBase = pbBase;
+	m_aBlocks[m_iBlocks].dwSize = dwSize;
+	m_iBlocks++;
+
+	return TRUE;
+}
+
+//--------------------------------------------------------------
+//	The calling thread's arena, created on first use
+//
+//	Threads that come and go should call ReleaseThread before
+//	they exit, long lived ones can simply keep theirs
+//--------------------------------------------------------------
+CScratchArena* CScratchArena::ForThread()
+{
+	CScratchArena* pArena = (CScratchArena*)TlsGetValue( s_dwTlsIndex );
+
+	if ( pArena == NULL )
+	{
+		pArena = new CScratchArena;
+		TlsSetValue( s_dwTlsIndex, pArena );
+	}
+
+	return pArena;
+}
+
+void CScratchArena::ReleaseThread()
+{
+	delete (CScratchArena*)TlsGetValue( s_dwTlsIndex );
+	TlsSetValue( s_dwTlsIndex, NULL );
+}
+
+//----------------------------------------------------------------------
+//	Ask for large pages in blocks added from now on
+//
+//	Needs SeLockMemoryPrivilege, which must be granted to the account
+//	through local security policy. Returns FALSE, and arenas carry on
+//	with ordinary pages, if it is not held or the system lacks them.
+//----------------------------------------------------------------------
+BOOL CScratchArena::EnableLargePages()
+{
+	HANDLE hToken;
+	TOKEN_PRIVILEGES privileges;
+
+	if ( LargePageSize() == 0 || !OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken ) )
+	{
+		return FALSE;
+	}
+
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	BOOL bResult = LookupPrivilegeValue( NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid )
+		&& AdjustTokenPrivileges( hToken, FALSE, &privileges, 0, NULL, NULL )
+		&& GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle( hToken );
+
+	s_bLargePages = bResult;
+
+	return bResult;
+}
+
+//--------------------------------------------------------------------
+//	Large page size, or 0 on systems that predate large page support
+//--------------------------------------------------------------------
+DWORD CScratchArena::LargePageSize()
+{
+	PFNGETLARGEPAGEMINIMUM pfnGetLargePageMinimum = (PFNGETLARGEPAGEMINIMUM)GetProcAddress( GetModuleHandle( "kernel32.dll" ), "GetLargePageMinimum" );
+
+	return pfnGetLargePageMinimum != NULL ? (DWORD)pfnGetLargePageMinimum() : 0;
+}
@@ -0,0 +1,106 @@
+/*--------------------------------------------------------------------------------
+
+	Arena.h
+
+	Provides a reusable arena of aligned scratch memory, so repeated runs
+	can take their temporary grids without going back to the heap
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+//-----------------
+//	Definitions
+//-----------------
+#define ARENA_ALIGN			64					// Every allocation starts on a cache line
+#define ARENA_MIN_BLOCK		( 1024 * 1024 )
+#define ARENA_MAX_BLOCKS	32
+
+typedef struct tagARENABLOCK
+{
+	BYTE*	pbBase;
+	DWORD	dwSize;
+} ARENABLOCK;
+
+typedef struct tagARENAMARK
+{
+	int		iBlock;
+	DWORD	dwUsed;
+} ARENAMARK;
+
+//-----------------------------------------------------------------------------
+//	A scratch arena
+//
+//	Alloc carves cache line aligned pieces from a few large blocks. Rewind
+//	hands everything after a mark back at once, but the blocks themselves
+//	are kept, so a run that asks for the same grids as the last one is
+//	served from memory that is already committed and faulted in.
+//
+//	Blocks come straight from VirtualAlloc. Once EnableLargePages succeeds,
+//	which needs the account to hold the lock pages privilege, new blocks
+//	come from large pages instead, cutting TLB misses on whole-grid sweeps.
+//
+//	An arena is not thread safe. Each thread that wants one uses ForThread,
+//	and work spread with ParallelFor is handed pieces of the caller's arena.
+//-----------------------------------------------------------------------------
+class CScratchArena
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CScratchArena();
+	virtual ~CScratchArena();
+
+	//-----------------------------
+	//	CScratchArena Interface
+	//-----------------------------
+	void* Alloc( DWORD dwBytes );
+	ARENAMARK Mark();
+	void Rewind( const ARENAMARK& mark );
+	void Free();
+
+	int BlockCount();
+	DWORD Capacity();
+
+	static CScratchArena* ForThread();
+	static void ReleaseThread();
+	static BOOL EnableLargePages();
+
+private:
+	BOOL AddBlock( DWORD dwBytes );
+
+	static DWORD LargePageSize();
+
+	ARENABLOCK m_aBlocks[ARENA_MAX_BLOCKS];
+	int m_iBlocks;
+	int m_iBlock;				// Block currently being carved
+	DWORD m_dwUsed;				// Bytes used in it
+};
+
+//-------------------------------------------------------------------
+//	Rewinds an arena to where it was when the scope was entered
+//-------------------------------------------------------------------
+class CArenaScope
+{
+public:
+	CArenaScope( CScratchArena* pArena ) : m_pArena( pArena ), m_mark( pArena->Mark() ) {}
+	~CArenaScope() { m_pArena->Rewind( m_mark ); }
+
+private:
+	CScratchArena* m_pArena;
+	ARENAMARK m_mark;
+};
+
+#endif
@@ -0,0 +1,345 @@
+/*--------------------------------------------------------------------------------
+
+	AsyncWriter.cpp
+
+	Provides a background I/O thread that writes encoded images to disk from
+	a small bounded pool of buffers, so generation can carry on meanwhile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <process.h>
+#include <string.h>
+
+#include "AsyncWriter.h"
+#include "Trace.h"
+
+//----------------------------------------
+//
+//	CLASS: CAsyncWriter implementation
+//
+//----------------------------------------
+CAsyncWriter::CAsyncWriter( int iBuffers )
+{
+	iBuffers = iBuffers < 1 ? 1 : iBuffers;
+	iBuffers = iBuffers > WRITER_MAX_BUFFERS ? WRITER_MAX_BUFFERS : iBuffers;
+
+	m_iBuffers = iBuffers;
+
+	for ( int iBuffer = 0; iBuffer < WRITER_MAX_BUFFERS; iBuffer++ )
+	{
+		m_apbBuffers[iBuffer] = NULL;
+		m_adwCapacity[iBuffer] = 0;
+		m_abInUse[iBuffer] = false;
+	}
+
+	m_iQueueHead = 0;
+	m_iQueueTail = 0;
+	m_iOutstanding = 0;
+	m_lFailures = 0;
+	m_llIoTicks = 0;
+
+	InitializeCriticalSection( &m_cs );
+
+	m_hFree = CreateSemaphore( NULL, m_iBuffers, m_iBuffers, NULL );
+	m_hQueued = CreateSemaphore( NULL, 0, WRITER_MAX_BUFFERS + 1, NULL );
+	m_hIdle = CreateEvent( NULL, TRUE, TRUE, NULL );
+
+	//	Without the I/O thread, Submit writes on the calling thread instead
+	//-------------------------------------------------------------------------
+	m_hThread = (HANDLE)_beginthreadex( NULL, 0, ThreadProc, this, 0, NULL );
+}
+
+CAsyncWriter::~CAsyncWriter()
+{
+	Flush();
+
+	//	A request with no buffer stops the thread
+	//-----------------------------------------------
+	if ( m_hThread != NULL )
+	{
+		Queue( -1, 0, "" );
+
+		WaitForSingleObject( m_hThread, INFINITE );
+		CloseHandle( m_hThread );
+	}
+
+	CloseHandle( m_hFree );
+	CloseHandle( m_hQueued );
+	CloseHandle( m_hIdle );
+
+	DeleteCriticalSection( &m_cs );
+
+	for ( int iBuffer = 0; iBuffer < WRITER_MAX_BUFFERS; iBuffer++ )
+	{
+		delete [] m_apbBuffers[iBuffer];
+	}
+}
+
+int CAsyncWriter::BufferCount()
+{
+	return m_iBuffers;
+}
+
+int CAsyncWriter::Failures()
+{
+	return (int)m_lFailures;
+}
+
+//--------------------------------------------------
+//	Total time the I/O thread has spent writing
+//--------------------------------------------------
+double CAsyncWriter::IoSeconds()
+{
+	LARGE_INTEGER liFreq;
+
+	QueryPerformanceFrequency( &liFreq );
+
+	EnterCriticalSection( &m_cs );
+	double dSeconds = (double)m_llIoTicks / (double)liFreq.QuadPart;
+	LeaveCriticalSection( &m_cs );
+
+	return dSeconds;
+}
+
+//------------------------------------------------------------------------
+//	Take a buffer of at least dwSize bytes from the pool, blocking until
+//	the I/O thread frees one if they are all in flight
+//
+//	Buffers are kept between uses and only grow, so a steady batch of
+//	same-sized jobs allocates once per buffer. Returns NULL, with the
+//	buffer handed back as it was, if it cannot grow to dwSize.
+//------------------------------------------------------------------------
+BYTE* CAsyncWriter::Acquire( DWORD dwSize )
+{
+	WaitForSingleObject( m_hFree, INFINITE );
+
+	EnterCriticalSection( &m_cs );
+
+	int iBuffer = 0;
+
+	while ( m_abInUse[iBuffer] )
+	{
+		iBuffer++;
+	}
+
+	m_abInUse[iBuffer] = true;
+
+	LeaveCriticalSection( &m_cs );
+
+	if ( m_adwCapacity[iBuffer] < dwSize )
+	{
+		BYTE* pbBuffer = new BYTE[dwSize];
+
+		if ( pbBuffer == NULL )
+		{
+			Return( iBuffer );
+			return NULL;
+		}
+
+		delete [] m_apbBuffers[iBuffer];
+		m_apbBuffers[iBuffer] = pbBuffer;
+		m_adwCapacity[iBuffer] = dwSize;
+	}
+
+	return m_apbBuffers[iBuffer];
+}
+
+//------------------------------------------------------------------
+//	Hand a filled buffer to the I/O thread, it is returned to the
+//	pool once written
+//
+//	If the thread could not be started the buffer is written before
+//	Submit returns, so nothing is left for Flush to wait on
+//------------------------------------------------------------------
+void CAsyncWriter::Submit( BYTE* pbData, DWORD dwSize, LPCSTR szFilename )
+{
+	int iBuffer = FindBuffer( pbData );
+
+	if ( iBuffer < 0 )
+	{
+		return;
+	}
+
+	if ( m_hThread != NULL )
+	{
+		Queue( iBuffer, dwSize, szFilename );
+		return;
+	}
+
+	WRITEREQUEST request;
+	LARGE_INTEGER liStart, liEnd;
+
+	request.iBuffer = iBuffer;
+	request.dwSize = dwSize;
+	strncpy( request.szFilename, szFilename, MAX_PATH - 1 );
+	request.szFilename[MAX_PATH - 1] = 0;
+
+	QueryPerformanceCounter( &liStart );
+
+	if ( !WriteRequest( request ) )
+	{
+		InterlockedIncrement( &m_lFailures );
+	}
+
+	QueryPerformanceCounter( &liEnd );
+
+	Return( iBuffer );
+
+	EnterCriticalSection( &m_cs );
+	m_llIoTicks += liEnd.QuadPart - liStart.QuadPart;
+	LeaveCriticalSection( &m_cs );
+}
+
+//---------------------------------------------------
+//	Give back a buffer that will not be submitted
+//---------------------------------------------------
+void CAsyncWriter::Release( BYTE* pbData )
+{
+	int iBuffer = FindBuffer( pbData );
+
+	if ( iBuffer >= 0 )
+	{
+		Return( iBuffer );
+	}
+}
+
+//----------------------------------------------------------------------
+//	Wait for every submitted write to reach the disk
+//
+//	Returns FALSE if any write since the writer was created has failed
+//----------------------------------------------------------------------
+BOOL CAsyncWriter::Flush()
+{
+	WaitForSingleObject( m_hIdle, INFINITE );
+
+	return m_lFailures == 0;
+}
+
+int CAsyncWriter::FindBuffer( BYTE* pbData )
+{
+	for ( int iBuffer = 0; iBuffer < m_iBuffers; iBuffer++ )
+	{
+		if ( m_apbBuffers[iBuffer] == pbData && m_abInUse[iBuffer] )
+		{
+			return iBuffer;
+		}
+	}
+
+	return -1;
+}
+
+void CAsyncWriter::Queue( int iBuffer, DWORD dwSize, LPCSTR szFilename )
+{
+	EnterCriticalSection( &m_cs );
+
+	WRITEREQUEST& request = m_aQueue[m_iQueueTail];
+
+	request.iBuffer = iBuffer;
+	request.dwSize = dwSize;
+	strncpy( request.szFilename, szFilename, MAX_PATH - 1 );
+	request.szFilename[MAX_PATH - 1] = 0;
+
+	m_iQueueTail = ( m_iQueueTail + 1 ) % ( WRITER_MAX_BUFFERS + 1 );
+
+	if ( iBuffer >= 0 )
+	{
+		m_iOutstanding++;
+		ResetEvent( m_hIdle );
+	}
+
+	LeaveCriticalSection( &m_cs );
+
+	ReleaseSemaphore( m_hQueued, 1, NULL );
+}
+
+void CAsyncWriter::Return( int iBuffer )
+{
+	EnterCriticalSection( &m_cs );
+	m_abInUse[iBuffer] = false;
+	LeaveCriticalSection( &m_cs );
+
+	ReleaseSemaphore( m_hFree, 1, NULL );
+}
+
+//-------------------------------------------
+//	Write one request, replacing the file
+//-------------------------------------------
+BOOL CAsyncWriter::WriteRequest( const WRITEREQUEST& request )
+{
+	TRACE_SPAN( "write file" );
+
+	HANDLE hFile = CreateFile( request.szFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+
+	if ( hFile == INVALID_HANDLE_VALUE )
+	{
+		return FALSE;
+	}
+
+	DWORD dwWritten = 0;
+	BOOL bResult = WriteFile( hFile, m_apbBuffers[request.iBuffer], request.dwSize, &dwWritten, NULL );
+
+	TRACE_BYTES( dwWritten );
+
+	CloseHandle( hFile );
+
+	return bResult && dwWritten == request.dwSize;
+}
+
+//-------------------------------------------------------------
+//	The I/O thread, writes requests in the order submitted
+//-------------------------------------------------------------
+unsigned __stdcall CAsyncWriter::ThreadProc( void* pParam )
+{
+	CAsyncWriter* pThis = (CAsyncWriter*)pParam;
+
+	for ( ;; )
+	{
+		WaitForSingleObject( pThis->m_hQueued, INFINITE );
+
+		EnterCriticalSection( &pThis->m_cs );
+		WRITEREQUEST request = pThis->m_aQueue[pThis->m_iQueueHead];
+		pThis->m_iQueueHead = ( pThis->m_iQueueHead + 1 ) % ( WRITER_MAX_BUFFERS + 1 );
+		LeaveCriticalSection( &pThis->m_cs );
+
+		if ( request.iBuffer < 0 )
+		{
+			break;
+		}
+
+		LARGE_INTEGER liStart, liEnd;
+
+		QueryPerformanceCounter( &liStart );
+
+		if ( !pThis->WriteRequest( request ) )
+		{
+			InterlockedIncrement( &pThis->m_lFailures );
+		}
+
+		QueryPerformanceCounter( &liEnd );
+
+		pThis->Return( request.iBuffer );
+
+		EnterCriticalSection( &pThis->m_cs );
+
+		pThis->m_llIoTicks += liEnd.QuadPart - liStart.QuadPart;
+
+		if ( --pThis->m_iOutstanding == 0 )
+		{
+			SetEvent( pThis->m_hIdle );
+		}
+
+		LeaveCriticalSection( &pThis->m_cs );
+	}
+
+	CTrace::ReleaseThread();
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*--------------------------------------------------------------------------------
+
+	AsyncWriter.h
+
+	Provides a background I/O thread that writes encoded images to disk from
+	a small bounded pool of buffers, so generation can carry on meanwhile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _ASYNCWRITER_H
+#define _ASYNCWRITER_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+//-----------------
+//	Definitions
+//-----------------
+#define WRITER_MAX_BUFFERS 8
+
+typedef struct tagWRITEREQUEST
+{
+	int		iBuffer;				// Index into the pool, -1 asks the thread to stop
+	DWORD	dwSize;
+	TCHAR	szFilename[MAX_PATH];
+} WRITEREQUEST;
+
+//-----------------------------------------------------------------------------
+//	Asynchronous file writer
+//
+//	Callers Acquire a buffer, fill it, and Submit it with a filename. The
+//	I/O thread writes submitted buffers in order and returns them to the
+//	pool. Acquire blocks while every buffer is in flight, which bounds both
+//	memory and how far generation can run ahead of the disk. Two buffers
+//	give classic double buffering. Should the I/O thread fail to start,
+//	Submit writes synchronously, so nothing is lost or waited on forever.
+//-----------------------------------------------------------------------------
+class CAsyncWriter
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CAsyncWriter( int iBuffers );
+	virtual ~CAsyncWriter();
+
+	//----------------------------
+	//	CAsyncWriter Interface
+	//----------------------------
+	BYTE* Acquire( DWORD dwSize );
+	void Submit( BYTE* pbData, DWORD dwSize, LPCSTR szFilename );
+	void Release( BYTE* pbData );
+	BOOL Flush();
+
+	int BufferCount();
+	int Failures();
+	double IoSeconds();
+
+private:
+	static unsigned __stdcall ThreadProc( void* pParam );
+
+	void Queue( int iBuffer, DWORD dwSize, LPCSTR szFilename );
+	void Return( int iBuffer );
+	int FindBuffer( BYTE* pbData );
+	BOOL WriteRequest( const WRITEREQUEST& request );
+
+	CRITICAL_SECTION m_cs;
+	HANDLE m_hThread;
+	HANDLE m_hFree;			// Semaphore, counts buffers not in use
+	HANDLE m_hQueued;		// Semaphore, counts requests waiting for the thread
+	HANDLE m_hIdle;			// Manual reset event, set when nothing is outstanding
+
+	int m_iBuffers;
+	BYTE* m_apbBuffers[WRITER_MAX_BUFFERS];
+	DWORD m_adwCapacity[WRITER_MAX_BUFFERS];
+	bool m_abInUse[WRITER_MAX_BUFFERS];
+
+	WRITEREQUEST m_aQueue[WRITER_MAX_BUFFERS + 1];
+	int m_iQueueHead;
+	int m_iQueueTail;
+	int m_iOutstanding;
+
+	volatile LONG m_lFailures;
+	LONGLONG m_llIoTicks;
+};
+
+#endif
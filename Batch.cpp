@@ -0,0 +1,130 @@
+/*--------------------------------------------------------------------------------
+
+	Batch.cpp
+
+	Provides batch generation of many terrains, overlapping each job's
+	generation with the writing of the one before
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include "Batch.h"
+
+//----------------------------------
+//
+//	CLASS: CBatch implementation
+//
+//----------------------------------
+CBatch::CBatch()
+{
+	m_pCache = NULL;
+	m_szError[0] = 0;
+}
+
+CBatch::~CBatch()
+{
+}
+
+LPCSTR CBatch::GetError()
+{
+	return m_szError;
+}
+
+void CBatch::SetCache( CResultCache* pCache )
+{
+	m_pCache = pCache;
+}
+
+//-------------------------------------------------------------------------
+//	Run every job in the jobs file on the given terrain tile
+//
+//	Failed jobs are counted and the batch carries on, the error for the
+//	last one is kept. Returns FALSE if any job or write failed.
+//-------------------------------------------------------------------------
+BOOL CBatch::Run( LPCSTR szJobsFile, CTerrain* pTerrain, int iBuffers, BATCHSTATS* pStats )
+{
+	FILE* file;
+	char acLine[MAX_PATH];
+	LARGE_INTEGER liFreq, liStart, liJobStart, liJobEnd, liEnd;
+	LONGLONG llComputeTicks = 0;
+	int iJobs = 0;
+	int iFailed = 0;
+
+	m_szError[0] = 0;
+
+	if ( ( file = fopen( szJobsFile, "r" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to open %.200s", szJobsFile );
+		return FALSE;
+	}
+
+	QueryPerformanceFrequency( &liFreq );
+	QueryPerformanceCounter( &liStart );
+
+	CAsyncWriter* pWriter = iBuffers > 0 ? new CAsyncWriter( iBuffers ) : NULL;
+
+	while ( fgets( acLine, sizeof(acLine), file ) != NULL )
+	{
+		char* szJob = strtok( acLine, "\r\n" );
+
+		if ( szJob == NULL || szJob[0] == '#' )
+		{
+			continue;
+		}
+
+		CPipeline pipeline;
+
+		pipeline.SetWriter( pWriter );
+		pipeline.SetCache( m_pCache );
+
+		QueryPerformanceCounter( &liJobStart );
+
+		if ( !pipeline.Load( szJob ) || !pipeline.Execute( pTerrain, FALSE, NULL, NULL ) )
+		{
+			strncpy( m_szError, pipeline.GetError(), MAX_PATH - 1 );
+			iFailed++;
+		}
+
+		QueryPerformanceCounter( &liJobEnd );
+
+		llComputeTicks += liJobEnd.QuadPart - liJobStart.QuadPart;
+		iJobs++;
+	}
+
+	fclose( file );
+
+	double dIoSeconds = 0.0;
+
+	if ( pWriter != NULL )
+	{
+		if ( !pWriter->Flush() )
+		{
+			sprintf( m_szError, "%d image writes failed", pWriter->Failures() );
+			iFailed++;
+		}
+
+		dIoSeconds = pWriter->IoSeconds();
+
+		delete pWriter;
+	}
+
+	QueryPerformanceCounter( &liEnd );
+
+	if ( pStats != NULL )
+	{
+		pStats->iJobs = iJobs;
+		pStats->iFailed = iFailed;
+		pStats->dWallSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+		pStats->dComputeSeconds = (double)llComputeTicks / (double)liFreq.QuadPart;
+		pStats->dIoSeconds = dIoSeconds;
+	}
+
+	return iFailed == 0;
+}
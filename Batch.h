@@ -0,0 +1,66 @@
+/*--------------------------------------------------------------------------------
+
+	Batch.h
+
+	Provides batch generation of many terrains, overlapping each job's
+	generation with the writing of the one before
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+//-------------
+//	Includes
+//-------------
+#include "Pipeline.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define BATCH_DEFAULT_BUFFERS 2
+
+typedef struct tagBATCHSTATS
+{
+	int		iJobs;
+	int		iFailed;
+	double	dWallSeconds;
+	double	dComputeSeconds;	// Time spent generating and encoding
+	double	dIoSeconds;			// Time the I/O thread spent writing
+} BATCHSTATS;
+
+//------------------------------------------------------------------------------
+//	Runs a list of pipeline configs, one per line of a jobs file
+//
+//	Saves go through a CAsyncWriter with a bounded pool of image buffers, so
+//	job n+1 generates while job n is written. With 0 buffers every save is
+//	written synchronously, for comparison. Given a result cache, every job
+//	looks its generation up in it first.
+//------------------------------------------------------------------------------
+class CBatch
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CBatch();
+	virtual ~CBatch();
+
+	//----------------------
+	//	CBatch Interface
+	//----------------------
+	BOOL Run( LPCSTR szJobsFile, CTerrain* pTerrain, int iBuffers, BATCHSTATS* pStats );
+	void SetCache( CResultCache* pCache );
+	LPCSTR GetError();
+
+private:
+	CResultCache* m_pCache;
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*--------------------------------------------------------------------------------
+
+	Checkpoint.cpp
+
+	Provides checkpoint files for long fault line runs, so that a run can be
+	resumed where it left off and finish with identical results
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+#include <string.h>
+
+#include "Checkpoint.h"
+
+//-----------------------------------------
+//
+//	CLASS: CFaultCheckpoint implementation
+//
+//-----------------------------------------
+CFaultCheckpoint::CFaultCheckpoint()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pbView = NULL;
+	m_pHeader = NULL;
+	m_dwSlotSize = 0;
+	m_szError[0] = 0;
+}
+
+CFaultCheckpoint::~CFaultCheckpoint()
+{
+	Close();
+}
+
+LPCSTR CFaultCheckpoint::GetError()
+{
+	return m_szError;
+}
+
+//-------------------------------------------------------------------
+//	Start a checkpoint file for a new run, replacing any existing one
+//
+//	Neither slot is valid until the first Commit
+//-------------------------------------------------------------------
+BOOL CFaultCheckpoint::Create( LPCSTR szFilename, int iTileSq, const FAULTRUN& run )
+{
+	Close();
+
+	DWORD dwCellSize = run.bRetainAllValues ? sizeof(double) : sizeof(BYTE);
+
+	m_dwSlotSize = SlotSize( (DWORD)iTileSq, dwCellSize );
+
+	if ( m_dwSlotSize == 0 )
+	{
+		sprintf( m_szError, "A checkpoint of a %d cell tile is too large to map", iTileSq );
+		return FALSE;
+	}
+
+	if ( !Map( szFilename, CHECKPOINT_PAGE + 2 * m_dwSlotSize ) )
+	{
+		return FALSE;
+	}
+
+	memset( m_pHeader, 0, sizeof(CHECKPOINTHEADER) );
+
+	m_pHeader->dwMagic = CHECKPOINT_MAGIC;
+	m_pHeader->dwVersion = CHECKPOINT_VERSION;
+	m_pHeader->dwTileSq = iTileSq;
+	m_pHeader->dwCellSize = dwCellSize;
+	m_pHeader->run = run;
+	m_pHeader->iActive = 1;
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------
+//	Open a checkpoint to resume from, it must be for a tile of
+//	this size
+//---------------------------------------------------------------
+BOOL CFaultCheckpoint::Open( LPCSTR szFilename, int iTileSq )
+{
+	Close();
+
+	if ( !Map( szFilename, 0 ) )
+	{
+		return FALSE;
+	}
+
+	CHECKPOINTHEADER* pHeader = m_pHeader;
+
+	m_dwSlotSize = SlotSize( pHeader->dwTileSq, pHeader->dwCellSize );
+
+	if ( pHeader->dwMagic != CHECKPOINT_MAGIC || pHeader->dwVersion != CHECKPOINT_VERSION || pHeader->dwTileSq != (DWORD)iTileSq
+		|| pHeader->dwCellSize != ( pHeader->run.bRetainAllValues ? sizeof(double) : sizeof(BYTE) )
+		|| ( m_dwSlotSize != 0 && GetFileSize( m_hFile, NULL ) < CHECKPOINT_PAGE + 2 * m_dwSlotSize ) )
+	{
+		sprintf( m_szError, "%.200s is not a checkpoint for this tile", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	if ( m_dwSlotSize == 0 )
+	{
+		sprintf( m_szError, "%.200s is too large to map", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	if ( pHeader->dwCommits == 0 )
+	{
+		sprintf( m_szError, "%.200s holds no checkpoint yet", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------------
+//	Bytes of a slot, rounded up to whole pages, or 0 if the file of two
+//	would pass CHECKPOINT_MAX_SIZE. The sums are in ULONGLONG, since a
+//	large tile's slots overflow a DWORD.
+//---------------------------------------------------------------------
+DWORD CFaultCheckpoint::SlotSize( DWORD dwTileSq, DWORD dwCellSize )
+{
+	ULONGLONG ullSlot = ( (ULONGLONG)dwTileSq * dwTileSq * dwCellSize + CHECKPOINT_PAGE - 1 ) / CHECKPOINT_PAGE * CHECKPOINT_PAGE;
+
+	if ( CHECKPOINT_PAGE + 2 * ullSlot > CHECKPOINT_MAX_SIZE )
+	{
+		return 0;
+	}
+
+	return (DWORD)ullSlot;
+}
+
+BOOL CFaultCheckpoint::Map( LPCSTR szFilename, DWORD dwSize )
+{
+	m_hFile = CreateFile( szFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, dwSize != 0 ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+	{
+		sprintf( m_szError, "Unable to open %.200s", szFilename );
+		return FALSE;
+	}
+
+	if ( dwSize != 0 || GetFileSize( m_hFile, NULL ) >= CHECKPOINT_PAGE )
+	{
+		m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READWRITE, 0, dwSize, NULL );
+	}
+
+	m_pbView = m_hMapping != NULL ? (BYTE*)MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, 0 ) : NULL;
+
+	if ( m_pbView == NULL )
+	{
+		sprintf( m_szError, "Unable to map %.200s", szFilename );
+		Close();
+		return FALSE;
+	}
+
+	m_pHeader = (CHECKPOINTHEADER*)m_pbView;
+
+	return TRUE;
+}
+
+void CFaultCheckpoint::Close()
+{
+	if ( m_pbView != NULL )
+	{
+		UnmapViewOfFile( m_pbView );
+	}
+
+	if ( m_hMapping != NULL )
+	{
+		CloseHandle( m_hMapping );
+	}
+
+	if ( m_hFile != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( m_hFile );
+	}
+
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pbView = NULL;
+	m_pHeader = NULL;
+}
+
+const FAULTRUN& CFaultCheckpoint::Run()
+{
+	return m_pHeader->run;
+}
+
+const FAULTCURSOR& CFaultCheckpoint::Cursor()
+{
+	return m_pHeader->aCursor[m_pHeader->iActive];
+}
+
+void* CFaultCheckpoint::Slot( int iSlot )
+{
+	return m_pbView + CHECKPOINT_PAGE + (size_t)iSlot * m_dwSlotSize;
+}
+
+void* CFaultCheckpoint::ActiveSlot()
+{
+	return Slot( m_pHeader->iActive );
+}
+
+void* CFaultCheckpoint::WorkSlot()
+{
+	return Slot( 1 - m_pHeader->iActive );
+}
+
+//---------------------------------------------------------------------------
+//	Make the work slot, now holding the grid at cursor, the active slot
+//
+//	The grid reaches the disk before the header that points to it does
+//---------------------------------------------------------------------------
+BOOL CFaultCheckpoint::Commit( const FAULTCURSOR& cursor )
+{
+	int iWork = 1 - m_pHeader->iActive;
+
+	if ( !FlushViewOfFile( WorkSlot(), m_dwSlotSize ) || !FlushFileBuffers( m_hFile ) )
+	{
+		sprintf( m_szError, "Unable to write checkpoint at fault %d", cursor.iNextFault );
+		return FALSE;
+	}
+
+	m_pHeader->aCursor[iWork] = cursor;
+	m_pHeader->iActive = iWork;
+	m_pHeader->dwCommits++;
+
+	if ( !FlushViewOfFile( m_pHeader, sizeof(CHECKPOINTHEADER) ) || !FlushFileBuffers( m_hFile ) )
+	{
+		sprintf( m_szError, "Unable to write checkpoint at fault %d", cursor.iNextFault );
+		return FALSE;
+	}
+
+	return TRUE;
+}
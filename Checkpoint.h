@@ -0,0 +1,126 @@
+/*--------------------------------------------------------------------------------
+
+	Checkpoint.h
+
+	Provides checkpoint files for long fault line runs, so that a run can be
+	resumed where it left off and finish with identical results
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+//-----------------
+//	Definitions
+//-----------------
+#define CHECKPOINT_MAGIC		0x4B504346		// 'FCPK'
+#define CHECKPOINT_VERSION		2
+#define CHECKPOINT_PAGE			4096			// Header size, slots are aligned to it
+#define CHECKPOINT_INTERVAL		1000			// Default faults between checkpoints
+#define CHECKPOINT_MAX_SIZE		0x7FFFFFFF		// Largest file mapped in one view, all a 32 bit process can address
+
+//	The run being checkpointed, fixed when the checkpoint is created
+//----------------------------------------------------------------------
+typedef struct tagFAULTRUN
+{
+	int		iIterations;
+	int		iDepthInit;
+	int		iDepthEnd;
+	int		iFixedFaultDepth;
+	BOOL	bUseLogisticFunc;
+	BOOL	bRetainAllValues;
+	FLOAT	fLogM;
+	FLOAT	fLogSeed;
+	int		iProfile;
+	FLOAT	fProfileWidth;
+} FAULTRUN;
+
+//	Where a run had got to, everything needed to carry on from there
+//----------------------------------------------------------------------
+typedef struct tagFAULTCURSOR
+{
+	int		iNextFault;
+	DWORD	dwRandomState;
+	FLOAT	fLogIterate;
+} FAULTCURSOR;
+
+//	File layout:	CHECKPOINTHEADER, padded to CHECKPOINT_PAGE
+//					slot 0 grid
+//					slot 1 grid
+//
+//	Slot grids are dwTileSq^2 cells of dwCellSize bytes, doubles for a
+//	retained run and BYTEs for a clamped one, stored [x * dwTileSq + y]
+//-------------------------------------------------------------------------
+typedef struct tagCHECKPOINTHEADER
+{
+	DWORD		dwMagic;
+	DWORD		dwVersion;
+	DWORD		dwTileSq;
+	DWORD		dwCellSize;
+	FAULTRUN	run;
+	int			iActive;			// Slot holding the last complete checkpoint
+	DWORD		dwCommits;			// 0 until the starting grid is committed
+	FAULTCURSOR	aCursor[2];			// Cursor for each slot's grid
+} CHECKPOINTHEADER;
+
+//------------------------------------------------------------------------------
+//	A fault line checkpoint
+//
+//	The file is memory mapped and holds two slots. The active slot is the
+//	last complete checkpoint. The run reads it and writes the next one into
+//	the work slot, and Commit flushes that to disk before flipping the slots
+//	over in the header, so a crash at any point leaves a consistent file.
+//	Resuming uses the active slot in place, nothing is read into memory.
+//	The whole file is one view, so it may be no larger than
+//	CHECKPOINT_MAX_SIZE, and Create and Open fail on a tile that needs more.
+//------------------------------------------------------------------------------
+class CFaultCheckpoint
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CFaultCheckpoint();
+	virtual ~CFaultCheckpoint();
+
+	//--------------------------------
+	//	CFaultCheckpoint Interface
+	//--------------------------------
+	BOOL Create( LPCSTR szFilename, int iTileSq, const FAULTRUN& run );
+	BOOL Open( LPCSTR szFilename, int iTileSq );
+	void Close();
+
+	const FAULTRUN& Run();
+	const FAULTCURSOR& Cursor();
+	void* ActiveSlot();
+	void* WorkSlot();
+	BOOL Commit( const FAULTCURSOR& cursor );
+
+	LPCSTR GetError();
+
+private:
+	BOOL Map( LPCSTR szFilename, DWORD dwSize );
+	void* Slot( int iSlot );
+
+	static DWORD SlotSize( DWORD dwTileSq, DWORD dwCellSize );
+
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	BYTE* m_pbView;
+	CHECKPOINTHEADER* m_pHeader;		// Points into the view
+	DWORD m_dwSlotSize;
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,919 @@
+/*--------------------------------------------------------------------------------
+
+	Contour.cpp
+
+	Provides contour lines at a height interval and a sea level coastline
+	over a terrain tile, by marching squares
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Contour.h"
+#include "Arena.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef CONTOUR_SIMD
+#define CONTOUR_SIMD		1		// 0 marks cells with the scalar loop only
+#endif
+
+#if CONTOUR_SIMD
+#include <emmintrin.h>
+#endif
+
+#define CONTOUR_NONE		0xFFFFFFFF
+
+//	Sides of a square, corners a to d clockwise from the top left
+//-------------------------------------------------------------------
+enum CONTOURSIDE
+{
+	CONTOUR_TOP,
+	CONTOUR_RIGHT,
+	CONTOUR_BOTTOM,
+	CONTOUR_LEFT
+};
+
+//	Where a side's edge is numbered from, and whether it runs down
+//--------------------------------------------------------------------
+static const int s_aiSideX[4] = { 0, 1, 0, 0 };
+static const int s_aiSideY[4] = { 0, 0, 1, 0 };
+static const int s_aiSideDown[4] = { 0, 1, 0, 1 };
+
+//	Segments across a square, from the side where its corners go from below
+//	the line to above it, clockwise, to the side where they go back. By the
+//	corners at or above, a 1, b 2, c 4, d 8, and 16 on for an alternating
+//	square whose centre is above.
+//-----------------------------------------------------------------------------
+static const signed char s_aacSegments[32][4] =
+{
+	{ -1, -1, -1, -1 },
+	{ CONTOUR_LEFT, CONTOUR_TOP, -1, -1 },
+	{ CONTOUR_TOP, CONTOUR_RIGHT, -1, -1 },
+	{ CONTOUR_LEFT, CONTOUR_RIGHT, -1, -1 },
+	{ CONTOUR_RIGHT, CONTOUR_BOTTOM, -1, -1 },
+	{ CONTOUR_LEFT, CONTOUR_TOP, CONTOUR_RIGHT, CONTOUR_BOTTOM },
+	{ CONTOUR_TOP, CONTOUR_BOTTOM, -1, -1 },
+	{ CONTOUR_LEFT, CONTOUR_BOTTOM, -1, -1 },
+	{ CONTOUR_BOTTOM, CONTOUR_LEFT, -1, -1 },
+	{ CONTOUR_BOTTOM, CONTOUR_TOP, -1, -1 },
+	{ CONTOUR_TOP, CONTOUR_RIGHT, CONTOUR_BOTTOM, CONTOUR_LEFT },
+	{ CONTOUR_BOTTOM, CONTOUR_RIGHT, -1, -1 },
+	{ CONTOUR_RIGHT, CONTOUR_LEFT, -1, -1 },
+	{ CONTOUR_RIGHT, CONTOUR_TOP, -1, -1 },
+	{ CONTOUR_TOP, CONTOUR_LEFT, -1, -1 },
+	{ -1, -1, -1, -1 },
+
+	{ -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 },
+	{ CONTOUR_LEFT, CONTOUR_BOTTOM, CONTOUR_RIGHT, CONTOUR_TOP },
+	{ -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 },
+	{ CONTOUR_TOP, CONTOUR_LEFT, CONTOUR_BOTTOM, CONTOUR_RIGHT },
+	{ -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }
+};
+
+//------------------------------------------------------------------------------
+//	Grow an array to hold at least iNeeded, doubling. Returns FALSE out of
+//	memory, leaving it as it was.
+//------------------------------------------------------------------------------
+template <class T>
+static BOOL GrowArray( T*& pArray, int& iCapacity, int iUsed, int iNeeded )
+{
+	if ( iNeeded <= iCapacity )
+	{
+		return TRUE;
+	}
+
+	int iGrown = iCapacity > 0 ? iCapacity * 2 : 256;
+
+	iGrown = iGrown < iNeeded ? iNeeded : iGrown;
+
+	T* pGrown = new T[iGrown];
+
+	if ( pGrown == NULL )
+	{
+		return FALSE;
+	}
+
+	if ( iUsed > 0 )
+	{
+		memcpy( pGrown, pArray, sizeof(T) * iUsed );
+	}
+
+	delete [] pArray;
+	pArray = pGrown;
+	iCapacity = iGrown;
+
+	return TRUE;
+}
+
+static int CompareKeys( const void* pvA, const void* pvB )
+{
+	ULONGLONG ullA = ( (const CONTOURKEY*)pvA )->ullKey;
+	ULONGLONG ullB = ( (const CONTOURKEY*)pvB )->ullKey;
+
+	return ullA < ullB ? -1 : ullA > ullB ? 1 : 0;
+}
+
+//------------------------------------
+//
+//	CLASS: CContours implementation
+//
+//------------------------------------
+CContours::CContours()
+{
+	m_iLevels = 0;
+	m_pGrid = NULL;
+	m_iSize = 0;
+	m_iBands = 0;
+	m_pBands = NULL;
+	m_pKeys = NULL;
+	m_iKeys = 0;
+	m_pLines = NULL;
+	m_iLines = 0;
+	m_pfPoints = NULL;
+	m_iPoints = 0;
+	m_szError[0] = 0;
+}
+
+CContours::~CContours()
+{
+	FreeBands();
+
+	delete [] m_pLines;
+	delete [] m_pfPoints;
+}
+
+void CContours::DefaultParams( CONTOURPARAMS* pParams )
+{
+	pParams->iInterval = 16;
+	pParams->iSeaLevel = 64;
+}
+
+//------------------------------------------------------------------------------
+//	Trace every line over the tile, replacing any from before
+//
+//	pStats may be NULL
+//------------------------------------------------------------------------------
+BOOL CContours::Extract( CTerrain* pTerrain, const CONTOURPARAMS& params, CONTOURSTATS* pStats )
+{
+	TRACE_SPAN( "contours" );
+
+	LARGE_INTEGER liFreq, liStart, liEnd;
+
+	QueryPerformanceFrequency( &liFreq );
+	QueryPerformanceCounter( &liStart );
+
+	int iSize = pTerrain->TileSize();
+
+	if ( iSize < 2 || iSize > CONTOUR_MAX_SIZE )
+	{
+		sprintf( m_szError, "Contours need a tile of 2 to %d cells, not %d", CONTOUR_MAX_SIZE, iSize );
+		return FALSE;
+	}
+
+	if ( params.iInterval < 0 || params.iSeaLevel < -1 || params.iSeaLevel > 255 || ( params.iInterval == 0 && params.iSeaLevel <= 0 ) )
+	{
+		sprintf( m_szError, "Interval %d and sea level %d give no lines", params.iInterval, params.iSeaLevel );
+		return FALSE;
+	}
+
+	//	Level 0 has every cell above it, so it is never a line
+	//------------------------------------------------------------
+	m_iLevels = 0;
+
+	for ( int iLevel = 1; iLevel < 256; iLevel++ )
+	{
+		BOOL bContour = params.iInterval > 0 && iLevel % params.iInterval == 0;
+
+		if ( bContour || iLevel == params.iSeaLevel )
+		{
+			m_aiLevels[m_iLevels] = iLevel;
+			m_adwLevelFlags[m_iLevels] = iLevel == params.iSeaLevel ? CONTOUR_COAST : 0;
+			m_iLevels++;
+		}
+	}
+
+	delete [] m_pLines;
+	delete [] m_pfPoints;
+
+	m_pLines = NULL;
+	m_pfPoints = NULL;
+	m_iLines = 0;
+	m_iPoints = 0;
+
+	FreeBands();
+
+	m_pGrid = &pTerrain->HeightGrid();
+	m_iSize = iSize;
+	m_iBands = ( iSize - 1 + CONTOUR_ROWS - 1 ) / CONTOUR_ROWS;
+	m_pBands = new CONTOURBAND[m_iBands];
+
+	memset( m_pBands, 0, sizeof(CONTOURBAND) * m_iBands );
+
+	//	Scratch is carved from the calling thread's arena, as the arena is
+	//	not safe to share. Links are left unset by tracing, so they are
+	//	only cleared here.
+	//------------------------------------------------------------------------
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iRows = CONTOUR_ROWS + 1;
+	int iWords = ( iSize + 31 ) / 32 + 1;
+	int iEdges = 2 * iRows * iSize;
+
+	for ( int iWorker = 0; iWorker < GetWorkerCount(); iWorker++ )
+	{
+		CONTOURSCRATCH& scratch = m_aScratch[iWorker];
+
+		scratch.pbHeights = (BYTE*)pArena->Alloc( iRows * iSize );
+		scratch.pdwBits = (DWORD*)pArena->Alloc( sizeof(DWORD) * iRows * iWords );
+		scratch.pdwNext = (DWORD*)pArena->Alloc( sizeof(DWORD) * iEdges );
+		scratch.pbIncoming = (BYTE*)pArena->Alloc( ( iEdges + 7 ) / 8 );
+		scratch.pdwLinked = (DWORD*)pArena->Alloc( sizeof(DWORD) * 2 * CONTOUR_ROWS * iSize );
+
+		if ( scratch.pbHeights == NULL || scratch.pdwBits == NULL || scratch.pdwNext == NULL || scratch.pbIncoming == NULL || scratch.pdwLinked == NULL )
+		{
+			FreeBands();
+
+			sprintf( m_szError, "Out of memory for the contours of a %d cell tile", iSize );
+			return FALSE;
+		}
+
+		memset( scratch.pdwNext, 0xFF, sizeof(DWORD) * iEdges );
+		memset( scratch.pbIncoming, 0, ( iEdges + 7 ) / 8 );
+	}
+
+	ParallelFor( m_iBands, BandTask, this );
+
+	Stitch( pStats );
+	FreeBands();
+
+	QueryPerformanceCounter( &liEnd );
+
+	if ( m_pLines == NULL )
+	{
+		sprintf( m_szError, "Out of memory for the contours of a %d cell tile", iSize );
+		return FALSE;
+	}
+
+	if ( pStats != NULL )
+	{
+		pStats->iLevels = m_iLevels;
+		pStats->iLines = m_iLines;
+		pStats->iPoints = m_iPoints;
+		pStats->dSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+	}
+
+	return TRUE;
+}
+
+void CContours::BandTask( int iIndex, int iWorker, void* pContext )
+{
+	( (CContours*)pContext )->ExtractBand( iIndex, iWorker );
+}
+
+//------------------------------------------------------------------------------
+//	Trace every level over one band's squares into its pieces
+//------------------------------------------------------------------------------
+void CContours::ExtractBand( int iBand, int iWorker )
+{
+	CONTOURSCRATCH& scratch = m_aScratch[iWorker];
+	int iSize = m_iSize;
+	int iFirstRow = iBand * CONTOUR_ROWS;
+	int iEndRow = iFirstRow + CONTOUR_ROWS > iSize - 1 ? iSize - 1 : iFirstRow + CONTOUR_ROWS;
+	int iRows = iEndRow - iFirstRow + 1;
+	int iWords = ( iSize + 31 ) / 32 + 1;
+	int iRow, iXPos;
+
+	//	The band's heights, read in the order the layout stores them
+	//-------------------------------------------------------------------
+	BYTE* pbHeights = scratch.pbHeights;
+
+	if ( m_pGrid->Layout() == GRID_LAYOUT_ROW )
+	{
+		for ( iRow = 0; iRow < iRows; iRow++ )
+		{
+			memcpy( pbHeights + iRow * iSize, &m_pGrid->At( 0, iFirstRow + iRow ), iSize );
+		}
+	}
+	else if ( m_pGrid->Layout() == GRID_LAYOUT_COLUMN )
+	{
+		for ( iXPos = 0; iXPos < iSize; iXPos++ )
+		{
+			const BYTE* pbColumn = &m_pGrid->At( iXPos, iFirstRow );
+
+			for ( iRow = 0; iRow < iRows; iRow++ )
+			{
+				pbHeights[iRow * iSize + iXPos] = pbColumn[iRow];
+			}
+		}
+	}
+	else
+	{
+		for ( iRow = 0; iRow < iRows; iRow++ )
+		{
+			for ( iXPos = 0; iXPos < iSize; iXPos++ )
+			{
+				pbHeights[iRow * iSize + iXPos] = m_pGrid->At( iXPos, iFirstRow + iRow );
+			}
+		}
+	}
+
+	int iLow = 255;
+	int iHigh = 0;
+
+	for ( int iCell = 0; iCell < iRows * iSize; iCell++ )
+	{
+		iLow = pbHeights[iCell] < iLow ? pbHeights[iCell] : iLow;
+		iHigh = pbHeights[iCell] > iHigh ? pbHeights[iCell] : iHigh;
+	}
+
+	for ( int iLevel = 0; iLevel < m_iLevels; iLevel++ )
+	{
+		int iThreshold = m_aiLevels[iLevel];
+
+		//	Every cell on one side, so nothing crosses the band
+		//---------------------------------------------------------
+		if ( iThreshold <= iLow || iThreshold > iHigh )
+		{
+			continue;
+		}
+
+		for ( iRow = 0; iRow < iRows; iRow++ )
+		{
+			Classify( pbHeights + iRow * iSize, iThreshold, scratch.pdwBits + iRow * iWords );
+		}
+
+		int iLinked = 0;
+
+		for ( iRow = 0; iRow < iRows - 1; iRow++ )
+		{
+			const DWORD* pdwAbove = scratch.pdwBits + iRow * iWords;
+			const DWORD* pdwBelow = pdwAbove + iWords;
+
+			for ( int iWord = 0; iWord < iWords - 1; iWord++ )
+			{
+				//	Each square's four corners, bit x of the top row and of
+				//	the top row shifted along, and the same below
+				//--------------------------------------------------------------
+				DWORD dwA = pdwAbove[iWord];
+				DWORD dwB = ( dwA >> 1 ) | ( pdwAbove[iWord + 1] << 31 );
+				DWORD dwD = pdwBelow[iWord];
+				DWORD dwC = ( dwD >> 1 ) | ( pdwBelow[iWord + 1] << 31 );
+				DWORD dwMixed = ( dwA ^ dwB ) | ( dwD ^ dwC ) | ( dwA ^ dwD );
+				int iBase = iWord * 32;
+
+				if ( iBase + 32 > iSize - 1 )
+				{
+					dwMixed &= ( (DWORD)1 << ( iSize - 1 - iBase ) ) - 1;
+				}
+
+				for ( int iBit = 0; dwMixed != 0; iBit++, dwMixed >>= 1 )
+				{
+					if ( !( dwMixed & 1 ) )
+					{
+						continue;
+					}
+
+					int iCase = ( ( dwA >> iBit ) & 1 ) | ( ( ( dwB >> iBit ) & 1 ) << 1 ) | ( ( ( dwC >> iBit ) & 1 ) << 2 ) | ( ( ( dwD >> iBit ) & 1 ) << 3 );
+
+					iXPos = iBase + iBit;
+
+					if ( iCase == 5 || iCase == 10 )
+					{
+						const BYTE* pbCorner = pbHeights + iRow * iSize + iXPos;
+
+						iCase += pbCorner[0] + pbCorner[1] + pbCorner[iSize] + pbCorner[iSize + 1] >= 4 * iThreshold - 2 ? 16 : 0;
+					}
+
+					for ( int iSegment = 0; iSegment < 4 && s_aacSegments[iCase][iSegment] >= 0; iSegment += 2 )
+					{
+						int iFrom = s_aacSegments[iCase][iSegment];
+						int iTo = s_aacSegments[iCase][iSegment + 1];
+						DWORD dwFrom = 2 * ( ( iRow + s_aiSideY[iFrom] ) * iSize + iXPos + s_aiSideX[iFrom] ) + s_aiSideDown[iFrom];
+						DWORD dwTo = 2 * ( ( iRow + s_aiSideY[iTo] ) * iSize + iXPos + s_aiSideX[iTo] ) + s_aiSideDown[iTo];
+
+						scratch.pdwNext[dwFrom] = dwTo;
+						scratch.pbIncoming[dwTo >> 3] |= (BYTE)( 1 << ( dwTo & 7 ) );
+						scratch.pdwLinked[iLinked++] = dwFrom;
+					}
+				}
+			}
+		}
+
+		//	Lines starting on an edge nothing links to, then the loops left
+		//-----------------------------------------------------------------------
+		int iLink;
+
+		for ( iLink = 0; iLink < iLinked; iLink++ )
+		{
+			DWORD dwEdge = scratch.pdwLinked[iLink];
+
+			if ( scratch.pdwNext[dwEdge] != CONTOUR_NONE && !( scratch.pbIncoming[dwEdge >> 3] & ( 1 << ( dwEdge & 7 ) ) ) )
+			{
+				Trace( iBand, iLevel, scratch, dwEdge, FALSE );
+			}
+		}
+
+		for ( iLink = 0; iLink < iLinked; iLink++ )
+		{
+			DWORD dwEdge = scratch.pdwLinked[iLink];
+
+			if ( scratch.pdwNext[dwEdge] != CONTOUR_NONE )
+			{
+				Trace( iBand, iLevel, scratch, dwEdge, TRUE );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Set a bit per cell of a row for the cells at or above the threshold,
+//	bit x of DWORD x / 32, with a DWORD of clear bits after the row
+//------------------------------------------------------------------------------
+void CContours::Classify( const BYTE* pbRow, int iThreshold, DWORD* pdwBits )
+{
+	int iSize = m_iSize;
+	int iXPos = 0;
+
+#if CONTOUR_SIMD
+	//	Unsigned bytes have no compare, but max( h, t ) == h is h >= t
+	//--------------------------------------------------------------------
+	__m128i viThreshold = _mm_set1_epi8( (char)iThreshold );
+
+	for ( ; iXPos + 32 <= iSize; iXPos += 32 )
+	{
+		__m128i viLow = _mm_loadu_si128( (const __m128i*)( pbRow + iXPos ) );
+		__m128i viHigh = _mm_loadu_si128( (const __m128i*)( pbRow + iXPos + 16 ) );
+		DWORD dwLow = (DWORD)_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( viLow, viThreshold ), viLow ) );
+		DWORD dwHigh = (DWORD)_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( viHigh, viThreshold ), viHigh ) );
+
+		pdwBits[iXPos >> 5] = dwLow | ( dwHigh << 16 );
+	}
+#endif
+
+	for ( ; iXPos < iSize; iXPos += 32 )
+	{
+		DWORD dwBits = 0;
+
+		for ( int iBit = 0; iBit < 32 && iXPos + iBit < iSize; iBit++ )
+		{
+			dwBits |= pbRow[iXPos + iBit] >= iThreshold ? (DWORD)1 << iBit : 0;
+		}
+
+		pdwBits[iXPos >> 5] = dwBits;
+	}
+
+	pdwBits[( iSize + 31 ) / 32] = 0;
+}
+
+//------------------------------------------------------------------------------
+//	Follow the links from an edge into a piece, unsetting them as it goes.
+//	A closed piece stops on coming back to its start.
+//------------------------------------------------------------------------------
+void CContours::Trace( int iBand, int iLevel, const CONTOURSCRATCH& scratch, DWORD dwStart, BOOL bClosed )
+{
+	CONTOURBAND& band = m_pBands[iBand];
+	int iSize = m_iSize;
+	int iFirstRow = iBand * CONTOUR_ROWS;
+	FLOAT fLevel = (FLOAT)m_aiLevels[iLevel] - 0.5f;
+	DWORD dwEdge = dwStart;
+	DWORD dwNext;
+
+	if ( !GrowArray( band.pPieces, band.iPieceCapacity, band.iPieces, band.iPieces + 1 ) )
+	{
+		return;
+	}
+
+	CONTOURPIECE& piece = band.pPieces[band.iPieces++];
+
+	piece.iLevel = iLevel;
+	piece.dwStart = dwStart + 2 * iFirstRow * iSize;
+	piece.bClosed = bClosed;
+	piece.bUsed = FALSE;
+	piece.iBand = iBand;
+	piece.iFirst = band.iPoints;
+
+	for ( ;; )
+	{
+		if ( GrowArray( band.pfPoints, band.iPointCapacity, 2 * band.iPoints, 2 * band.iPoints + 2 ) )
+		{
+			//	Strictly inside the edge, as no height is on the level
+			//------------------------------------------------------------
+			int iCell = (int)( dwEdge >> 1 );
+			int iRow = iCell / iSize;
+			int iXPos = iCell % iSize;
+			int iDown = ( dwEdge & 1 ) ? iSize : 1;
+			int iFrom = scratch.pbHeights[iCell];
+			int iTo = scratch.pbHeights[iCell + iDown];
+			FLOAT fAlong = ( fLevel - (FLOAT)iFrom ) / (FLOAT)( iTo - iFrom );
+			FLOAT* pfPoint = band.pfPoints + 2 * band.iPoints++;
+
+			pfPoint[0] = (FLOAT)iXPos + ( ( dwEdge & 1 ) ? 0.f : fAlong );
+			pfPoint[1] = (FLOAT)( iFirstRow + iRow ) + ( ( dwEdge & 1 ) ? fAlong : 0.f );
+		}
+
+		if ( ( dwNext = scratch.pdwNext[dwEdge] ) == CONTOUR_NONE )
+		{
+			break;
+		}
+
+		scratch.pdwNext[dwEdge] = CONTOUR_NONE;
+		scratch.pbIncoming[dwNext >> 3] &= (BYTE)~( 1 << ( dwNext & 7 ) );
+		dwEdge = dwNext;
+
+		if ( dwEdge == dwStart )
+		{
+			break;
+		}
+	}
+
+	piece.dwEnd = dwEdge + 2 * iFirstRow * iSize;
+	piece.iPoints = band.iPoints - piece.iFirst;
+}
+
+//------------------------------------------------------------------------------
+//	Whether an edge is on a row two bands share, where pieces are joined
+//------------------------------------------------------------------------------
+BOOL CContours::IsStitch( DWORD dwEdge )
+{
+	int iRow = (int)( ( dwEdge >> 1 ) / (DWORD)m_iSize );
+
+	return !( dwEdge & 1 ) && iRow % CONTOUR_ROWS == 0 && iRow > 0 && iRow < m_iSize - 1;
+}
+
+CONTOURPIECE* CContours::FindPiece( int iLevel, DWORD dwStart )
+{
+	ULONGLONG ullKey = ( (ULONGLONG)iLevel << 32 ) | dwStart;
+	int iLow = 0;
+	int iHigh = m_iKeys;
+
+	while ( iLow < iHigh )
+	{
+		int iMid = ( iLow + iHigh ) / 2;
+
+		if ( m_pKeys[iMid].ullKey < ullKey )
+		{
+			iLow = iMid + 1;
+		}
+		else
+		{
+			iHigh = iMid;
+		}
+	}
+
+	return iLow < m_iKeys && m_pKeys[iLow].ullKey == ullKey ? m_pKeys[iLow].pPiece : NULL;
+}
+
+//------------------------------------------------------------------------------
+//	Join the bands' pieces into lines: closed pieces as they are, lines
+//	from where they start on the tile's edge, then the loops that cross
+//	bands. Lines come out in band order, whatever ran the bands.
+//------------------------------------------------------------------------------
+void CContours::Stitch( CONTOURSTATS* pStats )
+{
+	int iPieces = 0;
+	int iPoints = 0;
+	int iBand, iPiece;
+
+	for ( iBand = 0; iBand < m_iBands; iBand++ )
+	{
+		iPieces += m_pBands[iBand].iPieces;
+		iPoints += m_pBands[iBand].iPoints;
+	}
+
+	m_pLines = new CONTOURLINE[iPieces > 0 ? iPieces : 1];
+	m_pfPoints = new FLOAT[iPoints > 0 ? 2 * iPoints : 2];
+	m_pKeys = new CONTOURKEY[iPieces > 0 ? iPieces : 1];
+
+	if ( m_pLines == NULL || m_pfPoints == NULL || m_pKeys == NULL )
+	{
+		delete [] m_pLines;
+		delete [] m_pfPoints;
+
+		m_pLines = NULL;
+		m_pfPoints = NULL;
+		return;
+	}
+
+	m_iKeys = 0;
+
+	for ( iBand = 0; iBand < m_iBands; iBand++ )
+	{
+		CONTOURBAND& band = m_pBands[iBand];
+
+		for ( iPiece = 0; iPiece < band.iPieces; iPiece++ )
+		{
+			CONTOURPIECE* pPiece = &band.pPieces[iPiece];
+
+			if ( !pPiece->bClosed && IsStitch( pPiece->dwStart ) )
+			{
+				m_pKeys[m_iKeys].ullKey = ( (ULONGLONG)pPiece->iLevel << 32 ) | pPiece->dwStart;
+				m_pKeys[m_iKeys].pPiece = pPiece;
+				m_iKeys++;
+			}
+		}
+	}
+
+	qsort( m_pKeys, m_iKeys, sizeof(CONTOURKEY), CompareKeys );
+
+	int iStitched = 0;
+
+	for ( int iPass = 0; iPass < 2; iPass++ )
+	{
+		for ( iBand = 0; iBand < m_iBands; iBand++ )
+		{
+			CONTOURBAND& band = m_pBands[iBand];
+
+			for ( iPiece = 0; iPiece < band.iPieces; iPiece++ )
+			{
+				CONTOURPIECE* pPiece = &band.pPieces[iPiece];
+
+				if ( !pPiece->bUsed && ( iPass == 1 || pPiece->bClosed || !IsStitch( pPiece->dwStart ) ) )
+				{
+					Emit( pPiece, &iStitched );
+				}
+			}
+		}
+	}
+
+	if ( pStats != NULL )
+	{
+		pStats->iStitched = iStitched;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Add the line starting with a piece, following it into the next band
+//	while it ends on a shared row. The next piece starts with the point
+//	this one ended on, so that point is only taken once.
+//------------------------------------------------------------------------------
+void CContours::Emit( CONTOURPIECE* pFirst, int* piStitched )
+{
+	CONTOURLINE& line = m_pLines[m_iLines++];
+	CONTOURPIECE* pPiece = pFirst;
+	int iSkip = 0;
+
+	line.iLevel = m_aiLevels[pFirst->iLevel];
+	line.dwFlags = m_adwLevelFlags[pFirst->iLevel] | ( pFirst->bClosed ? CONTOUR_CLOSED : 0 );
+	line.iFirst = m_iPoints;
+
+	for ( ;; )
+	{
+		const FLOAT* pfFrom = m_pBands[pPiece->iBand].pfPoints + 2 * ( pPiece->iFirst + iSkip );
+		int iTaken = pPiece->iPoints - iSkip;
+
+		memcpy( m_pfPoints + 2 * m_iPoints, pfFrom, sizeof(FLOAT) * 2 * iTaken );
+		m_iPoints += iTaken;
+		pPiece->bUsed = TRUE;
+
+		if ( pPiece->bClosed || !IsStitch( pPiece->dwEnd ) )
+		{
+			break;
+		}
+
+		//	Back where it started, a loop across bands
+		//------------------------------------------------
+		if ( pPiece->dwEnd == pFirst->dwStart )
+		{
+			m_iPoints--;
+			line.dwFlags |= CONTOUR_CLOSED;
+			break;
+		}
+
+		CONTOURPIECE* pNext = FindPiece( pPiece->iLevel, pPiece->dwEnd );
+
+		if ( pNext == NULL || pNext->bUsed )
+		{
+			break;
+		}
+
+		pPiece = pNext;
+		iSkip = 1;
+		( *piStitched )++;
+	}
+
+	line.iPoints = m_iPoints - line.iFirst;
+}
+
+void CContours::FreeBands()
+{
+	for ( int iBand = 0; iBand < m_iBands && m_pBands != NULL; iBand++ )
+	{
+		delete [] m_pBands[iBand].pPieces;
+		delete [] m_pBands[iBand].pfPoints;
+	}
+
+	delete [] m_pBands;
+	delete [] m_pKeys;
+
+	m_pBands = NULL;
+	m_pKeys = NULL;
+	m_iKeys = 0;
+}
+
+//------------------------------------------------------------------------------
+//	Write the lines as a compact stream, described in Contour.h
+//------------------------------------------------------------------------------
+BOOL CContours::Save( LPCSTR szFilename )
+{
+	TRACE_SPAN( "save contours" );
+
+	if ( m_pLines == NULL )
+	{
+		sprintf( m_szError, "No contours have been extracted" );
+		return FALSE;
+	}
+
+	FILE* file;
+
+	if ( ( file = fopen( szFilename, "wb" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to create %.200s", szFilename );
+		return FALSE;
+	}
+
+	int iMostPoints = 1;
+	int iLine;
+
+	for ( iLine = 0; iLine < m_iLines; iLine++ )
+	{
+		iMostPoints = m_pLines[iLine].iPoints > iMostPoints ? m_pLines[iLine].iPoints : iMostPoints;
+	}
+
+	CONTOURFILEHEADER header;
+	signed char* pcSteps = new signed char[2 * iMostPoints];
+
+	header.dwMagic = CONTOUR_MAGIC;
+	header.dwVersion = CONTOUR_VERSION;
+	header.iSize = m_iSize;
+	header.iLines = m_iLines;
+
+	BOOL bResult = fwrite( &header, sizeof(header), 1, file ) == 1;
+
+	for ( iLine = 0; iLine < m_iLines && bResult; iLine++ )
+	{
+		const CONTOURLINE& line = m_pLines[iLine];
+		const FLOAT* pfPoint = m_pfPoints + 2 * line.iFirst;
+		CONTOURFILELINE record;
+
+		record.wLevel = (WORD)line.iLevel;
+		record.wFlags = (WORD)line.dwFlags;
+		record.iPoints = line.iPoints;
+		record.iStartX = (int)( pfPoint[0] * CONTOUR_FIXED + 0.5f );
+		record.iStartY = (int)( pfPoint[1] * CONTOUR_FIXED + 0.5f );
+
+		int iLastX = record.iStartX;
+		int iLastY = record.iStartY;
+
+		for ( int iPoint = 1; iPoint < line.iPoints; iPoint++ )
+		{
+			int iX = (int)( pfPoint[2 * iPoint] * CONTOUR_FIXED + 0.5f );
+			int iY = (int)( pfPoint[2 * iPoint + 1] * CONTOUR_FIXED + 0.5f );
+
+			pcSteps[2 * iPoint - 2] = (signed char)( iX - iLastX );
+			pcSteps[2 * iPoint - 1] = (signed char)( iY - iLastY );
+			iLastX = iX;
+			iLastY = iY;
+		}
+
+		bResult = fwrite( &record, sizeof(record), 1, file ) == 1
+			&& ( line.iPoints < 2 || fwrite( pcSteps, 2 * ( line.iPoints - 1 ), 1, file ) == 1 );
+	}
+
+	delete [] pcSteps;
+	fclose( file );
+
+	if ( !bResult )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFilename );
+	}
+
+	return bResult;
+}
+
+//------------------------------------------------------------------------------
+//	Read lines Save wrote, to 1/CONTOUR_FIXED of a cell
+//------------------------------------------------------------------------------
+BOOL CContours::Load( LPCSTR szFilename )
+{
+	FILE* file;
+
+	if ( ( file = fopen( szFilename, "rb" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to open %.200s", szFilename );
+		return FALSE;
+	}
+
+	CONTOURFILEHEADER header;
+
+	if ( fread( &header, sizeof(header), 1, file ) != 1 || header.dwMagic != CONTOUR_MAGIC || header.dwVersion != CONTOUR_VERSION || header.iLines < 0 )
+	{
+		sprintf( m_szError, "%.200s is not a contour file", szFilename );
+		fclose( file );
+		return FALSE;
+	}
+
+	delete [] m_pLines;
+	delete [] m_pfPoints;
+
+	m_iSize = header.iSize;
+	m_pLines = new CONTOURLINE[header.iLines > 0 ? header.iLines : 1];
+	m_iLines = 0;
+	m_pfPoints = NULL;
+	m_iPoints = 0;
+
+	int iCapacity = 0;
+	signed char* pcSteps = NULL;
+	int iStepCapacity = 0;
+	BOOL bResult = TRUE;
+
+	while ( m_iLines < header.iLines && bResult )
+	{
+		CONTOURFILELINE record;
+
+		bResult = fread( &record, sizeof(record), 1, file ) == 1 && record.iPoints > 0
+			&& GrowArray( m_pfPoints, iCapacity, 2 * m_iPoints, 2 * ( m_iPoints + record.iPoints ) )
+			&& GrowArray( pcSteps, iStepCapacity, 0, 2 * record.iPoints )
+			&& ( record.iPoints < 2 || fread( pcSteps, 2 * ( record.iPoints - 1 ), 1, file ) == 1 );
+
+		if ( !bResult )
+		{
+			break;
+		}
+
+		CONTOURLINE& line = m_pLines[m_iLines++];
+		FLOAT* pfPoint = m_pfPoints + 2 * m_iPoints;
+		int iX = record.iStartX;
+		int iY = record.iStartY;
+
+		line.iLevel = record.wLevel;
+		line.dwFlags = record.wFlags;
+		line.iFirst = m_iPoints;
+		line.iPoints = record.iPoints;
+
+		for ( int iPoint = 0; iPoint < record.iPoints; iPoint++ )
+		{
+			if ( iPoint > 0 )
+			{
+				iX += pcSteps[2 * iPoint - 2];
+				iY += pcSteps[2 * iPoint - 1];
+			}
+
+			pfPoint[2 * iPoint] = (FLOAT)iX / (FLOAT)CONTOUR_FIXED;
+			pfPoint[2 * iPoint + 1] = (FLOAT)iY / (FLOAT)CONTOUR_FIXED;
+		}
+
+		m_iPoints += record.iPoints;
+	}
+
+	delete [] pcSteps;
+	fclose( file );
+
+	if ( !bResult )
+	{
+		sprintf( m_szError, "Unable to read %.200s", szFilename );
+	}
+
+	return bResult;
+}
+
+int CContours::Size()
+{
+	return m_iSize;
+}
+
+int CContours::Lines()
+{
+	return m_iLines;
+}
+
+const CONTOURLINE& CContours::Line( int iLine )
+{
+	return m_pLines[iLine];
+}
+
+//---------------------------------------------------------------
+//	x, y pairs of every line's points, from the top left corner
+//---------------------------------------------------------------
+const FLOAT* CContours::Points()
+{
+	return m_pfPoints;
+}
+
+LPCSTR CContours::GetError()
+{
+	return m_szError;
+}
@@ -0,0 +1,206 @@
+/*--------------------------------------------------------------------------------
+
+	Contour.h
+
+	Provides contour lines at a height interval and a sea level coastline
+	over a terrain tile, by marching squares
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _CONTOUR_H
+#define _CONTOUR_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define CONTOUR_ROWS			GRID_BLOCK	// Cell rows per band, a row of blocks in the tiled layout
+#define CONTOUR_MAX_LEVELS		256
+#define CONTOUR_MAX_SIZE		32768		// Edges are numbered in a DWORD
+#define CONTOUR_FIXED			64			// Saved points are in 1/64ths of a cell
+#define CONTOUR_MAGIC			0x4C434754	// "TGCL"
+#define CONTOUR_VERSION			1
+
+#define CONTOUR_CLOSED			0x0001		// The last point joins the first
+#define CONTOUR_COAST			0x0002		// The line is at sea level
+
+typedef struct tagCONTOURPARAMS
+{
+	int		iInterval;			// A line at every multiple of this, 0 for none
+	int		iSeaLevel;			// The coastline, -1 for none
+} CONTOURPARAMS;
+
+typedef struct tagCONTOURSTATS
+{
+	int		iLevels;
+	int		iLines;
+	int		iPoints;
+	int		iStitched;			// Pieces joined across bands
+	double	dSeconds;
+} CONTOURSTATS;
+
+typedef struct tagCONTOURLINE
+{
+	int		iLevel;				// Cells this high or higher are above the line
+	DWORD	dwFlags;			// CONTOUR_CLOSED, CONTOUR_COAST
+	int		iFirst;				// First point, in Points()
+	int		iPoints;
+} CONTOURLINE;
+
+//	A line as one band traced it, from one numbered edge to another
+//---------------------------------------------------------------------
+typedef struct tagCONTOURPIECE
+{
+	int		iLevel;				// Index into the levels
+	DWORD	dwStart;			// Edges the first and last points are on
+	DWORD	dwEnd;
+	BOOL	bClosed;
+	BOOL	bUsed;				// Already in a line
+	int		iBand;
+	int		iFirst;				// First point, in the band's points
+	int		iPoints;
+} CONTOURPIECE;
+
+typedef struct tagCONTOURKEY
+{
+	ULONGLONG		ullKey;				// Level << 32 | start edge
+	CONTOURPIECE*	pPiece;
+} CONTOURKEY;
+
+typedef struct tagCONTOURBAND
+{
+	CONTOURPIECE*	pPieces;
+	int				iPieces;
+	int				iPieceCapacity;
+	FLOAT*			pfPoints;			// x, y pairs
+	int				iPoints;
+	int				iPointCapacity;
+} CONTOURBAND;
+
+//	A worker's scratch for its band, rows y0 to y0 + CONTOUR_ROWS
+//-------------------------------------------------------------------
+typedef struct tagCONTOURSCRATCH
+{
+	BYTE*	pbHeights;			// The band's rows of heights
+	DWORD*	pdwBits;			// Each row's cells at or above the level, a bit per cell
+	DWORD*	pdwNext;			// Per edge, the next edge along its line
+	BYTE*	pbIncoming;			// Per edge, a bit for an edge linking to it
+	DWORD*	pdwLinked;			// Edges linked from, in the order they were
+} CONTOURSCRATCH;
+
+//	The saved stream is a CONTOURFILEHEADER, then per line a
+//	CONTOURFILELINE and a signed BYTE x, y step to each point after the
+//	first. Points are on cell edges, so no step is more than a cell.
+//-------------------------------------------------------------------------
+typedef struct tagCONTOURFILEHEADER
+{
+	DWORD	dwMagic;
+	DWORD	dwVersion;
+	int		iSize;
+	int		iLines;
+} CONTOURFILEHEADER;
+
+typedef struct tagCONTOURFILELINE
+{
+	WORD	wLevel;
+	WORD	wFlags;
+	int		iPoints;
+	int		iStartX;			// In 1/CONTOUR_FIXED of a cell
+	int		iStartY;
+} CONTOURFILELINE;
+
+//------------------------------------------------------------------------------
+//	Contour lines over a tile's heights
+//
+//	A line at level L runs between cells below L and cells at L or above,
+//	at L - 1/2 interpolated along each cell edge it crosses, so it never
+//	passes through a cell and every crossing is strictly inside an edge.
+//	Lines keep the higher ground on their left with row 0 at the top, so
+//	a coastline runs anticlockwise around an island. A square whose
+//	corners alternate is joined through its centre if their mean is above
+//	the line.
+//
+//	The tile is split into bands of CONTOUR_ROWS rows run over the
+//	scheduler. A band copies its heights once, then for each level marks
+//	each row's cells at or above it in a bit per cell, with SSE2 comparing
+//	16 heights at a time, and only looks at squares whose corners' bits
+//	differ. Each crossed edge is linked to the next along the line, and
+//	the links are followed into pieces. Pieces ending on a band's first or
+//	last row are stitched to the band next to it afterwards, so a line
+//	comes out whole whatever the bands. Lines that are not closed end on
+//	the tile's edge.
+//
+//	Save writes the lines in 1/CONTOUR_FIXED of a cell as a start point and
+//	a 2 byte step per point, and Load reads them back.
+//------------------------------------------------------------------------------
+class CContours
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CContours();
+	virtual ~CContours();
+
+	//-------------------------
+	//	CContours Interface
+	//-------------------------
+	static void DefaultParams( CONTOURPARAMS* pParams );
+
+	BOOL Extract( CTerrain* pTerrain, const CONTOURPARAMS& params, CONTOURSTATS* pStats );
+	BOOL Save( LPCSTR szFilename );
+	BOOL Load( LPCSTR szFilename );
+
+	int Size();
+	int Lines();
+	const CONTOURLINE& Line( int iLine );
+	const FLOAT* Points();
+	LPCSTR GetError();
+
+private:
+	static void BandTask( int iIndex, int iWorker, void* pContext );
+
+	void ExtractBand( int iBand, int iWorker );
+	void Classify( const BYTE* pbRow, int iThreshold, DWORD* pdwBits );
+	void Trace( int iBand, int iLevel, const CONTOURSCRATCH& scratch, DWORD dwStart, BOOL bClosed );
+	void Stitch( CONTOURSTATS* pStats );
+	void Emit( CONTOURPIECE* pFirst, int* piStitched );
+	CONTOURPIECE* FindPiece( int iLevel, DWORD dwStart );
+	BOOL IsStitch( DWORD dwEdge );
+	void FreeBands();
+
+	//	Levels, ascending
+	//-----------------------
+	int m_aiLevels[CONTOUR_MAX_LEVELS];
+	DWORD m_adwLevelFlags[CONTOUR_MAX_LEVELS];
+	int m_iLevels;
+
+	//	Per-extraction state
+	//--------------------------
+	CHeightGrid* m_pGrid;
+	int m_iSize;
+	int m_iBands;
+	CONTOURBAND* m_pBands;
+	CONTOURSCRATCH m_aScratch[MAX_WORKERS];
+	CONTOURKEY* m_pKeys;			// Pieces starting on a band's first or last row, sorted
+	int m_iKeys;
+
+	//	The lines
+	//---------------
+	CONTOURLINE* m_pLines;
+	int m_iLines;
+	FLOAT* m_pfPoints;
+	int m_iPoints;
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,630 @@
+/*--------------------------------------------------------------------------------
+
+	Drainage.cpp
+
+	Provides depression filling by priority flood, and D8 flow directions
+	and accumulation over a terrain tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Drainage.h"
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define DRAINAGE_DONE		15		// Inflow count of a cell already accumulated
+
+//	Neighbour offsets in DRAINAGEDIRECTION order, y grows to the south
+//------------------------------------------------------------------------
+static const int s_aiDrainX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int s_aiDrainY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+static const FLOAT s_afDrainWeight[8] = { 1.f, 0.70710678f, 1.f, 0.70710678f, 1.f, 0.70710678f, 1.f, 0.70710678f };
+
+static inline int Nibble( const BYTE* pbNibbles, int iCell )
+{
+	return ( iCell & 1 ) ? pbNibbles[iCell >> 1] >> 4 : pbNibbles[iCell >> 1] & 0x0f;
+}
+
+static inline void SetNibble( BYTE* pbNibbles, int iCell, int iValue )
+{
+	BYTE& bPair = pbNibbles[iCell >> 1];
+
+	bPair = ( iCell & 1 ) ? (BYTE)( ( bPair & 0x0f ) | ( iValue << 4 ) ) : (BYTE)( ( bPair & 0xf0 ) | iValue );
+}
+
+//------------------------------------
+//
+//	CLASS: CDrainage implementation
+//
+//------------------------------------
+CDrainage::CDrainage()
+{
+	for ( int iLevel = 0; iLevel < DRAINAGE_LEVELS; iLevel++ )
+	{
+		m_apHead[iLevel] = NULL;
+		m_apTail[iLevel] = NULL;
+		m_aiRead[iLevel] = 0;
+	}
+
+	m_pFree = NULL;
+	m_iBlocks = 0;
+	m_iPeakBlocks = 0;
+
+	m_pGrid = NULL;
+	m_iSize = 0;
+	m_pbReached = NULL;
+	m_pbDirections = NULL;
+	m_pdwAccumulation = NULL;
+	m_szError[0] = 0;
+}
+
+CDrainage::~CDrainage()
+{
+	while ( m_pFree != NULL )
+	{
+		DRAINAGEBLOCK* pBlock = m_pFree;
+
+		m_pFree = pBlock->pNext;
+		delete pBlock;
+	}
+
+	delete [] m_pbReached;
+	delete [] m_pbDirections;
+	delete [] m_pdwAccumulation;
+}
+
+//------------------------------------------------------------------------------
+//	Raise the tile's closed pits to their spill heights, in place
+//
+//	pStats may be NULL
+//------------------------------------------------------------------------------
+BOOL CDrainage::Fill( CTerrain* pTerrain, DRAINAGESTATS* pStats )
+{
+	delete [] m_pbDirections;
+	delete [] m_pdwAccumulation;
+
+	m_pbDirections = NULL;
+	m_pdwAccumulation = NULL;
+	m_iSize = 0;
+
+	return Flood( pTerrain, FALSE, pStats );
+}
+
+//------------------------------------------------------------------------------
+//	Fill the tile in place, then find each cell's direction and how many
+//	cells drain through it
+//
+//	pStats may be NULL
+//------------------------------------------------------------------------------
+BOOL CDrainage::Flow( CTerrain* pTerrain, DRAINAGESTATS* pStats )
+{
+	LARGE_INTEGER liFreq, liStart, liEnd;
+
+	QueryPerformanceFrequency( &liFreq );
+	QueryPerformanceCounter( &liStart );
+
+	if ( !Flood( pTerrain, TRUE, pStats ) )
+	{
+		return FALSE;
+	}
+
+	//	Even row runs start on a whole byte of directions, so no two tasks
+	//	write the same byte
+	//------------------------------------------------------------------------
+	ParallelFor( ( m_iSize + DRAINAGE_ROWS - 1 ) / DRAINAGE_ROWS, DirectionTask, this );
+
+	if ( !Accumulate() )
+	{
+		delete [] m_pdwAccumulation;
+		m_pdwAccumulation = NULL;
+
+		sprintf( m_szError, "Out of memory for the accumulation of a %d cell tile", m_iSize );
+		return FALSE;
+	}
+
+	QueryPerformanceCounter( &liEnd );
+
+	if ( pStats != NULL )
+	{
+		int iCells = m_iSize * m_iSize;
+
+		pStats->dwMaxAccumulation = 0;
+
+		for ( int iCell = 0; iCell < iCells; iCell++ )
+		{
+			pStats->dwMaxAccumulation = m_pdwAccumulation[iCell] > pStats->dwMaxAccumulation ? m_pdwAccumulation[iCell] : pStats->dwMaxAccumulation;
+		}
+
+		pStats->dSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	The priority flood, from the edges inwards. With bFlow each cell also
+//	gets the direction back to the neighbour the flood reached it from,
+//	and the edges drain off the tile.
+//------------------------------------------------------------------------------
+BOOL CDrainage::Flood( CTerrain* pTerrain, BOOL bFlow, DRAINAGESTATS* pStats )
+{
+	LARGE_INTEGER liFreq, liStart, liEnd;
+
+	QueryPerformanceFrequency( &liFreq );
+	QueryPerformanceCounter( &liStart );
+
+	int iSize = pTerrain->TileSize();
+
+	if ( iSize < 2 || iSize > DRAINAGE_MAX_SIZE )
+	{
+		sprintf( m_szError, "Drainage needs a tile of 2 to %d cells, not %d", DRAINAGE_MAX_SIZE, iSize );
+		return FALSE;
+	}
+
+	int iCells = iSize * iSize;
+
+	delete [] m_pbReached;
+	m_pbReached = new BYTE[( iCells + 7 ) / 8];
+
+	if ( bFlow )
+	{
+		delete [] m_pbDirections;
+		delete [] m_pdwAccumulation;
+
+		m_pbDirections = new BYTE[( iCells + 1 ) / 2];
+		m_pdwAccumulation = new DWORD[iCells];
+	}
+
+	if ( m_pbReached == NULL || ( bFlow && ( m_pbDirections == NULL || m_pdwAccumulation == NULL ) ) )
+	{
+		sprintf( m_szError, "Out of memory for the drainage of a %d cell tile", iSize );
+		return FALSE;
+	}
+
+	memset( m_pbReached, 0, ( iCells + 7 ) / 8 );
+
+	m_pGrid = &pTerrain->HeightGrid();
+	m_iSize = iSize;
+	m_iPeakBlocks = 0;
+
+	int iRaised = 0;
+	int iMaxRaise = 0;
+	int iEdge;
+	BOOL bQueued = TRUE;
+
+	//	The edges, each cell once
+	//-------------------------------
+	for ( iEdge = 0; iEdge < 4 * ( iSize - 1 ) && bQueued; iEdge++ )
+	{
+		int iSide = iEdge / ( iSize - 1 );
+		int iAlong = iEdge % ( iSize - 1 );
+		int iEdgeX = iSide == 0 ? iAlong : iSide == 1 ? iSize - 1 : iSide == 2 ? iSize - 1 - iAlong : 0;
+		int iEdgeY = iSide == 0 ? 0 : iSide == 1 ? iAlong : iSide == 2 ? iSize - 1 : iSize - 1 - iAlong;
+		int iEdgeCell = iEdgeY * iSize + iEdgeX;
+
+		m_pbReached[iEdgeCell >> 3] |= (BYTE)( 1 << ( iEdgeCell & 7 ) );
+
+		if ( bFlow )
+		{
+			SetNibble( m_pbDirections, iEdgeCell, DRAINAGE_OUTLET );
+		}
+
+		bQueued = Push( m_pGrid->At( iEdgeX, iEdgeY ), ( (DWORD)iEdgeY << 16 ) | (DWORD)iEdgeX );
+	}
+
+	//	A cell is only ever queued at or above the level being taken, so the
+	//	levels are walked once
+	//--------------------------------------------------------------------------
+	int iLevel;
+
+	for ( iLevel = 0; iLevel < DRAINAGE_LEVELS && bQueued; iLevel++ )
+	{
+		while ( m_apHead[iLevel] != NULL && bQueued )
+		{
+			DWORD dwCell = Pop( iLevel );
+			int iXPos = (int)( dwCell & 0xffff );
+			int iYPos = (int)( dwCell >> 16 );
+
+			for ( int iDir = 0; iDir < 8 && bQueued; iDir++ )
+			{
+				int iNX = iXPos + s_aiDrainX[iDir];
+				int iNY = iYPos + s_aiDrainY[iDir];
+				int iNCell = iNY * iSize + iNX;
+
+				if ( iNX < 0 || iNX >= iSize || iNY < 0 || iNY >= iSize || ( m_pbReached[iNCell >> 3] & ( 1 << ( iNCell & 7 ) ) ) )
+				{
+					continue;
+				}
+
+				m_pbReached[iNCell >> 3] |= (BYTE)( 1 << ( iNCell & 7 ) );
+
+				if ( bFlow )
+				{
+					SetNibble( m_pbDirections, iNCell, ( iDir + 4 ) & 7 );
+				}
+
+				BYTE& bHeight = m_pGrid->At( iNX, iNY );
+
+				if ( bHeight < iLevel )
+				{
+					iRaised++;
+					iMaxRaise = iLevel - bHeight > iMaxRaise ? iLevel - bHeight : iMaxRaise;
+					bHeight = (BYTE)iLevel;
+				}
+
+				bQueued = Push( bHeight, ( (DWORD)iNY << 16 ) | (DWORD)iNX );
+			}
+		}
+	}
+
+	delete [] m_pbReached;
+	m_pbReached = NULL;
+
+	//	Out of queue blocks. What is queued goes back to the pool and the
+	//	tile is left part filled.
+	//-----------------------------------------------------------------------
+	if ( !bQueued )
+	{
+		for ( iLevel = 0; iLevel < DRAINAGE_LEVELS; iLevel++ )
+		{
+			while ( m_apHead[iLevel] != NULL )
+			{
+				DRAINAGEBLOCK* pBlock = m_apHead[iLevel];
+
+				m_apHead[iLevel] = pBlock->pNext;
+				pBlock->pNext = m_pFree;
+				m_pFree = pBlock;
+			}
+
+			m_apTail[iLevel] = NULL;
+			m_aiRead[iLevel] = 0;
+		}
+
+		delete [] m_pbDirections;
+		delete [] m_pdwAccumulation;
+
+		m_pbDirections = NULL;
+		m_pdwAccumulation = NULL;
+		m_iBlocks = 0;
+		m_iSize = 0;
+
+		sprintf( m_szError, "Out of memory for the drainage queue of a %d cell tile", iSize );
+		return FALSE;
+	}
+
+	QueryPerformanceCounter( &liEnd );
+
+	if ( pStats != NULL )
+	{
+		pStats->iRaised = iRaised;
+		pStats->iMaxRaise = iMaxRaise;
+		pStats->dwMaxAccumulation = 0;
+		pStats->iPeakBlocks = m_iPeakBlocks;
+		pStats->dSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+	}
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------
+//	Queue a cell at the back of a level, on a pooled block.
+//	FALSE if a block was needed and could not be allocated.
+//---------------------------------------------------------------
+BOOL CDrainage::Push( int iLevel, DWORD dwCell )
+{
+	DRAINAGEBLOCK* pTail = m_apTail[iLevel];
+
+	if ( pTail == NULL || pTail->iCount == DRAINAGE_BLOCK_CELLS )
+	{
+		DRAINAGEBLOCK* pBlock = m_pFree;
+
+		if ( pBlock != NULL )
+		{
+			m_pFree = pBlock->pNext;
+		}
+		else
+		{
+			pBlock = new DRAINAGEBLOCK;
+
+			if ( pBlock == NULL )
+			{
+				return FALSE;
+			}
+		}
+
+		pBlock->pNext = NULL;
+		pBlock->iCount = 0;
+
+		if ( pTail == NULL )
+		{
+			m_apHead[iLevel] = pBlock;
+			m_aiRead[iLevel] = 0;
+		}
+		else
+		{
+			pTail->pNext = pBlock;
+		}
+
+		m_apTail[iLevel] = pTail = pBlock;
+		m_iBlocks++;
+		m_iPeakBlocks = m_iBlocks > m_iPeakBlocks ? m_iBlocks : m_iPeakBlocks;
+	}
+
+	pTail->adwCells[pTail->iCount++] = dwCell;
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------
+//	Take the cell at the front of a level, which must have one.
+//	Emptied blocks go back to the pool.
+//---------------------------------------------------------------
+DWORD CDrainage::Pop( int iLevel )
+{
+	DRAINAGEBLOCK* pHead = m_apHead[iLevel];
+	DWORD dwCell = pHead->adwCells[m_aiRead[iLevel]++];
+
+	if ( m_aiRead[iLevel] == pHead->iCount )
+	{
+		m_apHead[iLevel] = pHead->pNext;
+		m_aiRead[iLevel] = 0;
+
+		if ( pHead->pNext == NULL )
+		{
+			m_apTail[iLevel] = NULL;
+		}
+
+		pHead->pNext = m_pFree;
+		m_pFree = pHead;
+		m_iBlocks--;
+	}
+
+	return dwCell;
+}
+
+void CDrainage::DirectionTask( int iIndex, int iWorker, void* pContext )
+{
+	CDrainage* pThis = (CDrainage*)pContext;
+	int iEndRow = ( iIndex + 1 ) * DRAINAGE_ROWS;
+
+	pThis->Directions( iIndex * DRAINAGE_ROWS, iEndRow > pThis->m_iSize ? pThis->m_iSize : iEndRow );
+}
+
+//------------------------------------------------------------------------------
+//	Point interior cells with a lower neighbour down the steepest drop,
+//	the first in DRAINAGEDIRECTION order on a tie. The rest are on flats
+//	and keep the direction the flood gave them.
+//------------------------------------------------------------------------------
+void CDrainage::Directions( int iFirstRow, int iEndRow )
+{
+	int iSize = m_iSize;
+
+	iFirstRow = iFirstRow < 1 ? 1 : iFirstRow;
+	iEndRow = iEndRow > iSize - 1 ? iSize - 1 : iEndRow;
+
+	for ( int iYPos = iFirstRow; iYPos < iEndRow; iYPos++ )
+	{
+		for ( int iXPos = 1; iXPos < iSize - 1; iXPos++ )
+		{
+			int iHeight = m_pGrid->At( iXPos, iYPos );
+			FLOAT fSteepest = 0.f;
+			int iSteepest = -1;
+
+			for ( int iDir = 0; iDir < 8; iDir++ )
+			{
+				int iDrop = iHeight - m_pGrid->At( iXPos + s_aiDrainX[iDir], iYPos + s_aiDrainY[iDir] );
+				FLOAT fSlope = (FLOAT)iDrop * s_afDrainWeight[iDir];
+
+				if ( iDrop > 0 && fSlope > fSteepest )
+				{
+					fSteepest = fSlope;
+					iSteepest = iDir;
+				}
+			}
+
+			if ( iSteepest >= 0 )
+			{
+				SetNibble( m_pbDirections, iYPos * iSize + iXPos, iSteepest );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Count each cell's inflows, then walk downstream from every cell with
+//	none, adding its count on and carrying on from each cell whose last
+//	inflow that was. Every chain ends at an outlet, and no cell is walked
+//	from twice.
+//
+//	FALSE if the inflow counts could not be allocated
+//------------------------------------------------------------------------------
+BOOL CDrainage::Accumulate()
+{
+	int iSize = m_iSize;
+	int iCells = iSize * iSize;
+	BYTE* pbInflows = new BYTE[( iCells + 1 ) / 2];
+	int iCell;
+
+	if ( pbInflows == NULL )
+	{
+		return FALSE;
+	}
+
+	memset( pbInflows, 0, ( iCells + 1 ) / 2 );
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		int iDir = Nibble( m_pbDirections, iCell );
+
+		m_pdwAccumulation[iCell] = 1;
+
+		if ( iDir != DRAINAGE_OUTLET )
+		{
+			int iDown = iCell + s_aiDrainY[iDir] * iSize + s_aiDrainX[iDir];
+
+			SetNibble( pbInflows, iDown, Nibble( pbInflows, iDown ) + 1 );
+		}
+	}
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		if ( Nibble( pbInflows, iCell ) != 0 )
+		{
+			continue;
+		}
+
+		int iFrom = iCell;
+		int iDir;
+
+		SetNibble( pbInflows, iFrom, DRAINAGE_DONE );
+
+		while ( ( iDir = Nibble( m_pbDirections, iFrom ) ) != DRAINAGE_OUTLET )
+		{
+			int iDown = iFrom + s_aiDrainY[iDir] * iSize + s_aiDrainX[iDir];
+			int iLeft = Nibble( pbInflows, iDown ) - 1;
+
+			m_pdwAccumulation[iDown] += m_pdwAccumulation[iFrom];
+
+			if ( iLeft != 0 )
+			{
+				SetNibble( pbInflows, iDown, iLeft );
+				break;
+			}
+
+			SetNibble( pbInflows, iDown, DRAINAGE_DONE );
+			iFrom = iDown;
+		}
+	}
+
+	delete [] pbInflows;
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Write the accumulation as a grey TGA, log scaled so the ridges show as
+//	well as the rivers, a row at a time
+//------------------------------------------------------------------------------
+BOOL CDrainage::SaveAccumulation( LPCSTR szFilename )
+{
+	if ( m_pdwAccumulation == NULL )
+	{
+		sprintf( m_szError, "No flow has been run" );
+		return FALSE;
+	}
+
+	int iSize = m_iSize;
+	BYTE* pbRow = new BYTE[iSize * 3];
+
+	if ( pbRow == NULL )
+	{
+		sprintf( m_szError, "Out of memory writing %.200s", szFilename );
+		return FALSE;
+	}
+
+	FILE* file;
+
+	if ( ( file = fopen( szFilename, "wb" ) ) == NULL )
+	{
+		delete [] pbRow;
+		sprintf( m_szError, "Unable to create %.200s", szFilename );
+		return FALSE;
+	}
+
+	DWORD dwMax = 1;
+	int iCell;
+
+	for ( iCell = 0; iCell < iSize * iSize; iCell++ )
+	{
+		dwMax = m_pdwAccumulation[iCell] > dwMax ? m_pdwAccumulation[iCell] : dwMax;
+	}
+
+	double dScale = dwMax > 1 ? 255.0 / log( (double)dwMax ) : 0.0;
+	BYTE head[TGA_HEADER_SIZE];
+
+	FillTgaHeader( head, iSize, iSize );
+
+	BOOL bResult = fwrite( head, TGA_HEADER_SIZE, 1, file ) == 1;
+
+	//	Bottom row first, as the tile is saved
+	//--------------------------------------------
+	for ( int iYPos = iSize - 1; iYPos >= 0 && bResult; iYPos-- )
+	{
+		for ( int iXPos = 0; iXPos < iSize; iXPos++ )
+		{
+			BYTE bLevel = (BYTE)( log( (double)m_pdwAccumulation[iYPos * iSize + iXPos] ) * dScale + 0.5 );
+
+			pbRow[iXPos * 3] = bLevel;
+			pbRow[iXPos * 3 + 1] = bLevel;
+			pbRow[iXPos * 3 + 2] = bLevel;
+		}
+
+		bResult = fwrite( pbRow, iSize * 3, 1, file ) == 1;
+	}
+
+	delete [] pbRow;
+	fclose( file );
+
+	if ( !bResult )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFilename );
+	}
+
+	return bResult;
+}
+
+int CDrainage::Size()
+{
+	return m_iSize;
+}
+
+//---------------------------------------------------------------
+//	A cell's DRAINAGEDIRECTION from the last flow
+//---------------------------------------------------------------
+int CDrainage::Direction( int iXPos, int iYPos )
+{
+	return Nibble( m_pbDirections, iYPos * m_iSize + iXPos );
+}
+
+//---------------------------------------------------------------
+//	Cells draining through each from the last flow, by y * size + x
+//---------------------------------------------------------------
+const DWORD* CDrainage::Accumulation()
+{
+	return m_pdwAccumulation;
+}
+
+LPCSTR CDrainage::GetError()
+{
+	return m_szError;
+}
+
+//---------------------------------------------------------------
+//	Step a position one cell along a direction, FALSE for an
+//	outlet which leaves it where it is
+//---------------------------------------------------------------
+BOOL CDrainage::Downstream( int iDirection, int* piXPos, int* piYPos )
+{
+	if ( iDirection < 0 || iDirection >= DRAINAGE_OUTLET )
+	{
+		return FALSE;
+	}
+
+	*piXPos += s_aiDrainX[iDirection];
+	*piYPos += s_aiDrainY[iDirection];
+
+	return TRUE;
+}
@@ -0,0 +1,139 @@
+/*--------------------------------------------------------------------------------
+
+	Drainage.h
+
+	Provides depression filling by priority flood, and D8 flow directions
+	and accumulation over a terrain tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _DRAINAGE_H
+#define _DRAINAGE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define DRAINAGE_LEVELS			256		// One queue bucket per BYTE height
+#define DRAINAGE_BLOCK_CELLS	1022	// Cells per queue block, a block is 4K
+#define DRAINAGE_MAX_SIZE		32768	// Cells index as an int, and queue with x and y in 16 bits each
+#define DRAINAGE_ROWS			16		// Rows per direction task, even so tasks never share a byte
+
+//	Where a cell drains to, in the ESRI order, bit n of its D8 code. An
+//	outlet drains off the tile.
+//-------------------------------------------------------------------------
+enum DRAINAGEDIRECTION
+{
+	DRAINAGE_EAST,
+	DRAINAGE_SOUTH_EAST,
+	DRAINAGE_SOUTH,
+	DRAINAGE_SOUTH_WEST,
+	DRAINAGE_WEST,
+	DRAINAGE_NORTH_WEST,
+	DRAINAGE_NORTH,
+	DRAINAGE_NORTH_EAST,
+	DRAINAGE_OUTLET
+};
+
+typedef struct tagDRAINAGESTATS
+{
+	int		iRaised;				// Cells the fill raised
+	int		iMaxRaise;				// and the most any was raised by
+	DWORD	dwMaxAccumulation;		// Most cells draining through one
+	int		iPeakBlocks;			// Queue blocks in use at once
+	double	dSeconds;
+} DRAINAGESTATS;
+
+//	A run of queued cells, one of a bucket's FIFO chain
+//---------------------------------------------------------
+typedef struct tagDRAINAGEBLOCK
+{
+	tagDRAINAGEBLOCK*	pNext;
+	int					iCount;
+	DWORD				adwCells[DRAINAGE_BLOCK_CELLS];		// y << 16 | x
+} DRAINAGEBLOCK;
+
+//------------------------------------------------------------------------------
+//	Drainage over a tile's heights
+//
+//	Fill raises every closed pit to the height it spills at, in place, by
+//	priority flood: the edge cells are queued, then the lowest queued cell
+//	is taken in turn and its neighbours not yet reached are raised to at
+//	least its height and queued. Heights are BYTEs, so the queue is a
+//	bucket per height, each a FIFO of 4K blocks from a pool. A flood never
+//	goes back down a level, so taking the lowest cell is a walk up the
+//	buckets, and memory is the flood front, not the tile. Cells reached
+//	are marked in a bit per cell.
+//
+//	Flow fills, then gives each cell a D8 direction, 4 bits a cell: the
+//	steepest drop to a neighbour, diagonals over sqrt 2, or on a flat the
+//	neighbour the flood reached it from. That neighbour was taken earlier
+//	at the same height, so flats drain the way the flood came in and no
+//	path can loop. Accumulation counts the cells draining through each,
+//	itself included, following each chain downstream from the cells
+//	nothing drains into, with 4 bit counts of what is still to come in.
+//
+//	Cells are indexed y * size + x whatever the grid's layout. A 16k tile
+//	takes 128M for the directions and 1G for the counts.
+//------------------------------------------------------------------------------
+class CDrainage
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CDrainage();
+	virtual ~CDrainage();
+
+	//-------------------------
+	//	CDrainage Interface
+	//-------------------------
+	BOOL Fill( CTerrain* pTerrain, DRAINAGESTATS* pStats );
+	BOOL Flow( CTerrain* pTerrain, DRAINAGESTATS* pStats );
+	BOOL SaveAccumulation( LPCSTR szFilename );
+
+	int Size();
+	int Direction( int iXPos, int iYPos );
+	const DWORD* Accumulation();
+	LPCSTR GetError();
+
+	static BOOL Downstream( int iDirection, int* piXPos, int* piYPos );
+
+private:
+	static void DirectionTask( int iIndex, int iWorker, void* pContext );
+
+	BOOL Flood( CTerrain* pTerrain, BOOL bFlow, DRAINAGESTATS* pStats );
+	BOOL Push( int iLevel, DWORD dwCell );
+	DWORD Pop( int iLevel );
+	void Directions( int iFirstRow, int iEndRow );
+	BOOL Accumulate();
+
+	//	The bucket queue
+	//----------------------
+	DRAINAGEBLOCK* m_apHead[DRAINAGE_LEVELS];	// Taken from here, at m_aiRead
+	DRAINAGEBLOCK* m_apTail[DRAINAGE_LEVELS];	// Added here
+	int m_aiRead[DRAINAGE_LEVELS];
+	DRAINAGEBLOCK* m_pFree;
+	int m_iBlocks;
+	int m_iPeakBlocks;
+
+	//	Per-tile state
+	//--------------------
+	CHeightGrid* m_pGrid;
+	int m_iSize;
+	BYTE* m_pbReached;				// Bit per cell
+	BYTE* m_pbDirections;			// DRAINAGEDIRECTION per cell, low nibble first
+	DWORD* m_pdwAccumulation;
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,746 @@
+/*--------------------------------------------------------------------------------
+
+	Erosion.cpp
+
+	Provides thermal and droplet based hydraulic erosion of a terrain tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include "Erosion.h"
+#include "Arena.h"
+
+//------------------------------------
+//
+//	CLASS: CErosion implementation
+//
+//------------------------------------
+CErosion::CErosion()
+{
+	DefaultParams( &m_params );
+	BuildBrush();
+	m_szError[0] = 0;
+}
+
+CErosion::CErosion( const EROSIONPARAMS& params )
+{
+	m_params = params;
+	BuildBrush();
+	m_szError[0] = 0;
+}
+
+CErosion::~CErosion()
+{
+}
+
+//---------------------------------------------------------------
+//	Sensible defaults for heights in the 0-255 range of a tile
+//---------------------------------------------------------------
+void CErosion::DefaultParams( EROSIONPARAMS* pParams )
+{
+	pParams->dwSeed = 1;
+	pParams->iPasses = 4;
+	pParams->iTileSize = 0;
+
+	pParams->iThermalIterations = 8;
+	pParams->fTalus = 4.f;
+	pParams->fThermalRate = 0.25f;
+
+	pParams->iDropletsPerTile = 2048;
+	pParams->iDropletLifetime = 30;
+	pParams->iErosionRadius = 3;
+	pParams->fInertia = 0.05f;
+	pParams->fSedimentCapacity = 4.f;
+	pParams->fMinSedimentCapacity = 0.01f;
+	pParams->fErodeSpeed = 0.3f;
+	pParams->fDepositSpeed = 0.3f;
+	pParams->fEvaporateSpeed = 0.01f;
+	pParams->fGravity = 4.f;
+}
+
+EROSIONPARAMS& CErosion::Params()
+{
+	return m_params;
+}
+
+//----------------------------------------------------------------------
+//	Precompute the erosion brush, weights fall off linearly with
+//	distance from the droplet and sum to 1
+//----------------------------------------------------------------------
+void CErosion::BuildBrush()
+{
+	int iRadius = m_params.iErosionRadius;
+
+	iRadius = iRadius < 1 ? 1 : iRadius;
+	iRadius = iRadius > EROSION_MAX_RADIUS ? EROSION_MAX_RADIUS : iRadius;
+	m_params.iErosionRadius = iRadius;
+
+	FLOAT fWeightSum = 0.f;
+	m_iBrushSize = 0;
+
+	for ( int iY = -iRadius; iY <= iRadius; iY++ )
+	{
+		for ( int iX = -iRadius; iX <= iRadius; iX++ )
+		{
+			FLOAT fDist = (FLOAT)sqrt( (double)( iX * iX + iY * iY ) );
+
+			if ( fDist < (FLOAT)iRadius )
+			{
+				m_aiBrushX[m_iBrushSize] = iX;
+				m_aiBrushY[m_iBrushSize] = iY;
+				m_afBrushWeight[m_iBrushSize] = 1.f - fDist / (FLOAT)iRadius;
+				fWeightSum += m_afBrushWeight[m_iBrushSize];
+				m_iBrushSize++;
+			}
+		}
+	}
+
+	for ( int iBrush = 0; iBrush < m_iBrushSize; iBrush++ )
+	{
+		m_afBrushWeight[iBrush] /= fWeightSum;
+	}
+}
+
+//----------------------------------------------------------------------
+//	How far outside its interior a tile must read
+//
+//	A thermal step moves material between neighbours, but how a cell
+//	shares it depends on all of its own, so a copy's edge spoils two
+//	more cells a step. A droplet moves at most one cell per step and
+//	erodes within its brush radius, and must only read cells the thermal
+//	steps got right, so the two reaches add up.
+//----------------------------------------------------------------------
+int CErosion::Halo()
+{
+	int iThermal = 2 * m_params.iThermalIterations;
+	int iHydraulic = m_params.iDropletsPerTile > 0 ? m_params.iDropletLifetime + m_params.iErosionRadius + 2 : 0;
+
+	return iThermal + iHydraulic;
+}
+
+//-------------------------------------------------------------------------------
+//	Erode the terrain tile in place
+//
+//	pStats may be NULL, otherwise it receives timings including a throughput
+//	figure of grid cells eroded per second per thread for sizing jobs.
+//	Returns FALSE, leaving the tile as it was, if there is not the memory.
+//-------------------------------------------------------------------------------
+BOOL CErosion::Erode( CTerrain* pTerrain, EROSIONSTATS* pStats )
+{
+	LARGE_INTEGER liFreq, liStart, liEnd;
+
+	QueryPerformanceFrequency( &liFreq );
+	QueryPerformanceCounter( &liStart );
+
+	BuildBrush();
+
+	int iTileSq = pTerrain->TileSize();
+	int iHalo = Halo();
+	int iPasses = m_params.iPasses > 0 ? m_params.iPasses : 0;
+	int iPass;
+
+	//	Tiles must be at least twice as wide as the halo, so that the extended
+	//	tiles of the same phase (one tile apart) never overlap
+	//---------------------------------------------------------------------------
+	m_pTerrain = pTerrain;
+	m_iTile = m_params.iTileSize > 0 ? m_params.iTileSize : EROSION_TILE;
+	m_iTile = m_iTile < 2 * iHalo ? 2 * iHalo : m_iTile;
+	m_iTile = m_iTile > iTileSq ? iTileSq : m_iTile;
+	m_iTilesX = ( iTileSq + m_iTile - 1 ) / m_iTile;
+	m_iTilesY = m_iTilesX;
+	m_iRing = m_iTilesY < EROSION_RING ? m_iTilesY : EROSION_RING;
+
+	//	The rings of heights, the pass bookkeeping and scratch of three
+	//	halo-extended tiles per thread are carved from the calling thread's
+	//	arena here since the arena is not safe to share
+	//---------------------------------------------------------------------------
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iExtent = m_iTile + 2 * iHalo > iTileSq ? iTileSq : m_iTile + 2 * iHalo;
+	size_t cbRing = sizeof(FLOAT) * (size_t)m_iRing * (size_t)m_iTile * (size_t)iTileSq;
+	BOOL bMemory;
+
+	m_iExtent = iExtent;
+	m_piOrder = (int*)pArena->Alloc( sizeof(int) * m_iTilesY );
+	m_piDone = (int*)pArena->Alloc( sizeof(int) * ( iPasses + 1 ) );
+	m_piOpened = (int*)pArena->Alloc( sizeof(int) * ( iPasses + 1 ) );
+	m_ppfLevels = (FLOAT**)pArena->Alloc( sizeof(FLOAT*) * ( iPasses + 1 ) );
+	bMemory = m_piOrder != NULL && m_piDone != NULL && m_piOpened != NULL && m_ppfLevels != NULL;
+
+	for ( iPass = 0; bMemory && iPass < iPasses; iPass++ )
+	{
+		m_piDone[iPass] = 0;
+		m_piOpened[iPass] = 0;
+		m_ppfLevels[iPass + 1] = (FLOAT*)pArena->Alloc( cbRing );
+		bMemory &= m_ppfLevels[iPass + 1] != NULL;
+	}
+
+	for ( int iWorker = 0; iWorker < GetWorkerCount(); iWorker++ )
+	{
+		m_apfScratch[iWorker] = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * 3 * iExtent * iExtent );
+		bMemory &= m_apfScratch[iWorker] != NULL;
+	}
+
+	if ( !bMemory )
+	{
+		sprintf( m_szError, "Out of memory for the erosion of a %d cell tile", iTileSq );
+		return FALSE;
+	}
+
+	//	A pass takes the even rows of tiles one ahead of the odd ones, 0, 2,
+	//	1, 4, 3 and so on, so every cell gets the changes of the even rows
+	//	before those of the odd rows, in the order four phases over the whole
+	//	grid would add them, and two rows in is finished for the next pass
+	//---------------------------------------------------------------------------
+	int iOrder = 0;
+
+	m_piOrder[iOrder++] = 0;
+
+	for ( int iEven = 2; iEven - 1 < m_iTilesY; iEven += 2 )
+	{
+		if ( iEven < m_iTilesY )
+		{
+			m_piOrder[iOrder++] = iEven;
+		}
+
+		m_piOrder[iOrder++] = iEven - 1;
+	}
+
+	double dMass = 0.0;
+	int iMin = pTerrain->MinHeight();
+	int iMax = pTerrain->MaxHeight();
+	int iX, iY;
+
+	for ( iY = 0; iY < iTileSq; iY++ )
+	{
+		for ( iX = 0; iX < iTileSq; iX++ )
+		{
+			dMass -= (double)(FLOAT)pTerrain->Grid( iX, iY );
+		}
+	}
+
+	//	The deepest pass that can go on does, so the passes before it only
+	//	run as far ahead as it needs, and rows are rounded back to the grid
+	//	as the last pass finishes them. Pass 0 reads the grid itself, which
+	//	is only written well behind it
+	//---------------------------------------------------------------------------
+	m_iWritten = 0;
+
+	while ( iPasses > 0 && m_piDone[iPasses - 1] < m_iTilesY )
+	{
+		for ( iPass = iPasses - 1; iPass >= 0 && !CanRun( iPass ); iPass-- )
+		{
+		}
+
+		if ( iPass < 0 )
+		{
+			sprintf( m_szError, "The erosion passes of a %d cell tile stalled", iTileSq );
+			return FALSE;
+		}
+
+		RunRow( iPass );
+
+		if ( iPass < iPasses - 1 )
+		{
+			continue;
+		}
+
+		//	Heights are only rounded now, clamped to the terrain's range
+		//------------------------------------------------------------------
+		int iFinal = FinalRows( iPass );
+		int iEndY = iFinal * m_iTile > iTileSq ? iTileSq : iFinal * m_iTile;
+
+		for ( iY = m_iWritten * m_iTile; iY < iEndY; iY++ )
+		{
+			const FLOAT* pfRow = Row( iPasses, iY );
+
+			for ( iX = 0; iX < iTileSq; iX++ )
+			{
+				FLOAT fValue = pfRow[iX] + 0.5f;
+				int iValue = fValue < (FLOAT)iMin ? iMin : fValue > (FLOAT)iMax ? iMax : (int)fValue;
+
+				dMass += (double)pfRow[iX];
+				pTerrain->Grid( iX, iY ) = (BYTE)iValue;
+			}
+		}
+
+		m_iWritten = iFinal;
+	}
+
+	if ( iPasses == 0 )
+	{
+		dMass = 0.0;
+	}
+
+	QueryPerformanceCounter( &liEnd );
+
+	if ( pStats != NULL )
+	{
+		int iThreads = GetWorkerCount();
+		int iRowTiles = ( m_iTilesX + 1 ) / 2;
+
+		iThreads = iThreads > iRowTiles ? iRowTiles : iThreads;
+
+		pStats->iThreads = iThreads;
+		pStats->iTiles = m_iTilesX * m_iTilesY;
+		pStats->dSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+
+		double dCells = (double)iTileSq * (double)iTileSq * (double)m_params.iPasses;
+
+		pStats->dCellsPerSecPerCore = pStats->dSeconds > 0.0 ? dCells / pStats->dSeconds / (double)iThreads : 0.0;
+		pStats->dMassChange = dMass;
+	}
+
+	InvalidateRect( NULL, NULL, TRUE );
+
+	return TRUE;
+}
+
+LPCSTR CErosion::GetError()
+{
+	return m_szError;
+}
+
+//---------------------------------------------------------------------
+//	Row iY of the heights after iLevel passes, within its ring, and the
+//	number of rows of tiles a pass has finished for the next
+//---------------------------------------------------------------------
+FLOAT* CErosion::Row( int iLevel, int iY )
+{
+	int iSlot = ( iY / m_iTile ) % m_iRing;
+
+	return m_ppfLevels[iLevel] + ( (size_t)iSlot * m_iTile + iY % m_iTile ) * (size_t)m_pTerrain->TileSize();
+}
+
+int CErosion::FinalRows( int iPass )
+{
+	int iDone = m_piDone[iPass];
+
+	if ( iDone >= m_iTilesY )
+	{
+		return m_iTilesY;
+	}
+
+	//	A row is finished once it and both its neighbours have been run,
+	//	and the first row not run is one of the next two in the order
+	//-----------------------------------------------------------------------
+	int iFirst = m_piOrder[iDone];
+
+	if ( iDone + 1 < m_iTilesY && m_piOrder[iDone + 1] < iFirst )
+	{
+		iFirst = m_piOrder[iDone + 1];
+	}
+
+	return iFirst > 0 ? iFirst - 1 : 0;
+}
+
+//---------------------------------------------------------------------------
+//	Whether a pass can run its next row of tiles, which needs the rows
+//	around it finished by the pass before and room in the ring it writes
+//---------------------------------------------------------------------------
+BOOL CErosion::CanRun( int iPass )
+{
+	int iDone = m_piDone[iPass];
+
+	if ( iDone >= m_iTilesY )
+	{
+		return FALSE;
+	}
+
+	int iRow = m_piOrder[iDone];
+	int iLast = iRow + 1 < m_iTilesY ? iRow + 1 : m_iTilesY - 1;
+
+	if ( iPass > 0 && FinalRows( iPass - 1 ) <= iLast )
+	{
+		return FALSE;
+	}
+
+	//	The oldest row still held in the ring is the one the next pass
+	//	reads furthest back, or for the last pass the first not yet rounded
+	//-------------------------------------------------------------------------
+	int iOldest = m_iWritten;
+
+	if ( iPass + 1 < m_params.iPasses )
+	{
+		iOldest = FinalRows( iPass + 1 );
+	}
+
+	return iLast - iOldest < m_iRing;
+}
+
+//---------------------------------------------------------------------------
+//	Run a pass's next row of tiles, after starting the rows it writes from
+//	the heights the pass found them at
+//---------------------------------------------------------------------------
+void CErosion::RunRow( int iPass )
+{
+	int iTileSq = m_pTerrain->TileSize();
+	int iRow = m_piOrder[m_piDone[iPass]];
+	int iLast = iRow + 1 < m_iTilesY ? iRow + 1 : m_iTilesY - 1;
+
+	for ( ; m_piOpened[iPass] <= iLast; m_piOpened[iPass]++ )
+	{
+		int iY0 = m_piOpened[iPass] * m_iTile;
+		int iY1 = iY0 + m_iTile > iTileSq ? iTileSq : iY0 + m_iTile;
+
+		for ( int iY = iY0; iY < iY1; iY++ )
+		{
+			FLOAT* pfRow = Row( iPass + 1, iY );
+
+			if ( iPass > 0 )
+			{
+				memcpy( pfRow, Row( iPass, iY ), sizeof(FLOAT) * iTileSq );
+				continue;
+			}
+
+			for ( int iX = 0; iX < iTileSq; iX++ )
+			{
+				pfRow[iX] = (FLOAT)m_pTerrain->Grid( iX, iY );
+			}
+		}
+	}
+
+	m_iPass = iPass;
+	m_iRow = iRow;
+
+	for ( m_iPhase = 0; m_iPhase < 2; m_iPhase++ )
+	{
+		ParallelFor( ( m_iTilesX - m_iPhase + 1 ) / 2, TileTask, this );
+	}
+
+	m_piDone[iPass]++;
+}
+
+//-----------------------------------------------------------------
+//	Map a phase-local work index back to a tile in the row and
+//	erode it
+//-----------------------------------------------------------------
+void CErosion::TileTask( int iIndex, int iWorker, void* pContext )
+{
+	CErosion* pThis = (CErosion*)pContext;
+
+	int iTileX = pThis->m_iPhase + 2 * iIndex;
+
+	pThis->ErodeTile( iTileX, pThis->m_iRow, pThis->m_iPass, iWorker );
+}
+
+//------------------------------------------------------------------------
+//	Erode one tile on a private copy of it and its halo, then add what
+//	the tile owns of the changes back to the heights
+//------------------------------------------------------------------------
+void CErosion::ErodeTile( int iTileX, int iTileY, int iPass, int iWorker )
+{
+	int iTileSq = m_pTerrain->TileSize();
+	int iHalo = Halo();
+	int iExtent = m_iExtent;
+
+	FLOAT* pfHeights = m_apfScratch[iWorker];
+	FLOAT* pfDelta = pfHeights + iExtent * iExtent;
+	FLOAT* pfOwned = pfDelta + iExtent * iExtent;
+
+	//	Interior and halo-extended bounds, clipped to the grid
+	//------------------------------------------------------------
+	int iX0 = iTileX * m_iTile;
+	int iY0 = iTileY * m_iTile;
+	int iX1 = iX0 + m_iTile > iTileSq ? iTileSq : iX0 + m_iTile;
+	int iY1 = iY0 + m_iTile > iTileSq ? iTileSq : iY0 + m_iTile;
+
+	int iEX0 = iX0 - iHalo < 0 ? 0 : iX0 - iHalo;
+	int iEY0 = iY0 - iHalo < 0 ? 0 : iY0 - iHalo;
+	int iEX1 = iX1 + iHalo > iTileSq ? iTileSq : iX1 + iHalo;
+	int iEY1 = iY1 + iHalo > iTileSq ? iTileSq : iY1 + iHalo;
+
+	int iWidth = iEX1 - iEX0;
+	int iHeight = iEY1 - iEY0;
+	int iCell;
+
+	for ( int iLoadY = 0; iLoadY < iHeight; iLoadY++ )
+	{
+		FLOAT* pfLoad = pfHeights + iLoadY * iWidth;
+
+		if ( iPass > 0 )
+		{
+			memcpy( pfLoad, Row( iPass, iEY0 + iLoadY ) + iEX0, sizeof(FLOAT) * iWidth );
+			continue;
+		}
+
+		for ( int iLoadX = 0; iLoadX < iWidth; iLoadX++ )
+		{
+			pfLoad[iLoadX] = (FLOAT)m_pTerrain->Grid( iEX0 + iLoadX, iEY0 + iLoadY );
+		}
+	}
+
+	memset( pfOwned, 0, sizeof(FLOAT) * iWidth * iHeight );
+
+	Thermal( pfHeights, pfDelta, pfOwned, iWidth, iHeight, iX0 - iEX0, iY0 - iEY0, iX1 - iX0, iY1 - iY0 );
+
+	//	Droplets are all released in the interior, so whatever they change
+	//	is the tile's own
+	//-------------------------------------------------------------------------
+	for ( iCell = 0; iCell < iWidth * iHeight; iCell++ )
+	{
+		pfOwned[iCell] -= pfHeights[iCell];
+	}
+
+	//	Each tile and pass gets its own stream, so results do not depend on
+	//	which thread ran the tile or in what order
+	//-------------------------------------------------------------------------
+	CRandom random( CRandom::Hash( CRandom::Hash( m_params.dwSeed, (DWORD)iPass ), (DWORD)( iTileY * m_iTilesX + iTileX ) ) );
+
+	Hydraulic( pfHeights, iWidth, iHeight, iX0 - iEX0, iY0 - iEY0, iX1 - iX0, iY1 - iY0, random );
+
+	for ( int iStoreY = 0; iStoreY < iHeight; iStoreY++ )
+	{
+		FLOAT* pfStore = Row( iPass + 1, iEY0 + iStoreY ) + iEX0;
+		const FLOAT* pfRowHeights = pfHeights + iStoreY * iWidth;
+		const FLOAT* pfRowOwned = pfOwned + iStoreY * iWidth;
+
+		for ( int iStoreX = 0; iStoreX < iWidth; iStoreX++ )
+		{
+			pfStore[iStoreX] += pfRowOwned[iStoreX] + pfRowHeights[iStoreX];
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+//	Thermal erosion, material slumps from a cell to any lower 4-neighbour
+//	when the drop exceeds the talus
+//
+//	Deltas are gathered before being applied, so each step only propagates
+//	one cell and the halo bounds how far the interior can be influenced.
+//	What leaves the interior's cells is added to pfOwned as well.
+//----------------------------------------------------------------------------
+void CErosion::Thermal( FLOAT* pfHeights, FLOAT* pfDelta, FLOAT* pfOwned, int iWidth, int iHeight, int iInnerX, int iInnerY, int iInnerW, int iInnerH )
+{
+	static const int s_aiNeighbourX[4] = { -1, 1, 0, 0 };
+	static const int s_aiNeighbourY[4] = { 0, 0, -1, 1 };
+
+	FLOAT fTalus = m_params.fTalus;
+	FLOAT fRate = m_params.fThermalRate;
+
+	for ( int iIteration = 0; iIteration < m_params.iThermalIterations; iIteration++ )
+	{
+		memset( pfDelta, 0, sizeof(FLOAT) * iWidth * iHeight );
+
+		for ( int iY = 0; iY < iHeight; iY++ )
+		{
+			for ( int iX = 0; iX < iWidth; iX++ )
+			{
+				FLOAT fCentre = pfHeights[iY * iWidth + iX];
+				FLOAT afDrop[4];
+				FLOAT fMaxDrop = 0.f;
+				FLOAT fTotalDrop = 0.f;
+
+				for ( int iN = 0; iN < 4; iN++ )
+				{
+					int iNX = iX + s_aiNeighbourX[iN];
+					int iNY = iY + s_aiNeighbourY[iN];
+
+					afDrop[iN] = 0.f;
+
+					if ( iNX < 0 || iNX >= iWidth || iNY < 0 || iNY >= iHeight )
+					{
+						continue;
+					}
+
+					FLOAT fDrop = fCentre - pfHeights[iNY * iWidth + iNX];
+
+					if ( fDrop > fTalus )
+					{
+						afDrop[iN] = fDrop;
+						fTotalDrop += fDrop;
+						fMaxDrop = fDrop > fMaxDrop ? fDrop : fMaxDrop;
+					}
+				}
+
+				if ( fTotalDrop <= 0.f )
+				{
+					continue;
+				}
+
+				FLOAT fMoved = fRate * ( fMaxDrop - fTalus );
+				BOOL bOwned = iX >= iInnerX && iX < iInnerX + iInnerW && iY >= iInnerY && iY < iInnerY + iInnerH;
+
+				pfDelta[iY * iWidth + iX] -= fMoved;
+
+				if ( bOwned )
+				{
+					pfOwned[iY * iWidth + iX] -= fMoved;
+				}
+
+				for ( int iShare = 0; iShare < 4; iShare++ )
+				{
+					if ( afDrop[iShare] > 0.f )
+					{
+						int iIDX = ( iY + s_aiNeighbourY[iShare] ) * iWidth + iX + s_aiNeighbourX[iShare];
+						FLOAT fShare = fMoved * afDrop[iShare] / fTotalDrop;
+
+						pfDelta[iIDX] += fShare;
+
+						if ( bOwned )
+						{
+							pfOwned[iIDX] += fShare;
+						}
+					}
+				}
+			}
+		}
+
+		for ( int iCell = 0; iCell < iWidth * iHeight; iCell++ )
+		{
+			pfHeights[iCell] += pfDelta[iCell];
+		}
+	}
+}
+
+//------------------------------------------------------------------
+//	Bilinear height and gradient of the float tile at a position
+//------------------------------------------------------------------
+static void HeightAndGradient( const FLOAT* pfHeights, int iWidth, FLOAT fPosX, FLOAT fPosY, FLOAT* pfHeight, FLOAT* pfGradX, FLOAT* pfGradY )
+{
+	int iNodeX = (int)fPosX;
+	int iNodeY = (int)fPosY;
+	FLOAT fU = fPosX - (FLOAT)iNodeX;
+	FLOAT fV = fPosY - (FLOAT)iNodeY;
+
+	const FLOAT* pfNode = pfHeights + iNodeY * iWidth + iNodeX;
+	FLOAT fNW = pfNode[0];
+	FLOAT fNE = pfNode[1];
+	FLOAT fSW = pfNode[iWidth];
+	FLOAT fSE = pfNode[iWidth + 1];
+
+	*pfGradX = ( fNE - fNW ) * ( 1.f - fV ) + ( fSE - fSW ) * fV;
+	*pfGradY = ( fSW - fNW ) * ( 1.f - fU ) + ( fSE - fNE ) * fU;
+	*pfHeight = fNW * ( 1.f - fU ) * ( 1.f - fV ) + fNE * fU * ( 1.f - fV ) + fSW * ( 1.f - fU ) * fV + fSE * fU * fV;
+}
+
+//----------------------------------------------------------------------------
+//	Hydraulic erosion, droplets are released at random points in the tile
+//	interior and run downhill, picking up sediment where they speed up and
+//	dropping it where they slow or fill a pit
+//
+//	Droplets stop when they would leave the halo-extended tile, or when
+//	their lifetime runs out
+//----------------------------------------------------------------------------
+void CErosion::Hydraulic( FLOAT* pfHeights, int iWidth, int iHeight, int iInnerX, int iInnerY, int iInnerW, int iInnerH, CRandom& random )
+{
+	int iRadius = m_params.iErosionRadius;
+
+	for ( int iDroplet = 0; iDroplet < m_params.iDropletsPerTile; iDroplet++ )
+	{
+		FLOAT fPosX = (FLOAT)iInnerX + random.NextFloat() * (FLOAT)( iInnerW - 1 );
+		FLOAT fPosY = (FLOAT)iInnerY + random.NextFloat() * (FLOAT)( iInnerH - 1 );
+		FLOAT fDirX = 0.f;
+		FLOAT fDirY = 0.f;
+		FLOAT fSpeed = 1.f;
+		FLOAT fWater = 1.f;
+		FLOAT fSediment = 0.f;
+		FLOAT* pfLastNode = NULL;
+
+		for ( int iStep = 0; iStep < m_params.iDropletLifetime; iStep++ )
+		{
+			int iNodeX = (int)fPosX;
+			int iNodeY = (int)fPosY;
+
+			//	The brush must fit inside the extended tile
+			//-------------------------------------------------
+			if ( iNodeX < iRadius || iNodeY < iRadius || iNodeX >= iWidth - iRadius - 1 || iNodeY >= iHeight - iRadius - 1 )
+			{
+				break;
+			}
+
+			FLOAT fU = fPosX - (FLOAT)iNodeX;
+			FLOAT fV = fPosY - (FLOAT)iNodeY;
+			FLOAT fHeight, fGradX, fGradY;
+
+			HeightAndGradient( pfHeights, iWidth, fPosX, fPosY, &fHeight, &fGradX, &fGradY );
+
+			fDirX = fDirX * m_params.fInertia - fGradX * ( 1.f - m_params.fInertia );
+			fDirY = fDirY * m_params.fInertia - fGradY * ( 1.f - m_params.fInertia );
+
+			FLOAT fLen = (FLOAT)sqrt( (double)( fDirX * fDirX + fDirY * fDirY ) );
+
+			if ( fLen <= 0.f )
+			{
+				break;
+			}
+
+			fDirX /= fLen;
+			fDirY /= fLen;
+			fPosX += fDirX;
+			fPosY += fDirY;
+
+			if ( fPosX < 0.f || fPosY < 0.f || fPosX >= (FLOAT)( iWidth - 1 ) || fPosY >= (FLOAT)( iHeight - 1 ) )
+			{
+				break;
+			}
+
+			FLOAT fNewHeight, fNewGradX, fNewGradY;
+
+			HeightAndGradient( pfHeights, iWidth, fPosX, fPosY, &fNewHeight, &fNewGradX, &fNewGradY );
+
+			FLOAT fDeltaHeight = fNewHeight - fHeight;
+			FLOAT fCapacity = -fDeltaHeight * fSpeed * fWater * m_params.fSedimentCapacity;
+
+			fCapacity = fCapacity < m_params.fMinSedimentCapacity ? m_params.fMinSedimentCapacity : fCapacity;
+
+			FLOAT* pfNode = pfHeights + iNodeY * iWidth + iNodeX;
+
+			pfLastNode = pfNode;
+
+			if ( fSediment > fCapacity || fDeltaHeight > 0.f )
+			{
+				//	Moving uphill fills the pit behind, otherwise drop the surplus
+				//--------------------------------------------------------------------
+				FLOAT fDeposit = fDeltaHeight > 0.f
+					? ( fDeltaHeight < fSediment ? fDeltaHeight : fSediment )
+					: ( fSediment - fCapacity ) * m_params.fDepositSpeed;
+
+				fSediment -= fDeposit;
+
+				pfNode[0] += fDeposit * ( 1.f - fU ) * ( 1.f - fV );
+				pfNode[1] += fDeposit * fU * ( 1.f - fV );
+				pfNode[iWidth] += fDeposit * ( 1.f - fU ) * fV;
+				pfNode[iWidth + 1] += fDeposit * fU * fV;
+			}
+			else
+			{
+				//	Never erode more than the drop, or the droplet digs a hole
+				//----------------------------------------------------------------
+				FLOAT fErode = ( fCapacity - fSediment ) * m_params.fErodeSpeed;
+
+				fErode = fErode < -fDeltaHeight ? fErode : -fDeltaHeight;
+
+				for ( int iBrush = 0; iBrush < m_iBrushSize; iBrush++ )
+				{
+					FLOAT* pfCell = pfNode + m_aiBrushY[iBrush] * iWidth + m_aiBrushX[iBrush];
+					FLOAT fWeighted = fErode * m_afBrushWeight[iBrush];
+					FLOAT fTaken = *pfCell < fWeighted ? *pfCell : fWeighted;
+
+					*pfCell -= fTaken;
+					fSediment += fTaken;
+				}
+			}
+
+			FLOAT fSpeedSq = fSpeed * fSpeed - fDeltaHeight * m_params.fGravity;
+
+			fSpeed = (FLOAT)sqrt( (double)( fSpeedSq > 0.f ? fSpeedSq : 0.f ) );
+			fWater *= ( 1.f - m_params.fEvaporateSpeed );
+		}
+
+		//	Drop whatever is still carried, so erosion moves material rather
+		//	than removing it from the tile
+		//----------------------------------------------------------------------
+		if ( pfLastNode != NULL )
+		{
+			*pfLastNode += fSediment;
+		}
+	}
+}
@@ -0,0 +1,153 @@
+/*--------------------------------------------------------------------------------
+
+	Erosion.h
+
+	Provides thermal and droplet based hydraulic erosion of a terrain tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _EROSION_H
+#define _EROSION_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define EROSION_TILE		64		// Minimum interior size of an erosion tile
+#define EROSION_MAX_RADIUS	8		// Largest supported droplet erosion brush
+#define EROSION_RING		8		// Tile rows of floats held per pass in flight
+
+typedef struct tagEROSIONPARAMS
+{
+	DWORD	dwSeed;					// Master seed, every tile and pass derives its own stream
+	int		iPasses;				// Number of thermal + hydraulic passes over the whole tile
+	int		iTileSize;				// Interior size of an erosion tile, 0 for EROSION_TILE
+
+	int		iThermalIterations;		// Thermal relaxation steps per pass
+	FLOAT	fTalus;					// Height difference neighbours may hold without slumping
+	FLOAT	fThermalRate;			// Fraction of the excess moved per step
+
+	int		iDropletsPerTile;		// Droplets released per erosion tile per pass
+	int		iDropletLifetime;		// Maximum steps a droplet takes (one cell per step)
+	int		iErosionRadius;			// Radius of the erosion brush
+	FLOAT	fInertia;				// How much a droplet keeps its previous direction
+	FLOAT	fSedimentCapacity;		// Multiplier for how much sediment a droplet can carry
+	FLOAT	fMinSedimentCapacity;	// Stops capacity falling to 0 on flat ground
+	FLOAT	fErodeSpeed;			// Fraction of free capacity eroded per step
+	FLOAT	fDepositSpeed;			// Fraction of surplus sediment deposited per step
+	FLOAT	fEvaporateSpeed;		// Fraction of water lost per step
+	FLOAT	fGravity;
+} EROSIONPARAMS;
+
+typedef struct tagEROSIONSTATS
+{
+	int		iThreads;
+	int		iTiles;
+	double	dSeconds;
+	double	dCellsPerSecPerCore;	// Grid cells eroded per pass, per second, per thread
+	double	dMassChange;			// Heights summed after the run less before, before rounding
+} EROSIONSTATS;
+
+//---------------------------------------------------------------------------
+//	Erodes a terrain tile in place
+//
+//	Heights are held as floats from the first pass to the last and only
+//	rounded back to the grid at the end, so changes too small to move a
+//	cell in one pass still add up over several.
+//
+//	The tile is split into square tiles, each processed on a private copy
+//	of the heights as the pass found them, extended by a halo wide enough
+//	that everything the tile computes for its own cells is as an untiled
+//	pass would have it. A tile owns the material leaving its interior, by
+//	thermal steps from its cells and by droplets released in it, and adds
+//	what that does anywhere in its extended copy back to the heights, so
+//	material crossing into a neighbour is kept rather than cut off at the
+//	seam. Tiles are run in four interleaved phases, and are at least twice
+//	the halo across, so that no two extended tiles running together
+//	overlap, which keeps the result identical regardless of thread count.
+//
+//	Passes are pipelined a row of tiles at a time rather than run over the
+//	whole grid in turn. A pass works down the rows as soon as the pass
+//	before has finished the rows around them, so each pass only keeps the
+//	float heights of the few rows in flight, in a ring of EROSION_RING tile
+//	rows. Memory use is that ring per pass, and three halo-extended tiles
+//	per thread, however tall the grid.
+//---------------------------------------------------------------------------
+class CErosion
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CErosion();
+	CErosion( const EROSIONPARAMS& params );
+	virtual ~CErosion();
+
+	//------------------------
+	//	CErosion Interface
+	//------------------------
+	EROSIONPARAMS& Params();
+
+	BOOL Erode( CTerrain* pTerrain, EROSIONSTATS* pStats );
+	LPCSTR GetError();
+
+	static void DefaultParams( EROSIONPARAMS* pParams );
+
+private:
+	//	Per-tile work, called from worker threads
+	//-----------------------------------------------
+	static void TileTask( int iIndex, int iWorker, void* pContext );
+
+	BOOL CanRun( int iPass );
+	void RunRow( int iPass );
+	int FinalRows( int iPass );
+	FLOAT* Row( int iLevel, int iY );
+
+	void ErodeTile( int iTileX, int iTileY, int iPass, int iWorker );
+	void Thermal( FLOAT* pfHeights, FLOAT* pfDelta, FLOAT* pfOwned, int iWidth, int iHeight, int iInnerX, int iInnerY, int iInnerW, int iInnerH );
+	void Hydraulic( FLOAT* pfHeights, int iWidth, int iHeight, int iInnerX, int iInnerY, int iInnerW, int iInnerH, CRandom& random );
+
+	void BuildBrush();
+	int Halo();
+
+	EROSIONPARAMS m_params;
+
+	//	Per-run state
+	//-------------------
+	CTerrain* m_pTerrain;
+	int m_iTile;
+	int m_iTilesX;
+	int m_iTilesY;
+	int m_iRing;					// Tile rows in each ring of heights
+	int m_iPass;
+	int m_iRow;
+	int m_iPhase;
+	int m_iExtent;					// Side of a halo-extended tile, clipped to the grid
+	int* m_piOrder;					// Tile rows in the order a pass takes them
+	int* m_piDone;					// Rows of m_piOrder each pass has finished
+	int* m_piOpened;				// Rows of heights each pass has started writing
+	int m_iWritten;					// Rows rounded back to the grid
+	FLOAT** m_ppfLevels;			// Rings of heights after each pass, [0] is the grid
+	FLOAT* m_apfScratch[MAX_WORKERS];
+
+	//	Erosion brush, offsets and normalised weights
+	//---------------------------------------------------
+	int m_iBrushSize;
+	int m_aiBrushX[( 2 * EROSION_MAX_RADIUS + 1 ) * ( 2 * EROSION_MAX_RADIUS + 1 )];
+	int m_aiBrushY[( 2 * EROSION_MAX_RADIUS + 1 ) * ( 2 * EROSION_MAX_RADIUS + 1 )];
+	FLOAT m_afBrushWeight[( 2 * EROSION_MAX_RADIUS + 1 ) * ( 2 * EROSION_MAX_RADIUS + 1 )];
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,869 @@
+/*--------------------------------------------------------------------------------
+
+	FaultKernel.cpp
+
+	Provides the fault line kernel, specialised at compile time for each
+	accumulation mode, cell type and common tile size, and the picking of
+	its faults for each endpoint source
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <string.h>
+
+#include "FaultKernel.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define FAULT_CLAMP		0
+#define FAULT_RETAIN	1
+
+#ifndef FAULT_SIMD
+#define FAULT_SIMD		1		// 0 evaluates profiles with the scalar loop only
+#endif
+
+#if FAULT_SIMD
+#include <emmintrin.h>
+#endif
+
+#define FAULT_CHUNK		64		// Band cells evaluated per batch, a multiple of 4
+
+#define FAULT_LINES		256		// Faults picked ahead, and applied together over bands
+
+class CFaultProfile;
+
+//	Faults for a kernel to apply over some of its outer rows or columns
+//-------------------------------------------------------------------------
+typedef struct tagFAULTAPPLY
+{
+	const FAULTPASS*		pPass;
+	const CFaultProfile*	pProfile;		// Smooth profiles only
+	const FAULTLINE*		pLines;
+	int						iLines;
+} FAULTAPPLY;
+
+//	A kernel instantiation, applying the faults to outer rows (or columns)
+//	[iOuterFirst, iOuterLast) and widening *pdMin, *pdMax by the cells the
+//	pass's last fault leaves when the pass tracks its range
+//----------------------------------------------------------------------------
+typedef void (*PFNFAULTAPPLY)( const FAULTAPPLY& apply, int iOuterFirst, int iOuterLast, double* pdMin, double* pdMax );
+
+//------------------------------------------------------------------------------
+//	The offset a band cell adds, the rounded one for integer cells and the
+//	exact one for floating point cells
+//------------------------------------------------------------------------------
+template <class TCell>
+class CCellDelta
+{
+public:
+	typedef int TDelta;
+
+	static int Get( FLOAT fDelta, int iDelta )
+	{
+		return iDelta;
+	}
+};
+
+template <>
+class CCellDelta<FLOAT>
+{
+public:
+	typedef FLOAT TDelta;
+
+	static FLOAT Get( FLOAT fDelta, int iDelta )
+	{
+		return fDelta;
+	}
+};
+
+template <>
+class CCellDelta<double>
+{
+public:
+	typedef double TDelta;
+
+	static double Get( FLOAT fDelta, int iDelta )
+	{
+		return (double)fDelta;
+	}
+};
+
+//------------------------------------------------------------------------------
+//	Adds over part of a run, shared by the step and profile kernels
+//
+//	Clamped adds keep the old rule, a cell only moves if it stays strictly
+//	inside iMinHeight..iMaxHeight
+//------------------------------------------------------------------------------
+template <class TCell, int MODE>
+class CFaultSpan
+{
+public:
+	static void Step( TCell* pRun, const TCell* pFrom, int iStart, int iEnd, int iDelta, int iMinHeight, int iMaxHeight )
+	{
+		if ( MODE == FAULT_RETAIN )
+		{
+			for ( int iCell = iStart; iCell < iEnd; iCell++ )
+			{
+				pRun[iCell] = (TCell)( pFrom[iCell] + iDelta );
+			}
+		}
+		else if ( iDelta > 0 )
+		{
+			for ( int iCell = iStart; iCell < iEnd; iCell++ )
+			{
+				pRun[iCell] = pRun[iCell] + iDelta < iMaxHeight ? (TCell)( pRun[iCell] + iDelta ) : pRun[iCell];
+			}
+		}
+		else
+		{
+			for ( int iCell = iStart; iCell < iEnd; iCell++ )
+			{
+				pRun[iCell] = pRun[iCell] + iDelta > iMinHeight ? (TCell)( pRun[iCell] + iDelta ) : pRun[iCell];
+			}
+		}
+	}
+
+	static void Band( TCell* pRun, const TCell* pFrom, int iCount, const FLOAT* pfDelta, const int* piDelta, int iMinHeight, int iMaxHeight )
+	{
+		typedef typename CCellDelta<TCell>::TDelta TDelta;
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			TDelta delta = CCellDelta<TCell>::Get( pfDelta[iCell], piDelta[iCell] );
+
+			if ( MODE == FAULT_RETAIN )
+			{
+				pRun[iCell] = (TCell)( pFrom[iCell] + delta );
+			}
+			else if ( delta > 0 )
+			{
+				pRun[iCell] = pRun[iCell] + delta < iMaxHeight ? (TCell)( pRun[iCell] + delta ) : pRun[iCell];
+			}
+			else if ( delta < 0 )
+			{
+				pRun[iCell] = pRun[iCell] + delta > iMinHeight ? (TCell)( pRun[iCell] + delta ) : pRun[iCell];
+			}
+		}
+	}
+};
+
+//------------------------------------------------------------------------------
+//	The fault kernel
+//
+//	Which side of a fault a cell lies on is the sign of the same cross product
+//	CFaultLine::TestPoint takes. Along one of the layout's contiguous runs
+//	(down a column, or across a row or block row) only one of its terms
+//	changes, and float rounding keeps that monotonic, so each run splits into
+//	at most two spans found by binary search. Each span is then a plain add
+//	(retain) or an add guarded by the clamp, with no test of the mode or the
+//	fault in the loop, which the compiler is free to unroll and vectorize.
+//	Runs are visited in memory order, a band of outer rows (or columns) at
+//	a time with the faults outermost, so a band is read into cache once for
+//	all of them. TILESQ is the tile size when known at compile time, or 0 to
+//	take it from the pass.
+//------------------------------------------------------------------------------
+template <class TCell, int MODE, int TILESQ>
+class CFaultKernel
+{
+public:
+	static void Run( const FAULTAPPLY& apply, int iOuterFirst, int iOuterLast, double* pdMin, double* pdMax )
+	{
+		const FAULTPASS& pass = *apply.pPass;
+		const int iTileSq = TILESQ != 0 ? TILESQ : pass.iTileSq;
+		const int iPitch = pass.iPitch;
+		TCell* pCells = (TCell*)pass.pvCells;
+		const TCell* pSource = pass.pvSource != NULL ? (const TCell*)pass.pvSource : pCells;
+		double dMin = *pdMin;
+		double dMax = *pdMax;
+
+		//	Runs go down columns in the column layout, else across rows
+		//------------------------------------------------------------------
+		bool bAlongX = pass.iLayout != GRID_LAYOUT_COLUMN;
+		int iRunLength = CHeightGrid::RunLength( pass.iLayout, iTileSq );
+
+		for ( int iLine = 0; iLine < apply.iLines; iLine++ )
+		{
+			const FAULTLINE& line = apply.pLines[iLine];
+			FLOAT fX1 = line.fX1;
+			FLOAT fY1 = line.fY1;
+			FLOAT fDX = line.fX2 - line.fX1;
+			FLOAT fDY = line.fY2 - line.fY1;
+			int iFaultDepth = line.iDepth;
+
+			bool bTrackRange = MODE == FAULT_RETAIN && pass.pdMin != NULL && line.iIndex == pass.iIterations - 1;
+			const TCell* pFrom = line.iIndex == pass.iFirst ? pSource : pCells;
+
+			//	The cross product term fixed along a run, and the one that varies
+			//-----------------------------------------------------------------------
+			FLOAT fOuter1 = bAlongX ? fY1 : fX1;
+			FLOAT fOuterScale = bAlongX ? fDX : fDY;
+			FLOAT fInner1 = bAlongX ? fX1 : fY1;
+			FLOAT fInnerScale = bAlongX ? fDY : fDX;
+
+			for ( int iOuter = iOuterFirst; iOuter < iOuterLast; iOuter++ )
+			{
+				FLOAT fCrossOuter = ( (FLOAT)iOuter - fOuter1 ) * fOuterScale;
+
+				for ( int iRunStart = 0; iRunStart < iTileSq; iRunStart += iRunLength )
+				{
+					int iOffset = pass.iLayout == GRID_LAYOUT_TILED ? CHeightGrid::LayoutOffset( pass.iLayout, iTileSq, iRunStart, iOuter ) : iOuter * iPitch + iRunStart;
+					TCell* pRun = pCells + iOffset;
+					const TCell* pFromRun = pFrom + iOffset;
+					bool bLeftFirst = IsLeft( fCrossOuter, fInner1, fInnerScale, bAlongX, iRunStart );
+					int iSplit = Split( fCrossOuter, fInner1, fInnerScale, bAlongX, bLeftFirst, iRunStart, iRunStart + iRunLength ) - iRunStart;
+
+					Update( pRun, pFromRun, 0, iSplit, iFaultDepth, bLeftFirst, pass.iMinHeight, pass.iMaxHeight );
+					Update( pRun, pFromRun, iSplit, iRunLength, iFaultDepth, !bLeftFirst, pass.iMinHeight, pass.iMaxHeight );
+
+					if ( bTrackRange )
+					{
+						for ( int iCell = 0; iCell < iRunLength; iCell++ )
+						{
+							double dValue = (double)pRun[iCell];
+
+							dMin = dValue < dMin ? dValue : dMin;
+							dMax = dValue > dMax ? dValue : dMax;
+						}
+					}
+				}
+			}
+		}
+
+		*pdMin = dMin;
+		*pdMax = dMax;
+	}
+
+private:
+	//	The terms are subtracted in the same order whichever way the run
+	//	goes, (x - x1) * dy - (y - y1) * dx, so both agree to the bit
+	//------------------------------------------------------------------------
+	static bool IsLeft( FLOAT fCrossOuter, FLOAT fInner1, FLOAT fInnerScale, bool bAlongX, int iInner )
+	{
+		FLOAT fCrossInner = ( (FLOAT)iInner - fInner1 ) * fInnerScale;
+
+		return bAlongX ? fCrossInner - fCrossOuter < 0.f : fCrossOuter - fCrossInner < 0.f;
+	}
+
+	//	First cell of the run [iStart, iEnd) on the other side from its first
+	//------------------------------------------------------------------------------
+	static int Split( FLOAT fCrossOuter, FLOAT fInner1, FLOAT fInnerScale, bool bAlongX, bool bLeftFirst, int iStart, int iEnd )
+	{
+		int iLow = iStart;
+		int iHigh = iEnd;
+
+		while ( iHigh - iLow > 1 )
+		{
+			int iMid = ( iLow + iHigh ) >> 1;
+
+			if ( IsLeft( fCrossOuter, fInner1, fInnerScale, bAlongX, iMid ) == bLeftFirst )
+			{
+				iLow = iMid;
+			}
+			else
+			{
+				iHigh = iMid;
+			}
+		}
+
+		return iHigh;
+	}
+
+	static void Update( TCell* pRun, const TCell* pFrom, int iStart, int iEnd, int iFaultDepth, bool bLeft, int iMinHeight, int iMaxHeight )
+	{
+		CFaultSpan<TCell, MODE>::Step( pRun, pFrom, iStart, iEnd, bLeft ? iFaultDepth : -iFaultDepth, iMinHeight, iMaxHeight );
+	}
+};
+
+//------------------------------------------------------------------------------
+//	A fault profile, tabulated over t = -1..1 so that each cell costs a
+//	lookup whichever curve is chosen. P(-1) = -1, P(0) = 0 and P(1) = 1.
+//------------------------------------------------------------------------------
+class CFaultProfile
+{
+public:
+	CFaultProfile( int iProfile )
+	{
+		TabulateFaultProfile( iProfile, m_afTable );
+	}
+
+	//	Offsets for iCount cells of a run from iInner on, scaled by fDepth,
+	//	into pfDelta and rounded half away from zero into piDelta. The cross
+	//	product is formed as the step kernel forms it, so a cell gets the same
+	//	t to the bit whichever way its run goes.
+	//---------------------------------------------------------------------------
+	void Evaluate( FLOAT fCrossOuter, FLOAT fInner1, FLOAT fInnerScale, bool bAlongX, int iInner, FLOAT fInvBand, FLOAT fDepth, int iCount, FLOAT* pfDelta, int* piDelta ) const
+	{
+		const FLOAT fScale = (FLOAT)FAULT_LUT_SIZE * 0.5f;
+		int iCell = 0;
+
+#if FAULT_SIMD
+		//	Index arithmetic four lanes at a time, then a scalar gather since
+		//	SSE2 has none
+		//------------------------------------------------------------------------
+		__m128 vCrossOuter = _mm_set1_ps( fCrossOuter );
+		__m128 vInner1 = _mm_set1_ps( fInner1 );
+		__m128 vInnerScale = _mm_set1_ps( fInnerScale );
+		__m128 vNegInvBand = _mm_set1_ps( -fInvBand );
+		__m128 vOne = _mm_set1_ps( 1.f );
+		__m128 vScale = _mm_set1_ps( fScale );
+		__m128 vHalf = _mm_set1_ps( 0.5f );
+		__m128 vSign = _mm_set1_ps( -0.f );
+		__m128 vDepth = _mm_set1_ps( fDepth );
+		__m128i viInner = _mm_add_epi32( _mm_set1_epi32( iInner ), _mm_set_epi32( 3, 2, 1, 0 ) );
+		__m128i viFour = _mm_set1_epi32( 4 );
+		__m128i viZero = _mm_setzero_si128();
+		__m128i viLast = _mm_set1_epi32( FAULT_LUT_SIZE );
+
+		for ( ; iCell + 4 <= iCount; iCell += 4 )
+		{
+			__m128 vCrossInner = _mm_mul_ps( _mm_sub_ps( _mm_cvtepi32_ps( viInner ), vInner1 ), vInnerScale );
+			__m128 vCross = bAlongX ? _mm_sub_ps( vCrossInner, vCrossOuter ) : _mm_sub_ps( vCrossOuter, vCrossInner );
+			__m128 vT = _mm_mul_ps( vCross, vNegInvBand );
+			__m128i viEntry = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( _mm_add_ps( vT, vOne ), vScale ), vHalf ) );
+
+			//	Clamp to the table, SSE2 has no 32 bit min and max
+			//----------------------------------------------------------
+			viEntry = _mm_and_si128( viEntry, _mm_cmpgt_epi32( viEntry, viZero ) );
+			__m128i viOver = _mm_cmpgt_epi32( viEntry, viLast );
+			viEntry = _mm_or_si128( _mm_andnot_si128( viOver, viEntry ), _mm_and_si128( viOver, viLast ) );
+
+			int aiEntry[4];
+
+			_mm_storeu_si128( (__m128i*)aiEntry, viEntry );
+
+			__m128 vValue = _mm_set_ps( m_afTable[aiEntry[3]], m_afTable[aiEntry[2]], m_afTable[aiEntry[1]], m_afTable[aiEntry[0]] );
+			__m128 vDelta = _mm_mul_ps( vValue, vDepth );
+			__m128 vRound = _mm_or_ps( vHalf, _mm_and_ps( vDelta, vSign ) );
+
+			_mm_storeu_ps( pfDelta + iCell, vDelta );
+			_mm_storeu_si128( (__m128i*)( piDelta + iCell ), _mm_cvttps_epi32( _mm_add_ps( vDelta, vRound ) ) );
+
+			viInner = _mm_add_epi32( viInner, viFour );
+		}
+#endif
+
+		for ( ; iCell < iCount; iCell++ )
+		{
+			FLOAT fCrossInner = ( (FLOAT)( iInner + iCell ) - fInner1 ) * fInnerScale;
+			FLOAT fCross = bAlongX ? fCrossInner - fCrossOuter : fCrossOuter - fCrossInner;
+			FLOAT fT = fCross * -fInvBand;
+			int iEntry = (int)( ( fT + 1.f ) * fScale + 0.5f );
+
+			iEntry = iEntry > 0 ? iEntry : 0;
+			iEntry = iEntry < FAULT_LUT_SIZE ? iEntry : FAULT_LUT_SIZE;
+
+			FLOAT fDelta = m_afTable[iEntry] * fDepth;
+
+			pfDelta[iCell] = fDelta;
+			piDelta[iCell] = (int)( fDelta + ( fDelta < 0.f ? -0.5f : 0.5f ) );
+		}
+	}
+
+private:
+	FLOAT m_afTable[FAULT_LUT_SIZE + 1];
+};
+
+//------------------------------------------------------------------------------
+//	The smooth profile kernel
+//
+//	A cell's offset is depth * P(t), t being its signed distance from the
+//	line over the band half width, positive on the side the step kernel
+//	raises. t is linear along a run, so each run has one short band where
+//	|t| < 1, found directly, and saturated spans either side of it that take
+//	the step kernel's plain adds. Only the band is evaluated through the
+//	table, FAULT_CHUNK cells at a time, and as the table is exactly +-1 near
+//	the band's edges the result is the same in every layout. Picks, depth and progress follow the
+//	step kernel fault for fault, so a checkpoint or a seed replays the same
+//	lines whichever profile cuts them.
+//------------------------------------------------------------------------------
+template <class TCell, int MODE>
+class CFaultProfileKernel
+{
+public:
+	static void Run( const FAULTAPPLY& apply, int iOuterFirst, int iOuterLast, double* pdMin, double* pdMax )
+	{
+		const FAULTPASS& pass = *apply.pPass;
+		const int iTileSq = pass.iTileSq;
+		const int iPitch = pass.iPitch;
+		TCell* pCells = (TCell*)pass.pvCells;
+		const TCell* pSource = pass.pvSource != NULL ? (const TCell*)pass.pvSource : pCells;
+		double dMin = *pdMin;
+		double dMax = *pdMax;
+		FLOAT afDelta[FAULT_CHUNK];
+		int aiDelta[FAULT_CHUNK];
+		const CFaultProfile& profile = *apply.pProfile;
+
+		bool bAlongX = pass.iLayout != GRID_LAYOUT_COLUMN;
+		int iRunLength = CHeightGrid::RunLength( pass.iLayout, iTileSq );
+
+		for ( int iLine = 0; iLine < apply.iLines; iLine++ )
+		{
+			const FAULTLINE& line = apply.pLines[iLine];
+			FLOAT fX1 = line.fX1;
+			FLOAT fY1 = line.fY1;
+			FLOAT fDX = line.fX2 - line.fX1;
+			FLOAT fDY = line.fY2 - line.fY1;
+			int iFaultDepth = line.iDepth;
+
+			bool bTrackRange = MODE == FAULT_RETAIN && pass.pdMin != NULL && line.iIndex == pass.iIterations - 1;
+			const TCell* pFrom = line.iIndex == pass.iFirst ? pSource : pCells;
+
+			//	t = -cross / ( length * width ), a line of no length puts every
+			//	cell at t = 0, which moves nothing
+			//-----------------------------------------------------------------------
+			FLOAT fLength = (FLOAT)sqrt( (double)( fDX * fDX + fDY * fDY ) );
+			FLOAT fInvBand = fLength > 0.f ? 1.f / ( fLength * pass.fProfileWidth ) : 0.f;
+			FLOAT fTStep = bAlongX ? -fDY * fInvBand : fDX * fInvBand;
+
+			FLOAT fOuter1 = bAlongX ? fY1 : fX1;
+			FLOAT fOuterScale = bAlongX ? fDX : fDY;
+			FLOAT fInner1 = bAlongX ? fX1 : fY1;
+			FLOAT fInnerScale = bAlongX ? fDY : fDX;
+
+			for ( int iOuter = iOuterFirst; iOuter < iOuterLast; iOuter++ )
+			{
+				FLOAT fCrossOuter = ( (FLOAT)iOuter - fOuter1 ) * fOuterScale;
+
+				for ( int iRunStart = 0; iRunStart < iTileSq; iRunStart += iRunLength )
+				{
+					int iOffset = pass.iLayout == GRID_LAYOUT_TILED ? CHeightGrid::LayoutOffset( pass.iLayout, iTileSq, iRunStart, iOuter ) : iOuter * iPitch + iRunStart;
+					TCell* pRun = pCells + iOffset;
+					const TCell* pFromRun = pFrom + iOffset;
+					FLOAT fXStart = (FLOAT)( bAlongX ? iRunStart : iOuter );
+					FLOAT fYStart = (FLOAT)( bAlongX ? iOuter : iRunStart );
+					FLOAT fT0 = -( ( fXStart - fX1 ) * fDY - ( fYStart - fY1 ) * fDX ) * fInvBand;
+					int iBandStart, iBandEnd;
+
+					FindBand( fT0, fTStep, iRunLength, iBandStart, iBandEnd );
+
+					if ( iBandStart > 0 )
+					{
+						CFaultSpan<TCell, MODE>::Step( pRun, pFromRun, 0, iBandStart, fT0 > 0.f ? iFaultDepth : -iFaultDepth, pass.iMinHeight, pass.iMaxHeight );
+					}
+
+					if ( iBandEnd < iRunLength )
+					{
+						FLOAT fTEnd = fT0 + (FLOAT)iBandEnd * fTStep;
+
+						CFaultSpan<TCell, MODE>::Step( pRun, pFromRun, iBandEnd, iRunLength, fTEnd > 0.f ? iFaultDepth : -iFaultDepth, pass.iMinHeight, pass.iMaxHeight );
+					}
+
+					for ( int iChunk = iBandStart; iChunk < iBandEnd; iChunk += FAULT_CHUNK )
+					{
+						int iCount = iBandEnd - iChunk < FAULT_CHUNK ? iBandEnd - iChunk : FAULT_CHUNK;
+
+						profile.Evaluate( fCrossOuter, fInner1, fInnerScale, bAlongX, iRunStart + iChunk, fInvBand, (FLOAT)iFaultDepth, iCount, afDelta, aiDelta );
+						CFaultSpan<TCell, MODE>::Band( pRun + iChunk, pFromRun + iChunk, iCount, afDelta, aiDelta, pass.iMinHeight, pass.iMaxHeight );
+					}
+
+					if ( bTrackRange )
+					{
+						for ( int iCell = 0; iCell < iRunLength; iCell++ )
+						{
+							double dValue = (double)pRun[iCell];
+
+							dMin = dValue < dMin ? dValue : dMin;
+							dMax = dValue > dMax ? dValue : dMax;
+						}
+					}
+				}
+			}
+		}
+
+		*pdMin = dMin;
+		*pdMax = dMax;
+	}
+
+private:
+	//	Cells [iStart, iEnd) of a run of iLength where |fT0 + i * fTStep| < 1,
+	//	widened by a cell each way so that rounding in fT0 and fTStep never
+	//	leaves a cell short of 1 in a saturated span
+	//------------------------------------------------------------------------------
+	static void FindBand( FLOAT fT0, FLOAT fTStep, int iLength, int& iStart, int& iEnd )
+	{
+		if ( fTStep == 0.f )
+		{
+			iStart = fT0 > -1.f && fT0 < 1.f ? 0 : iLength;
+			iEnd = iLength;
+			return;
+		}
+
+		double dLow = ( -1.0 - (double)fT0 ) / (double)fTStep;
+		double dHigh = ( 1.0 - (double)fT0 ) / (double)fTStep;
+
+		if ( dLow > dHigh )
+		{
+			double dSwap = dLow;
+
+			dLow = dHigh;
+			dHigh = dSwap;
+		}
+
+		dLow = dLow > 0.0 ? dLow : 0.0;
+		dHigh = dHigh < (double)iLength ? dHigh : (double)iLength;
+
+		iStart = dLow < (double)iLength ? (int)dLow - 1 : iLength;
+		iStart = iStart > 0 ? iStart : 0;
+		iEnd = dHigh > 0.0 ? (int)dHigh + 2 : 0;
+		iEnd = iEnd < iLength ? iEnd : iLength;
+		iEnd = iEnd > iStart ? iEnd : iStart;
+	}
+};
+
+//------------------------------------------------------------------------
+//	Dispatch, chooses the instantiation once per pass
+//
+//	Class templates rather than function templates, since VC6 does not
+//	tell apart function templates that differ only in explicit arguments
+//------------------------------------------------------------------------
+template <class TCell, int MODE>
+class CFaultSizeDispatch
+{
+public:
+	static PFNFAULTAPPLY Select( const FAULTPASS& pass )
+	{
+		if ( pass.iProfile != FAULT_PROFILE_STEP )
+		{
+			return CFaultProfileKernel<TCell, MODE>::Run;
+		}
+
+		switch ( pass.iTileSq )
+		{
+			case 256:	return CFaultKernel<TCell, MODE, 256>::Run;
+			case 512:	return CFaultKernel<TCell, MODE, 512>::Run;
+			case 1024:	return CFaultKernel<TCell, MODE, 1024>::Run;
+			case 2048:	return CFaultKernel<TCell, MODE, 2048>::Run;
+			case 4096:	return CFaultKernel<TCell, MODE, 4096>::Run;
+		}
+
+		return CFaultKernel<TCell, MODE, 0>::Run;
+	}
+};
+
+template <class TCell>
+class CFaultCellDispatch
+{
+public:
+	static PFNFAULTAPPLY Select( const FAULTPASS& pass )
+	{
+		if ( pass.bRetain )
+		{
+			return CFaultSizeDispatch<TCell, FAULT_RETAIN>::Select( pass );
+		}
+
+		return CFaultSizeDispatch<TCell, FAULT_CLAMP>::Select( pass );
+	}
+};
+
+//-------------------------------------------------------------
+//	Endpoint sources, matching CTerrain::PickPoint for each
+//-------------------------------------------------------------
+class CRandomPicker
+{
+public:
+	CRandomPicker( CRandom* pRandom, int iPickSq ) : m_pRandom( pRandom ), m_iPickSq( iPickSq ) {}
+
+	FLOAT Pick()
+	{
+		return (FLOAT)( m_pRandom->Next() % m_iPickSq );
+	}
+
+private:
+	CRandom* m_pRandom;
+	int m_iPickSq;
+};
+
+class CLogisticPicker
+{
+public:
+	CLogisticPicker( CLogFunc* pLogFunc, int iPickSq ) : m_pLogFunc( pLogFunc ), m_fScale( (FLOAT)iPickSq - 1.f ) {}
+
+	FLOAT Pick()
+	{
+		return m_pLogFunc->Iterate() * m_fScale;
+	}
+
+private:
+	CLogFunc* m_pLogFunc;
+	FLOAT m_fScale;
+};
+
+//------------------------------------------------------------------------
+//	PickFaultLines for one endpoint source, with no test of the source
+//	in the loop
+//------------------------------------------------------------------------
+template <class TPicker>
+void PickLines( const FAULTPASS& pass, int iFirst, int iCount, FAULTLINE* pLines, TPicker& picker )
+{
+	FLOAT afPoints[4];
+	FLOAT fSample = 1.f / (FLOAT)pass.iSample;
+
+	for ( int iLine = 0; iLine < iCount; iLine++ )
+	{
+		int iFaultIDX = iFirst + iLine;
+
+		for ( int iPoint = 0; iPoint < 4; iPoint++ )
+		{
+			afPoints[iPoint] = picker.Pick();
+		}
+
+		pLines[iLine].fX1 = afPoints[0] * fSample;
+		pLines[iLine].fY1 = afPoints[1] * fSample;
+		pLines[iLine].fX2 = afPoints[2] * fSample;
+		pLines[iLine].fY2 = afPoints[3] * fSample;
+		pLines[iLine].iDepth = FaultDepth( iFaultIDX, pass.iIterations, pass.iDepthInit, pass.iDepthEnd, pass.iFixedFaultDepth );
+		pLines[iLine].iIndex = iFaultIDX;
+	}
+}
+
+//------------------------------------------------------------------------
+//	Pick iCount faults from iFirst on, each from four endpoint draws in
+//	the order CTerrain::PickPoint has always made them, over the tile a
+//	preview samples
+//------------------------------------------------------------------------
+void PickFaultLines( const FAULTPASS& pass, int iFirst, int iCount, FAULTLINE* pLines )
+{
+	TRACE_SPAN( "fault pick" );
+
+	int iPickSq = pass.iTileSq * pass.iSample;
+
+	if ( pass.bLogistic )
+	{
+		CLogisticPicker picker( pass.pLogFunc, iPickSq );
+
+		PickLines( pass, iFirst, iCount, pLines, picker );
+	}
+	else
+	{
+		CRandomPicker picker( pass.pRandom, iPickSq );
+
+		PickLines( pass, iFirst, iCount, pLines, picker );
+	}
+}
+
+//------------------------------------------------------------------------
+//	The depth fault iFaultIDX of an iIterations long run is cut to.
+//	Negating the three depths gives the fault that takes it back out.
+//------------------------------------------------------------------------
+int FaultDepth( int iFaultIDX, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth )
+{
+	if ( iFixedFaultDepth != 0 )
+	{
+		return iFixedFaultDepth;
+	}
+
+	return iDepthInit + ( (int)( (FLOAT)iFaultIDX / (FLOAT)iIterations ) * ( iDepthEnd - iDepthInit ) );
+}
+
+//------------------------------------------------------------------------
+//	A FAULTPROFILE's curve at FAULT_LUT_SIZE + 1 points over t = -1..1
+//------------------------------------------------------------------------
+void TabulateFaultProfile( int iProfile, FLOAT* pfTable )
+{
+	for ( int iEntry = 0; iEntry <= FAULT_LUT_SIZE; iEntry++ )
+	{
+		double dT = 2.0 * (double)iEntry / (double)FAULT_LUT_SIZE - 1.0;
+		double dValue = dT;
+
+		switch ( iProfile )
+		{
+			case FAULT_PROFILE_COSINE:	dValue = -cos( FAULT_PI * ( dT + 1.0 ) * 0.5 );		break;
+			case FAULT_PROFILE_SIGMOID:	dValue = tanh( FAULT_SIGMOID * dT ) / tanh( FAULT_SIGMOID );	break;
+		}
+
+		pfTable[iEntry] = (FLOAT)dValue;
+	}
+
+	pfTable[0] = -1.f;
+	pfTable[FAULT_LUT_SIZE / 2] = 0.f;
+	pfTable[FAULT_LUT_SIZE] = 1.f;
+}
+
+//	Bytes in one cell of a FAULTCELL type
+//----------------------------------------------
+int FaultCellSize( int iCellType )
+{
+	switch ( iCellType )
+	{
+		case FAULT_CELL_U16:	return sizeof(WORD);
+		case FAULT_CELL_I32:	return sizeof(INT);
+		case FAULT_CELL_F32:	return sizeof(FLOAT);
+		case FAULT_CELL_F64:	return sizeof(double);
+	}
+
+	return sizeof(BYTE);
+}
+
+static void ReportProgress( const FAULTPASS& pass, int iFaultIDX )
+{
+	int iProgress = (int)(((FLOAT)iFaultIDX / (FLOAT)pass.iIterations) * 100.f);
+
+	SendMessage( GetDlgItem( pass.hWnd, IDC_PROGRESS ), WM_USER+2, (WPARAM)iProgress, 0 );
+}
+
+//	Faults applied over a grid's bands, see CHeightGrid::ForBands
+//-------------------------------------------------------------------
+typedef struct tagFAULTJOB
+{
+	const FAULTAPPLY*	pApply;
+	PFNFAULTAPPLY		pfnApply;
+	int					iBandWidth;
+	double				adMin[MAX_WORKERS];
+	double				adMax[MAX_WORKERS];
+} FAULTJOB;
+
+static void FaultBandTask( int iIndex, int iWorker, void* pContext )
+{
+	FAULTJOB* pJob = (FAULTJOB*)pContext;
+	int iTileSq = pJob->pApply->pPass->iTileSq;
+	int iOuterFirst = iIndex * pJob->iBandWidth;
+	int iOuterLast = iOuterFirst + pJob->iBandWidth < iTileSq ? iOuterFirst + pJob->iBandWidth : iTileSq;
+
+	pJob->pfnApply( *pJob->pApply, iOuterFirst, iOuterLast, &pJob->adMin[iWorker], &pJob->adMax[iWorker] );
+}
+
+//--------------------------------------------------------------------------
+//	Run a pass of faults with the kernel specialised for it
+//
+//	A pass with pvSource reads it for the first fault and leaves it alone.
+//	Faults are picked FAULT_LINES at a time. On a small grid each is then
+//	applied to the whole grid in turn. On a larger one (CHeightGrid::
+//	Parallel) the scheduler's workers apply the lot a band at a time, the
+//	owners of the bands on a grid big enough to have them, and progress
+//	moves a chunk at a time. Every cell sees the faults in the same order
+//	either way, so the results match.
+//--------------------------------------------------------------------------
+void ApplyFaultPass( const FAULTPASS& pass )
+{
+	TRACE_SPAN( "faults" );
+
+	PFNFAULTAPPLY pfnApply = NULL;
+
+	switch ( pass.iCellType )
+	{
+		case FAULT_CELL_U8:		pfnApply = CFaultCellDispatch<BYTE>::Select( pass );	break;
+		case FAULT_CELL_U16:	pfnApply = CFaultCellDispatch<WORD>::Select( pass );	break;
+		case FAULT_CELL_I32:	pfnApply = CFaultCellDispatch<INT>::Select( pass );		break;
+		case FAULT_CELL_F32:	pfnApply = CFaultCellDispatch<FLOAT>::Select( pass );	break;
+		case FAULT_CELL_F64:	pfnApply = CFaultCellDispatch<double>::Select( pass );	break;
+	}
+
+	if ( pfnApply == NULL )
+	{
+		return;
+	}
+
+	int iTileSq = pass.iTileSq;
+	BOOL bParallel = CHeightGrid::Parallel( iTileSq );
+	double dMin = 65536;
+	double dMax = -65536;
+	FAULTLINE aLines[FAULT_LINES];
+	CFaultProfile profile( pass.iProfile );
+	FAULTAPPLY apply;
+	FAULTJOB job;
+	int iWorker;
+
+	apply.pPass = &pass;
+	apply.pProfile = &profile;
+
+	job.pApply = &apply;
+	job.pfnApply = pfnApply;
+	job.iBandWidth = CHeightGrid::BandWidth( pass.iLayout );
+
+	for ( iWorker = 0; iWorker < MAX_WORKERS; iWorker++ )
+	{
+		job.adMin[iWorker] = dMin;
+		job.adMax[iWorker] = dMax;
+	}
+
+	for ( int iChunk = pass.iFirst; iChunk < pass.iLast; iChunk += FAULT_LINES )
+	{
+		int iLines = pass.iLast - iChunk < FAULT_LINES ? pass.iLast - iChunk : FAULT_LINES;
+
+		PickFaultLines( pass, iChunk, iLines, aLines );
+
+		if ( bParallel )
+		{
+			TRACE_SPAN( "fault apply" );
+			TRACE_CELLS( (ULONGLONG)iTileSq * iTileSq * iLines );
+			TRACE_BYTES( (ULONGLONG)iTileSq * iTileSq * FaultCellSize( pass.iCellType ) );
+
+			apply.pLines = aLines;
+			apply.iLines = iLines;
+
+			CHeightGrid::ForBands( pass.iLayout, iTileSq, FaultBandTask, &job );
+			ReportProgress( pass, iChunk + iLines - 1 );
+			continue;
+		}
+
+		for ( int iLine = 0; iLine < iLines; iLine++ )
+		{
+			{
+				TRACE_SPAN( "fault apply" );
+				TRACE_CELLS( (ULONGLONG)iTileSq * iTileSq );
+				TRACE_BYTES( (ULONGLONG)iTileSq * iTileSq * FaultCellSize( pass.iCellType ) );
+
+				apply.pLines = aLines + iLine;
+				apply.iLines = 1;
+
+				pfnApply( apply, 0, iTileSq, &dMin, &dMax );
+			}
+
+			ReportProgress( pass, iChunk + iLine );
+		}
+	}
+
+	for ( iWorker = 0; iWorker < MAX_WORKERS; iWorker++ )
+	{
+		dMin = job.adMin[iWorker] < dMin ? job.adMin[iWorker] : dMin;
+		dMax = job.adMax[iWorker] > dMax ? job.adMax[iWorker] : dMax;
+	}
+
+	if ( pass.pdMin != NULL && pass.pdMax != NULL )
+	{
+		*pass.pdMin = dMin;
+		*pass.pdMax = dMax;
+	}
+}
+
+//------------------------------------------------------------------------
+//	Draw the endpoints of the pass's faults and throw them away, leaving
+//	its generator or logistic function where ApplyFaultPass would
+//------------------------------------------------------------------------
+void SkipFaultPass( const FAULTPASS& pass )
+{
+	FAULTLINE aLines[FAULT_LINES];
+
+	for ( int iChunk = pass.iFirst; iChunk < pass.iLast; iChunk += FAULT_LINES )
+	{
+		PickFaultLines( pass, iChunk, pass.iLast - iChunk < FAULT_LINES ? pass.iLast - iChunk : FAULT_LINES, aLines );
+	}
+}
+
+//------------------------------------------------------------------------
+//	FAULTPROFILE by name, as scripts and the command line give it, or -1
+//------------------------------------------------------------------------
+int ParseFaultProfile( LPCSTR szName )
+{
+	static const LPCSTR s_aszNames[] = { "step", "linear", "cosine", "sigmoid" };
+
+	for ( int iProfile = 0; iProfile < (int)( sizeof(s_aszNames) / sizeof(s_aszNames[0]) ); iProfile++ )
+	{
+		if ( strcmp( szName, s_aszNames[iProfile] ) == 0 )
+		{
+			return iProfile;
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,111 @@
+/*--------------------------------------------------------------------------------
+
+	FaultKernel.h
+
+	Provides the fault line kernel, specialised at compile time for each
+	accumulation mode, cell type and common tile size, and the picking of
+	its faults for each endpoint source
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _FAULTKERNEL_H
+#define _FAULTKERNEL_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+enum FAULTCELL
+{
+	FAULT_CELL_U8,
+	FAULT_CELL_U16,
+	FAULT_CELL_I32,
+	FAULT_CELL_F32,
+	FAULT_CELL_F64
+};
+
+//	How a fault's offset varies with signed distance from the line. Step is
+//	the classic hard cliff, the rest go from -depth to +depth across a band
+//	fProfileWidth cells either side of the line.
+//--------------------------------------------------------------------------
+enum FAULTPROFILE
+{
+	FAULT_PROFILE_STEP,
+	FAULT_PROFILE_LINEAR,
+	FAULT_PROFILE_COSINE,
+	FAULT_PROFILE_SIGMOID
+};
+
+#define FAULT_PROFILE_WIDTH		8.f		// Default band half width, in cells
+#define FAULT_LUT_SIZE			1024	// Profile table intervals over [-1, 1]
+#define FAULT_PI				3.14159265358979323846
+#define FAULT_SIGMOID			3.0		// Steepness, tanh( 3t ) is within 1% of its limit at the band edge
+
+//	One run of faults [iFirst, iLast) out of iIterations, over iTileSq^2
+//	cells stored in iLayout (GRIDLAYOUT). Retained grids are always
+//	GRID_LAYOUT_COLUMN, [x * iTileSq + y]. A row or column layout may be
+//	padded, iPitch cells apart, as a caller's raster is. A preview grid
+//	samples every iSample'th cell of a tile iSample times the size, its
+//	faults picked over the whole tile and shrunk onto the grid.
+//--------------------------------------------------------------------------
+typedef struct tagFAULTPASS
+{
+	void*		pvCells;
+	const void*	pvSource;			// Retain: cells before iFirst if not pvCells, else NULL
+	int			iCellType;			// FAULTCELL
+	int			iLayout;			// GRIDLAYOUT, pvSource shares it
+	BOOL		bRetain;			// Accumulate unclamped, else clamp to iMinHeight..iMaxHeight
+	BOOL		bLogistic;			// Endpoints from pLogFunc, else from pRandom
+	int			iProfile;			// FAULTPROFILE
+	FLOAT		fProfileWidth;		// Band half width for a smooth profile, in cells
+	int			iTileSq;
+	int			iPitch;				// Cells from one column (or row) to the next, iTileSq if tiled
+	int			iSample;			// Tile cells per grid cell along each axis, 1 but for a preview
+	int			iFirst;
+	int			iLast;
+	int			iIterations;
+	int			iDepthInit;
+	int			iDepthEnd;
+	int			iFixedFaultDepth;
+	int			iMinHeight;
+	int			iMaxHeight;
+	CRandom*	pRandom;
+	CLogFunc*	pLogFunc;
+	HWND		hWnd;				// Receives progress, may be NULL
+	double*		pdMin;				// Retain: if not NULL, receive the range after
+	double*		pdMax;				// the run's last fault
+} FAULTPASS;
+
+//	One fault's line and depth, picked ahead of applying it
+//-------------------------------------------------------------
+typedef struct tagFAULTLINE
+{
+	FLOAT	fX1;
+	FLOAT	fY1;
+	FLOAT	fX2;
+	FLOAT	fY2;
+	int		iDepth;
+	int		iIndex;				// Fault number in [0, iIterations)
+} FAULTLINE;
+
+//-----------------
+//	Functions
+//-----------------
+void ApplyFaultPass( const FAULTPASS& pass );
+void SkipFaultPass( const FAULTPASS& pass );
+void PickFaultLines( const FAULTPASS& pass, int iFirst, int iCount, FAULTLINE* pLines );
+void TabulateFaultProfile( int iProfile, FLOAT* pfTable );
+int FaultDepth( int iFaultIDX, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth );
+int FaultCellSize( int iCellType );
+int ParseFaultProfile( LPCSTR szName );
+
+#endif
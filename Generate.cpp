@@ -0,0 +1,865 @@
+/*--------------------------------------------------------------------------------
+
+	Generate.cpp
+
+	Provides fault line generation on a background thread, publishing
+	snapshots of the tile as it goes and able to pause, resume and cancel
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <process.h>
+#include <string.h>
+
+#include "Generate.h"
+#include "Arena.h"
+#include "FaultKernel.h"
+#include "Quantize.h"
+#include "ResultCache.h"
+#include "Trace.h"
+
+extern CLogFunc g_LogFunc;
+
+//--------------------------------------------
+//
+//	CLASS: CGenerationTask implementation
+//
+//--------------------------------------------
+CGenerationTask::CGenerationTask()
+{
+	m_hThread = NULL;
+	m_lState = GENERATE_IDLE;
+	m_lCancel = 0;
+
+	m_pTerrain = NULL;
+	m_iSnapshotFaults = GENERATE_SNAPSHOT_FAULTS;
+	m_hNotify = NULL;
+
+	m_pbFront = NULL;
+	m_pbBack = NULL;
+	m_iCells = 0;
+	m_iFaultsDone = 0;
+	m_iFrontScale = 1;
+	m_bPreview = FALSE;
+
+	m_bSession = FALSE;
+	m_pbStart = NULL;
+	m_pdAccumulator = NULL;
+	m_dwStartState = 0;
+	m_iMinHeight = m_iMaxHeight = 0;
+	m_ullTileHash = 0;
+
+	m_bSeed = FALSE;
+	m_bReplay = FALSE;
+	m_iRemoveFirst = m_iRemoveLast = 0;
+	m_iScaleNew = m_iScaleOld = 0;
+	m_iFaultsApplied = 0;
+	m_szError[0] = 0;
+
+	memset( &m_run, 0, sizeof(m_run) );
+	memset( &m_applied, 0, sizeof(m_applied) );
+	memset( &m_cursor, 0, sizeof(m_cursor) );
+
+	InitializeCriticalSection( &m_cs );
+
+	m_hResume = CreateEvent( NULL, TRUE, TRUE, NULL );
+}
+
+CGenerationTask::~CGenerationTask()
+{
+	Cancel();
+	Wait( INFINITE );
+
+	if ( m_hThread != NULL )
+	{
+		CloseHandle( m_hThread );
+	}
+
+	CloseHandle( m_hResume );
+
+	DeleteCriticalSection( &m_cs );
+
+	delete [] m_pbFront;
+	delete [] m_pbBack;
+	delete [] m_pbStart;
+	delete [] m_pdAccumulator;
+}
+
+//------------------------------------------------------------------------------
+//	Start a run on pTerrain's tile, from the cells it holds now, and a
+//	session for Tune to carry on
+//
+//	run					-	The faults, as a checkpoint describes them. The
+//							logistic function starts from fLogSeed.
+//	iSnapshotFaults		-	Faults between snapshots, 0 for the default
+//	hNotify				-	If not NULL, is posted WM_GENERATE_SNAPSHOT and
+//							WM_GENERATE_FINISHED
+//
+//	Returns FALSE if a run is already going, there is not the memory for
+//	its snapshots or the thread could not start
+//------------------------------------------------------------------------------
+BOOL CGenerationTask::Start( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify )
+{
+	if ( Busy() )
+	{
+		sprintf( m_szError, "A fault line run is already going" );
+		return FALSE;
+	}
+
+	m_bSeed = TRUE;
+	m_bReplay = TRUE;
+	m_iRemoveFirst = m_iRemoveLast = 0;
+	m_iScaleNew = m_iScaleOld = 0;
+
+	return Launch( pTerrain, run, iSnapshotFaults, hNotify );
+}
+
+//------------------------------------------------------------------------------
+//	Change the session's run to run, doing only the faults that differ
+//
+//	The faults keep the session's logistic seed, whatever run.fLogSeed
+//	says, so they are the same stream. With no session, or a tile changed
+//	since, this is Start.
+//------------------------------------------------------------------------------
+BOOL CGenerationTask::Tune( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify )
+{
+	if ( Busy() )
+	{
+		sprintf( m_szError, "A fault line run is already going" );
+		return FALSE;
+	}
+
+	if ( !m_bSession || !TileUnchanged( pTerrain ) )
+	{
+		return Start( pTerrain, run, iSnapshotFaults, hNotify );
+	}
+
+	FAULTRUN tuned = run;
+
+	tuned.fLogSeed = m_applied.fLogSeed;
+
+	Plan( tuned );
+
+	return Launch( pTerrain, tuned, iSnapshotFaults, hNotify );
+}
+
+//------------------------------------------------------------------------------
+//	Start the thread on the plan made by Start or Tune
+//------------------------------------------------------------------------------
+BOOL CGenerationTask::Launch( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify )
+{
+	//	A finished thread may still be on its way out
+	//---------------------------------------------------
+	if ( m_hThread != NULL )
+	{
+		WaitForSingleObject( m_hThread, INFINITE );
+		CloseHandle( m_hThread );
+		m_hThread = NULL;
+	}
+
+	int iCells = pTerrain->TileSize() * pTerrain->TileSize();
+
+	if ( iCells != m_iCells )
+	{
+		delete [] m_pbFront;
+		delete [] m_pbBack;
+		delete [] m_pbStart;
+		delete [] m_pdAccumulator;
+
+		m_pbFront = new BYTE[iCells];
+		m_pbBack = new BYTE[iCells];
+		m_pbStart = new BYTE[iCells];
+		m_pdAccumulator = NULL;
+		m_iCells = iCells;
+	}
+
+	if ( run.bRetainAllValues && m_pdAccumulator == NULL )
+	{
+		m_pdAccumulator = new double[iCells];
+	}
+
+	//	Without every buffer there is no session left to tune either
+	//-------------------------------------------------------------------
+	if ( m_pbFront == NULL || m_pbBack == NULL || m_pbStart == NULL || ( run.bRetainAllValues && m_pdAccumulator == NULL ) )
+	{
+		delete [] m_pbFront;
+		delete [] m_pbBack;
+		delete [] m_pbStart;
+		delete [] m_pdAccumulator;
+
+		m_pbFront = NULL;
+		m_pbBack = NULL;
+		m_pbStart = NULL;
+		m_pdAccumulator = NULL;
+		m_iCells = 0;
+		m_bSession = FALSE;
+
+		sprintf( m_szError, "Out of memory for a fault line run on a %d cell tile", pTerrain->TileSize() );
+		return FALSE;
+	}
+
+	m_pTerrain = pTerrain;
+	m_run = run;
+	m_iSnapshotFaults = iSnapshotFaults > 0 ? iSnapshotFaults : GENERATE_SNAPSHOT_FAULTS;
+	m_hNotify = hNotify;
+	m_iMinHeight = pTerrain->MinHeight();
+	m_iMaxHeight = pTerrain->MaxHeight();
+
+	//	The first snapshot is the tile the run starts from, taken while
+	//	the tile is still the caller's
+	//---------------------------------------------------------------------
+	if ( m_bSeed )
+	{
+		pTerrain->HeightGrid().ToColumns( m_pbStart );
+		m_bSession = TRUE;
+	}
+
+	if ( m_bReplay )
+	{
+		memcpy( m_pbFront, m_pbStart, iCells );
+		m_iFaultsDone = 0;
+	}
+	else
+	{
+		pTerrain->HeightGrid().ToColumns( m_pbFront );
+		m_iFaultsDone = m_cursor.iNextFault;
+	}
+
+	m_iFrontScale = 1;
+
+	m_lCancel = 0;
+	m_lState = GENERATE_RUNNING;
+	SetEvent( m_hResume );
+
+	m_hThread = (HANDLE)_beginthreadex( NULL, 0, ThreadProc, this, 0, NULL );
+
+	if ( m_hThread == NULL )
+	{
+		m_lState = GENERATE_IDLE;
+		m_bSession = FALSE;
+
+		sprintf( m_szError, "Unable to start the fault line thread" );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Work out how little of the session has to change for run
+//
+//	Faults [0, kept) are the ones both runs share. Those past it that were
+//	applied are taken out, and those past it that weren't are added by the
+//	chunk loop. The kept faults are left, or scaled if their depths all
+//	change by one ratio. Anything else is a replay.
+//------------------------------------------------------------------------------
+void CGenerationTask::Plan( const FAULTRUN& run )
+{
+	int iApplied = m_cursor.iNextFault;
+	int iKept = run.iIterations < iApplied ? run.iIterations : iApplied;
+	int iScaleNew = 0;
+	int iScaleOld = 0;
+	BOOL bRetain = run.bRetainAllValues;
+
+	m_bSeed = FALSE;
+	m_bReplay = TRUE;
+	m_iRemoveFirst = m_iRemoveLast = 0;
+	m_iScaleNew = m_iScaleOld = 0;
+
+	if ( bRetain != m_applied.bRetainAllValues || run.bUseLogisticFunc != m_applied.bUseLogisticFunc || run.fLogM != m_applied.fLogM ||
+		 run.iProfile != m_applied.iProfile || run.fProfileWidth != m_applied.fProfileWidth )
+	{
+		return;
+	}
+
+	//	A clamped tile clamped to other heights is a different tile
+	//-----------------------------------------------------------------
+	if ( !bRetain && ( m_pTerrain->MinHeight() != m_iMinHeight || m_pTerrain->MaxHeight() != m_iMaxHeight ) )
+	{
+		return;
+	}
+
+	for ( int iFault = 0; iFault < iKept; iFault++ )
+	{
+		int iOld = FaultDepth( iFault, m_applied.iIterations, m_applied.iDepthInit, m_applied.iDepthEnd, m_applied.iFixedFaultDepth );
+		int iNew = FaultDepth( iFault, run.iIterations, run.iDepthInit, run.iDepthEnd, run.iFixedFaultDepth );
+
+		if ( iOld == 0 )
+		{
+			if ( iNew != 0 )
+			{
+				return;
+			}
+		}
+		else if ( iScaleOld == 0 )
+		{
+			iScaleNew = iNew;
+			iScaleOld = iOld;
+		}
+		else if ( iNew * iScaleOld != iOld * iScaleNew )
+		{
+			return;
+		}
+	}
+
+	if ( iScaleNew == iScaleOld )
+	{
+		iScaleNew = iScaleOld = 0;
+	}
+
+	//	Only a retained run's heights can have faults taken out or scaled,
+	//	and only a step's whole offsets come back out, or scale, exactly.
+	//	A smooth profile's would leave the heights a rounding off a replay.
+	//-------------------------------------------------------------------------
+	if ( ( !bRetain || run.iProfile != FAULT_PROFILE_STEP ) && ( iKept < iApplied || iScaleOld != 0 ) )
+	{
+		return;
+	}
+
+	m_bReplay = FALSE;
+	m_iRemoveFirst = iKept;
+	m_iRemoveLast = iApplied;
+	m_iScaleNew = iScaleNew;
+	m_iScaleOld = iScaleOld;
+}
+
+//------------------------------------------------------------------------------
+//	Whether the tile is as the session left it, so the session still
+//	describes it
+//------------------------------------------------------------------------------
+BOOL CGenerationTask::TileUnchanged( CTerrain* pTerrain )
+{
+	if ( pTerrain != m_pTerrain || pTerrain->TileSize() * pTerrain->TileSize() != m_iCells )
+	{
+		return FALSE;
+	}
+
+	return CResultCache::Hash( 0, pTerrain->HeightGrid().Cells(), m_iCells ) == m_ullTileHash;
+}
+
+//------------------------------------------------------------------
+//	Hold the run at the next snapshot, until Resume or Cancel
+//------------------------------------------------------------------
+void CGenerationTask::Pause()
+{
+	EnterCriticalSection( &m_cs );
+
+	if ( m_lState == GENERATE_RUNNING && m_lCancel == 0 )
+	{
+		m_lState = GENERATE_PAUSED;
+		ResetEvent( m_hResume );
+	}
+
+	LeaveCriticalSection( &m_cs );
+}
+
+void CGenerationTask::Resume()
+{
+	EnterCriticalSection( &m_cs );
+
+	if ( m_lState == GENERATE_PAUSED )
+	{
+		m_lState = GENERATE_RUNNING;
+		SetEvent( m_hResume );
+	}
+
+	LeaveCriticalSection( &m_cs );
+}
+
+//------------------------------------------------------------------
+//	Stop the run at the next snapshot, paused or not. The tile is
+//	left as that snapshot.
+//------------------------------------------------------------------
+void CGenerationTask::Cancel()
+{
+	EnterCriticalSection( &m_cs );
+
+	m_lCancel = 1;
+	SetEvent( m_hResume );
+
+	LeaveCriticalSection( &m_cs );
+}
+
+//------------------------------------------------------------------
+//	Wait for the thread to finish, TRUE if it has or never started
+//------------------------------------------------------------------
+BOOL CGenerationTask::Wait( DWORD dwMilliseconds )
+{
+	if ( m_hThread == NULL )
+	{
+		return TRUE;
+	}
+
+	return WaitForSingleObject( m_hThread, dwMilliseconds ) == WAIT_OBJECT_0;
+}
+
+//	A GENERATESTATE
+//---------------------
+int CGenerationTask::State()
+{
+	return (int)m_lState;
+}
+
+//--------------------------------------------------------------
+//	Whether the thread owns the tile, running or paused
+//--------------------------------------------------------------
+BOOL CGenerationTask::Busy()
+{
+	int iState = State();
+
+	return iState == GENERATE_RUNNING || iState == GENERATE_PAUSED;
+}
+
+int CGenerationTask::FaultsDone()
+{
+	EnterCriticalSection( &m_cs );
+	int iFaultsDone = m_iFaultsDone;
+	LeaveCriticalSection( &m_cs );
+
+	return iFaultsDone;
+}
+
+int CGenerationTask::Iterations()
+{
+	return m_run.iIterations;
+}
+
+//------------------------------------------------------------------
+//	Faults the last run cut or took out, all of them unless it was
+//	tuned. Only meaningful once it has finished.
+//------------------------------------------------------------------
+int CGenerationTask::FaultsApplied()
+{
+	return m_iFaultsApplied;
+}
+
+//------------------------------------------------------------------
+//	Whether runs from now on publish coarse previews first
+//------------------------------------------------------------------
+void CGenerationTask::SetPreview( BOOL bPreview )
+{
+	m_bPreview = bPreview;
+}
+
+//------------------------------------------------------------------
+//	Tile cells per cell the latest snapshot was cut at along each
+//	axis, 1 once it is at full resolution
+//------------------------------------------------------------------
+int CGenerationTask::SnapshotScale()
+{
+	EnterCriticalSection( &m_cs );
+	int iScale = m_iFrontScale;
+	LeaveCriticalSection( &m_cs );
+
+	return iScale;
+}
+
+//------------------------------------------------------------------------------
+//	Copy the latest snapshot, TileSize^2 cells [x * iTileSq + y]
+//
+//	Returns the faults it holds, or -1 before the first Start
+//------------------------------------------------------------------------------
+int CGenerationTask::Snapshot( BYTE* pbColumns )
+{
+	int iFaultsDone = -1;
+
+	EnterCriticalSection( &m_cs );
+
+	if ( m_pbFront != NULL )
+	{
+		memcpy( pbColumns, m_pbFront, m_iCells );
+		iFaultsDone = m_iFaultsDone;
+	}
+
+	LeaveCriticalSection( &m_cs );
+
+	return iFaultsDone;
+}
+
+//------------------------------------------------------------------
+//	Draw the latest snapshot as the tile would draw itself
+//------------------------------------------------------------------
+void CGenerationTask::Draw( HWND hWnd, HDC hdc )
+{
+	EnterCriticalSection( &m_cs );
+
+	if ( m_pbFront != NULL )
+	{
+		m_pTerrain->Draw( hWnd, hdc, -1, -1, m_pbFront );
+	}
+
+	LeaveCriticalSection( &m_cs );
+}
+
+LPCSTR CGenerationTask::GetError()
+{
+	return m_szError;
+}
+
+unsigned __stdcall CGenerationTask::ThreadProc( void* pParam )
+{
+	CGenerationTask* pThis = (CGenerationTask*)pParam;
+
+	pThis->Run();
+
+	CTrace::ReleaseThread();
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+//	Put the generator and g_LogFunc where they were before fault iFault
+//	of the session, and the cursor with them
+//------------------------------------------------------------------------------
+void CGenerationTask::Rewind( int iFault )
+{
+	CRandom& random = m_pTerrain->FaultRandom();
+
+	random.SetState( m_dwStartState );
+	g_LogFunc = CLogFunc( m_run.fLogM, m_run.fLogSeed );
+
+	m_pTerrain->SkipFaultRange( 0, iFault, m_run.bUseLogisticFunc != FALSE );
+
+	m_cursor.iNextFault = iFault;
+	m_cursor.dwRandomState = random.State();
+	m_cursor.fLogIterate = g_LogFunc.LastIterate();
+}
+
+//------------------------------------------------------------------------------
+//	Take the applied faults past the kept ones back out of the retained
+//	heights, by cutting each again at minus its depth
+//------------------------------------------------------------------------------
+void CGenerationTask::Remove()
+{
+	TRACE_SPAN( "generation remove" );
+
+	Rewind( m_iRemoveFirst );
+
+	m_pTerrain->ApplyFaultRange( NULL, m_pdAccumulator, m_iRemoveFirst, m_iRemoveLast, m_applied.iIterations, -m_applied.iDepthInit, -m_applied.iDepthEnd, -m_applied.iFixedFaultDepth,
+								 m_run.bUseLogisticFunc != FALSE, NULL, NULL, NULL );
+
+	m_iFaultsApplied += m_iRemoveLast - m_iRemoveFirst;
+}
+
+//------------------------------------------------------------------------------
+//	Scale the kept faults' offsets from the start tile by New / Old.
+//	Multiplying first keeps a step run's whole heights whole.
+//------------------------------------------------------------------------------
+void CGenerationTask::Rescale()
+{
+	TRACE_SPAN( "generation rescale" );
+	TRACE_CELLS( m_iCells );
+
+	double dNew = (double)m_iScaleNew;
+	double dOld = (double)m_iScaleOld;
+
+	for ( int i = 0; i < m_iCells; i++ )
+	{
+		double dStart = (double)m_pbStart[i];
+
+		m_pdAccumulator[i] = dStart + ( ( m_pdAccumulator[i] - dStart ) * dNew ) / dOld;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Cut every fault of the run on a grid sampling every iScale'th cell of
+//	the start tile, and publish it blown up to the tile's size
+//
+//	The faults are picked over the whole tile and shrunk onto the grid,
+//	profile bands and all, so each preview cell is cut by the same lines
+//	as the tile cell it samples. They are drawn from a generator and
+//	logistic function of the preview's own, started as the session's
+//	were, leaving the run proper alone. Without the memory for it there is
+//	simply no preview.
+//------------------------------------------------------------------------------
+void CGenerationTask::Preview( int iScale )
+{
+	TRACE_SPAN( "generation preview" );
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = m_pTerrain->TileSize();
+	int iSize = iTileSq / iScale;
+	int iCells = iSize * iSize;
+	BOOL bRetain = m_run.bRetainAllValues;
+	double* pdHeights = bRetain ? (double*)pArena->Alloc( sizeof(double) * iCells ) : NULL;
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	FLOAT fWidth = m_run.fProfileWidth > 0.f ? m_run.fProfileWidth : FAULT_PROFILE_WIDTH;
+	CRandom random;
+	CLogFunc logFunc( m_run.fLogM, m_run.fLogSeed );
+	FAULTPASS pass;
+	int iX, iY, iCell;
+
+	if ( pbCells == NULL || ( bRetain && pdHeights == NULL ) )
+	{
+		return;
+	}
+
+	random.SetState( m_dwStartState );
+
+	for ( iX = 0; iX < iSize; iX++ )
+	{
+		for ( iY = 0; iY < iSize; iY++ )
+		{
+			pbCells[iX * iSize + iY] = m_pbStart[iX * iScale * iTileSq + iY * iScale];
+		}
+	}
+
+	if ( bRetain )
+	{
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdHeights[iCell] = (double)pbCells[iCell];
+		}
+	}
+
+	pass.pvCells = bRetain ? (void*)pdHeights : (void*)pbCells;
+	pass.pvSource = NULL;
+	pass.iCellType = bRetain ? FAULT_CELL_F64 : FAULT_CELL_U8;
+	pass.iLayout = GRID_LAYOUT_COLUMN;
+	pass.bRetain = bRetain;
+	pass.bLogistic = m_run.bUseLogisticFunc;
+	pass.iProfile = m_run.iProfile;
+	pass.fProfileWidth = fWidth / (FLOAT)iScale;
+	pass.iTileSq = iSize;
+	pass.iPitch = iSize;
+	pass.iSample = iScale;
+	pass.iFirst = 0;
+	pass.iLast = m_run.iIterations;
+	pass.iIterations = m_run.iIterations;
+	pass.iDepthInit = m_run.iDepthInit;
+	pass.iDepthEnd = m_run.iDepthEnd;
+	pass.iFixedFaultDepth = m_run.iFixedFaultDepth;
+	pass.iMinHeight = m_iMinHeight;
+	pass.iMaxHeight = m_iMaxHeight;
+	pass.pRandom = &random;
+	pass.pLogFunc = &logFunc;
+	pass.hWnd = NULL;
+	pass.pdMin = NULL;
+	pass.pdMax = NULL;
+
+	ApplyFaultPass( pass );
+
+	if ( bRetain )
+	{
+		WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+		int iTop = m_iMaxHeight - m_iMinHeight;
+		CQuantizer quantizer;
+
+		quantizer.Params() = m_pTerrain->GetQuantize();
+
+		if ( pwLevels == NULL || !quantizer.Quantize( pdHeights, iSize, iTop > 255 ? 255 : iTop, pwLevels ) )
+		{
+			return;
+		}
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pbCells[iCell] = (BYTE)pwLevels[iCell];
+		}
+	}
+
+	for ( iX = 0; iX < iTileSq; iX++ )
+	{
+		for ( iY = 0; iY < iTileSq; iY++ )
+		{
+			m_pbBack[iX * iTileSq + iY] = pbCells[( iX / iScale ) * iSize + iY / iScale];
+		}
+	}
+
+	Present( m_run.iIterations, iScale );
+}
+
+//------------------------------------------------------------------------------
+//	Carry out the plan, then apply the run a chunk at a time, publishing
+//	after each
+//
+//	Chunks are split just as a checkpointed run splits its intervals, the
+//	generator and logistic function carrying on from one to the next, so
+//	the result does not depend on the snapshot interval, nor on how many
+//	runs of a session it took to get there
+//------------------------------------------------------------------------------
+void CGenerationTask::Run()
+{
+	CRandom& random = m_pTerrain->FaultRandom();
+	double* pdRetainGrid = m_run.bRetainAllValues ? m_pdAccumulator : NULL;
+	BOOL bPublished = FALSE;
+	BOOL bQuantized = TRUE;
+	double dMin, dMax;
+
+	m_iFaultsApplied = 0;
+	m_pTerrain->SetFaultProfile( m_run.iProfile, m_run.fProfileWidth );
+
+	if ( m_bSeed )
+	{
+		m_pTerrain->SeedFaults();
+		m_dwStartState = random.State();
+	}
+
+	if ( m_bReplay )
+	{
+		if ( !m_bSeed )
+		{
+			m_pTerrain->HeightGrid().FromColumns( m_pbStart );
+		}
+
+		Rewind( 0 );
+
+		if ( pdRetainGrid != NULL )
+		{
+			m_pTerrain->RetainGrid( pdRetainGrid );
+		}
+	}
+	else
+	{
+		if ( m_iRemoveLast > m_iRemoveFirst )
+		{
+			Remove();
+		}
+
+		if ( m_iScaleOld != 0 )
+		{
+			Rescale();
+		}
+
+		random.SetState( m_cursor.dwRandomState );
+		g_LogFunc = CLogFunc( m_run.fLogM, m_run.fLogSeed );
+		g_LogFunc.LastIterate() = m_cursor.fLogIterate;
+	}
+
+	m_applied = m_run;
+
+	//	A rough look first, when every fault is to be cut
+	//-------------------------------------------------------
+	if ( m_bPreview && m_bReplay )
+	{
+		for ( int iScale = GENERATE_PREVIEW_SCALE; iScale > 1; iScale /= 2 )
+		{
+			WaitForSingleObject( m_hResume, INFINITE );
+
+			if ( m_lCancel != 0 )
+			{
+				break;
+			}
+
+			if ( m_pTerrain->TileSize() % iScale == 0 )
+			{
+				Preview( iScale );
+			}
+		}
+	}
+
+	while ( m_cursor.iNextFault < m_run.iIterations )
+	{
+		WaitForSingleObject( m_hResume, INFINITE );
+
+		if ( m_lCancel != 0 )
+		{
+			break;
+		}
+
+		int iNextFault = m_cursor.iNextFault;
+		int iLast = m_run.iIterations - iNextFault > m_iSnapshotFaults ? iNextFault + m_iSnapshotFaults : m_run.iIterations;
+
+		TRACE_SPAN( "generation chunk" );
+
+		m_pTerrain->ApplyFaultRange( NULL, pdRetainGrid, iNextFault, iLast, m_run.iIterations, m_run.iDepthInit, m_run.iDepthEnd, m_run.iFixedFaultDepth,
+									 m_run.bUseLogisticFunc != FALSE, NULL, pdRetainGrid != NULL ? &dMin : NULL, pdRetainGrid != NULL ? &dMax : NULL );
+
+		//	The last fault of the chunk gathered the range. A chunk that
+		//	could not be quantized is still applied, and published by the
+		//	next one or below.
+		//------------------------------------------------------------------
+		bQuantized = pdRetainGrid == NULL || m_pTerrain->QuantizeRetained( pdRetainGrid, dMin, dMax );
+
+		m_cursor.iNextFault = iLast;
+		m_cursor.dwRandomState = random.State();
+		m_cursor.fLogIterate = g_LogFunc.LastIterate();
+		m_iFaultsApplied += iLast - iNextFault;
+
+		if ( bQuantized )
+		{
+			Publish( iLast );
+		}
+
+		bPublished = bQuantized;
+	}
+
+	//	Nothing to add, but faults may have been taken out or scaled, or
+	//	the last chunk was not published. A run cancelled before its first
+	//	chunk publishes the tile as it stands, over any previews. One whose
+	//	tile still could not be quantized ends cancelled, to be run again.
+	//------------------------------------------------------------------------
+	if ( !bPublished )
+	{
+		if ( pdRetainGrid != NULL && m_lCancel == 0 )
+		{
+			bQuantized = m_pTerrain->QuantizeRetained( pdRetainGrid );
+		}
+
+		Publish( m_cursor.iNextFault );
+	}
+
+	m_ullTileHash = CResultCache::Hash( 0, m_pTerrain->HeightGrid().Cells(), m_iCells );
+
+	CScratchArena::ReleaseThread();
+
+	Finish( m_cursor.iNextFault < m_run.iIterations || !bQuantized ? GENERATE_CANCELLED : GENERATE_DONE );
+}
+
+//------------------------------------------------------------------------------
+//	Copy the tile into the back buffer and swap it to the front
+//------------------------------------------------------------------------------
+void CGenerationTask::Publish( int iFaultsDone )
+{
+	m_pTerrain->HeightGrid().ToColumns( m_pbBack );
+
+	Present( iFaultsDone, 1 );
+}
+
+//------------------------------------------------------------------------------
+//	Swap the filled back buffer to the front and say so
+//------------------------------------------------------------------------------
+void CGenerationTask::Present( int iFaultsDone, int iScale )
+{
+	EnterCriticalSection( &m_cs );
+
+	BYTE* pbFront = m_pbFront;
+
+	m_pbFront = m_pbBack;
+	m_pbBack = pbFront;
+	m_iFaultsDone = iFaultsDone;
+	m_iFrontScale = iScale;
+
+	LeaveCriticalSection( &m_cs );
+
+	if ( m_hNotify != NULL )
+	{
+		PostMessage( m_hNotify, WM_GENERATE_SNAPSHOT, (WPARAM)iFaultsDone, (LPARAM)m_run.iIterations );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Hand the tile back. Nothing of the task's is touched by the thread
+//	after this, but for returning.
+//------------------------------------------------------------------------------
+void CGenerationTask::Finish( int iState )
+{
+	HWND hNotify = m_hNotify;
+
+	EnterCriticalSection( &m_cs );
+	m_lState = iState;
+	LeaveCriticalSection( &m_cs );
+
+	if ( hNotify != NULL )
+	{
+		PostMessage( hNotify, WM_GENERATE_FINISHED, (WPARAM)iState, 0 );
+	}
+}
@@ -0,0 +1,170 @@
+/*--------------------------------------------------------------------------------
+
+	Generate.h
+
+	Provides fault line generation on a background thread, publishing
+	snapshots of the tile as it goes and able to pause, resume and cancel
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _GENERATE_H
+#define _GENERATE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+#include "Checkpoint.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define GENERATE_SNAPSHOT_FAULTS	64				// Default faults between snapshots
+#define GENERATE_PREVIEW_SCALE		4				// First preview samples every 4th cell, 1/16 of them
+#define WM_GENERATE_SNAPSHOT		( WM_APP + 1 )	// wParam faults done, lParam faults in the run
+#define WM_GENERATE_FINISHED		( WM_APP + 2 )	// wParam the GENERATESTATE it finished in
+
+enum GENERATESTATE
+{
+	GENERATE_IDLE,			// Never started
+	GENERATE_RUNNING,
+	GENERATE_PAUSED,
+	GENERATE_DONE,
+	GENERATE_CANCELLED
+};
+
+//------------------------------------------------------------------------------
+//	A fault line run on its own thread
+//
+//	Start returns at once. The thread applies the run's faults in chunks of
+//	iSnapshotFaults, through the same kernel and scheduler a synchronous
+//	run uses, so the finished tile is identical to one. After each chunk
+//	the tile's cells are copied into a back buffer, retained heights being
+//	quantized first, and swapped with the front one under the lock, so a
+//	snapshot is always a whole number of faults and never a half written
+//	chunk. Given a window, each snapshot and the finish are posted to it.
+//
+//	Pause and Cancel take effect at the next chunk boundary. A cancelled
+//	run leaves the tile as its last snapshot. While the task is Busy the
+//	tile belongs to the thread, so callers draw and read the snapshot
+//	instead, and leave the tile and g_LogFunc alone until it finishes.
+//
+//	Start also begins a session, keeping the tile it started from, the
+//	generator as seeded and, for a retained run, the accumulated heights.
+//	Tune runs a changed run in that session. The faults are the same
+//	stream, so rather than start over it only does the difference:
+//
+//		More iterations		-	the new faults, from where the last stopped
+//		Fewer iterations	-	the dropped faults cut again at minus their
+//								depth, which takes them back out exactly
+//		New depths			-	the kept faults' offsets scaled, when every
+//								one changes by the same ratio
+//
+//	With previews on, a run that cuts every fault first cuts them all on
+//	grids sampling every 4th and then every 2nd cell of the tile, 1/16 and
+//	1/4 of the work, publishing each blown up to the tile's size before
+//	the full run's first chunk. SnapshotScale says which one is showing.
+//
+//	A clamped tile keeps nothing but its cells, and a smooth profile's
+//	offsets do not come back out exactly, so for those only more
+//	iterations can be done that way. Anything else (a new profile,
+//	endpoint source or height range) replays the whole run from the start
+//	tile, still with the session's faults. If the tile has changed since the session left
+//	it, Tune starts a new session from it as Start would.
+//------------------------------------------------------------------------------
+class CGenerationTask
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CGenerationTask();
+	virtual ~CGenerationTask();
+
+	//-------------------------------
+	//	CGenerationTask Interface
+	//-------------------------------
+	BOOL Start( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify );
+	BOOL Tune( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify );
+	void Pause();
+	void Resume();
+	void Cancel();
+	BOOL Wait( DWORD dwMilliseconds );
+
+	int State();
+	BOOL Busy();
+	int FaultsDone();
+	int Iterations();
+	int FaultsApplied();
+	void SetPreview( BOOL bPreview );
+	int SnapshotScale();
+	int Snapshot( BYTE* pbColumns );
+	void Draw( HWND hWnd, HDC hdc );
+	LPCSTR GetError();
+
+private:
+	static unsigned __stdcall ThreadProc( void* pParam );
+
+	BOOL Launch( CTerrain* pTerrain, const FAULTRUN& run, int iSnapshotFaults, HWND hNotify );
+	void Plan( const FAULTRUN& run );
+	BOOL TileUnchanged( CTerrain* pTerrain );
+	void Rewind( int iFault );
+	void Remove();
+	void Rescale();
+	void Preview( int iScale );
+	void Run();
+	void Publish( int iFaultsDone );
+	void Present( int iFaultsDone, int iScale );
+	void Finish( int iState );
+
+	CRITICAL_SECTION m_cs;
+	HANDLE m_hThread;
+	HANDLE m_hResume;				// Manual reset event, reset while paused
+	volatile LONG m_lState;			// GENERATESTATE
+	volatile LONG m_lCancel;
+
+	CTerrain* m_pTerrain;
+	FAULTRUN m_run;
+	int m_iSnapshotFaults;
+	HWND m_hNotify;
+
+	//	Snapshots, column-major, the front one guarded by m_cs
+	//------------------------------------------------------------
+	BYTE* m_pbFront;
+	BYTE* m_pbBack;
+	int m_iCells;
+	int m_iFaultsDone;				// Faults in the front snapshot
+	int m_iFrontScale;				// Tile cells per cell it was cut at
+	BOOL m_bPreview;
+
+	//	The session Tune carries on
+	//---------------------------------
+	BOOL m_bSession;
+	BYTE* m_pbStart;				// Tile the session started from, column-major
+	double* m_pdAccumulator;		// Retained heights, column-major
+	DWORD m_dwStartState;			// Generator as seeded, before fault 0
+	FAULTRUN m_applied;				// Run the session's faults were cut for
+	FAULTCURSOR m_cursor;			// and how far it got
+	int m_iMinHeight;
+	int m_iMaxHeight;
+	ULONGLONG m_ullTileHash;		// Tile as the session left it
+
+	//	What the next Run does, see Plan
+	//--------------------------------------
+	BOOL m_bSeed;					// Seed a new session
+	BOOL m_bReplay;					// Redo the run from the start tile
+	int m_iRemoveFirst;				// Faults [first, last) of m_applied to take out
+	int m_iRemoveLast;
+	int m_iScaleNew;				// Kept faults' offsets times New / Old, if Old isn't 0
+	int m_iScaleOld;
+	int m_iFaultsApplied;			// Faults the run cut or took out
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
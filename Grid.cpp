@@ -0,0 +1,304 @@
+/*--------------------------------------------------------------------------------
+
+	Grid.cpp
+
+	Provides the height grid behind a terrain tile, stored in whichever
+	memory layout suits the passes run over it
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <string.h>
+
+#include "Grid.h"
+
+//	A band of cells set to one value
+//--------------------------------------
+typedef struct tagGRIDFILL
+{
+	BYTE*	pbCells;
+	int		iBandBytes;
+	BYTE	bValue;
+} GRIDFILL;
+
+static void FillTask( int iIndex, int iWorker, void* pContext )
+{
+	GRIDFILL* pFill = (GRIDFILL*)pContext;
+
+	memset( pFill->pbCells + iIndex * pFill->iBandBytes, pFill->bValue, pFill->iBandBytes );
+}
+
+//----------------------------------------------------------------------------
+//	Copies between a grid and a plain [x * size + y] array, a GRID_BLOCK
+//	square at a time so both sides stay within a few cache lines whatever
+//	the grid's layout
+//----------------------------------------------------------------------------
+template <class TCell>
+class CColumnCopy
+{
+public:
+	static void Read( CHeightGrid& grid, TCell* pColumns )
+	{
+		int iSize = grid.Size();
+
+		for ( int iBlockX = 0; iBlockX < iSize; iBlockX += GRID_BLOCK )
+		{
+			for ( int iBlockY = 0; iBlockY < iSize; iBlockY += GRID_BLOCK )
+			{
+				int iEndX = iBlockX + GRID_BLOCK < iSize ? iBlockX + GRID_BLOCK : iSize;
+				int iEndY = iBlockY + GRID_BLOCK < iSize ? iBlockY + GRID_BLOCK : iSize;
+
+				for ( int iXPos = iBlockX; iXPos < iEndX; iXPos++ )
+				{
+					for ( int iYPos = iBlockY; iYPos < iEndY; iYPos++ )
+					{
+						pColumns[iXPos * iSize + iYPos] = (TCell)grid.At( iXPos, iYPos );
+					}
+				}
+			}
+		}
+	}
+
+	static void Write( CHeightGrid& grid, const TCell* pColumns )
+	{
+		int iSize = grid.Size();
+
+		for ( int iBlockX = 0; iBlockX < iSize; iBlockX += GRID_BLOCK )
+		{
+			for ( int iBlockY = 0; iBlockY < iSize; iBlockY += GRID_BLOCK )
+			{
+				int iEndX = iBlockX + GRID_BLOCK < iSize ? iBlockX + GRID_BLOCK : iSize;
+				int iEndY = iBlockY + GRID_BLOCK < iSize ? iBlockY + GRID_BLOCK : iSize;
+
+				for ( int iXPos = iBlockX; iXPos < iEndX; iXPos++ )
+				{
+					for ( int iYPos = iBlockY; iYPos < iEndY; iYPos++ )
+					{
+						grid.At( iXPos, iYPos ) = (BYTE)pColumns[iXPos * iSize + iYPos];
+					}
+				}
+			}
+		}
+	}
+};
+
+//--------------------------------------
+//
+//	CLASS: CHeightGrid implementation
+//
+//--------------------------------------
+CHeightGrid::CHeightGrid()
+{
+	m_iSize = 0;
+	m_iLayout = GRID_LAYOUT_ROW;
+	m_pbCells = NULL;
+}
+
+CHeightGrid::~CHeightGrid()
+{
+	if ( m_pbCells != NULL )
+	{
+		VirtualFree( m_pbCells, 0, MEM_RELEASE );
+	}
+}
+
+//------------------------------------------------------------------------
+//	Allocate an iSize^2 grid, the contents are undefined until filled
+//
+//	The tiled layout needs iSize to be a multiple of GRID_BLOCK, and no
+//	side may pass GRID_MAX_SIZE. Cells come straight from VirtualAlloc, so
+//	no page is placed until Fill first writes it. On failure the grid is
+//	left as it was.
+//------------------------------------------------------------------------
+BOOL CHeightGrid::Create( int iSize, int iLayout )
+{
+	if ( iSize < 1 || iSize > GRID_MAX_SIZE || ( iLayout == GRID_LAYOUT_TILED && ( iSize % GRID_BLOCK ) != 0 ) )
+	{
+		return FALSE;
+	}
+
+	BYTE* pbCells = (BYTE*)VirtualAlloc( NULL, (SIZE_T)iSize * (SIZE_T)iSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+
+	if ( pbCells == NULL )
+	{
+		return FALSE;
+	}
+
+	if ( m_pbCells != NULL )
+	{
+		VirtualFree( m_pbCells, 0, MEM_RELEASE );
+	}
+
+	m_iSize = iSize;
+	m_iLayout = iLayout;
+	m_pbCells = pbCells;
+
+	return TRUE;
+}
+
+//----------------------------------------------------------
+//	Change layout, keeping the heights where they are
+//----------------------------------------------------------
+BOOL CHeightGrid::SetLayout( int iLayout )
+{
+	if ( iLayout == m_iLayout )
+	{
+		return TRUE;
+	}
+
+	if ( iLayout == GRID_LAYOUT_TILED && ( m_iSize % GRID_BLOCK ) != 0 )
+	{
+		return FALSE;
+	}
+
+	BYTE* pbColumns = new BYTE[(SIZE_T)m_iSize * (SIZE_T)m_iSize];
+
+	if ( pbColumns == NULL )
+	{
+		return FALSE;
+	}
+
+	ToColumns( pbColumns );
+	m_iLayout = iLayout;
+	FromColumns( pbColumns );
+
+	delete [] pbColumns;
+
+	return TRUE;
+}
+
+int CHeightGrid::Size()
+{
+	return m_iSize;
+}
+
+int CHeightGrid::Layout()
+{
+	return m_iLayout;
+}
+
+BYTE* CHeightGrid::Cells()
+{
+	return m_pbCells;
+}
+
+//--------------------------------------------------------------------------
+//	Length of the contiguous runs a layout stores, along y for
+//	GRID_LAYOUT_COLUMN and along x otherwise. Runs start at multiples of it.
+//--------------------------------------------------------------------------
+int CHeightGrid::RunLength( int iLayout, int iSize )
+{
+	return iLayout == GRID_LAYOUT_TILED ? GRID_BLOCK : iSize;
+}
+
+//--------------------------------------------------------------------------
+//	Bands, see the class comment. Cells of the outer axis (RowsOuter, or
+//	columns) per band, and bands in a grid of iSize.
+//--------------------------------------------------------------------------
+int CHeightGrid::BandWidth( int iLayout )
+{
+	return iLayout == GRID_LAYOUT_TILED ? GRID_BLOCK : 1;
+}
+
+int CHeightGrid::Bands( int iLayout, int iSize )
+{
+	return ( iSize + BandWidth( iLayout ) - 1 ) / BandWidth( iLayout );
+}
+
+//	Whether passes over a grid of iSize go by owned bands, or to the
+//	scheduler at all
+//----------------------------------------------------------------------
+BOOL CHeightGrid::Owned( int iSize )
+{
+	return (LONGLONG)iSize * iSize >= GRID_OWNED_CELLS && GetWorkerCount() > 1;
+}
+
+BOOL CHeightGrid::Parallel( int iSize )
+{
+	return (LONGLONG)iSize * iSize >= GRID_PARALLEL_CELLS && GetWorkerCount() > 1;
+}
+
+//--------------------------------------------------------------------------
+//	Run pfnTask for each band of a grid of iSize in iLayout, by their
+//	owners on a large grid, stolen as the scheduler sees fit on a middling
+//	one, and in order on this thread on a small one
+//--------------------------------------------------------------------------
+void CHeightGrid::ForBands( int iLayout, int iSize, PFNPARALLELTASK pfnTask, void* pContext )
+{
+	int iBands = Bands( iLayout, iSize );
+
+	if ( Owned( iSize ) )
+	{
+		ParallelForOwned( iBands, pfnTask, pContext );
+	}
+	else if ( Parallel( iSize ) )
+	{
+		ParallelFor( iBands, pfnTask, pContext );
+	}
+	else
+	{
+		for ( int iBand = 0; iBand < iBands; iBand++ )
+		{
+			pfnTask( iBand, 0, pContext );
+		}
+	}
+}
+
+//--------------------------------------------------------------------------
+//	Set every cell. On a large grid each band is written first by the
+//	worker that owns it, which places its pages.
+//--------------------------------------------------------------------------
+void CHeightGrid::Fill( BYTE bValue )
+{
+	if ( !Parallel( m_iSize ) )
+	{
+		memset( m_pbCells, bValue, m_iSize * m_iSize );
+		return;
+	}
+
+	GRIDFILL fill;
+
+	fill.pbCells = m_pbCells;
+	fill.iBandBytes = m_iSize * BandWidth( m_iLayout );
+	fill.bValue = bValue;
+
+	ForBands( m_iLayout, m_iSize, FillTask, &fill );
+}
+
+//------------------------------------------------------------------------
+//	Copy to and from [x * size + y] arrays, the layout retained grids
+//	and checkpoints use
+//------------------------------------------------------------------------
+void CHeightGrid::ToColumns( BYTE* pbColumns )
+{
+	if ( m_iLayout == GRID_LAYOUT_COLUMN )
+	{
+		memcpy( pbColumns, m_pbCells, m_iSize * m_iSize );
+		return;
+	}
+
+	CColumnCopy<BYTE>::Read( *this, pbColumns );
+}
+
+void CHeightGrid::ToColumns( double* pdColumns )
+{
+	CColumnCopy<double>::Read( *this, pdColumns );
+}
+
+void CHeightGrid::FromColumns( const BYTE* pbColumns )
+{
+	if ( m_iLayout == GRID_LAYOUT_COLUMN )
+	{
+		memcpy( m_pbCells, pbColumns, m_iSize * m_iSize );
+		return;
+	}
+
+	CColumnCopy<BYTE>::Write( *this, pbColumns );
+}
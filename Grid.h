@@ -0,0 +1,143 @@
+/*--------------------------------------------------------------------------------
+
+	Grid.h
+
+	Provides the height grid behind a terrain tile, stored in whichever
+	memory layout suits the passes run over it
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _GRID_H
+#define _GRID_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define GRID_BLOCK			16		// Tiled layout block side, 256 bytes, 4 cache lines
+#define GRID_BLOCK_SHIFT	4
+#define GRID_MAX_SIZE		46340	// Largest side whose cells an int offset can still address
+
+//	Grids of this many cells or more are filled, faulted, blurred and saved
+//	by ParallelForOwned over bands, so each band stays with one worker.
+//	From GRID_PARALLEL_CELLS up they go to the scheduler, below that the
+//	calling thread does the lot.
+//--------------------------------------------------------------------------
+#ifndef GRID_OWNED_CELLS
+#define GRID_OWNED_CELLS	( 1 << 22 )
+#endif
+
+#ifndef GRID_PARALLEL_CELLS
+#define GRID_PARALLEL_CELLS	( 1 << 16 )
+#endif
+
+enum GRIDLAYOUT
+{
+	GRID_LAYOUT_COLUMN,		// [x * size + y], columns contiguous
+	GRID_LAYOUT_ROW,		// [y * size + x], rows contiguous
+	GRID_LAYOUT_TILED		// GRID_BLOCK square blocks in row order, each row-major
+};
+
+//------------------------------------------------------------------------------
+//	A square grid of heights
+//
+//	Cells are addressed by (x, y) whatever the layout, so callers that only
+//	touch a few cells need not care. Whole-grid passes should walk memory in
+//	order instead: columns outer for GRID_LAYOUT_COLUMN, rows outer for the
+//	other two (RowsOuter), or the cells as a flat array when the order does
+//	not matter. The tiled layout keeps a block's neighbours in both axes in
+//	a few cache lines, for passes that work on square patches.
+//
+//	A band is a contiguous stretch of memory: one column, one row, or for
+//	GRID_LAYOUT_TILED one row of blocks. Large grids are first touched by
+//	ParallelForOwned over bands, so on a NUMA system a band's pages are on
+//	the node of the worker that owns it, and passes over the same bands find
+//	them there.
+//------------------------------------------------------------------------------
+class CHeightGrid
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CHeightGrid();
+	virtual ~CHeightGrid();
+
+	//---------------------------
+	//	CHeightGrid Interface
+	//---------------------------
+	BOOL Create( int iSize, int iLayout );
+	BOOL SetLayout( int iLayout );
+
+	int Size();
+	int Layout();
+	BOOL RowsOuter();
+	BYTE* Cells();
+
+	BYTE& At( int iXPos, int iYPos );
+	int Offset( int iXPos, int iYPos );
+
+	void Fill( BYTE bValue );
+	void ToColumns( BYTE* pbColumns );
+	void ToColumns( double* pdColumns );
+	void FromColumns( const BYTE* pbColumns );
+
+	static int RunLength( int iLayout, int iSize );
+	static int BandWidth( int iLayout );
+	static int Bands( int iLayout, int iSize );
+	static BOOL Owned( int iSize );
+	static BOOL Parallel( int iSize );
+	static void ForBands( int iLayout, int iSize, PFNPARALLELTASK pfnTask, void* pContext );
+	static int LayoutOffset( int iLayout, int iSize, int iXPos, int iYPos );
+
+private:
+	int m_iSize;
+	int m_iLayout;
+	BYTE* m_pbCells;
+};
+
+//------------------------------------------------------------------------------
+//	Inlines, cell access is on every pass's inner loop
+//------------------------------------------------------------------------------
+inline int CHeightGrid::LayoutOffset( int iLayout, int iSize, int iXPos, int iYPos )
+{
+	switch ( iLayout )
+	{
+		case GRID_LAYOUT_ROW:
+			return iYPos * iSize + iXPos;
+
+		case GRID_LAYOUT_TILED:
+			return ( ( ( iYPos >> GRID_BLOCK_SHIFT ) * ( iSize >> GRID_BLOCK_SHIFT ) + ( iXPos >> GRID_BLOCK_SHIFT ) ) << ( 2 * GRID_BLOCK_SHIFT ) )
+				+ ( ( iYPos & ( GRID_BLOCK - 1 ) ) << GRID_BLOCK_SHIFT ) + ( iXPos & ( GRID_BLOCK - 1 ) );
+	}
+
+	return iXPos * iSize + iYPos;
+}
+
+inline int CHeightGrid::Offset( int iXPos, int iYPos )
+{
+	return LayoutOffset( m_iLayout, m_iSize, iXPos, iYPos );
+}
+
+inline BYTE& CHeightGrid::At( int iXPos, int iYPos )
+{
+	return m_pbCells[Offset( iXPos, iYPos )];
+}
+
+inline BOOL CHeightGrid::RowsOuter()
+{
+	return m_iLayout != GRID_LAYOUT_COLUMN;
+}
+
+#endif
@@ -0,0 +1,523 @@
+/*--------------------------------------------------------------------------------
+
+	Logistic.cpp
+
+	Provides analysis of the logistic function over a sweep of M and seeds,
+	its Lyapunov exponents, orbit histograms and bifurcation diagram
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Logistic.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef LOGISTIC_SIMD
+#define LOGISTIC_SIMD		1		// 0 iterates the lanes with the scalar loop only
+#endif
+
+#if LOGISTIC_SIMD
+#include <emmintrin.h>
+#endif
+
+#define LOGISTIC_MAX_SIZE		4096						// Most columns or seeds, the images' largest side
+#define LOGISTIC_RENORMALIZE	4							// Iterates between taking the product's exponent off
+#define LOGISTIC_LN2			0.69314718055994531
+
+//------------------------------------------------------------------------------
+//	Take the exponent off a positive float, adding it to *piExponent and
+//	leaving the mantissa in [1, 2)
+//------------------------------------------------------------------------------
+static inline FLOAT Renormalize( FLOAT fProduct, int* piExponent )
+{
+	DWORD dwBits;
+
+	memcpy( &dwBits, &fProduct, sizeof(dwBits) );
+
+	*piExponent += (int)( dwBits >> 23 ) - 127;
+	dwBits = ( dwBits & 0x007FFFFF ) | 0x3F800000;
+
+	memcpy( &fProduct, &dwBits, sizeof(dwBits) );
+
+	return fProduct;
+}
+
+//	The histogram bin of an iterate, anything outside [0, 1] going to the end
+//--------------------------------------------------------------------------------
+static inline int LogisticBin( FLOAT fX )
+{
+	int iBin = (int)( fX * (FLOAT)LOGISTIC_BINS );
+
+	iBin = iBin > 0 ? iBin : 0;
+
+	return iBin < LOGISTIC_BINS ? iBin : LOGISTIC_BINS - 1;
+}
+
+//----------------------------------------------
+//
+//	CLASS: CLogisticAnalysis implementation
+//
+//----------------------------------------------
+CLogisticAnalysis::CLogisticAnalysis()
+{
+	DefaultParams( &m_params );
+
+	m_pColumns = NULL;
+	m_pfExponents = NULL;
+	m_pdwHistograms = NULL;
+	m_szError[0] = 0;
+}
+
+CLogisticAnalysis::~CLogisticAnalysis()
+{
+	delete [] m_pColumns;
+	delete [] m_pfExponents;
+	delete [] m_pdwHistograms;
+}
+
+void CLogisticAnalysis::DefaultParams( LOGISTICPARAMS* pParams )
+{
+	pParams->fMinM = LOGISTIC_DEFAULT_MIN_M;
+	pParams->fMaxM = LOGISTIC_DEFAULT_MAX_M;
+	pParams->iColumns = LOGISTIC_DEFAULT_COLUMNS;
+	pParams->fMinSeed = 0.01f;
+	pParams->fMaxSeed = 0.99f;
+	pParams->iSeeds = LOGISTIC_DEFAULT_SEEDS;
+	pParams->iTransient = LOGISTIC_TRANSIENT;
+	pParams->iIterates = LOGISTIC_ITERATES;
+}
+
+//------------------------------------------------------------------------------
+//	Sweep every column over every seed
+//
+//	Returns FALSE if the parameters leave [0, 1] or the sweep is too large,
+//	see GetError
+//------------------------------------------------------------------------------
+BOOL CLogisticAnalysis::Run( const LOGISTICPARAMS& params )
+{
+	if ( params.iColumns < 1 || params.iColumns > LOGISTIC_MAX_SIZE || params.iSeeds < 1 || params.iSeeds > LOGISTIC_MAX_SIZE )
+	{
+		sprintf( m_szError, "Sweep %d values of M by %d seeds, from 1 to %d of each", params.iColumns, params.iSeeds, LOGISTIC_MAX_SIZE );
+		return FALSE;
+	}
+
+	//	Beyond 4 the orbits leave [0, 1] and run off to infinity
+	//--------------------------------------------------------------
+	if ( !( params.fMinM > 0.f && params.fMaxM <= 4.f && params.fMinM <= params.fMaxM ) )
+	{
+		sprintf( m_szError, "M from %g to %g, it must lie in (0, 4]", params.fMinM, params.fMaxM );
+		return FALSE;
+	}
+
+	if ( !( params.fMinSeed >= 0.f && params.fMaxSeed <= 1.f && params.fMinSeed <= params.fMaxSeed ) )
+	{
+		sprintf( m_szError, "Seeds from %g to %g, they must lie in [0, 1]", params.fMinSeed, params.fMaxSeed );
+		return FALSE;
+	}
+
+	if ( params.iTransient < 0 || params.iIterates < 1 )
+	{
+		sprintf( m_szError, "%d transient and %d measured iterates", params.iTransient, params.iIterates );
+		return FALSE;
+	}
+
+	delete [] m_pColumns;
+	delete [] m_pfExponents;
+	delete [] m_pdwHistograms;
+
+	m_params = params;
+	m_pColumns = new LOGISTICCOLUMN[params.iColumns];
+	m_pfExponents = new FLOAT[params.iColumns * params.iSeeds];
+	m_pdwHistograms = new DWORD[params.iColumns * LOGISTIC_BINS];
+
+	if ( m_pColumns == NULL || m_pfExponents == NULL || m_pdwHistograms == NULL )
+	{
+		delete [] m_pColumns;
+		delete [] m_pfExponents;
+		delete [] m_pdwHistograms;
+
+		m_pColumns = NULL;
+		m_pfExponents = NULL;
+		m_pdwHistograms = NULL;
+
+		sprintf( m_szError, "Out of memory for a sweep of %d values of M by %d seeds", params.iColumns, params.iSeeds );
+		return FALSE;
+	}
+
+	ParallelFor( params.iColumns, ColumnTask, this );
+
+	return TRUE;
+}
+
+void CLogisticAnalysis::ColumnTask( int iIndex, int iWorker, void* pContext )
+{
+	( (CLogisticAnalysis*)pContext )->RunColumn( iIndex );
+}
+
+//------------------------------------------------------------------------------
+//	One value of M, its seeds LOGISTIC_LANES at a time, then the column's
+//	summary
+//------------------------------------------------------------------------------
+void CLogisticAnalysis::RunColumn( int iColumn )
+{
+	TRACE_SPAN( "logistic column" );
+	TRACE_CELLS( (ULONGLONG)m_params.iSeeds * ( m_params.iTransient + m_params.iIterates ) );
+
+	LOGISTICCOLUMN& column = m_pColumns[iColumn];
+	FLOAT* pfExponents = m_pfExponents + iColumn * m_params.iSeeds;
+	DWORD* pdwHistogram = m_pdwHistograms + iColumn * LOGISTIC_BINS;
+	FLOAT afSeeds[LOGISTIC_LANES];
+	int iSeed, iLane, iBin;
+
+	column.fM = m_params.iColumns > 1 ? m_params.fMinM + ( m_params.fMaxM - m_params.fMinM ) * (FLOAT)iColumn / (FLOAT)( m_params.iColumns - 1 ) : m_params.fMinM;
+
+	memset( pdwHistogram, 0, sizeof(DWORD) * LOGISTIC_BINS );
+
+	for ( iSeed = 0; iSeed < m_params.iSeeds; iSeed += LOGISTIC_LANES )
+	{
+		int iLanes = m_params.iSeeds - iSeed < LOGISTIC_LANES ? m_params.iSeeds - iSeed : LOGISTIC_LANES;
+
+		//	Lanes past the last seed repeat it and are thrown away
+		//------------------------------------------------------------
+		for ( iLane = 0; iLane < LOGISTIC_LANES; iLane++ )
+		{
+			afSeeds[iLane] = Seed( iSeed + ( iLane < iLanes ? iLane : iLanes - 1 ) );
+		}
+
+		RunLanes( column.fM, afSeeds, iLanes, pfExponents + iSeed, pdwHistogram );
+	}
+
+	double dSum = 0.0;
+	int iChaotic = 0;
+	int iVisited = 0;
+
+	column.fMinExponent = column.fMaxExponent = pfExponents[0];
+
+	for ( iSeed = 0; iSeed < m_params.iSeeds; iSeed++ )
+	{
+		dSum += pfExponents[iSeed];
+		iChaotic += pfExponents[iSeed] > 0.f;
+
+		column.fMinExponent = pfExponents[iSeed] < column.fMinExponent ? pfExponents[iSeed] : column.fMinExponent;
+		column.fMaxExponent = pfExponents[iSeed] > column.fMaxExponent ? pfExponents[iSeed] : column.fMaxExponent;
+	}
+
+	for ( iBin = 0; iBin < LOGISTIC_BINS; iBin++ )
+	{
+		iVisited += pdwHistogram[iBin] != 0;
+	}
+
+	column.fMeanExponent = (FLOAT)( dSum / (double)m_params.iSeeds );
+	column.fChaotic = (FLOAT)iChaotic / (FLOAT)m_params.iSeeds;
+	column.fCoverage = (FLOAT)iVisited / (FLOAT)LOGISTIC_BINS;
+}
+
+//------------------------------------------------------------------------------
+//	Iterate LOGISTIC_LANES orbits together, writing the exponents of the
+//	first iLanes and adding their iterates to the histogram
+//
+//	Each lane keeps its product of slopes as a float in [1, 2), multiplied
+//	by up to LOGISTIC_RENORMALIZE slopes between renormalizations, and the
+//	sum of the exponents taken off. The exponent is the log of the whole
+//	product over the iterates. A slope is never taken below
+//	LOGISTIC_MIN_SLOPE, which only an orbit through x = 0.5 reaches.
+//------------------------------------------------------------------------------
+void CLogisticAnalysis::RunLanes( FLOAT fM, const FLOAT* pfSeeds, int iLanes, FLOAT* pfExponents, DWORD* pdwHistogram )
+{
+	FLOAT afX[LOGISTIC_LANES];
+	FLOAT afProduct[LOGISTIC_LANES];
+	int aiExponent[LOGISTIC_LANES];
+	int iIterate, iLane;
+
+	for ( iLane = 0; iLane < LOGISTIC_LANES; iLane++ )
+	{
+		afX[iLane] = pfSeeds[iLane];
+		afProduct[iLane] = 1.f;
+		aiExponent[iLane] = 0;
+	}
+
+#if LOGISTIC_SIMD
+	__m128 vM = _mm_set1_ps( fM );
+	__m128 vOne = _mm_set1_ps( 1.f );
+	__m128 vTwo = _mm_set1_ps( 2.f );
+	__m128 vSign = _mm_set1_ps( -0.f );
+	__m128 vMinSlope = _mm_set1_ps( LOGISTIC_MIN_SLOPE );
+	__m128i viMantissa = _mm_set1_epi32( 0x007FFFFF );
+	__m128i viOneBits = _mm_set1_epi32( 0x3F800000 );
+	__m128i viBias = _mm_set1_epi32( 127 );
+	__m128i viExponent = _mm_setzero_si128();
+	__m128 vX = _mm_loadu_ps( afX );
+	__m128 vProduct = vOne;
+	int aiBits[LOGISTIC_LANES];
+
+	for ( iIterate = 0; iIterate < m_params.iTransient; iIterate++ )
+	{
+		vX = _mm_mul_ps( _mm_mul_ps( vM, vX ), _mm_sub_ps( vOne, vX ) );
+	}
+
+	for ( iIterate = 0; iIterate < m_params.iIterates; iIterate++ )
+	{
+		__m128 vSlope = _mm_mul_ps( vM, _mm_sub_ps( vOne, _mm_mul_ps( vTwo, vX ) ) );
+
+		vProduct = _mm_mul_ps( vProduct, _mm_max_ps( _mm_andnot_ps( vSign, vSlope ), vMinSlope ) );
+
+		_mm_storeu_ps( afX, vX );
+
+		for ( iLane = 0; iLane < iLanes; iLane++ )
+		{
+			pdwHistogram[LogisticBin( afX[iLane] )]++;
+		}
+
+		vX = _mm_mul_ps( _mm_mul_ps( vM, vX ), _mm_sub_ps( vOne, vX ) );
+
+		//	SSE2 has no float to integer bit cast, so the product goes
+		//	through memory
+		//-------------------------------------------------------------------
+		if ( ( iIterate + 1 ) % LOGISTIC_RENORMALIZE == 0 || iIterate + 1 == m_params.iIterates )
+		{
+			_mm_storeu_ps( (FLOAT*)aiBits, vProduct );
+
+			__m128i viBits = _mm_loadu_si128( (const __m128i*)aiBits );
+
+			viExponent = _mm_add_epi32( viExponent, _mm_sub_epi32( _mm_srli_epi32( viBits, 23 ), viBias ) );
+			viBits = _mm_or_si128( _mm_and_si128( viBits, viMantissa ), viOneBits );
+
+			_mm_storeu_si128( (__m128i*)aiBits, viBits );
+			vProduct = _mm_loadu_ps( (const FLOAT*)aiBits );
+		}
+	}
+
+	_mm_storeu_ps( afProduct, vProduct );
+	_mm_storeu_si128( (__m128i*)aiExponent, viExponent );
+#else
+	for ( iLane = 0; iLane < iLanes; iLane++ )
+	{
+		FLOAT fX = afX[iLane];
+		FLOAT fProduct = 1.f;
+		int iExponent = 0;
+
+		for ( iIterate = 0; iIterate < m_params.iTransient; iIterate++ )
+		{
+			fX = ( fM * fX ) * ( 1.f - fX );
+		}
+
+		for ( iIterate = 0; iIterate < m_params.iIterates; iIterate++ )
+		{
+			FLOAT fSlope = (FLOAT)fabs( fM * ( 1.f - 2.f * fX ) );
+
+			fProduct *= fSlope > LOGISTIC_MIN_SLOPE ? fSlope : LOGISTIC_MIN_SLOPE;
+
+			pdwHistogram[LogisticBin( fX )]++;
+
+			fX = ( fM * fX ) * ( 1.f - fX );
+
+			if ( ( iIterate + 1 ) % LOGISTIC_RENORMALIZE == 0 || iIterate + 1 == m_params.iIterates )
+			{
+				fProduct = Renormalize( fProduct, &iExponent );
+			}
+		}
+
+		afProduct[iLane] = fProduct;
+		aiExponent[iLane] = iExponent;
+	}
+#endif
+
+	for ( iLane = 0; iLane < iLanes; iLane++ )
+	{
+		pfExponents[iLane] = (FLOAT)( ( (double)aiExponent[iLane] * LOGISTIC_LN2 + log( (double)afProduct[iLane] ) ) / (double)m_params.iIterates );
+	}
+}
+
+int CLogisticAnalysis::Columns()
+{
+	return m_pColumns != NULL ? m_params.iColumns : 0;
+}
+
+const LOGISTICCOLUMN& CLogisticAnalysis::Column( int iColumn )
+{
+	return m_pColumns[iColumn];
+}
+
+FLOAT CLogisticAnalysis::Exponent( int iColumn, int iSeed )
+{
+	return m_pfExponents[iColumn * m_params.iSeeds + iSeed];
+}
+
+//	The seed of row iSeed
+//---------------------------
+FLOAT CLogisticAnalysis::Seed( int iSeed )
+{
+	if ( m_params.iSeeds == 1 )
+	{
+		return ( m_params.fMinSeed + m_params.fMaxSeed ) * 0.5f;
+	}
+
+	return m_params.fMinSeed + ( m_params.fMaxSeed - m_params.fMinSeed ) * (FLOAT)iSeed / (FLOAT)( m_params.iSeeds - 1 );
+}
+
+//	LOGISTIC_BINS counts of the column's iterates over [0, 1]
+//-----------------------------------------------------------------
+const DWORD* CLogisticAnalysis::Histogram( int iColumn )
+{
+	return m_pdwHistograms + iColumn * LOGISTIC_BINS;
+}
+
+LPCSTR CLogisticAnalysis::GetError()
+{
+	return m_szError;
+}
+
+//------------------------------------------------------------------------------
+//	Write the last Run as <szPrefix>.csv, <szPrefix>_bifurcation.tga and
+//	<szPrefix>_lyapunov.tga
+//------------------------------------------------------------------------------
+BOOL CLogisticAnalysis::Save( LPCSTR szPrefix )
+{
+	TCHAR szFilename[MAX_PATH];
+	int iColumns = Columns();
+	int iColumn, iRow;
+
+	if ( iColumns == 0 )
+	{
+		sprintf( m_szError, "Nothing has been swept" );
+		return FALSE;
+	}
+
+	sprintf( szFilename, "%.240s.csv", szPrefix );
+
+	if ( !SaveCsv( szFilename ) )
+	{
+		return FALSE;
+	}
+
+	//	Bifurcation diagram, each column's histogram on a log scale against
+	//	its own fullest bin, so periodic and chaotic bands both show
+	//-------------------------------------------------------------------------
+	BYTE* pbPixels = new BYTE[iColumns * ( LOGISTIC_BINS > m_params.iSeeds ? LOGISTIC_BINS : m_params.iSeeds ) * 3];
+
+	if ( pbPixels == NULL )
+	{
+		sprintf( m_szError, "Out of memory writing %.200s", szPrefix );
+		return FALSE;
+	}
+
+	for ( iColumn = 0; iColumn < iColumns; iColumn++ )
+	{
+		const DWORD* pdwHistogram = Histogram( iColumn );
+		DWORD dwFullest = 1;
+
+		for ( iRow = 0; iRow < LOGISTIC_BINS; iRow++ )
+		{
+			dwFullest = pdwHistogram[iRow] > dwFullest ? pdwHistogram[iRow] : dwFullest;
+		}
+
+		double dScale = 255.0 / log( 1.0 + (double)dwFullest );
+
+		for ( iRow = 0; iRow < LOGISTIC_BINS; iRow++ )
+		{
+			BYTE* pbPixel = pbPixels + ( iRow * iColumns + iColumn ) * 3;
+
+			pbPixel[0] = pbPixel[1] = pbPixel[2] = (BYTE)( log( 1.0 + (double)pdwHistogram[iRow] ) * dScale );
+		}
+	}
+
+	sprintf( szFilename, "%.240s_bifurcation.tga", szPrefix );
+
+	BOOL bResult = SaveTga( szFilename, pbPixels, iColumns, LOGISTIC_BINS );
+
+	//	Exponents, blue for stable orbits and red for chaotic ones, brighter
+	//	the further from 0
+	//--------------------------------------------------------------------------
+	for ( iColumn = 0; iColumn < iColumns && bResult; iColumn++ )
+	{
+		for ( iRow = 0; iRow < m_params.iSeeds; iRow++ )
+		{
+			FLOAT fExponent = Exponent( iColumn, iRow );
+			FLOAT fLevel = (FLOAT)fabs( fExponent ) / LOGISTIC_EXPONENT_SCALE;
+			BYTE bLevel = (BYTE)( 255.f * ( fLevel < 1.f ? fLevel : 1.f ) );
+			BYTE* pbPixel = pbPixels + ( iRow * iColumns + iColumn ) * 3;
+
+			pbPixel[0] = fExponent < 0.f ? bLevel : 0;		// Blue
+			pbPixel[1] = 0;									// Green
+			pbPixel[2] = fExponent > 0.f ? bLevel : 0;		// Red
+		}
+	}
+
+	if ( bResult )
+	{
+		sprintf( szFilename, "%.240s_lyapunov.tga", szPrefix );
+
+		bResult = SaveTga( szFilename, pbPixels, iColumns, m_params.iSeeds );
+	}
+
+	delete [] pbPixels;
+
+	return bResult;
+}
+
+BOOL CLogisticAnalysis::SaveCsv( LPCSTR szFilename )
+{
+	FILE* file;
+
+	if ( ( file = fopen( szFilename, "w" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to create %.200s", szFilename );
+		return FALSE;
+	}
+
+	fprintf( file, "m,mean_exponent,min_exponent,max_exponent,chaotic_seeds,coverage\n" );
+
+	for ( int iColumn = 0; iColumn < Columns(); iColumn++ )
+	{
+		const LOGISTICCOLUMN& column = m_pColumns[iColumn];
+
+		fprintf( file, "%.6f,%.6f,%.6f,%.6f,%.4f,%.4f\n", column.fM, column.fMeanExponent, column.fMinExponent, column.fMaxExponent, column.fChaotic, column.fCoverage );
+	}
+
+	fclose( file );
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Write iHeight rows of iWidth BGR pixels, the bottom row first, as a
+//	24 bit TGA
+//------------------------------------------------------------------------------
+BOOL CLogisticAnalysis::SaveTga( LPCSTR szFilename, const BYTE* pbPixels, int iWidth, int iHeight )
+{
+	FILE* file;
+	BYTE head[TGA_HEADER_SIZE];
+
+	FillTgaHeader( head, iWidth, iHeight );
+
+	if ( ( file = fopen( szFilename, "wb" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to create %.200s", szFilename );
+		return FALSE;
+	}
+
+	BOOL bResult = fwrite( head, TGA_HEADER_SIZE, 1, file ) == 1 && fwrite( pbPixels, iWidth * iHeight * 3, 1, file ) == 1;
+
+	fclose( file );
+
+	if ( !bResult )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFilename );
+	}
+
+	return bResult;
+}
@@ -0,0 +1,122 @@
+/*--------------------------------------------------------------------------------
+
+	Logistic.h
+
+	Provides analysis of the logistic function over a sweep of M and seeds,
+	its Lyapunov exponents, orbit histograms and bifurcation diagram
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _LOGISTIC_H
+#define _LOGISTIC_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define LOGISTIC_DEFAULT_COLUMNS	1024	// Values of M swept
+#define LOGISTIC_DEFAULT_SEEDS		256		// Seeds per value of M
+#define LOGISTIC_DEFAULT_MIN_M		3.5f
+#define LOGISTIC_DEFAULT_MAX_M		4.f
+#define LOGISTIC_TRANSIENT			256		// Iterates dropped before measuring
+#define LOGISTIC_ITERATES			2048	// Iterates measured per orbit
+#define LOGISTIC_BINS				512		// Orbit histogram bins over [0, 1]
+#define LOGISTIC_LANES				4		// Orbits iterated together with SSE2
+#define LOGISTIC_MIN_SLOPE			( 1.f / 1073741824.f )	// 2^-30, least slope an exponent counts
+#define LOGISTIC_EXPONENT_SCALE		0.7f	// Exponent drawn at full colour, about ln 2
+
+typedef struct tagLOGISTICPARAMS
+{
+	FLOAT	fMinM;				// M of the first column
+	FLOAT	fMaxM;				// and the last
+	int		iColumns;
+	FLOAT	fMinSeed;			// Seeds are spread evenly over [fMinSeed, fMaxSeed]
+	FLOAT	fMaxSeed;
+	int		iSeeds;
+	int		iTransient;
+	int		iIterates;
+} LOGISTICPARAMS;
+
+//	One value of M over all the seeds
+//---------------------------------------
+typedef struct tagLOGISTICCOLUMN
+{
+	FLOAT	fM;
+	FLOAT	fMeanExponent;
+	FLOAT	fMinExponent;
+	FLOAT	fMaxExponent;
+	FLOAT	fChaotic;			// Share of seeds with a positive exponent
+	FLOAT	fCoverage;			// Share of the histogram's bins the orbits visited
+} LOGISTICCOLUMN;
+
+//------------------------------------------------------------------------------
+//	A sweep of the logistic function x' = M x (1 - x) as CLogFunc iterates
+//	it, for choosing M and the seed before spending a terrain run on them
+//
+//	Each column is one value of M, run over the scheduler. Its seeds are
+//	iterated LOGISTIC_LANES at a time in SSE2 lanes, in single precision
+//	just as CLogFunc does, so each orbit is the sequence a fault run would
+//	draw its endpoints from. After the transient each orbit's Lyapunov
+//	exponent is the mean of ln|M (1 - 2x)| along it. The logs are summed
+//	as a running product kept in [1, 2) with its exponent bits counted
+//	off, so the lanes need no log until the end. Every iterate measured
+//	also goes into the column's histogram.
+//
+//	A positive exponent means nearby seeds diverge, which is what scatters
+//	faults over the whole tile. Coverage says how much of the tile the
+//	orbits reach: a chaotic band can still be confined to part of [0, 1].
+//
+//	Save writes <prefix>.csv, a row per column, <prefix>_bifurcation.tga,
+//	the histograms with M across and x up, and <prefix>_lyapunov.tga, each
+//	orbit's exponent with M across and the seed up, blue for stable and
+//	red for chaotic.
+//------------------------------------------------------------------------------
+class CLogisticAnalysis
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CLogisticAnalysis();
+	virtual ~CLogisticAnalysis();
+
+	//---------------------------------
+	//	CLogisticAnalysis Interface
+	//---------------------------------
+	static void DefaultParams( LOGISTICPARAMS* pParams );
+
+	BOOL Run( const LOGISTICPARAMS& params );
+	BOOL Save( LPCSTR szPrefix );
+
+	int Columns();
+	const LOGISTICCOLUMN& Column( int iColumn );
+	FLOAT Exponent( int iColumn, int iSeed );
+	FLOAT Seed( int iSeed );
+	const DWORD* Histogram( int iColumn );
+	LPCSTR GetError();
+
+private:
+	static void ColumnTask( int iIndex, int iWorker, void* pContext );
+
+	void RunColumn( int iColumn );
+	void RunLanes( FLOAT fM, const FLOAT* pfSeeds, int iLanes, FLOAT* pfExponents, DWORD* pdwHistogram );
+	BOOL SaveCsv( LPCSTR szFilename );
+	BOOL SaveTga( LPCSTR szFilename, const BYTE* pbPixels, int iWidth, int iHeight );
+
+	LOGISTICPARAMS m_params;
+	LOGISTICCOLUMN* m_pColumns;
+	FLOAT* m_pfExponents;			// [iColumn * iSeeds + iSeed]
+	DWORD* m_pdwHistograms;			// [iColumn * LOGISTIC_BINS + iBin]
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,619 @@
+/*--------------------------------------------------------------------------------
+
+	Parallel.cpp
+
+	Provides the work-stealing scheduler used to spread terrain operations
+	across the available processors
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <process.h>
+#include <string.h>
+
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define PARALLEL_DEQUE_SIZE		256		// Ranges a worker can hold, beyond that it runs them itself
+#define PARALLEL_SPLITS			8		// Ranges per worker a job is split down to, at most
+
+typedef struct tagPARALLELJOB
+{
+	PFNPARALLELTASK	pfnTask;
+	void*			pContext;
+	int				iGrain;				// Smallest range worth splitting off
+	volatile LONG	lRemaining;			// Items not yet run, the job is done at 0
+} PARALLELJOB;
+
+//	Items [iFirst, iLast) of a job. A pinned range is only ever run by
+//	the worker whose deque it was put on.
+//------------------------------------------------------------------------
+typedef struct tagPARALLELRANGE
+{
+	PARALLELJOB*	pJob;
+	int				iFirst;
+	int				iLast;
+	BOOL			bPinned;
+} PARALLELRANGE;
+
+//	A worker's ranges, oldest first. The worker takes from the newest end
+//	and thieves from the oldest, each under the lock. Deque 0 is shared by
+//	every thread that is not one of the pool's.
+//----------------------------------------------------------------------------
+typedef struct tagPARALLELDEQUE
+{
+	CRITICAL_SECTION	cs;
+	PARALLELRANGE		aRanges[PARALLEL_DEQUE_SIZE];
+	int					iRanges;
+	HANDLE				hWake;			// Pool workers sleep on this when idle
+	volatile LONG		lSleeping;
+	BOOL				bRunning;		// Has a pool thread, for deques 1 and up
+} PARALLELDEQUE;
+
+//	Where each worker runs. Masks are 0 when workers are left to the
+//	scheduler, as they are on a single node.
+//----------------------------------------------------------------------------
+typedef struct tagPARALLELTOPOLOGY
+{
+	int				iNodes;
+	DWORD_PTR		adwMask[MAX_WORKERS];
+	int				aiNode[MAX_WORKERS];
+} PARALLELTOPOLOGY;
+
+typedef BOOL (WINAPI *PFNGETNUMAHIGHESTNODENUMBER)( PULONG );
+typedef BOOL (WINAPI *PFNGETNUMANODEPROCESSORMASK)( UCHAR, PULONGLONG );
+
+typedef struct tagPARALLEL2D
+{
+	PFNPARALLELTASK2D	pfnTask;
+	void*				pContext;
+	int					iCountX;
+} PARALLEL2D;
+
+static PARALLELDEQUE s_aDeques[MAX_WORKERS];
+static PARALLELTOPOLOGY s_topology;				// Loaded by StartPool, under s_csStart
+static CRITICAL_SECTION s_csStart;
+static volatile LONG s_lStarted = 0;
+static DWORD s_dwTlsWorker = TlsAlloc();		// Pool worker index + 1, 0 elsewhere
+
+static BOOL InitDeques()
+{
+	for ( int iDeque = 0; iDeque < MAX_WORKERS; iDeque++ )
+	{
+		InitializeCriticalSection( &s_aDeques[iDeque].cs );
+		s_aDeques[iDeque].iRanges = 0;
+		s_aDeques[iDeque].hWake = NULL;
+		s_aDeques[iDeque].lSleeping = 0;
+		s_aDeques[iDeque].bRunning = FALSE;
+	}
+
+	InitializeCriticalSection( &s_csStart );
+
+	return TRUE;
+}
+
+static BOOL s_bDequesReady = InitDeques();
+
+//-----------------------------------------------------------
+//	Number of threads ParallelFor will use, one per processor
+//-----------------------------------------------------------
+int GetWorkerCount()
+{
+	static int s_iWorkers = 0;
+
+	if ( s_iWorkers == 0 )
+	{
+		SYSTEM_INFO sysInfo;
+
+		GetSystemInfo( &sysInfo );
+
+		int iWorkers = (int)sysInfo.dwNumberOfProcessors;
+
+		iWorkers = iWorkers < 1 ? 1 : iWorkers;
+		iWorkers = iWorkers > MAX_WORKERS ? MAX_WORKERS : iWorkers;
+
+		s_iWorkers = iWorkers;
+	}
+
+	return s_iWorkers;
+}
+
+static void StartPool();
+
+//------------------------------------------------------------------------
+//	Find the processors of each NUMA node and give each worker one of
+//	them, filling node 0's first. Systems without the NUMA calls, or with
+//	a single node, leave the workers unpinned.
+//
+//	Called once, by StartPool, before any worker exists.
+//------------------------------------------------------------------------
+static void LoadTopology()
+{
+	int iWorkers = GetWorkerCount();
+	int iAssigned = 0;
+	ULONG ulHighest = 0;
+	DWORD_PTR dwProcessMask = 0;
+	DWORD_PTR dwSystemMask = 0;
+
+	memset( &s_topology, 0, sizeof(s_topology) );
+	s_topology.iNodes = 1;
+
+	HMODULE hKernel = GetModuleHandle( "kernel32.dll" );
+	PFNGETNUMAHIGHESTNODENUMBER pfnGetNumaHighestNodeNumber = (PFNGETNUMAHIGHESTNODENUMBER)GetProcAddress( hKernel, "GetNumaHighestNodeNumber" );
+	PFNGETNUMANODEPROCESSORMASK pfnGetNumaNodeProcessorMask = (PFNGETNUMANODEPROCESSORMASK)GetProcAddress( hKernel, "GetNumaNodeProcessorMask" );
+
+	if ( pfnGetNumaHighestNodeNumber != NULL && pfnGetNumaNodeProcessorMask != NULL
+		&& pfnGetNumaHighestNodeNumber( &ulHighest ) && ulHighest > 0
+		&& GetProcessAffinityMask( GetCurrentProcess(), &dwProcessMask, &dwSystemMask ) )
+	{
+		int iNodes = 0;
+
+		for ( ULONG ulNode = 0; ulNode <= ulHighest && iAssigned < iWorkers; ulNode++ )
+		{
+			ULONGLONG ullNodeMask = 0;
+			int iNodeWorkers = 0;
+
+			if ( !pfnGetNumaNodeProcessorMask( (UCHAR)ulNode, &ullNodeMask ) )
+			{
+				continue;
+			}
+
+			for ( int iProcessor = 0; iProcessor < (int)( sizeof(DWORD_PTR) * 8 ) && iAssigned < iWorkers; iProcessor++ )
+			{
+				DWORD_PTR dwMask = (DWORD_PTR)1 << iProcessor;
+
+				if ( ( ullNodeMask & dwMask ) && ( dwProcessMask & dwMask ) )
+				{
+					s_topology.adwMask[iAssigned] = dwMask;
+					s_topology.aiNode[iAssigned] = iNodes;
+					iAssigned++;
+					iNodeWorkers++;
+				}
+			}
+
+			iNodes += iNodeWorkers > 0 ? 1 : 0;
+		}
+
+		s_topology.iNodes = iNodes;
+	}
+
+	//	One node, or processors the masks couldn't reach, gain nothing
+	//	from pinning
+	//-----------------------------------------------------------------------
+	if ( s_topology.iNodes < 2 || iAssigned < iWorkers )
+	{
+		memset( &s_topology, 0, sizeof(s_topology) );
+		s_topology.iNodes = 1;
+	}
+}
+
+//-----------------------------------------------------------
+//	NUMA nodes the workers are spread over, 1 if not NUMA
+//-----------------------------------------------------------
+int GetNodeCount()
+{
+	StartPool();
+
+	return s_topology.iNodes;
+}
+
+int GetWorkerNode( int iWorker )
+{
+	StartPool();
+
+	return s_topology.aiNode[iWorker];
+}
+
+//------------------------------------------------------------------------
+//	Deque operations
+//
+//	Push fails when the deque is full, and the caller runs the range
+//	itself. Take finds the newest (bOwner) or oldest range it may run:
+//	only pOnly's if that is given, and never another worker's pinned
+//	range.
+//------------------------------------------------------------------------
+static BOOL Push( int iDeque, const PARALLELRANGE& range )
+{
+	PARALLELDEQUE* pDeque = &s_aDeques[iDeque];
+	BOOL bPushed = FALSE;
+
+	EnterCriticalSection( &pDeque->cs );
+
+	if ( pDeque->iRanges < PARALLEL_DEQUE_SIZE )
+	{
+		pDeque->aRanges[pDeque->iRanges++] = range;
+		bPushed = TRUE;
+	}
+
+	LeaveCriticalSection( &pDeque->cs );
+
+	return bPushed;
+}
+
+static BOOL Take( int iDeque, BOOL bOwner, const PARALLELJOB* pOnly, PARALLELRANGE* pRange )
+{
+	PARALLELDEQUE* pDeque = &s_aDeques[iDeque];
+	BOOL bTaken = FALSE;
+
+	EnterCriticalSection( &pDeque->cs );
+
+	for ( int iScan = 0; iScan < pDeque->iRanges && !bTaken; iScan++ )
+	{
+		int iRange = bOwner ? pDeque->iRanges - 1 - iScan : iScan;
+		const PARALLELRANGE& range = pDeque->aRanges[iRange];
+
+		if ( ( pOnly == NULL || range.pJob == pOnly ) && ( bOwner || !range.bPinned ) )
+		{
+			*pRange = range;
+			memmove( &pDeque->aRanges[iRange], &pDeque->aRanges[iRange + 1], ( pDeque->iRanges - iRange - 1 ) * sizeof(PARALLELRANGE) );
+			pDeque->iRanges--;
+			bTaken = TRUE;
+		}
+	}
+
+	LeaveCriticalSection( &pDeque->cs );
+
+	return bTaken;
+}
+
+//	Wake one sleeping pool worker, or iWorker's if given
+//---------------------------------------------------------
+static void Wake( int iWorker )
+{
+	if ( iWorker > 0 )
+	{
+		SetEvent( s_aDeques[iWorker].hWake );
+		return;
+	}
+
+	for ( int iPool = 1; iPool < GetWorkerCount(); iPool++ )
+	{
+		if ( s_aDeques[iPool].lSleeping != 0 )
+		{
+			SetEvent( s_aDeques[iPool].hWake );
+			return;
+		}
+	}
+}
+
+//	The calling thread's own deque, which is also its worker index
+//--------------------------------------------------------------------
+static int CurrentWorker()
+{
+	int iSlot = (int)(INT_PTR)TlsGetValue( s_dwTlsWorker );
+
+	return iSlot > 0 ? iSlot - 1 : 0;
+}
+
+//	Own deque first, newest range, then the oldest of anyone else's
+//--------------------------------------------------------------------
+static BOOL FindWork( int iWorker, const PARALLELJOB* pOnly, PARALLELRANGE* pRange )
+{
+	if ( Take( iWorker, TRUE, pOnly, pRange ) )
+	{
+		return TRUE;
+	}
+
+	int iWorkers = GetWorkerCount();
+
+	for ( int iVictim = 1; iVictim < iWorkers + 1; iVictim++ )
+	{
+		if ( Take( ( iWorker + iVictim ) % iWorkers, FALSE, pOnly, pRange ) )
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+//------------------------------------------------------------------------
+//	Run a range, first splitting its upper halves off onto this worker's
+//	deque for idle workers to steal, down to the job's grain
+//------------------------------------------------------------------------
+static void RunRange( PARALLELRANGE range, int iWorker )
+{
+	PARALLELJOB* pJob = range.pJob;
+
+	while ( !range.bPinned && range.iLast - range.iFirst > pJob->iGrain )
+	{
+		PARALLELRANGE upper = range;
+
+		upper.iFirst = ( range.iFirst + range.iLast ) / 2;
+
+		if ( !Push( iWorker, upper ) )
+		{
+			break;
+		}
+
+		Wake( 0 );
+		range.iLast = upper.iFirst;
+	}
+
+	for ( int iIndex = range.iFirst; iIndex < range.iLast; iIndex++ )
+	{
+		pJob->pfnTask( iIndex, iWorker, pJob->pContext );
+	}
+
+	InterlockedExchangeAdd( (LONG*)&pJob->lRemaining, -( range.iLast - range.iFirst ) );
+}
+
+//------------------------------------------------------------------------
+//	Run worker iWorker's pinned range on the calling thread, which is
+//	not a pool thread, on that worker's processor. The caller's own
+//	affinity is put back after, so a thread calling in from outside the
+//	pool is only ever pinned while it runs a band.
+//------------------------------------------------------------------------
+static void RunRangeOnCaller( PARALLELRANGE range, int iWorker )
+{
+	HANDLE hThread = GetCurrentThread();
+	DWORD_PTR dwPrevious = s_topology.adwMask[iWorker] != 0 ? SetThreadAffinityMask( hThread, s_topology.adwMask[iWorker] ) : 0;
+
+	RunRange( range, 0 );
+
+	if ( dwPrevious != 0 )
+	{
+		SetThreadAffinityMask( hThread, dwPrevious );
+	}
+}
+
+//------------------------------------------------------------------------
+//	Help with a job until all its items have run
+//
+//	Only the job's own ranges are taken while waiting. A task that is
+//	waiting on a nested job never has another of its job's tasks started
+//	under it on the same worker, so per-worker scratch is never shared.
+//------------------------------------------------------------------------
+static void WaitJob( PARALLELJOB* pJob, int iWorker )
+{
+	PARALLELRANGE range;
+
+	while ( pJob->lRemaining > 0 )
+	{
+		if ( FindWork( iWorker, pJob, &range ) )
+		{
+			RunRange( range, iWorker );
+		}
+		else
+		{
+			//	The last ranges are running elsewhere
+			//--------------------------------------------
+			SwitchToThread();
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+//	A pool worker, running whatever it can find and sleeping when there
+//	is nothing. It sets its sleeping flag before the last look, so a
+//	range pushed after that look always sees the flag and wakes it.
+//------------------------------------------------------------------------
+static unsigned __stdcall WorkerThreadProc( void* pParam )
+{
+	int iWorker = (int)(INT_PTR)pParam;
+	PARALLELDEQUE* pDeque = &s_aDeques[iWorker];
+	PARALLELRANGE range;
+
+	TlsSetValue( s_dwTlsWorker, (LPVOID)(INT_PTR)( iWorker + 1 ) );
+	CTrace::BindWorker( iWorker );
+
+	for ( ;; )
+	{
+		if ( FindWork( iWorker, NULL, &range ) )
+		{
+			RunRange( range, iWorker );
+			continue;
+		}
+
+		InterlockedExchange( (LONG*)&pDeque->lSleeping, 1 );
+
+		if ( FindWork( iWorker, NULL, &range ) )
+		{
+			InterlockedExchange( (LONG*)&pDeque->lSleeping, 0 );
+			RunRange( range, iWorker );
+			continue;
+		}
+
+		WaitForSingleObject( pDeque->hWake, INFINITE );
+		InterlockedExchange( (LONG*)&pDeque->lSleeping, 0 );
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------
+//	Start the pool's GetWorkerCount() - 1 threads on first use, each
+//	pinned to its processor when the workers are spread over NUMA nodes.
+//	They run until the process ends.
+//------------------------------------------------------------------------
+static void StartPool()
+{
+	if ( s_lStarted != 0 )
+	{
+		return;
+	}
+
+	EnterCriticalSection( &s_csStart );
+
+	if ( s_lStarted == 0 )
+	{
+		LoadTopology();
+
+		for ( int iWorker = 1; iWorker < GetWorkerCount(); iWorker++ )
+		{
+			s_aDeques[iWorker].hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+			HANDLE hThread = (HANDLE)_beginthreadex( NULL, 0, WorkerThreadProc, (void*)(INT_PTR)iWorker, CREATE_SUSPENDED, NULL );
+
+			if ( hThread != NULL )
+			{
+				if ( s_topology.adwMask[iWorker] != 0 )
+				{
+					SetThreadAffinityMask( hThread, s_topology.adwMask[iWorker] );
+				}
+
+				ResumeThread( hThread );
+				CloseHandle( hThread );
+
+				s_aDeques[iWorker].bRunning = TRUE;
+			}
+		}
+
+		InterlockedExchange( (LONG*)&s_lStarted, 1 );
+	}
+
+	LeaveCriticalSection( &s_csStart );
+}
+
+//------------------------------------------------------------------------
+//	Run pfnTask for every index in [0, iCount), blocking until all done
+//
+//	The whole range goes on the calling thread's deque and is split in
+//	halves as workers steal it, so an uneven job balances itself. The
+//	caller works on it too, as worker 0 or, from inside a task, as the
+//	pool worker it is. Nested calls therefore share the one pool, and a
+//	single processor machine never creates a thread at all.
+//------------------------------------------------------------------------
+void ParallelFor( int iCount, PFNPARALLELTASK pfnTask, void* pContext )
+{
+	if ( iCount <= 0 )
+	{
+		return;
+	}
+
+	int iWorkers = GetWorkerCount();
+	int iWorker = CurrentWorker();
+
+	if ( iWorkers == 1 || iCount == 1 )
+	{
+		for ( int iIndex = 0; iIndex < iCount; iIndex++ )
+		{
+			pfnTask( iIndex, iWorker, pContext );
+		}
+
+		return;
+	}
+
+	StartPool();
+
+	PARALLELJOB job;
+	PARALLELRANGE range;
+
+	job.pfnTask = pfnTask;
+	job.pContext = pContext;
+	job.iGrain = iCount / ( iWorkers * PARALLEL_SPLITS ) > 1 ? iCount / ( iWorkers * PARALLEL_SPLITS ) : 1;
+	job.lRemaining = iCount;
+
+	range.pJob = &job;
+	range.iFirst = 0;
+	range.iLast = iCount;
+	range.bPinned = FALSE;
+
+	RunRange( range, iWorker );
+	WaitJob( &job, iWorker );
+}
+
+//------------------------------------------------------------------------
+//	ParallelFor over an iCountX by iCountY array of tiles, x fastest, so
+//	a stolen range is a run of whole rows of tiles
+//------------------------------------------------------------------------
+static void Task2D( int iIndex, int iWorker, void* pContext )
+{
+	PARALLEL2D* p2D = (PARALLEL2D*)pContext;
+
+	p2D->pfnTask( iIndex % p2D->iCountX, iIndex / p2D->iCountX, iWorker, p2D->pContext );
+}
+
+void ParallelFor2D( int iCountX, int iCountY, PFNPARALLELTASK2D pfnTask, void* pContext )
+{
+	if ( iCountX <= 0 || iCountY <= 0 )
+	{
+		return;
+	}
+
+	PARALLEL2D task2D;
+
+	task2D.pfnTask = pfnTask;
+	task2D.pContext = pContext;
+	task2D.iCountX = iCountX;
+
+	ParallelFor( iCountX * iCountY, Task2D, &task2D );
+}
+
+//------------------------------------------------------------------------
+//	Run pfnTask for every index in [0, iCount), each on a fixed worker
+//
+//	Worker w owns the w-th of GetWorkerCount() equal runs of indices, so
+//	a pass over the same count always puts an index on the same thread.
+//	Used over a grid's bands, the memory a worker first touches when the
+//	grid is filled is the memory it works on in every pass after, and on
+//	a NUMA system each pool worker is pinned to a processor of its own,
+//	node by node, so that memory stays on its node.
+//
+//	Each run goes on its worker's deque pinned, where no other worker
+//	can steal it. Called from inside a task, where the caller is not
+//	worker 0, it is a plain ParallelFor.
+//------------------------------------------------------------------------
+void ParallelForOwned( int iCount, PFNPARALLELTASK pfnTask, void* pContext )
+{
+	if ( iCount <= 0 )
+	{
+		return;
+	}
+
+	int iWorkers = GetWorkerCount();
+
+	if ( iWorkers == 1 || CurrentWorker() != 0 )
+	{
+		ParallelFor( iCount, pfnTask, pContext );
+		return;
+	}
+
+	StartPool();
+
+	PARALLELJOB job;
+	PARALLELRANGE range;
+
+	job.pfnTask = pfnTask;
+	job.pContext = pContext;
+	job.iGrain = 1;
+	job.lRemaining = iCount;
+
+	range.pJob = &job;
+	range.bPinned = TRUE;
+
+	for ( int iWorker = iWorkers - 1; iWorker >= 0; iWorker-- )
+	{
+		range.iFirst = (int)( (LONGLONG)iCount * iWorker / iWorkers );
+		range.iLast = (int)( (LONGLONG)iCount * ( iWorker + 1 ) / iWorkers );
+
+		if ( range.iFirst == range.iLast )
+		{
+			continue;
+		}
+
+		if ( iWorker > 0 && s_aDeques[iWorker].bRunning && Push( iWorker, range ) )
+		{
+			Wake( iWorker );
+		}
+		else
+		{
+			//	Worker 0's share, or one no pool thread can take, is the
+			//	caller's, on the processor of the worker it belongs to
+			//----------------------------------------------------------------
+			RunRangeOnCaller( range, iWorker );
+		}
+	}
+
+	WaitJob( &job, 0 );
+}
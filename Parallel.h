@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------------------
+
+	Parallel.h
+
+	Provides the work-stealing scheduler used to spread terrain operations
+	across the available processors
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+//-----------------
+//	Definitions
+//-----------------
+#define MAX_WORKERS 64
+
+//	Task callback, iIndex is the work item, iWorker identifies the calling
+//	thread in [0, GetWorkerCount()) so tasks can keep per-thread scratch
+//--------------------------------------------------------------------------
+typedef void (*PFNPARALLELTASK)( int iIndex, int iWorker, void* pContext );
+
+//	As PFNPARALLELTASK, for tile (iX, iY) of a 2D range
+//---------------------------------------------------------
+typedef void (*PFNPARALLELTASK2D)( int iX, int iY, int iWorker, void* pContext );
+
+//-----------------
+//	Functions
+//-----------------
+int GetWorkerCount();
+int GetNodeCount();
+int GetWorkerNode( int iWorker );
+void ParallelFor( int iCount, PFNPARALLELTASK pfnTask, void* pContext );
+void ParallelFor2D( int iCountX, int iCountY, PFNPARALLELTASK2D pfnTask, void* pContext );
+void ParallelForOwned( int iCount, PFNPARALLELTASK pfnTask, void* pContext );
+
+#endif
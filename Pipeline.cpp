@@ -0,0 +1,1477 @@
+/*--------------------------------------------------------------------------------
+
+	Pipeline.cpp
+
+	Provides a declarative chain of terrain operations, read from a small
+	config file and executed with adjacent per-cell stages fused together
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <ctype.h>
+
+#include "Pipeline.h"
+#include "Erosion.h"
+#include "Drainage.h"
+#include "Contour.h"
+#include "Archive.h"
+#include "Arena.h"
+#include "FaultKernel.h"
+#include "Parallel.h"
+#include "Spectral.h"
+#include "Trace.h"
+extern CLogFunc g_LogFunc;
+
+//-----------------
+//	Definitions
+//-----------------
+
+//	One band of a fused sweep, see RunFused
+//---------------------------------------------
+typedef struct tagPIPELINESWEEP
+{
+	CTerrain*	pTerrain;
+	int			iBandStart;
+	int			iBandEnd;
+	BOOL		bQuantize;
+	BOOL		bWriteGrid;
+	double		dMin;
+	double		dRatio;
+	int			iMinHeight;
+	const double*		pdHeights;		// Column-major heights to map, NULL reads the grid
+	const CQuantizer*	pQuantizer;		// Prepared to map pdHeights
+	BYTE*		pbRows;				// The band's pixels, if anything is saved
+	DWORD*		pdwHistograms;		// 256 bins per worker
+} PIPELINESWEEP;
+
+//-------------------------------------
+//
+//	CLASS: CPipeline implementation
+//
+//-------------------------------------
+CPipeline::CPipeline()
+{
+	m_pWriter = NULL;
+	m_pCache = NULL;
+	Clear();
+}
+
+CPipeline::~CPipeline()
+{
+}
+
+void CPipeline::Clear()
+{
+	m_iStages = 0;
+	m_iGridPasses = 0;
+	m_szError[0] = 0;
+}
+
+int CPipeline::StageCount()
+{
+	return m_iStages;
+}
+
+LPCSTR CPipeline::GetError()
+{
+	return m_szError;
+}
+
+//-----------------------------------------------------------------
+//	Send saves through an asynchronous writer, NULL writes them
+//	synchronously as they are encoded
+//-----------------------------------------------------------------
+void CPipeline::SetWriter( CAsyncWriter* pWriter )
+{
+	m_pWriter = pWriter;
+}
+
+//-----------------------------------------------------------------
+//	Look generation up in a result cache first, NULL runs it all
+//-----------------------------------------------------------------
+void CPipeline::SetCache( CResultCache* pCache )
+{
+	m_pCache = pCache;
+}
+
+BOOL CPipeline::AddStage( const PIPELINESTAGE& stage )
+{
+	if ( m_iStages >= PIPELINE_MAX_STAGES )
+	{
+		sprintf( m_szError, "Too many stages, at most %d are supported", PIPELINE_MAX_STAGES );
+		return FALSE;
+	}
+
+	m_aStages[m_iStages++] = stage;
+
+	return TRUE;
+}
+
+//--------------------------------------------------------------------
+//	Read a pipeline config, one operation per line, '#' comments
+//
+//	e.g.	clear 128
+//			faults 512 10 1 retain
+//			blur 2
+//			quantize
+//			stats
+//			save fractal01.tga
+//--------------------------------------------------------------------
+BOOL CPipeline::Load( LPCSTR szFilename )
+{
+	FILE* file;
+	char acLine[MAX_PATH];
+	int iLine = 0;
+
+	Clear();
+
+	if ( ( file = fopen( szFilename, "r" ) ) == NULL )
+	{
+		sprintf( m_szError, "Unable to open %.200s", szFilename );
+		return FALSE;
+	}
+
+	while ( fgets( acLine, sizeof(acLine), file ) != NULL )
+	{
+		iLine++;
+
+		if ( !ParseLine( acLine, iLine ) )
+		{
+			fclose( file );
+			return FALSE;
+		}
+	}
+
+	fclose( file );
+
+	return TRUE;
+}
+
+BOOL CPipeline::ParseLine( LPSTR szLine, int iLine )
+{
+	static const char* s_szSeps = " \t\r\n";
+
+	char* pcComment = strchr( szLine, '#' );
+
+	if ( pcComment != NULL )
+	{
+		*pcComment = 0;
+	}
+
+	char* szOp = strtok( szLine, s_szSeps );
+
+	if ( szOp == NULL )
+	{
+		return TRUE;
+	}
+
+	PIPELINESTAGE stage;
+	char* aszArgs[PIPELINE_MAX_ARGS];
+	int iArgs = 0;
+
+	memset( &stage, 0, sizeof(stage) );
+
+	while ( iArgs < PIPELINE_MAX_ARGS && ( aszArgs[iArgs] = strtok( NULL, s_szSeps ) ) != NULL )
+	{
+		iArgs++;
+	}
+
+	if ( strcmp( szOp, "clear" ) == 0 && iArgs == 1 )
+	{
+		stage.iOp = PIPE_CLEAR;
+		stage.aiArgs[0] = atoi( aszArgs[0] );
+	}
+	else if ( strcmp( szOp, "layout" ) == 0 && iArgs == 1 )
+	{
+		stage.iOp = PIPE_LAYOUT;
+
+		if ( strcmp( aszArgs[0], "row" ) == 0 )
+		{
+			stage.aiArgs[0] = GRID_LAYOUT_ROW;
+		}
+		else if ( strcmp( aszArgs[0], "column" ) == 0 )
+		{
+			stage.aiArgs[0] = GRID_LAYOUT_COLUMN;
+		}
+		else if ( strcmp( aszArgs[0], "tiled" ) == 0 )
+		{
+			stage.aiArgs[0] = GRID_LAYOUT_TILED;
+		}
+		else
+		{
+			sprintf( m_szError, "Line %d: unknown layout '%.64s'", iLine, aszArgs[0] );
+			return FALSE;
+		}
+	}
+	else if ( strcmp( szOp, "faults" ) == 0 && iArgs >= 3 )
+	{
+		stage.iOp = PIPE_FAULTS;
+		stage.aiArgs[0] = atoi( aszArgs[0] );
+		stage.aiArgs[1] = atoi( aszArgs[1] );
+		stage.aiArgs[2] = atoi( aszArgs[2] );
+
+		for ( int iFlag = 3; iFlag < iArgs; iFlag++ )
+		{
+			if ( strcmp( aszArgs[iFlag], "interpolate" ) == 0 )
+			{
+				stage.dwFlags |= PIPE_FLAG_INTERPOLATE;
+			}
+			else if ( strcmp( aszArgs[iFlag], "logistic" ) == 0 )
+			{
+				stage.dwFlags |= PIPE_FLAG_LOGISTIC;
+
+				if ( iFlag + 1 < iArgs && isdigit( (unsigned char)aszArgs[iFlag + 1][0] ) )
+				{
+					stage.fLogM = (FLOAT)atof( aszArgs[++iFlag] );
+				}
+
+				if ( stage.fLogM > 4.f )
+				{
+					sprintf( m_szError, "Line %d: logistic M must be at most 4", iLine );
+					return FALSE;
+				}
+			}
+			else if ( strcmp( aszArgs[iFlag], "retain" ) == 0 )
+			{
+				stage.dwFlags |= PIPE_FLAG_RETAIN;
+			}
+			else if ( strcmp( aszArgs[iFlag], "seed" ) == 0 && iFlag + 1 < iArgs )
+			{
+				stage.dwSeed = (DWORD)strtoul( aszArgs[++iFlag], NULL, 10 );
+			}
+			else if ( strcmp( aszArgs[iFlag], "profile" ) == 0 && iFlag + 1 < iArgs && ParseFaultProfile( aszArgs[iFlag + 1] ) >= 0 )
+			{
+				stage.iProfile = ParseFaultProfile( aszArgs[++iFlag] );
+
+				if ( iFlag + 1 < iArgs && isdigit( (unsigned char)aszArgs[iFlag + 1][0] ) )
+				{
+					stage.fArg = (FLOAT)atof( aszArgs[++iFlag] );
+				}
+			}
+			else if ( strcmp( aszArgs[iFlag], "checkpoint" ) == 0 && iFlag + 1 < iArgs )
+			{
+				strncpy( stage.szFilename, aszArgs[++iFlag], MAX_PATH - 1 );
+
+				if ( iFlag + 1 < iArgs && isdigit( (unsigned char)aszArgs[iFlag + 1][0] ) )
+				{
+					stage.aiArgs[3] = atoi( aszArgs[++iFlag] );
+				}
+			}
+			else
+			{
+				sprintf( m_szError, "Line %d: unknown faults option '%.64s'", iLine, aszArgs[iFlag] );
+				return FALSE;
+			}
+		}
+	}
+	else if ( strcmp( szOp, "spectral" ) == 0 && ( iArgs == 1 || iArgs == 2 ) )
+	{
+		stage.iOp = PIPE_SPECTRAL;
+		stage.fArg = (FLOAT)atof( aszArgs[0] );
+		stage.aiArgs[0] = iArgs == 2 ? atoi( aszArgs[1] ) : 0;
+	}
+	else if ( strcmp( szOp, "resume" ) == 0 && ( iArgs == 1 || iArgs == 2 ) )
+	{
+		stage.iOp = PIPE_RESUME;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+		stage.aiArgs[0] = iArgs == 2 ? atoi( aszArgs[1] ) : 0;
+	}
+	else if ( strcmp( szOp, "blur" ) == 0 && iArgs == 1 )
+	{
+		stage.iOp = PIPE_BLUR;
+		stage.aiArgs[0] = atoi( aszArgs[0] );
+	}
+	else if ( strcmp( szOp, "erode" ) == 0 && iArgs <= 2 )
+	{
+		EROSIONPARAMS params;
+
+		CErosion::DefaultParams( &params );
+
+		stage.iOp = PIPE_ERODE;
+		stage.aiArgs[0] = iArgs > 0 ? atoi( aszArgs[0] ) : params.iPasses;
+		stage.aiArgs[1] = iArgs > 1 ? atoi( aszArgs[1] ) : (int)params.dwSeed;
+	}
+	else if ( strcmp( szOp, "fill" ) == 0 && iArgs == 0 )
+	{
+		stage.iOp = PIPE_FILL;
+	}
+	else if ( strcmp( szOp, "flow" ) == 0 && iArgs == 1 )
+	{
+		stage.iOp = PIPE_FLOW;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+	}
+	else if ( strcmp( szOp, "contours" ) == 0 && ( iArgs == 2 || iArgs == 3 ) )
+	{
+		stage.iOp = PIPE_CONTOURS;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+		stage.aiArgs[0] = atoi( aszArgs[1] );
+		stage.aiArgs[1] = iArgs == 3 ? atoi( aszArgs[2] ) : -1;
+	}
+	else if ( strcmp( szOp, "quantize" ) == 0 && ParseMapping( aszArgs, iArgs, &stage.quantize ) )
+	{
+		stage.iOp = PIPE_QUANTIZE;
+	}
+	else if ( strcmp( szOp, "stats" ) == 0 && iArgs == 0 )
+	{
+		stage.iOp = PIPE_STATS;
+	}
+	else if ( strcmp( szOp, "save" ) == 0 && iArgs == 1 )
+	{
+		stage.iOp = PIPE_SAVE;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+	}
+	else if ( strcmp( szOp, "archive" ) == 0 && iArgs == 5 )
+	{
+		stage.iOp = PIPE_ARCHIVE;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+
+		for ( int iArg = 0; iArg < 4; iArg++ )
+		{
+			stage.aiArgs[iArg] = atoi( aszArgs[iArg + 1] );
+		}
+	}
+	else if ( strcmp( szOp, "raw16" ) == 0 && iArgs >= 1 && ParseMapping( aszArgs + 1, iArgs - 1, &stage.quantize ) )
+	{
+		stage.iOp = PIPE_RAW16;
+		strncpy( stage.szFilename, aszArgs[0], MAX_PATH - 1 );
+	}
+	else
+	{
+		sprintf( m_szError, "Line %d: unknown operation or wrong arguments for '%.64s'", iLine, szOp );
+		return FALSE;
+	}
+
+	if ( !AddStage( stage ) )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	A quantize mapping and its arguments, none meaning linear
+//
+//	e.g.	percentile 2 98
+//			gamma 1.5
+//------------------------------------------------------------------------------
+BOOL CPipeline::ParseMapping( char** aszArgs, int iArgs, QUANTIZEPARAMS* pParams )
+{
+	CQuantizer::DefaultParams( pParams );
+
+	if ( iArgs == 0 )
+	{
+		return TRUE;
+	}
+
+	pParams->iMapping = CQuantizer::ParseMapping( aszArgs[0] );
+
+	switch ( pParams->iMapping )
+	{
+		case QUANTIZE_PERCENTILE:
+			if ( iArgs == 3 )
+			{
+				pParams->fLow = (FLOAT)atof( aszArgs[1] );
+				pParams->fHigh = (FLOAT)atof( aszArgs[2] );
+			}
+			return ( iArgs == 1 || iArgs == 3 ) && pParams->fLow >= 0.f && pParams->fLow < pParams->fHigh && pParams->fHigh <= 100.f;
+
+		case QUANTIZE_GAMMA:
+			if ( iArgs == 2 )
+			{
+				pParams->fGamma = (FLOAT)atof( aszArgs[1] );
+			}
+			return iArgs == 2 && pParams->fGamma > 0.f;
+
+		case QUANTIZE_LINEAR:
+		case QUANTIZE_EQUALIZE:
+			return iArgs == 1;
+	}
+
+	return FALSE;
+}
+
+//----------------------------------------------------------
+//	Stages that only ever look at one cell at a time, and
+//	so can share a single sweep over the grid
+//----------------------------------------------------------
+BOOL CPipeline::IsPerCell( int iOp )
+{
+	return iOp == PIPE_QUANTIZE || iOp == PIPE_STATS || iOp == PIPE_SAVE;
+}
+
+//------------------------------------------------------------------------------
+//	How many leading stages only shape the grid, and so can come from the
+//	result cache
+//
+//	The cache holds the BYTE grid, so a raw16 stage that would read retained
+//	heights ends the prefix before the stage that retained them, or its
+//	levels would come from the 8 bit grid on a miss and a hit alike
+//------------------------------------------------------------------------------
+int CPipeline::CachedStages()
+{
+	int iRetainedFrom = -1;
+
+	for ( int iStage = 0; iStage < m_iStages; iStage++ )
+	{
+		const PIPELINESTAGE& stage = m_aStages[iStage];
+
+		switch ( stage.iOp )
+		{
+			case PIPE_RAW16:
+				return iRetainedFrom >= 0 ? iRetainedFrom : iStage;
+
+			case PIPE_SAVE:
+			case PIPE_STATS:
+			case PIPE_ARCHIVE:
+			case PIPE_RESUME:
+			case PIPE_FLOW:
+			case PIPE_CONTOURS:
+				return iStage;
+
+			case PIPE_FAULTS:
+				if ( stage.szFilename[0] != 0 )
+				{
+					return iStage;
+				}
+
+				iRetainedFrom = ( stage.dwFlags & PIPE_FLAG_RETAIN ) ? iStage : -1;
+			break;
+
+			case PIPE_SPECTRAL:
+				iRetainedFrom = iStage;
+			break;
+
+			case PIPE_LAYOUT:
+			break;
+
+			default:
+				iRetainedFrom = -1;
+			break;
+		}
+	}
+
+	return m_iStages;
+}
+
+//------------------------------------------------------------------------------
+//	Hash the first iStages stages and the state they start from
+//
+//	Returns FALSE when they cannot be cached, because they place faults by
+//	the clock. The starting grid is only hashed if something reads it
+//	before a clear or spectral stage replaces it, and the logistic
+//	function's state only if a stage uses it.
+//------------------------------------------------------------------------------
+BOOL CPipeline::CacheKey( CTerrain* pTerrain, int iStages, ULONGLONG* pullKey )
+{
+	DWORD adwTile[5];
+	BOOL bReadsGrid = TRUE;
+	BOOL bLogistic = FALSE;
+	int iStage;
+
+	adwTile[0] = RESULTCACHE_VERSION;
+	adwTile[1] = (DWORD)pTerrain->TileSize();
+	adwTile[2] = (DWORD)pTerrain->MinHeight();
+	adwTile[3] = (DWORD)pTerrain->MaxHeight();
+	adwTile[4] = (DWORD)pTerrain->HeightGrid().Layout();
+
+	ULONGLONG ullKey = CResultCache::Hash( 0, adwTile, sizeof(adwTile) );
+
+	for ( iStage = 0; iStage < iStages; iStage++ )
+	{
+		const PIPELINESTAGE& stage = m_aStages[iStage];
+
+		if ( stage.iOp == PIPE_FAULTS )
+		{
+			if ( !( stage.dwFlags & PIPE_FLAG_LOGISTIC ) && stage.dwSeed == 0 )
+			{
+				return FALSE;
+			}
+
+			bLogistic = bLogistic || ( stage.dwFlags & PIPE_FLAG_LOGISTIC ) != 0;
+		}
+
+		ullKey = CResultCache::Hash( ullKey, &stage, sizeof(PIPELINESTAGE) );
+	}
+
+	for ( iStage = 0; iStage < iStages && m_aStages[iStage].iOp == PIPE_LAYOUT; iStage++ )
+	{
+	}
+
+	if ( iStage < iStages && ( m_aStages[iStage].iOp == PIPE_CLEAR || m_aStages[iStage].iOp == PIPE_SPECTRAL ) )
+	{
+		bReadsGrid = FALSE;
+	}
+
+	if ( bReadsGrid )
+	{
+		int iCells = pTerrain->TileSize() * pTerrain->TileSize();
+
+		ullKey = CResultCache::Hash( ullKey, pTerrain->HeightGrid().Cells(), iCells );
+	}
+
+	if ( bLogistic )
+	{
+		FLOAT afLogistic[2];
+
+		afLogistic[0] = g_LogFunc.M();
+		afLogistic[1] = g_LogFunc.LastIterate();
+
+		ullKey = CResultCache::Hash( ullKey, afLogistic, sizeof(afLogistic) );
+	}
+
+	*pullKey = ullKey;
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Bring the grid up to date and store it in the result cache under ullKey,
+//	FALSE only if the grid could not be brought up to date
+//------------------------------------------------------------------------------
+BOOL CPipeline::StoreCached( CTerrain* pTerrain, ULONGLONG ullKey, double*& pdRetained, int& iPendingClear )
+{
+	if ( iPendingClear >= 0 )
+	{
+		pTerrain->ClearGrid( iPendingClear );
+		iPendingClear = -1;
+		m_iGridPasses++;
+	}
+
+	if ( !Materialize( pTerrain, pdRetained ) )
+	{
+		return FALSE;
+	}
+
+	//	A failed store costs the next run a miss, it is not an error
+	//-------------------------------------------------------------------
+	m_pCache->Store( ullKey, pTerrain, g_LogFunc.LastIterate() );
+	m_iGridPasses++;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------
+//	Quantize a retained grid into the BYTE grid and drop it,
+//	for stages that need the grid itself
+//-------------------------------------------------------------
+BOOL CPipeline::Materialize( CTerrain* pTerrain, double*& pdRetained )
+{
+	if ( pdRetained != NULL )
+	{
+		if ( !pTerrain->QuantizeRetained( pdRetained ) )
+		{
+			sprintf( m_szError, "Out of memory for the quantize of a %d cell tile", pTerrain->TileSize() );
+			return FALSE;
+		}
+
+		m_iGridPasses += 2;
+
+		pdRetained = NULL;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Run the pipeline over a terrain tile
+//
+//	bKeepGrid	-	The caller needs the final heights in the tile (e.g. to
+//					draw it), otherwise a final save may skip writing them
+//
+//	pStats may be NULL, and is only filled in by a stats stage
+//------------------------------------------------------------------------------
+BOOL CPipeline::Execute( CTerrain* pTerrain, BOOL bKeepGrid, HWND hWnd, PIPELINESTATS* pStats )
+{
+	//	Scratch comes from this thread's arena and is handed back on return,
+	//	so a run allocates nothing once the arena has grown to fit it
+	//--------------------------------------------------------------------------
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	double* pdRetainBuffer = NULL;
+	double* pdRetained = NULL;
+	BOOL bRangeKnown = FALSE;
+	double dMin = 0.0;
+	double dMax = 0.0;
+	int iPendingClear = -1;
+	int iTileSq = pTerrain->TileSize();
+	BOOL bResult = TRUE;
+
+	m_iGridPasses = 0;
+	m_szError[0] = 0;
+
+	int iStage = 0;
+
+	//	A cache hit stands in for the leading stages, a miss stores their
+	//	grid once they have run
+	//-----------------------------------------------------------------------
+	int iCached = m_pCache != NULL ? CachedStages() : 0;
+	int iStoreAt = -1;
+	ULONGLONG ullKey = 0;
+
+	if ( iCached > 0 && CacheKey( pTerrain, iCached, &ullKey ) )
+	{
+		FLOAT fLogIterate;
+
+		if ( m_pCache->Load( ullKey, pTerrain, &fLogIterate ) )
+		{
+			g_LogFunc.LastIterate() = fLogIterate;
+
+			for ( ; iStage < iCached; iStage++ )
+			{
+				g_LogFunc.M() = m_aStages[iStage].fLogM > 0.f ? m_aStages[iStage].fLogM : g_LogFunc.M();
+			}
+
+			m_iGridPasses++;
+		}
+		else
+		{
+			iStoreAt = iCached;
+		}
+	}
+
+	while ( iStage < m_iStages && bResult )
+	{
+		PIPELINESTAGE& stage = m_aStages[iStage];
+
+		if ( iStage == iStoreAt && !StoreCached( pTerrain, ullKey, pdRetained, iPendingClear ) )
+		{
+			bResult = FALSE;
+			break;
+		}
+
+		if ( IsPerCell( stage.iOp ) )
+		{
+			//	Fuse the whole run of per-cell stages into one sweep, but
+			//	not across the point the cache stores at
+			//---------------------------------------------------------------
+			int iLast = iStage;
+			int iEnd = iStage < iStoreAt ? iStoreAt : m_iStages;
+
+			while ( iLast < iEnd && IsPerCell( m_aStages[iLast].iOp ) )
+			{
+				iLast++;
+			}
+
+			BOOL bWriteGrid = bKeepGrid || iLast == iStoreAt || ( iLast < m_iStages && m_aStages[iLast].iOp != PIPE_CLEAR );
+
+			bResult = RunFused( pTerrain, iStage, iLast, pdRetained, bRangeKnown, dMin, dMax, bWriteGrid, pStats );
+
+			pdRetained = NULL;
+
+			iStage = iLast;
+			continue;
+		}
+
+		switch ( stage.iOp )
+		{
+			case PIPE_CLEAR:
+			{
+				//	A retained fault grid can start from the clear value
+				//	directly, so the BYTE grid is never touched
+				//----------------------------------------------------------
+				pdRetained = NULL;
+
+				if ( iStage + 1 < m_iStages && m_aStages[iStage + 1].iOp == PIPE_FAULTS && ( m_aStages[iStage + 1].dwFlags & PIPE_FLAG_RETAIN ) )
+				{
+					iPendingClear = stage.aiArgs[0];
+				}
+				else
+				{
+					pTerrain->ClearGrid( stage.aiArgs[0] );
+					m_iGridPasses++;
+				}
+			}
+			break;
+
+			case PIPE_FAULTS:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				int iFixedFaultDepth = ( stage.dwFlags & PIPE_FLAG_INTERPOLATE ) ? 0 : stage.aiArgs[1];
+				bool bUseLogisticFunc = ( stage.dwFlags & PIPE_FLAG_LOGISTIC ) != 0;
+
+				pTerrain->SetFaultProfile( stage.iProfile, stage.fArg );
+				pTerrain->SetFaultSeed( stage.dwSeed );
+
+				if ( stage.fLogM > 0.f )
+				{
+					g_LogFunc.M() = stage.fLogM;
+				}
+
+				if ( stage.szFilename[0] != 0 )
+				{
+					//	Checkpointed runs keep their accumulator in the checkpoint
+					//	file and leave the result in the grid
+					//----------------------------------------------------------------
+					if ( iPendingClear >= 0 )
+					{
+						pTerrain->ClearGrid( iPendingClear );
+						iPendingClear = -1;
+						m_iGridPasses++;
+					}
+
+					bResult = pTerrain->GenerateFaultLines( stage.szFilename, stage.aiArgs[3], stage.aiArgs[0], stage.aiArgs[1], stage.aiArgs[2], iFixedFaultDepth, bUseLogisticFunc, ( stage.dwFlags & PIPE_FLAG_RETAIN ) != 0, hWnd );
+
+					if ( !bResult )
+					{
+						sprintf( m_szError, "Unable to checkpoint to %.200s", stage.szFilename );
+					}
+				}
+				else if ( stage.dwFlags & PIPE_FLAG_RETAIN )
+				{
+					if ( pdRetainBuffer == NULL )
+					{
+						pdRetainBuffer = (double*)pArena->Alloc( sizeof(double) * iTileSq * iTileSq );
+					}
+
+					if ( pdRetainBuffer == NULL )
+					{
+						sprintf( m_szError, "Out of memory retaining a %d cell tile", iTileSq );
+						bResult = FALSE;
+						break;
+					}
+
+					pdRetained = pdRetainBuffer;
+
+					if ( iPendingClear >= 0 )
+					{
+						for ( int iCell = 0; iCell < iTileSq * iTileSq; iCell++ )
+						{
+							pdRetained[iCell] = (double)iPendingClear;
+						}
+					}
+					else
+					{
+						pTerrain->HeightGrid().ToColumns( pdRetained );
+					}
+
+					iPendingClear = -1;
+
+					pTerrain->ApplyFaultLines( pdRetained, stage.aiArgs[0], stage.aiArgs[1], stage.aiArgs[2], iFixedFaultDepth, bUseLogisticFunc, hWnd, &dMin, &dMax );
+					bRangeKnown = stage.aiArgs[0] > 0;
+				}
+				else
+				{
+					pTerrain->ApplyFaultLines( NULL, stage.aiArgs[0], stage.aiArgs[1], stage.aiArgs[2], iFixedFaultDepth, bUseLogisticFunc, hWnd, NULL, NULL );
+				}
+
+				pTerrain->SetFaultSeed( 0 );
+				m_iGridPasses += stage.aiArgs[0];
+			}
+			break;
+
+			case PIPE_SPECTRAL:
+			{
+				//	Synthesized heights replace the grid and stay retained, so a
+				//	following quantize reads them directly
+				//------------------------------------------------------------------
+				CSpectralSynth synth;
+
+				iPendingClear = -1;
+
+				if ( pdRetainBuffer == NULL )
+				{
+					pdRetainBuffer = (double*)pArena->Alloc( sizeof(double) * iTileSq * iTileSq );
+				}
+
+				if ( pdRetainBuffer == NULL )
+				{
+					sprintf( m_szError, "Out of memory retaining a %d cell tile", iTileSq );
+					bResult = FALSE;
+					break;
+				}
+
+				pdRetained = pdRetainBuffer;
+				bRangeKnown = FALSE;
+
+				bResult = synth.Synthesize( iTileSq, stage.fArg, (DWORD)stage.aiArgs[0], pdRetained );
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "%.200s", synth.GetError() );
+				}
+
+				m_iGridPasses++;
+			}
+			break;
+
+			case PIPE_LAYOUT:
+			{
+				//	Only the BYTE grid has a layout, a retained grid stays as it is
+				//---------------------------------------------------------------------
+				if ( pTerrain->HeightGrid().Layout() != stage.aiArgs[0] )
+				{
+					bResult = pTerrain->HeightGrid().SetLayout( stage.aiArgs[0] );
+					m_iGridPasses++;
+
+					if ( !bResult && stage.aiArgs[0] == GRID_LAYOUT_TILED && ( pTerrain->TileSize() % GRID_BLOCK ) != 0 )
+					{
+						sprintf( m_szError, "The tiled layout needs a tile size that is a multiple of %d", GRID_BLOCK );
+					}
+					else if ( !bResult )
+					{
+						sprintf( m_szError, "Out of memory changing the layout of a %d cell tile", pTerrain->TileSize() );
+					}
+				}
+			}
+			break;
+
+			case PIPE_RESUME:
+			{
+				//	The checkpoint holds everything, whatever came before is replaced
+				//-----------------------------------------------------------------------
+				pdRetained = NULL;
+				iPendingClear = -1;
+
+				bResult = pTerrain->ResumeFaultLines( stage.szFilename, stage.aiArgs[0], hWnd );
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "Unable to resume from %.200s", stage.szFilename );
+				}
+
+				m_iGridPasses++;
+			}
+			break;
+
+			case PIPE_BLUR:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				pTerrain->Blur( stage.aiArgs[0] );
+				m_iGridPasses += stage.aiArgs[0];
+			}
+			break;
+
+			case PIPE_ERODE:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				CErosion erosion;
+
+				erosion.Params().iPasses = stage.aiArgs[0];
+				erosion.Params().dwSeed = (DWORD)stage.aiArgs[1];
+				bResult = erosion.Erode( pTerrain, NULL );
+				m_iGridPasses += stage.aiArgs[0];
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "%.200s", erosion.GetError() );
+				}
+			}
+			break;
+
+			case PIPE_FILL:
+			case PIPE_FLOW:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				//	A flow fills first, so both leave the filled tile
+				//-------------------------------------------------------
+				CDrainage drainage;
+
+				if ( stage.iOp == PIPE_FILL )
+				{
+					bResult = drainage.Fill( pTerrain, NULL );
+					m_iGridPasses++;
+				}
+				else
+				{
+					bResult = drainage.Flow( pTerrain, NULL ) && drainage.SaveAccumulation( stage.szFilename );
+					m_iGridPasses += 2;
+				}
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "%.200s", drainage.GetError() );
+				}
+			}
+			break;
+
+			case PIPE_CONTOURS:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				CContours contours;
+				CONTOURPARAMS params;
+
+				params.iInterval = stage.aiArgs[0];
+				params.iSeaLevel = stage.aiArgs[1];
+
+				bResult = contours.Extract( pTerrain, params, NULL ) && contours.Save( stage.szFilename );
+				m_iGridPasses++;
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "%.200s", contours.GetError() );
+				}
+			}
+			break;
+
+			case PIPE_ARCHIVE:
+			{
+				if ( !Materialize( pTerrain, pdRetained ) )
+				{
+					bResult = FALSE;
+					break;
+				}
+
+				//	Opened per stage, so several pipelines can fill one world
+				//---------------------------------------------------------------
+				CTileArchive archive;
+
+				bResult = archive.OpenForWrite( stage.szFilename, stage.aiArgs[0], stage.aiArgs[1], iTileSq )
+					&& archive.WriteTile( stage.aiArgs[2], stage.aiArgs[3], pTerrain )
+					&& archive.Close();
+
+				if ( !bResult )
+				{
+					sprintf( m_szError, "%.200s", archive.GetError() );
+				}
+
+				m_iGridPasses++;
+			}
+			break;
+
+			case PIPE_RAW16:
+			{
+				//	Reads the retained grid if there is one, and leaves it
+				//	for the stages that follow
+				//------------------------------------------------------------
+				CQuantizer quantizer;
+				const double* pdHeights = pdRetained;
+				WORD* pwCells = (WORD*)pArena->Alloc( sizeof(WORD) * iTileSq * iTileSq );
+				double* pdColumns = pdHeights == NULL ? (double*)pArena->Alloc( sizeof(double) * iTileSq * iTileSq ) : NULL;
+
+				if ( pwCells == NULL || ( pdHeights == NULL && pdColumns == NULL ) )
+				{
+					sprintf( m_szError, "Out of memory for the raw16 levels of a %d cell tile", iTileSq );
+					bResult = FALSE;
+					break;
+				}
+
+				if ( pdHeights == NULL )
+				{
+					pTerrain->HeightGrid().ToColumns( pdColumns );
+					pdHeights = pdColumns;
+					m_iGridPasses++;
+				}
+				else if ( bRangeKnown )
+				{
+					quantizer.SetRange( dMin, dMax );
+				}
+
+				quantizer.Params() = stage.quantize;
+
+				if ( !quantizer.Quantize( pdHeights, iTileSq, QUANTIZE_TOP_16, pwCells ) )
+				{
+					sprintf( m_szError, "%.200s", quantizer.GetError() );
+					bResult = FALSE;
+					break;
+				}
+
+				m_iGridPasses += quantizer.Passes();
+
+				bResult = SaveRaw16( stage.szFilename, pwCells, iTileSq );
+			}
+			break;
+		}
+
+		iStage++;
+	}
+
+	if ( bResult && iStage == iStoreAt )
+	{
+		bResult = StoreCached( pTerrain, ullKey, pdRetained, iPendingClear );
+	}
+
+	//	Nothing consumed the last stage's output, so it must land in the grid
+	//----------------------------------------------------------------------------
+	if ( bResult && bKeepGrid )
+	{
+		if ( iPendingClear >= 0 )
+		{
+			pTerrain->ClearGrid( iPendingClear );
+			m_iGridPasses++;
+		}
+
+		bResult = Materialize( pTerrain, pdRetained );
+	}
+
+	if ( pStats != NULL )
+	{
+		pStats->iGridPasses = m_iGridPasses;
+	}
+
+	InvalidateRect( NULL, NULL, TRUE );
+
+	return bResult;
+}
+
+//------------------------------------------------------------------------------
+//	Write column-major 16 bit levels as a headerless raw file, little-endian
+//	and rows top first like the tile server's .raw tiles
+//------------------------------------------------------------------------------
+BOOL CPipeline::SaveRaw16( LPCSTR szFilename, const WORD* pwCells, int iTileSq )
+{
+	TRACE_SPAN( "save raw16" );
+	TRACE_BYTES( (ULONGLONG)iTileSq * iTileSq * sizeof(WORD) );
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	WORD* pwRow = (WORD*)pArena->Alloc( sizeof(WORD) * iTileSq );
+
+	if ( pwRow == NULL )
+	{
+		sprintf( m_szError, "Out of memory writing %.200s", szFilename );
+		return FALSE;
+	}
+
+	FILE* file = fopen( szFilename, "wb" );
+
+	if ( file == NULL )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFilename );
+		return FALSE;
+	}
+
+	for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+	{
+		for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+		{
+			pwRow[iXPos] = pwCells[iXPos * iTileSq + iYPos];
+		}
+
+		fwrite( pwRow, sizeof(WORD), iTileSq, file );
+	}
+
+	m_iGridPasses++;
+
+	BOOL bResult = ferror( file ) == 0;
+
+	if ( fclose( file ) != 0 || !bResult )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFilename );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Columns [iBlock * PIPELINE_COLUMNS, ...) of the current band of a sweep
+//------------------------------------------------------------------------------
+void CPipeline::SweepTask( int iBlock, int iWorker, void* pContext )
+{
+	PIPELINESWEEP* pSweep = (PIPELINESWEEP*)pContext;
+	CTerrain* pTerrain = pSweep->pTerrain;
+	int iTileSq = pTerrain->TileSize();
+	DWORD* pdwHistogram = pSweep->pdwHistograms + iWorker * 256;
+	int iXFirst = iBlock * PIPELINE_COLUMNS;
+	int iXLast = iXFirst + PIPELINE_COLUMNS < iTileSq ? iXFirst + PIPELINE_COLUMNS : iTileSq;
+
+	//	Down each column of a column-major grid, along each row otherwise
+	//-----------------------------------------------------------------------
+	BOOL bColumns = pTerrain->HeightGrid().Layout() == GRID_LAYOUT_COLUMN;
+	int iOuterFirst = bColumns ? iXFirst : pSweep->iBandStart;
+	int iOuterLast = bColumns ? iXLast : pSweep->iBandEnd;
+	int iInnerFirst = bColumns ? pSweep->iBandStart : iXFirst;
+	int iInnerLast = bColumns ? pSweep->iBandEnd : iXLast;
+
+	for ( int iOuter = iOuterFirst; iOuter < iOuterLast; iOuter++ )
+	{
+		for ( int iInner = iInnerFirst; iInner < iInnerLast; iInner++ )
+		{
+			int iXPos = bColumns ? iOuter : iInner;
+			int iYPos = bColumns ? iInner : iOuter;
+			int iValue;
+
+			if ( pSweep->pdHeights != NULL )
+			{
+				iValue = pSweep->pQuantizer->Level( pSweep->pdHeights[iXPos * iTileSq + iYPos] );
+			}
+			else
+			{
+				iValue = pTerrain->Grid( iXPos, iYPos );
+
+				if ( pSweep->bQuantize )
+				{
+					iValue = pSweep->dRatio > 0.0 ? (int)( ( (double)iValue - pSweep->dMin ) / pSweep->dRatio ) : pSweep->iMinHeight;
+				}
+			}
+
+			iValue = iValue < 0 ? 0 : ( iValue > 255 ? 255 : iValue );
+
+			if ( pSweep->bWriteGrid )
+			{
+				pTerrain->Grid( iXPos, iYPos ) = (BYTE)iValue;
+			}
+
+			pdwHistogram[iValue]++;
+
+			if ( pSweep->pbRows != NULL )
+			{
+				BYTE* pbPixel = pSweep->pbRows + ( ( pSweep->iBandEnd - 1 - iYPos ) * iTileSq + iXPos ) * 3;
+
+				pbPixel[0] = pbPixel[1] = pbPixel[2] = (BYTE)iValue;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	One sweep over the grid covering stages [iFirst, iLast)
+//
+//	The source is the retained grid if there is one (always quantized), else
+//	the BYTE grid (stretched to the full height range by a quantize stage).
+//	The first quantize stage's mapping is used, linear if there is none.
+//	Only a linear stretch of the BYTE grid is worked out here, any other
+//	mapping comes from a quantizer prepared over the heights, which the
+//	sweep asks for each cell's level as it reaches it, so nothing is
+//	written to the grid ahead of the sweep.
+//	Rows are processed in bands, top of the image first as TGA expects, and
+//	each band's cells are walked in storage order, a column-major grid's
+//	down its columns and the others' along their rows, the columns shared
+//	out to the scheduler on a larger grid. Stats describe the heights leaving the
+//	sweep, wherever the stats stage sits in the run.
+//------------------------------------------------------------------------------
+BOOL CPipeline::RunFused( CTerrain* pTerrain, int iFirst, int iLast, const double* pdRetained, BOOL bRangeKnown, double dMin, double dMax, BOOL bWriteGrid, PIPELINESTATS* pStats )
+{
+	TRACE_SPAN( "fused sweep" );
+
+	int iTileSq = pTerrain->TileSize();
+	BOOL bQuantize = pdRetained != NULL;
+	BOOL bStats = FALSE;
+	QUANTIZEPARAMS mapping;
+	BOOL bMapped = FALSE;
+	FILE* apFiles[PIPELINE_MAX_STAGES];
+	LPCSTR aszFiles[PIPELINE_MAX_STAGES];
+	LPCSTR szFailed = NULL;				// The first file a write or close failed on
+	int iFiles = 0;
+	BYTE* apbOutputs[PIPELINE_MAX_STAGES];
+	LPCSTR aszOutputs[PIPELINE_MAX_STAGES];
+	int iOutputs = 0;
+	DWORD adwHistogram[256];
+	ULONGLONG ullImageSize = TGA_HEADER_SIZE + (ULONGLONG)iTileSq * iTileSq * 3;
+	DWORD dwImageSize = (DWORD)ullImageSize;
+
+	memset( adwHistogram, 0, sizeof(adwHistogram) );
+
+	//	Only go asynchronous if every save in the run can hold a buffer at
+	//	once, or acquiring them would wait on ourselves, and an image fits
+	//	the DWORD a buffer is sized by
+	//------------------------------------------------------------------------
+	int iSaves = 0;
+
+	for ( int iCount = iFirst; iCount < iLast; iCount++ )
+	{
+		iSaves += m_aStages[iCount].iOp == PIPE_SAVE ? 1 : 0;
+	}
+
+	CAsyncWriter* pWriter = m_pWriter != NULL && iSaves <= m_pWriter->BufferCount() && ullImageSize <= MAXDWORD ? m_pWriter : NULL;
+
+	CQuantizer::DefaultParams( &mapping );
+
+	for ( int iStage = iFirst; iStage < iLast; iStage++ )
+	{
+		switch ( m_aStages[iStage].iOp )
+		{
+			case PIPE_QUANTIZE:
+				if ( !bMapped )
+				{
+					mapping = m_aStages[iStage].quantize;
+					bMapped = TRUE;
+				}
+
+				bQuantize = TRUE;
+			break;
+
+			case PIPE_STATS:
+				bStats = TRUE;
+			break;
+		}
+	}
+
+	int iMinHeight = pTerrain->MinHeight();
+	int iMaxHeight = pTerrain->MaxHeight();
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+
+	//	Retained heights, and any stretch but a linear one, are mapped by the
+	//	quantizer as the sweep reaches them
+	//--------------------------------------------------------------------------
+	CQuantizer quantizer;
+	const double* pdHeights = NULL;
+
+	if ( pdRetained != NULL || ( bQuantize && mapping.iMapping != QUANTIZE_LINEAR ) )
+	{
+		pdHeights = pdRetained;
+
+		if ( pdHeights == NULL )
+		{
+			double* pdColumns = (double*)pArena->Alloc( sizeof(double) * iTileSq * iTileSq );
+
+			if ( pdColumns == NULL )
+			{
+				sprintf( m_szError, "Out of memory for the quantize of a %d cell tile", iTileSq );
+				return FALSE;
+			}
+
+			pTerrain->HeightGrid().ToColumns( pdColumns );
+			pdHeights = pdColumns;
+			m_iGridPasses++;
+		}
+		else if ( bRangeKnown )
+		{
+			quantizer.SetRange( dMin, dMax );
+		}
+
+		quantizer.Params() = mapping;
+
+		if ( !quantizer.Prepare( pdHeights, iTileSq, iMaxHeight - iMinHeight > 255 ? 255 : iMaxHeight - iMinHeight ) )
+		{
+			sprintf( m_szError, "%.200s", quantizer.GetError() );
+			return FALSE;
+		}
+
+		m_iGridPasses += quantizer.Passes();
+
+		bQuantize = FALSE;
+	}
+
+	//	A linear stretch of the grid needs only its range
+	//--------------------------------------------------------
+	if ( bQuantize )
+	{
+		TRACE_SPAN( "quantize range" );
+		TRACE_CELLS( (ULONGLONG)iTileSq * iTileSq );
+
+		//	Order doesn't matter for a range, so the grid is read flat
+		//----------------------------------------------------------------
+		const BYTE* pbCells = pTerrain->HeightGrid().Cells();
+
+		dMin = 65536;
+		dMax = -65536;
+
+		for ( int iCell = 0; iCell < iTileSq * iTileSq; iCell++ )
+		{
+			double dValue = (double)pbCells[iCell];
+
+			dMin = dValue < dMin ? dValue : dMin;
+			dMax = dValue > dMax ? dValue : dMax;
+		}
+
+		m_iGridPasses++;
+	}
+
+	//	Each band's columns go to the scheduler PIPELINE_COLUMNS at a time,
+	//	with a histogram per worker. The scratch is taken before any file is
+	//	opened, so running out leaves nothing to undo.
+	//--------------------------------------------------------------------------
+	PIPELINESWEEP sweep;
+	int iWorkers = GetWorkerCount();
+	int iBlocks = ( iTileSq + PIPELINE_COLUMNS - 1 ) / PIPELINE_COLUMNS;
+
+	sweep.pTerrain = pTerrain;
+	sweep.bQuantize = bQuantize;
+	sweep.bWriteGrid = bWriteGrid;
+	sweep.dMin = dMin;
+	sweep.dRatio = ( dMax - dMin ) / (double)( iMaxHeight - iMinHeight );
+	sweep.iMinHeight = iMinHeight;
+	sweep.pdHeights = pdHeights;
+	sweep.pQuantizer = &quantizer;
+	sweep.pbRows = iSaves > 0 ? (BYTE*)pArena->Alloc( PIPELINE_BAND * iTileSq * 3 ) : NULL;
+	sweep.pdwHistograms = (DWORD*)pArena->Alloc( iWorkers * 256 * sizeof(DWORD) );
+
+	if ( ( iSaves > 0 && sweep.pbRows == NULL ) || sweep.pdwHistograms == NULL )
+	{
+		sprintf( m_szError, "Out of memory for the sweep of a %d cell tile", iTileSq );
+		return FALSE;
+	}
+
+	memset( sweep.pdwHistograms, 0, iWorkers * 256 * sizeof(DWORD) );
+
+	for ( int iSave = iFirst; iSave < iLast; iSave++ )
+	{
+		if ( m_aStages[iSave].iOp != PIPE_SAVE )
+		{
+			continue;
+		}
+
+		BYTE head[TGA_HEADER_SIZE];
+
+		FillTgaHeader( head, iTileSq, iTileSq );
+
+		if ( pWriter != NULL )
+		{
+			apbOutputs[iOutputs] = pWriter->Acquire( dwImageSize );
+			aszOutputs[iOutputs] = m_aStages[iSave].szFilename;
+
+			if ( apbOutputs[iOutputs] != NULL )
+			{
+				memcpy( apbOutputs[iOutputs], head, TGA_HEADER_SIZE );
+				iOutputs++;
+				continue;
+			}
+
+			sprintf( m_szError, "Out of memory for the output of %.200s", m_aStages[iSave].szFilename );
+		}
+		else
+		{
+			apFiles[iFiles] = fopen( m_aStages[iSave].szFilename, "wb" );
+			aszFiles[iFiles] = m_aStages[iSave].szFilename;
+
+			if ( apFiles[iFiles] != NULL && fwrite( head, TGA_HEADER_SIZE, 1, apFiles[iFiles] ) != 1 )
+			{
+				fclose( apFiles[iFiles] );
+				apFiles[iFiles] = NULL;
+			}
+
+			if ( apFiles[iFiles] != NULL )
+			{
+				iFiles++;
+				continue;
+			}
+
+			sprintf( m_szError, "Unable to write %.200s", m_aStages[iSave].szFilename );
+		}
+
+		while ( iFiles > 0 )
+		{
+			fclose( apFiles[--iFiles] );
+		}
+
+		while ( iOutputs > 0 )
+		{
+			pWriter->Release( apbOutputs[--iOutputs] );
+		}
+
+		return FALSE;
+	}
+
+	BYTE* pbRows = sweep.pbRows;
+
+	for ( int iBandEnd = iTileSq; iBandEnd > 0; iBandEnd -= PIPELINE_BAND )
+	{
+		int iBandStart = iBandEnd - PIPELINE_BAND < 0 ? 0 : iBandEnd - PIPELINE_BAND;
+
+		TRACE_CELLS( (ULONGLONG)( iBandEnd - iBandStart ) * iTileSq );
+
+		if ( bWriteGrid )
+		{
+			TRACE_BYTES( (ULONGLONG)( iBandEnd - iBandStart ) * iTileSq );
+		}
+
+		sweep.iBandStart = iBandStart;
+		sweep.iBandEnd = iBandEnd;
+
+		if ( CHeightGrid::Parallel( iTileSq ) )
+		{
+			ParallelFor( iBlocks, SweepTask, &sweep );
+		}
+		else
+		{
+			for ( int iBlock = 0; iBlock < iBlocks; iBlock++ )
+			{
+				SweepTask( iBlock, 0, &sweep );
+			}
+		}
+
+		for ( int iFile = 0; iFile < iFiles; iFile++ )
+		{
+			if ( fwrite( pbRows, iTileSq * 3, iBandEnd - iBandStart, apFiles[iFile] ) != (size_t)( iBandEnd - iBandStart ) && szFailed == NULL )
+			{
+				szFailed = aszFiles[iFile];
+			}
+
+			TRACE_BYTES( (ULONGLONG)( iBandEnd - iBandStart ) * iTileSq * 3 );
+		}
+
+		for ( int iOutput = 0; iOutput < iOutputs; iOutput++ )
+		{
+			memcpy( apbOutputs[iOutput] + TGA_HEADER_SIZE + (size_t)( iTileSq - iBandEnd ) * iTileSq * 3, pbRows, (size_t)( iBandEnd - iBandStart ) * iTileSq * 3 );
+		}
+	}
+
+	m_iGridPasses++;
+
+	for ( int iWorker = 0; iWorker < iWorkers; iWorker++ )
+	{
+		for ( int iMerge = 0; iMerge < 256; iMerge++ )
+		{
+			adwHistogram[iMerge] += sweep.pdwHistograms[iWorker * 256 + iMerge];
+		}
+	}
+
+	for ( int iClose = 0; iClose < iFiles; iClose++ )
+	{
+		if ( fclose( apFiles[iClose] ) != 0 && szFailed == NULL )
+		{
+			szFailed = aszFiles[iClose];
+		}
+	}
+
+	for ( int iSubmit = 0; iSubmit < iOutputs; iSubmit++ )
+	{
+		pWriter->Submit( apbOutputs[iSubmit], dwImageSize, aszOutputs[iSubmit] );
+	}
+
+	if ( szFailed != NULL )
+	{
+		sprintf( m_szError, "Unable to write %.200s", szFailed );
+		return FALSE;
+	}
+
+	if ( bStats && pStats != NULL )
+	{
+		double dSum = 0.0;
+
+		pStats->iMin = -1;
+		pStats->iMax = 0;
+
+		for ( int iBin = 0; iBin < 256; iBin++ )
+		{
+			pStats->adwHistogram[iBin] = adwHistogram[iBin];
+
+			if ( adwHistogram[iBin] > 0 )
+			{
+				pStats->iMin = pStats->iMin < 0 ? iBin : pStats->iMin;
+				pStats->iMax = iBin;
+				dSum += (double)iBin * (double)adwHistogram[iBin];
+			}
+		}
+
+		pStats->fMean = (FLOAT)( dSum / ( (double)iTileSq * (double)iTileSq ) );
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,139 @@
+/*--------------------------------------------------------------------------------
+
+	Pipeline.h
+
+	Provides a declarative chain of terrain operations, read from a small
+	config file and executed with adjacent per-cell stages fused together
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+#include "AsyncWriter.h"
+#include "ResultCache.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define PIPELINE_MAX_STAGES		32
+#define PIPELINE_MAX_ARGS		12		// Words after the op on one line
+#define PIPELINE_BAND			8		// Rows per fused band, a cache line of doubles per column
+#define PIPELINE_COLUMNS		64		// Columns of a band per scheduler task
+
+#define PIPE_FLAG_INTERPOLATE	0x01	// faults: interpolate depth from start to finish
+#define PIPE_FLAG_LOGISTIC		0x02	// faults: place faults with the logistic function
+#define PIPE_FLAG_RETAIN		0x04	// faults: retain all values and quantize afterwards
+
+enum PIPELINEOP
+{
+	PIPE_CLEAR,			// clear <value>
+	PIPE_LAYOUT,		// layout <row | column | tiled>
+	PIPE_FAULTS,		// faults <iterations> <depth start> <depth finish> [interpolate] [logistic [M]] [retain] [seed <n>] [profile <name> [width]] [checkpoint <filename> [interval]]
+	PIPE_SPECTRAL,		// spectral <fractal dimension> [seed]
+	PIPE_RESUME,		// resume <checkpoint filename> [interval]
+	PIPE_BLUR,			// blur <passes>
+	PIPE_ERODE,			// erode [passes] [seed]
+	PIPE_FILL,			// fill
+	PIPE_FLOW,			// flow <accumulation filename>
+	PIPE_CONTOURS,		// contours <filename> <interval> [sea level]
+	PIPE_QUANTIZE,		// quantize [linear | percentile [low high] | gamma <exponent> | equalize]
+	PIPE_STATS,			// stats
+	PIPE_SAVE,			// save <filename>
+	PIPE_ARCHIVE,		// archive <filename> <tiles x> <tiles y> <tile x> <tile y>
+	PIPE_RAW16			// raw16 <filename> [mapping as quantize]
+};
+
+typedef struct tagPIPELINESTAGE
+{
+	int		iOp;
+	int		aiArgs[4];
+	FLOAT	fArg;				// spectral: dimension, faults: profile width
+	FLOAT	fLogM;				// faults: M for the logistic function, 0 leaves it
+	int		iProfile;			// faults: FAULTPROFILE
+	DWORD	dwSeed;				// faults: seeds fault placement, 0 takes the clock
+	QUANTIZEPARAMS quantize;	// quantize, raw16: how heights map to levels
+	DWORD	dwFlags;
+	TCHAR	szFilename[MAX_PATH];
+} PIPELINESTAGE;
+
+typedef struct tagPIPELINESTATS
+{
+	int		iMin;
+	int		iMax;
+	FLOAT	fMean;
+	DWORD	adwHistogram[256];
+	int		iGridPasses;		// Full sweeps over the grid the run actually made
+} PIPELINESTATS;
+
+//------------------------------------------------------------------------------
+//	A chain of terrain operations
+//
+//	Per-cell stages (quantize, stats, save) that follow one another run as a
+//	single sweep over the grid in bands of rows, so each cell is quantized,
+//	counted and encoded into the TGA row while it is still in cache. A
+//	retained fault grid feeds that sweep directly and the BYTE grid is only
+//	written when a later stage, or the caller, needs it.
+//
+//	Given a writer, saves are encoded into its buffers and written on its
+//	I/O thread, so the next run can start while this one reaches the disk.
+//
+//	Given a result cache, the stages up to the first that writes anything
+//	(save, stats, archive) or depends on a file (resume, checkpoint) are
+//	looked up by a hash of themselves and whatever state they read. A hit
+//	loads their grid and runs only the rest. Faults placed by the clock
+//	rather than a seed are never cached.
+//------------------------------------------------------------------------------
+class CPipeline
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CPipeline();
+	virtual ~CPipeline();
+
+	//-------------------------
+	//	CPipeline Interface
+	//-------------------------
+	BOOL Load( LPCSTR szFilename );
+	BOOL AddStage( const PIPELINESTAGE& stage );
+	void Clear();
+	int StageCount();
+	LPCSTR GetError();
+	void SetWriter( CAsyncWriter* pWriter );
+	void SetCache( CResultCache* pCache );
+
+	BOOL Execute( CTerrain* pTerrain, BOOL bKeepGrid, HWND hWnd, PIPELINESTATS* pStats );
+
+private:
+	BOOL ParseLine( LPSTR szLine, int iLine );
+	static BOOL ParseMapping( char** aszArgs, int iArgs, QUANTIZEPARAMS* pParams );
+	BOOL RunFused( CTerrain* pTerrain, int iFirst, int iLast, const double* pdRetained, BOOL bRangeKnown, double dMin, double dMax, BOOL bWriteGrid, PIPELINESTATS* pStats );
+	BOOL Materialize( CTerrain* pTerrain, double*& pdRetained );
+	int CachedStages();
+	BOOL CacheKey( CTerrain* pTerrain, int iStages, ULONGLONG* pullKey );
+	BOOL SaveRaw16( LPCSTR szFilename, const WORD* pwCells, int iTileSq );
+	BOOL StoreCached( CTerrain* pTerrain, ULONGLONG ullKey, double*& pdRetained, int& iPendingClear );
+
+	static BOOL IsPerCell( int iOp );
+	static void SweepTask( int iBlock, int iWorker, void* pContext );
+
+	PIPELINESTAGE m_aStages[PIPELINE_MAX_STAGES];
+	int m_iStages;
+	int m_iGridPasses;
+	CAsyncWriter* m_pWriter;
+	CResultCache* m_pCache;
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,680 @@
+/*--------------------------------------------------------------------------------
+
+	Quantize.cpp
+
+	Provides quantization of accumulated double heights down to 8 or 16 bit
+	cells, spread over the worker threads
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Quantize.h"
+#include "Arena.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef QUANTIZE_SIMD
+#define QUANTIZE_SIMD		1		// 0 maps and reduces with the scalar loops only
+#endif
+
+#if QUANTIZE_SIMD
+#include <emmintrin.h>
+#endif
+
+#if QUANTIZE_SIMD
+//------------------------------------------------------------------------------
+//	Eight levels in 0..65535 from four pairs of truncated doubles, as WORDs
+//
+//	SSE2 only packs to signed 16 bits, so the levels are shifted down by
+//	32768 to pack and the top bit flipped back afterwards
+//------------------------------------------------------------------------------
+static inline __m128i PackLevels( __m128d dA, __m128d dB, __m128d dC, __m128d dD )
+{
+	const __m128i iBias = _mm_set1_epi32( 32768 );
+	const __m128i iFlip = _mm_set1_epi16( (short)0x8000 );
+
+	__m128i iLow = _mm_unpacklo_epi64( _mm_cvttpd_epi32( dA ), _mm_cvttpd_epi32( dB ) );
+	__m128i iHigh = _mm_unpacklo_epi64( _mm_cvttpd_epi32( dC ), _mm_cvttpd_epi32( dD ) );
+
+	return _mm_xor_si128( _mm_packs_epi32( _mm_sub_epi32( iLow, iBias ), _mm_sub_epi32( iHigh, iBias ) ), iFlip );
+}
+#endif
+
+//--------------------------------------
+//
+//	CLASS: CQuantizer implementation
+//
+//--------------------------------------
+CQuantizer::CQuantizer()
+{
+	DefaultParams( &m_params );
+
+	m_bRangeKnown = FALSE;
+	m_iPasses = 0;
+	m_dMin = 0.0;
+	m_dMax = 0.0;
+	m_szError[0] = '\0';
+}
+
+CQuantizer::~CQuantizer()
+{
+}
+
+QUANTIZEPARAMS& CQuantizer::Params()
+{
+	return m_params;
+}
+
+void CQuantizer::DefaultParams( QUANTIZEPARAMS* pParams )
+{
+	pParams->iMapping = QUANTIZE_LINEAR;
+	pParams->fLow = QUANTIZE_DEFAULT_LOW;
+	pParams->fHigh = QUANTIZE_DEFAULT_HIGH;
+	pParams->fGamma = QUANTIZE_DEFAULT_GAMMA;
+}
+
+//-----------------------------------------------------
+//	QUANTIZEMAP for a mapping's name, -1 if unknown
+//-----------------------------------------------------
+int CQuantizer::ParseMapping( LPCSTR szName )
+{
+	static const LPCSTR s_aszNames[] = { "linear", "percentile", "gamma", "equalize" };
+
+	for ( int iName = 0; iName < (int)( sizeof(s_aszNames) / sizeof(s_aszNames[0]) ); iName++ )
+	{
+		if ( strcmp( szName, s_aszNames[iName] ) == 0 )
+		{
+			return iName;
+		}
+	}
+
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+//	Give the range of the heights the next Quantize will read, when the
+//	caller has already gathered it, saving a pass
+//------------------------------------------------------------------------------
+void CQuantizer::SetRange( double dMin, double dMax )
+{
+	m_bRangeKnown = TRUE;
+	m_dMin = dMin;
+	m_dMax = dMax;
+}
+
+//------------------------------------------------------------
+//	Passes over the heights the last Quantize made
+//------------------------------------------------------------
+int CQuantizer::Passes()
+{
+	return m_iPasses;
+}
+
+LPCSTR CQuantizer::GetError()
+{
+	return m_szError;
+}
+
+//------------------------------------------------------------------------
+//	Quantize to levels 0..iTop (at most 255) in the grid's own layout
+//------------------------------------------------------------------------
+BOOL CQuantizer::Quantize( const double* pdHeights, int iTileSq, int iTop, CHeightGrid* pGrid )
+{
+	return Run( pdHeights, iTileSq, iTop > 255 ? 255 : iTop, pGrid, NULL );
+}
+
+//------------------------------------------------------------------------
+//	Quantize to levels 0..iTop (at most 65535), column-major like the
+//	heights
+//------------------------------------------------------------------------
+BOOL CQuantizer::Quantize( const double* pdHeights, int iTileSq, int iTop, WORD* pwCells )
+{
+	return Run( pdHeights, iTileSq, iTop > QUANTIZE_TOP_16 ? QUANTIZE_TOP_16 : iTop, NULL, pwCells );
+}
+
+BOOL CQuantizer::Run( const double* pdHeights, int iTileSq, int iTop, CHeightGrid* pGrid, WORD* pwCells )
+{
+	TRACE_SPAN( "quantize" );
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iWorkers = GetWorkerCount();
+	int iCells = iTileSq * iTileSq;
+	int iBlocks = ( iTileSq + QUANTIZE_BLOCK - 1 ) / QUANTIZE_BLOCK;
+	int iWorker;
+
+	if ( !Prepare( pdHeights, iTileSq, iTop ) )
+	{
+		return FALSE;
+	}
+
+	m_pGrid = pGrid;
+	m_pwCells = pwCells;
+
+	//	Mapping, through per-thread columns when the grid is the target
+	//-----------------------------------------------------------------------
+	if ( pGrid != NULL )
+	{
+		for ( iWorker = 0; iWorker < iWorkers; iWorker++ )
+		{
+			m_apwScratch[iWorker] = (WORD*)pArena->Alloc( sizeof(WORD) * QUANTIZE_BLOCK * iTileSq );
+
+			if ( m_apwScratch[iWorker] == NULL )
+			{
+				sprintf( m_szError, "Out of memory for the quantize of a %d cell tile", iTileSq );
+				return FALSE;
+			}
+		}
+	}
+
+	{
+		TRACE_SPAN( "quantize map" );
+		TRACE_CELLS( iCells );
+		TRACE_BYTES( pGrid != NULL ? (ULONGLONG)iCells : (ULONGLONG)iCells * sizeof(WORD) );
+
+		ParallelFor( iBlocks, MapTask, this );
+
+		m_iPasses++;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Range, histogram and mapping for levels 0..iTop of the heights, without
+//	mapping them, the tables left in the calling thread's arena
+//------------------------------------------------------------------------------
+BOOL CQuantizer::Prepare( const double* pdHeights, int iTileSq, int iTop )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	int iWorkers = GetWorkerCount();
+	int iCells = iTileSq * iTileSq;
+	int iBlocks = ( iTileSq + QUANTIZE_BLOCK - 1 ) / QUANTIZE_BLOCK;
+	int iWorker;
+
+	m_pdHeights = pdHeights;
+	m_iTileSq = iTileSq;
+	m_iTop = iTop > QUANTIZE_TOP_16 ? QUANTIZE_TOP_16 : iTop;
+	m_pGrid = NULL;
+	m_pwCells = NULL;
+	m_pdCurve = NULL;
+	m_iPasses = 0;
+
+	//	Range, each thread reducing into its own slot
+	//----------------------------------------------------
+	if ( !m_bRangeKnown )
+	{
+		TRACE_SPAN( "quantize range" );
+		TRACE_CELLS( iCells );
+
+		for ( iWorker = 0; iWorker < iWorkers; iWorker++ )
+		{
+			m_adMin[iWorker] = DBL_MAX;
+			m_adMax[iWorker] = -DBL_MAX;
+		}
+
+		ParallelFor( ( iCells + QUANTIZE_CHUNK - 1 ) / QUANTIZE_CHUNK, RangeTask, this );
+
+		m_dMin = m_adMin[0];
+		m_dMax = m_adMax[0];
+
+		for ( iWorker = 1; iWorker < iWorkers; iWorker++ )
+		{
+			m_dMin = m_adMin[iWorker] < m_dMin ? m_adMin[iWorker] : m_dMin;
+			m_dMax = m_adMax[iWorker] > m_dMax ? m_adMax[iWorker] : m_dMax;
+		}
+
+		m_iPasses++;
+	}
+
+	m_bRangeKnown = FALSE;
+
+	//	Histogram, for the mappings that follow the distribution
+	//----------------------------------------------------------------
+	BOOL bHistogram = m_dMax > m_dMin && ( m_params.iMapping == QUANTIZE_PERCENTILE || m_params.iMapping == QUANTIZE_EQUALIZE );
+
+	if ( bHistogram )
+	{
+		TRACE_SPAN( "quantize histogram" );
+		TRACE_CELLS( iCells );
+
+		for ( iWorker = 0; iWorker < iWorkers; iWorker++ )
+		{
+			m_apdwHistograms[iWorker] = (DWORD*)pArena->Alloc( sizeof(DWORD) * QUANTIZE_BINS );
+
+			if ( m_apdwHistograms[iWorker] == NULL )
+			{
+				sprintf( m_szError, "Out of memory for the quantize histograms" );
+				return FALSE;
+			}
+
+			memset( m_apdwHistograms[iWorker], 0, sizeof(DWORD) * QUANTIZE_BINS );
+		}
+
+		ParallelFor( iBlocks, HistogramTask, this );
+
+		for ( iWorker = 1; iWorker < iWorkers; iWorker++ )
+		{
+			for ( int iBin = 0; iBin < QUANTIZE_BINS; iBin++ )
+			{
+				m_apdwHistograms[0][iBin] += m_apdwHistograms[iWorker][iBin];
+			}
+		}
+
+		m_iPasses++;
+	}
+
+	return BuildMapping();
+}
+
+//------------------------------------------------------------------------------
+//	The level of one height under the mapping Prepare built
+//------------------------------------------------------------------------------
+int CQuantizer::Level( double dHeight ) const
+{
+	double dTop = (double)m_iTop;
+	double dLevel;
+
+	if ( m_dRatio == 0.0 )
+	{
+		return 0;
+	}
+
+	if ( m_pdCurve == NULL )
+	{
+		dLevel = ( dHeight - m_dBase ) / m_dRatio;
+	}
+	else
+	{
+		double dPoints = (double)QUANTIZE_BINS;
+		double dAt = ( dHeight - m_dMin ) * m_dScale;
+
+		dAt = dAt > 0.0 ? dAt : 0.0;
+		dAt = dAt < dPoints ? dAt : dPoints;
+
+		int iPoint = (int)dAt;
+		double dFraction = dAt - (double)iPoint;
+
+		dLevel = m_pdCurve[iPoint] + dFraction * ( m_pdCurve[iPoint + 1] - m_pdCurve[iPoint] );
+	}
+
+	dLevel = dLevel > 0.0 ? dLevel : 0.0;
+	dLevel = dLevel < dTop ? dLevel : dTop;
+
+	return (int)dLevel;
+}
+
+//------------------------------------------------------------------------------
+//	Height at dPercent percent of the cells, interpolated within its bin
+//------------------------------------------------------------------------------
+double CQuantizer::Percentile( const DWORD* pdwHistogram, double dPercent )
+{
+	double dTarget = dPercent / 100.0 * (double)m_iTileSq * (double)m_iTileSq;
+	double dBinWidth = ( m_dMax - m_dMin ) / (double)QUANTIZE_BINS;
+	double dBelow = 0.0;
+
+	if ( dPercent <= 0.0 )
+	{
+		return m_dMin;
+	}
+
+	for ( int iBin = 0; iBin < QUANTIZE_BINS; iBin++ )
+	{
+		double dCount = (double)pdwHistogram[iBin];
+
+		if ( dCount > 0.0 && dBelow + dCount >= dTarget )
+		{
+			return m_dMin + ( (double)iBin + ( dTarget - dBelow ) / dCount ) * dBinWidth;
+		}
+
+		dBelow += dCount;
+	}
+
+	return m_dMax;
+}
+
+//------------------------------------------------------------------------------
+//	Turn the parameters, range and histogram into either a linear map or a
+//	curve table, FALSE if there is no memory for the table
+//------------------------------------------------------------------------------
+BOOL CQuantizer::BuildMapping()
+{
+	m_dBase = m_dMin;
+	m_dRatio = m_dMax > m_dMin ? ( m_dMax - m_dMin ) / (double)m_iTop : 0.0;
+
+	if ( m_dRatio == 0.0 )
+	{
+		return TRUE;
+	}
+
+	switch ( m_params.iMapping )
+	{
+		case QUANTIZE_PERCENTILE:
+		{
+			double dLow = Percentile( m_apdwHistograms[0], m_params.fLow );
+			double dHigh = Percentile( m_apdwHistograms[0], m_params.fHigh );
+
+			m_dBase = dLow;
+			m_dRatio = dHigh > dLow ? ( dHigh - dLow ) / (double)m_iTop : 0.0;
+		}
+		break;
+
+		case QUANTIZE_GAMMA:
+		case QUANTIZE_EQUALIZE:
+		{
+			if ( m_params.iMapping == QUANTIZE_GAMMA && m_params.fGamma == 1.f )
+			{
+				break;
+			}
+
+			//	One level per table point, and a repeat of the last so the
+			//	top of the range can interpolate without a test
+			//--------------------------------------------------------------------
+			m_pdCurve = (double*)CScratchArena::ForThread()->Alloc( sizeof(double) * ( QUANTIZE_BINS + 2 ) );
+
+			if ( m_pdCurve == NULL )
+			{
+				sprintf( m_szError, "Out of memory for the quantize curve" );
+				return FALSE;
+			}
+
+			m_dScale = (double)QUANTIZE_BINS / ( m_dMax - m_dMin );
+
+			if ( m_params.iMapping == QUANTIZE_GAMMA )
+			{
+				for ( int iPoint = 0; iPoint <= QUANTIZE_BINS; iPoint++ )
+				{
+					m_pdCurve[iPoint] = (double)m_iTop * pow( (double)iPoint / (double)QUANTIZE_BINS, (double)m_params.fGamma );
+				}
+			}
+			else
+			{
+				const DWORD* pdwHistogram = m_apdwHistograms[0];
+				double dCells = (double)m_iTileSq * (double)m_iTileSq;
+				double dBelow = 0.0;
+
+				for ( int iPoint = 0; iPoint <= QUANTIZE_BINS; iPoint++ )
+				{
+					m_pdCurve[iPoint] = (double)m_iTop * dBelow / dCells;
+					dBelow += iPoint < QUANTIZE_BINS ? (double)pdwHistogram[iPoint] : 0.0;
+				}
+			}
+
+			m_pdCurve[QUANTIZE_BINS + 1] = m_pdCurve[QUANTIZE_BINS];
+		}
+		break;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Min and max of chunk iIndex, into the calling thread's slot
+//------------------------------------------------------------------------------
+void CQuantizer::RangeTask( int iIndex, int iWorker, void* pContext )
+{
+	CQuantizer* pThis = (CQuantizer*)pContext;
+	int iCells = pThis->m_iTileSq * pThis->m_iTileSq;
+	int iFirst = iIndex * QUANTIZE_CHUNK;
+	int iEnd = iCells - iFirst < QUANTIZE_CHUNK ? iCells : iFirst + QUANTIZE_CHUNK;
+	const double* pdHeights = pThis->m_pdHeights;
+	double dMin = pThis->m_adMin[iWorker];
+	double dMax = pThis->m_adMax[iWorker];
+	int iCell = iFirst;
+
+#if QUANTIZE_SIMD
+	__m128d dMinPair = _mm_set1_pd( dMin );
+	__m128d dMaxPair = _mm_set1_pd( dMax );
+
+	for ( ; iCell + 4 <= iEnd; iCell += 4 )
+	{
+		__m128d dA = _mm_loadu_pd( pdHeights + iCell );
+		__m128d dB = _mm_loadu_pd( pdHeights + iCell + 2 );
+
+		dMinPair = _mm_min_pd( dMinPair, _mm_min_pd( dA, dB ) );
+		dMaxPair = _mm_max_pd( dMaxPair, _mm_max_pd( dA, dB ) );
+	}
+
+	dMinPair = _mm_min_sd( dMinPair, _mm_unpackhi_pd( dMinPair, dMinPair ) );
+	dMaxPair = _mm_max_sd( dMaxPair, _mm_unpackhi_pd( dMaxPair, dMaxPair ) );
+
+	_mm_store_sd( &dMin, dMinPair );
+	_mm_store_sd( &dMax, dMaxPair );
+#endif
+
+	for ( ; iCell < iEnd; iCell++ )
+	{
+		dMin = pdHeights[iCell] < dMin ? pdHeights[iCell] : dMin;
+		dMax = pdHeights[iCell] > dMax ? pdHeights[iCell] : dMax;
+	}
+
+	pThis->m_adMin[iWorker] = dMin;
+	pThis->m_adMax[iWorker] = dMax;
+}
+
+//------------------------------------------------------------------------------
+//	Count column block iIndex into the calling thread's histogram
+//------------------------------------------------------------------------------
+void CQuantizer::HistogramTask( int iIndex, int iWorker, void* pContext )
+{
+	CQuantizer* pThis = (CQuantizer*)pContext;
+	int iTileSq = pThis->m_iTileSq;
+	int iFirstX = iIndex * QUANTIZE_BLOCK;
+	int iEndX = iTileSq - iFirstX < QUANTIZE_BLOCK ? iTileSq : iFirstX + QUANTIZE_BLOCK;
+	const double* pdHeights = pThis->m_pdHeights + iFirstX * iTileSq;
+	const double* pdEnd = pThis->m_pdHeights + iEndX * iTileSq;
+	DWORD* pdwHistogram = pThis->m_apdwHistograms[iWorker];
+	double dMin = pThis->m_dMin;
+	double dScale = (double)QUANTIZE_BINS / ( pThis->m_dMax - pThis->m_dMin );
+	double dLast = (double)( QUANTIZE_BINS - 1 );
+
+#if QUANTIZE_SIMD
+	__m128d dMinPair = _mm_set1_pd( dMin );
+	__m128d dScalePair = _mm_set1_pd( dScale );
+	__m128d dZeroPair = _mm_setzero_pd();
+	__m128d dLastPair = _mm_set1_pd( dLast );
+	int aiBins[4];
+
+	for ( ; pdHeights + 4 <= pdEnd; pdHeights += 4 )
+	{
+		__m128d dA = _mm_mul_pd( _mm_sub_pd( _mm_loadu_pd( pdHeights ), dMinPair ), dScalePair );
+		__m128d dB = _mm_mul_pd( _mm_sub_pd( _mm_loadu_pd( pdHeights + 2 ), dMinPair ), dScalePair );
+
+		dA = _mm_min_pd( _mm_max_pd( dA, dZeroPair ), dLastPair );
+		dB = _mm_min_pd( _mm_max_pd( dB, dZeroPair ), dLastPair );
+
+		_mm_storeu_si128( (__m128i*)aiBins, _mm_unpacklo_epi64( _mm_cvttpd_epi32( dA ), _mm_cvttpd_epi32( dB ) ) );
+
+		pdwHistogram[aiBins[0]]++;
+		pdwHistogram[aiBins[1]]++;
+		pdwHistogram[aiBins[2]]++;
+		pdwHistogram[aiBins[3]]++;
+	}
+#endif
+
+	for ( ; pdHeights < pdEnd; pdHeights++ )
+	{
+		double dBin = ( *pdHeights - dMin ) * dScale;
+
+		dBin = dBin > 0.0 ? dBin : 0.0;
+		dBin = dBin < dLast ? dBin : dLast;
+
+		pdwHistogram[(int)dBin]++;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Map one column of heights to levels
+//
+//	The SIMD and scalar loops do the same double operations in the same
+//	order, so a cell's level does not depend on which one reached it
+//------------------------------------------------------------------------------
+void CQuantizer::MapColumn( const double* pdColumn, WORD* pwColumn )
+{
+	int iTileSq = m_iTileSq;
+	double dTop = (double)m_iTop;
+	int iYPos = 0;
+
+	if ( m_dRatio == 0.0 )
+	{
+		memset( pwColumn, 0, sizeof(WORD) * iTileSq );
+		return;
+	}
+
+	if ( m_pdCurve == NULL )
+	{
+#if QUANTIZE_SIMD
+		__m128d dBasePair = _mm_set1_pd( m_dBase );
+		__m128d dRatioPair = _mm_set1_pd( m_dRatio );
+		__m128d dZeroPair = _mm_setzero_pd();
+		__m128d dTopPair = _mm_set1_pd( dTop );
+		__m128d adLevels[4];
+
+		for ( ; iYPos + 8 <= iTileSq; iYPos += 8 )
+		{
+			for ( int iPair = 0; iPair < 4; iPair++ )
+			{
+				__m128d dLevel = _mm_div_pd( _mm_sub_pd( _mm_loadu_pd( pdColumn + iYPos + 2 * iPair ), dBasePair ), dRatioPair );
+
+				adLevels[iPair] = _mm_min_pd( _mm_max_pd( dLevel, dZeroPair ), dTopPair );
+			}
+
+			_mm_storeu_si128( (__m128i*)( pwColumn + iYPos ), PackLevels( adLevels[0], adLevels[1], adLevels[2], adLevels[3] ) );
+		}
+#endif
+
+		for ( ; iYPos < iTileSq; iYPos++ )
+		{
+			pwColumn[iYPos] = (WORD)Level( pdColumn[iYPos] );
+		}
+
+		return;
+	}
+
+#if QUANTIZE_SIMD
+	const double* pdCurve = m_pdCurve;
+	double dPoints = (double)QUANTIZE_BINS;
+	__m128d dMinPair = _mm_set1_pd( m_dMin );
+	__m128d dScalePair = _mm_set1_pd( m_dScale );
+	__m128d dZeroPair = _mm_setzero_pd();
+	__m128d dPointsPair = _mm_set1_pd( dPoints );
+	__m128d dTopPair = _mm_set1_pd( dTop );
+	__m128d adLevels[4];
+	int aiPoints[2];
+
+	for ( ; iYPos + 8 <= iTileSq; iYPos += 8 )
+	{
+		for ( int iPair = 0; iPair < 4; iPair++ )
+		{
+			__m128d dAt = _mm_mul_pd( _mm_sub_pd( _mm_loadu_pd( pdColumn + iYPos + 2 * iPair ), dMinPair ), dScalePair );
+
+			dAt = _mm_min_pd( _mm_max_pd( dAt, dZeroPair ), dPointsPair );
+
+			__m128i iPoints = _mm_cvttpd_epi32( dAt );
+			__m128d dFraction = _mm_sub_pd( dAt, _mm_cvtepi32_pd( iPoints ) );
+
+			_mm_storel_epi64( (__m128i*)aiPoints, iPoints );
+
+			__m128d dLow = _mm_set_pd( pdCurve[aiPoints[1]], pdCurve[aiPoints[0]] );
+			__m128d dHigh = _mm_set_pd( pdCurve[aiPoints[1] + 1], pdCurve[aiPoints[0] + 1] );
+			__m128d dLevel = _mm_add_pd( dLow, _mm_mul_pd( dFraction, _mm_sub_pd( dHigh, dLow ) ) );
+
+			adLevels[iPair] = _mm_min_pd( _mm_max_pd( dLevel, dZeroPair ), dTopPair );
+		}
+
+		_mm_storeu_si128( (__m128i*)( pwColumn + iYPos ), PackLevels( adLevels[0], adLevels[1], adLevels[2], adLevels[3] ) );
+	}
+#endif
+
+	for ( ; iYPos < iTileSq; iYPos++ )
+	{
+		pwColumn[iYPos] = (WORD)Level( pdColumn[iYPos] );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Map column block iIndex into the output
+//
+//	A grid in any layout but column-major takes the block a row at a time,
+//	and since a block is GRID_BLOCK wide and aligned each row is one run in
+//	both the row and tiled layouts
+//------------------------------------------------------------------------------
+void CQuantizer::MapTask( int iIndex, int iWorker, void* pContext )
+{
+	CQuantizer* pThis = (CQuantizer*)pContext;
+	int iTileSq = pThis->m_iTileSq;
+	int iFirstX = iIndex * QUANTIZE_BLOCK;
+	int iColumns = iTileSq - iFirstX < QUANTIZE_BLOCK ? iTileSq - iFirstX : QUANTIZE_BLOCK;
+	int iColumn;
+
+	if ( pThis->m_pwCells != NULL )
+	{
+		for ( iColumn = 0; iColumn < iColumns; iColumn++ )
+		{
+			int iOffset = ( iFirstX + iColumn ) * iTileSq;
+
+			pThis->MapColumn( pThis->m_pdHeights + iOffset, pThis->m_pwCells + iOffset );
+		}
+
+		return;
+	}
+
+	WORD* pwScratch = pThis->m_apwScratch[iWorker];
+	CHeightGrid* pGrid = pThis->m_pGrid;
+
+	for ( iColumn = 0; iColumn < iColumns; iColumn++ )
+	{
+		pThis->MapColumn( pThis->m_pdHeights + ( iFirstX + iColumn ) * iTileSq, pwScratch + iColumn * iTileSq );
+	}
+
+	if ( !pGrid->RowsOuter() )
+	{
+		for ( iColumn = 0; iColumn < iColumns; iColumn++ )
+		{
+			const WORD* pwFrom = pwScratch + iColumn * iTileSq;
+			BYTE* pbTo = &pGrid->At( iFirstX + iColumn, 0 );
+			int iYPos = 0;
+
+#if QUANTIZE_SIMD
+			for ( ; iYPos + 16 <= iTileSq; iYPos += 16 )
+			{
+				__m128i iLow = _mm_loadu_si128( (const __m128i*)( pwFrom + iYPos ) );
+				__m128i iHigh = _mm_loadu_si128( (const __m128i*)( pwFrom + iYPos + 8 ) );
+
+				_mm_storeu_si128( (__m128i*)( pbTo + iYPos ), _mm_packus_epi16( iLow, iHigh ) );
+			}
+#endif
+
+			for ( ; iYPos < iTileSq; iYPos++ )
+			{
+				pbTo[iYPos] = (BYTE)pwFrom[iYPos];
+			}
+		}
+
+		return;
+	}
+
+	for ( int iRow = 0; iRow < iTileSq; iRow++ )
+	{
+		BYTE* pbRun = &pGrid->At( iFirstX, iRow );
+
+		for ( iColumn = 0; iColumn < iColumns; iColumn++ )
+		{
+			pbRun[iColumn] = (BYTE)pwScratch[iColumn * iTileSq + iRow];
+		}
+	}
+}
@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------------------
+
+	Quantize.h
+
+	Provides quantization of accumulated double heights down to 8 or 16 bit
+	cells, spread over the worker threads
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _QUANTIZE_H
+#define _QUANTIZE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Grid.h"
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define QUANTIZE_BINS			4096	// Histogram bins and curve table intervals over the range
+#define QUANTIZE_BLOCK			16		// Columns per task, GRID_BLOCK so a tiled block row is one run
+#define QUANTIZE_CHUNK			16384	// Cells per range task
+#define QUANTIZE_DEFAULT_LOW	1.f		// Percentile clip, percent
+#define QUANTIZE_DEFAULT_HIGH	99.f
+#define QUANTIZE_DEFAULT_GAMMA	1.f
+#define QUANTIZE_TOP_16			65535
+
+//	How heights are spread over the output levels. Linear is the classic
+//	stretch of the full range, percentile stretches [low, high] percent of
+//	the cells and clips the tails, gamma raises the stretched height to a
+//	power, and equalize gives each level a roughly equal share of cells.
+//--------------------------------------------------------------------------
+enum QUANTIZEMAP
+{
+	QUANTIZE_LINEAR,
+	QUANTIZE_PERCENTILE,
+	QUANTIZE_GAMMA,
+	QUANTIZE_EQUALIZE
+};
+
+typedef struct tagQUANTIZEPARAMS
+{
+	int		iMapping;			// QUANTIZEMAP
+	FLOAT	fLow;				// Percentile: percent of cells clipped to the bottom level
+	FLOAT	fHigh;				// Percentile: percent of cells at or below the top level
+	FLOAT	fGamma;				// Gamma: exponent, above 1 darkens the lowlands
+} QUANTIZEPARAMS;
+
+//------------------------------------------------------------------------------
+//	A quantizer
+//
+//	Heights come column-major, [x * iTileSq + y], as every retained grid is,
+//	and go to levels 0..iTop, into a CHeightGrid in its own layout or a WORD
+//	array laid out like the source. A flat field goes to level 0.
+//
+//	Each pass is split into blocks of QUANTIZE_BLOCK columns over the worker
+//	threads, and uses SSE2 two doubles at a time. The range is scanned only
+//	if the caller doesn't know it. Percentile and equalize add a histogram
+//	pass, built per thread and merged, so the whole quantize is at most three
+//	reads of the source: range, histogram and the mapping itself.
+//
+//	Linear and percentile divide exactly as the original serial quantize
+//	did, (height - min) / ( range / iTop ) truncated, so linear results are
+//	unchanged. Gamma and equalize read a QUANTIZE_BINS interval curve table.
+//
+//	Histograms, the curve and the grid's column scratch come from the
+//	calling thread's arena. Quantize returns FALSE, leaving the target as it
+//	was, if they cannot be had.
+//
+//	Prepare does everything but the mapping pass, so a caller sweeping the
+//	heights anyway can take each cell's level from Level as it goes, the
+//	same level Quantize would give it. Its tables stay in the calling
+//	thread's arena until the caller's scope ends, and Level may be called
+//	from any thread once it returns.
+//------------------------------------------------------------------------------
+class CQuantizer
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CQuantizer();
+	virtual ~CQuantizer();
+
+	//--------------------------
+	//	CQuantizer Interface
+	//--------------------------
+	QUANTIZEPARAMS& Params();
+
+	BOOL Quantize( const double* pdHeights, int iTileSq, int iTop, CHeightGrid* pGrid );
+	BOOL Quantize( const double* pdHeights, int iTileSq, int iTop, WORD* pwCells );
+	BOOL Prepare( const double* pdHeights, int iTileSq, int iTop );
+	int Level( double dHeight ) const;
+	void SetRange( double dMin, double dMax );
+	int Passes();
+	LPCSTR GetError();
+
+	static void DefaultParams( QUANTIZEPARAMS* pParams );
+	static int ParseMapping( LPCSTR szName );
+
+private:
+	//	Per-block work, called from worker threads
+	//-------------------------------------------------
+	static void RangeTask( int iIndex, int iWorker, void* pContext );
+	static void HistogramTask( int iIndex, int iWorker, void* pContext );
+	static void MapTask( int iIndex, int iWorker, void* pContext );
+
+	BOOL Run( const double* pdHeights, int iTileSq, int iTop, CHeightGrid* pGrid, WORD* pwCells );
+	BOOL BuildMapping();
+	double Percentile( const DWORD* pdwHistogram, double dPercent );
+	void MapColumn( const double* pdColumn, WORD* pwColumn );
+
+	QUANTIZEPARAMS m_params;
+
+	//	Per-run state
+	//-------------------
+	BOOL m_bRangeKnown;
+	int m_iPasses;
+	const double* m_pdHeights;
+	int m_iTileSq;
+	int m_iTop;
+	CHeightGrid* m_pGrid;
+	WORD* m_pwCells;
+	double m_dMin;
+	double m_dMax;
+	double m_dBase;					// Linear: height mapped to level 0
+	double m_dRatio;				// Linear: height per level, 0 for a flat field
+	double m_dScale;				// Curve: table intervals per unit height
+	double* m_pdCurve;				// Curve: QUANTIZE_BINS + 2 levels, NULL maps linearly
+	DWORD* m_apdwHistograms[MAX_WORKERS];
+	double m_adMin[MAX_WORKERS];
+	double m_adMax[MAX_WORKERS];
+	WORD* m_apwScratch[MAX_WORKERS];
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,395 @@
+/*--------------------------------------------------------------------------------
+
+	Raster.cpp
+
+	Provides the terrain operations over a caller's raster, cells of any
+	fault cell type in padded rows, worked on in place
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+
+#include "Raster.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+
+//	A raster operation shared out a row at a time
+//---------------------------------------------------
+typedef struct tagRASTERJOB
+{
+	const RASTER*	pRaster;
+	const RASTER*	pLevels;				// MapTask, written from pRaster
+	double			dValue;					// FillTask
+	BOOL			bAlongX;				// BlurTask
+	int				iFirst;
+	int				iEnd;
+	double			dBase;					// MapTask, height mapped to level 0
+	double			dRatio;					// and height per level, 0 for a flat field
+	double			adMin[MAX_WORKERS];		// RangeTask, per worker
+	double			adMax[MAX_WORKERS];
+} RASTERJOB;
+
+//------------------------------------------------------------------------
+//	Row iRow of the raster
+//------------------------------------------------------------------------
+static BYTE* RasterRow( const RASTER& raster, int iRow )
+{
+	return (BYTE*)raster.pvCells + (ptrdiff_t)iRow * raster.iPitch * FaultCellSize( raster.iCellType );
+}
+
+//------------------------------------------------------------------------
+//	Run iRows row tasks, over the scheduler for a large raster
+//------------------------------------------------------------------------
+static void ForRows( const RASTER& raster, int iRows, PFNPARALLELTASK pfnTask, RASTERJOB* pJob )
+{
+	if ( CHeightGrid::Parallel( raster.iSize ) )
+	{
+		ParallelFor( iRows, pfnTask, pJob );
+		return;
+	}
+
+	for ( int iRow = 0; iRow < iRows; iRow++ )
+	{
+		pfnTask( iRow, 0, pJob );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	A value as a cell, held to the cell type's range so nothing wraps. NaN
+//	goes to the bottom of an integer type's range.
+//------------------------------------------------------------------------------
+static void ToCell( double dValue, BYTE& cell )
+{
+	cell = (BYTE)( dValue > 0.0 ? ( dValue < 255.0 ? dValue : 255.0 ) : 0.0 );
+}
+
+static void ToCell( double dValue, WORD& cell )
+{
+	cell = (WORD)( dValue > 0.0 ? ( dValue < 65535.0 ? dValue : 65535.0 ) : 0.0 );
+}
+
+static void ToCell( double dValue, INT& cell )
+{
+	cell = (INT)( dValue > (double)INT_MIN ? ( dValue < (double)INT_MAX ? dValue : (double)INT_MAX ) : (double)INT_MIN );
+}
+
+static void ToCell( double dValue, FLOAT& cell )
+{
+	cell = (FLOAT)( dValue > FLT_MAX ? FLT_MAX : ( dValue < -FLT_MAX ? -FLT_MAX : dValue ) );
+}
+
+static void ToCell( double dValue, double& cell )
+{
+	cell = dValue;
+}
+
+//	The highest level a cell type holds
+//-----------------------------------------
+static int LevelTop( int iCellType )
+{
+	switch ( iCellType )
+	{
+		case FAULT_CELL_U8:		return 255;
+		case FAULT_CELL_U16:	return 65535;
+	}
+
+	return INT_MAX;
+}
+
+//------------------------------------------------------------------------------
+//	Per cell type row work
+//
+//	Blur means in the cell type, so BYTE and WORD cells truncate just as
+//	the tile's own blur does
+//------------------------------------------------------------------------------
+template <class TCell>
+class CRasterRow
+{
+public:
+	static void Fill( BYTE* pbRow, int iCount, double dValue )
+	{
+		TCell* pRow = (TCell*)pbRow;
+		TCell value;
+
+		ToCell( dValue, value );
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			pRow[iCell] = value;
+		}
+	}
+
+	static void BlurAlong( BYTE* pbRow, int iFirst, int iEnd )
+	{
+		TCell* pRow = (TCell*)pbRow;
+
+		for ( int iCell = iFirst; iCell < iEnd; iCell += 2 )
+		{
+			pRow[iCell] = (TCell)( ( pRow[iCell - 1] + pRow[iCell + 1] ) / 2 );
+		}
+	}
+
+	static void BlurAcross( BYTE* pbRow, const BYTE* pbAbove, const BYTE* pbBelow, int iCount )
+	{
+		TCell* pRow = (TCell*)pbRow;
+		const TCell* pAbove = (const TCell*)pbAbove;
+		const TCell* pBelow = (const TCell*)pbBelow;
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			pRow[iCell] = (TCell)( ( pAbove[iCell] + pBelow[iCell] ) / 2 );
+		}
+	}
+
+	static void Read( const BYTE* pbRow, int iCount, double* pdValues )
+	{
+		const TCell* pRow = (const TCell*)pbRow;
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			pdValues[iCell] = (double)pRow[iCell];
+		}
+	}
+
+	static void Write( BYTE* pbRow, int iCount, const int* piLevels )
+	{
+		TCell* pRow = (TCell*)pbRow;
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			ToCell( (double)piLevels[iCell], pRow[iCell] );
+		}
+	}
+};
+
+//	Dispatch on the cell type, one macro rather than a switch in every task
+//-----------------------------------------------------------------------------
+#define RASTER_DISPATCH( iCellType, call )											\
+	switch ( iCellType )															\
+	{																				\
+		case FAULT_CELL_U8:		CRasterRow<BYTE>::call;		break;					\
+		case FAULT_CELL_U16:	CRasterRow<WORD>::call;		break;					\
+		case FAULT_CELL_I32:	CRasterRow<INT>::call;		break;					\
+		case FAULT_CELL_F32:	CRasterRow<FLOAT>::call;	break;					\
+		case FAULT_CELL_F64:	CRasterRow<double>::call;	break;					\
+	}
+
+//-----------------------------------
+//
+//	CLASS: CRaster implementation
+//
+//-----------------------------------
+
+//------------------------------------------------------------------------
+//	Set every cell to dValue, converted to the cell type and held to its
+//	range
+//------------------------------------------------------------------------
+void CRaster::Fill( const RASTER& raster, double dValue )
+{
+	RASTERJOB job;
+
+	job.pRaster = &raster;
+	job.dValue = dValue;
+
+	ForRows( raster, raster.iSize, FillTask, &job );
+}
+
+void CRaster::FillTask( int iIndex, int iWorker, void* pContext )
+{
+	RASTERJOB* pJob = (RASTERJOB*)pContext;
+	const RASTER& raster = *pJob->pRaster;
+
+	RASTER_DISPATCH( raster.iCellType, Fill( RasterRow( raster, iIndex ), raster.iSize, pJob->dValue ) );
+}
+
+//------------------------------------------------------------------------
+//	Run the pass's faults on the raster in place
+//
+//	Fills in where the cells are. Everything else, including whether
+//	they clamp or accumulate, is the caller's.
+//------------------------------------------------------------------------
+void CRaster::Faults( const RASTER& raster, FAULTPASS& pass )
+{
+	pass.pvCells = raster.pvCells;
+	pass.pvSource = NULL;
+	pass.iCellType = raster.iCellType;
+	pass.iLayout = GRID_LAYOUT_ROW;
+	pass.iTileSq = raster.iSize;
+	pass.iPitch = raster.iPitch;
+	pass.iSample = 1;
+
+	ApplyFaultPass( pass );
+}
+
+//------------------------------------------------------------------------
+//	Blur as CTerrain::Blur does, by averaging neighbours on alternate
+//	cells along each axis in turn
+//
+//	Every pass stops short of the last cell, so an odd sized raster
+//	never reads past a row or below the last one
+//------------------------------------------------------------------------
+void CRaster::Blur( const RASTER& raster, int iBlurFactor )
+{
+	int iSize = raster.iSize;
+
+	for ( int k = 0; k < iBlurFactor; k++ )
+	{
+		BlurPass( raster, TRUE, 1, iSize - 1 );		// Horizontal
+		BlurPass( raster, FALSE, 1, iSize - 1 );	// Vertical
+		BlurPass( raster, TRUE, 2, iSize - 1 );		// Horizontal + 1
+		BlurPass( raster, FALSE, 2, iSize - 1 );	// Vertical + 1
+	}
+}
+
+//	Along x every row is a task, across rows each row written is one. A
+//	pass never reads a cell it writes, so the rows are independent.
+//----------------------------------------------------------------------------
+void CRaster::BlurPass( const RASTER& raster, BOOL bAlongX, int iFirst, int iEnd )
+{
+	TRACE_SPAN( bAlongX ? "raster blur x" : "raster blur y" );
+	TRACE_CELLS( (ULONGLONG)( ( iEnd - iFirst + 1 ) / 2 ) * raster.iSize * 3 );
+
+	RASTERJOB job;
+
+	job.pRaster = &raster;
+	job.bAlongX = bAlongX;
+	job.iFirst = iFirst;
+	job.iEnd = iEnd;
+
+	ForRows( raster, bAlongX ? raster.iSize : ( iEnd - iFirst + 1 ) / 2, BlurTask, &job );
+}
+
+void CRaster::BlurTask( int iIndex, int iWorker, void* pContext )
+{
+	RASTERJOB* pJob = (RASTERJOB*)pContext;
+	const RASTER& raster = *pJob->pRaster;
+
+	if ( pJob->bAlongX )
+	{
+		RASTER_DISPATCH( raster.iCellType, BlurAlong( RasterRow( raster, iIndex ), pJob->iFirst, pJob->iEnd ) );
+	}
+	else
+	{
+		int iRow = pJob->iFirst + iIndex * 2;
+
+		RASTER_DISPATCH( raster.iCellType, BlurAcross( RasterRow( raster, iRow ), RasterRow( raster, iRow - 1 ), RasterRow( raster, iRow + 1 ), raster.iSize ) );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Stretch the heights' full range over levels 0..iTop, written to levels
+//	in its own cell type. A flat field goes to level 0.
+//
+//	Two reads of the heights, the range and then the map, each a row at a
+//	time in RASTER_CHUNK pieces converted to doubles on the stack
+//------------------------------------------------------------------------------
+void CRaster::Quantize( const RASTER& heights, int iTop, const RASTER& levels )
+{
+	TRACE_SPAN( "raster quantize" );
+	TRACE_CELLS( (ULONGLONG)heights.iSize * heights.iSize * 2 );
+
+	RASTERJOB job;
+	double dFirst;
+	double dMin, dMax;
+	int iWorker;
+
+	//	The stretch stops at the most the levels' cell type holds, as
+	//	CQuantizer's does for the tile
+	//-------------------------------------------------------------------
+	iTop = iTop < LevelTop( levels.iCellType ) ? iTop : LevelTop( levels.iCellType );
+
+	RASTER_DISPATCH( heights.iCellType, Read( RasterRow( heights, 0 ), 1, &dFirst ) );
+
+	job.pRaster = &heights;
+	job.pLevels = &levels;
+
+	for ( iWorker = 0; iWorker < MAX_WORKERS; iWorker++ )
+	{
+		job.adMin[iWorker] = dFirst;
+		job.adMax[iWorker] = dFirst;
+	}
+
+	ForRows( heights, heights.iSize, RangeTask, &job );
+
+	dMin = dMax = dFirst;
+
+	for ( iWorker = 0; iWorker < MAX_WORKERS; iWorker++ )
+	{
+		dMin = job.adMin[iWorker] < dMin ? job.adMin[iWorker] : dMin;
+		dMax = job.adMax[iWorker] > dMax ? job.adMax[iWorker] : dMax;
+	}
+
+	job.dBase = dMin;
+	job.dRatio = dMax > dMin ? ( dMax - dMin ) / (double)iTop : 0.0;
+
+	ForRows( heights, heights.iSize, MapTask, &job );
+}
+
+void CRaster::RangeTask( int iIndex, int iWorker, void* pContext )
+{
+	RASTERJOB* pJob = (RASTERJOB*)pContext;
+	const RASTER& heights = *pJob->pRaster;
+	const BYTE* pbRow = RasterRow( heights, iIndex );
+	int iCellSize = FaultCellSize( heights.iCellType );
+	double adValues[RASTER_CHUNK];
+	double dMin = pJob->adMin[iWorker];
+	double dMax = pJob->adMax[iWorker];
+
+	for ( int iChunk = 0; iChunk < heights.iSize; iChunk += RASTER_CHUNK )
+	{
+		int iCount = heights.iSize - iChunk < RASTER_CHUNK ? heights.iSize - iChunk : RASTER_CHUNK;
+
+		RASTER_DISPATCH( heights.iCellType, Read( pbRow + iChunk * iCellSize, iCount, adValues ) );
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			dMin = adValues[iCell] < dMin ? adValues[iCell] : dMin;
+			dMax = adValues[iCell] > dMax ? adValues[iCell] : dMax;
+		}
+	}
+
+	pJob->adMin[iWorker] = dMin;
+	pJob->adMax[iWorker] = dMax;
+}
+
+void CRaster::MapTask( int iIndex, int iWorker, void* pContext )
+{
+	RASTERJOB* pJob = (RASTERJOB*)pContext;
+	const RASTER& heights = *pJob->pRaster;
+	const RASTER& levels = *pJob->pLevels;
+	const BYTE* pbRow = RasterRow( heights, iIndex );
+	BYTE* pbLevels = RasterRow( levels, iIndex );
+	int iCellSize = FaultCellSize( heights.iCellType );
+	int iLevelSize = FaultCellSize( levels.iCellType );
+	double adValues[RASTER_CHUNK];
+	int aiLevels[RASTER_CHUNK];
+
+	for ( int iChunk = 0; iChunk < heights.iSize; iChunk += RASTER_CHUNK )
+	{
+		int iCount = heights.iSize - iChunk < RASTER_CHUNK ? heights.iSize - iChunk : RASTER_CHUNK;
+
+		RASTER_DISPATCH( heights.iCellType, Read( pbRow + iChunk * iCellSize, iCount, adValues ) );
+
+		for ( int iCell = 0; iCell < iCount; iCell++ )
+		{
+			aiLevels[iCell] = pJob->dRatio > 0.0 ? (int)( ( adValues[iCell] - pJob->dBase ) / pJob->dRatio ) : 0;
+		}
+
+		RASTER_DISPATCH( levels.iCellType, Write( pbLevels + iChunk * iLevelSize, iCount, aiLevels ) );
+	}
+}
@@ -0,0 +1,69 @@
+/*--------------------------------------------------------------------------------
+
+	Raster.h
+
+	Provides the terrain operations over a caller's raster, cells of any
+	fault cell type in padded rows, worked on in place
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _RASTER_H
+#define _RASTER_H
+
+//-------------
+//	Includes
+//-------------
+#include "FaultKernel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define RASTER_CHUNK	256		// Cells converted at a time quantizing
+
+//	iSize^2 cells of iCellType, row-major with rows iPitch cells apart, so
+//	cell (x, y) is at [y * iPitch + x]. The memory is the caller's.
+//-----------------------------------------------------------------------------
+typedef struct tagRASTER
+{
+	void*	pvCells;
+	int		iCellType;			// FAULTCELL
+	int		iSize;
+	int		iPitch;				// At least iSize
+} RASTER;
+
+//------------------------------------------------------------------------------
+//	Raster operations
+//
+//	The same operations the tile runs on its own grid, for memory the tile
+//	does not own, such as a mapped texture, with no copy either way. Faults
+//	go straight through ApplyFaultPass as a padded row layout. Blur makes
+//	the tile's four passes, rows at a time, and gives the same cells as
+//	CTerrain::Blur for BYTE cells. Quantize stretches one raster's heights
+//	linearly over levels 0..iTop in another, dividing as CQuantizer's linear
+//	map does, iTop held to what the levels' cell type holds. Fill and the
+//	levels clamp to the cell type's range rather than wrap. Large rasters
+//	go over the scheduler a row at a time.
+//------------------------------------------------------------------------------
+class CRaster
+{
+public:
+	static void Fill( const RASTER& raster, double dValue );
+	static void Faults( const RASTER& raster, FAULTPASS& pass );
+	static void Blur( const RASTER& raster, int iBlurFactor );
+	static void Quantize( const RASTER& heights, int iTop, const RASTER& levels );
+
+private:
+	static void BlurPass( const RASTER& raster, BOOL bAlongX, int iFirst, int iEnd );
+
+	static void FillTask( int iIndex, int iWorker, void* pContext );
+	static void BlurTask( int iIndex, int iWorker, void* pContext );
+	static void RangeTask( int iIndex, int iWorker, void* pContext );
+	static void MapTask( int iIndex, int iWorker, void* pContext );
+};
+
+#endif
@@ -0,0 +1,643 @@
+/*--------------------------------------------------------------------------------
+
+	Reference.cpp
+
+	Provides the original scalar implementations of the terrain operations,
+	kept unoptimized so the optimized paths can be checked against them
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <string.h>
+
+#include "Reference.h"
+
+//--------------------------------------
+//
+//	CLASS: CReference implementation
+//
+//--------------------------------------
+
+//------------------------------------------------------------------------------------
+//	Run faults [iFirst, iLast) of the pass, testing every cell against every
+//	line with CFaultLine::TestPoint
+//------------------------------------------------------------------------------------
+void CReference::Faults( const FAULTPASS& pass )
+{
+	int iTileSq = pass.iTileSq;
+	BYTE* pbCells = (BYTE*)pass.pvCells;
+	double* pdCells = (double*)pass.pvCells;
+
+	for ( int iFaultIDX = pass.iFirst; iFaultIDX < pass.iLast; iFaultIDX++ )
+	{
+		//-----------------------------------------------------
+		//	Generate two points to describe this fault line
+		//-----------------------------------------------------
+		FLOAT afPoints[4];
+
+		for ( int iPoint = 0; iPoint < 4; iPoint++ )
+		{
+			if ( pass.bLogistic )
+			{
+				afPoints[iPoint] = pass.pLogFunc->Iterate() * ((FLOAT)iTileSq - 1.f);
+			}
+			else
+			{
+				afPoints[iPoint] = (FLOAT)(pass.pRandom->Next() % iTileSq);
+			}
+		}
+
+		FLOAT x1 = afPoints[0];
+		FLOAT y1 = afPoints[1];
+		FLOAT x2 = afPoints[2];
+		FLOAT y2 = afPoints[3];
+
+		CFaultLine faultLine( CVector(x1, y1, 0.f), CVector(x2, y2, 0.f) );
+
+		//----------------------------------------------------------------------------------
+		//	Use a fixed fault depth, or, linearly interpolate between the desired values
+		//----------------------------------------------------------------------------------
+		int iFaultDepth = pass.iFixedFaultDepth != 0 ? pass.iFixedFaultDepth : pass.iDepthInit + ( (int)( (FLOAT)iFaultIDX / (FLOAT)pass.iIterations ) * ( pass.iDepthEnd - pass.iDepthInit ) );
+		double dLength = sqrt( (double)( x2 - x1 ) * ( x2 - x1 ) + (double)( y2 - y1 ) * ( y2 - y1 ) );
+
+		for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+		{
+			for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+			{
+				CVector vGridLoc((FLOAT)iXPos, (FLOAT)iYPos, 0.f);
+				FLOAT fSide = faultLine.TestPoint( vGridLoc );
+				int iCell = iXPos * iTileSq + iYPos;
+
+				if ( pass.iProfile != FAULT_PROFILE_STEP )
+				{
+					//	Signed distance over the band, a line of no length
+					//	moves nothing
+					//--------------------------------------------------------
+					double dT = dLength > 0.0 ? -(double)fSide / ( dLength * (double)pass.fProfileWidth ) : 0.0;
+
+					pdCells[iCell] += (double)iFaultDepth * Profile( pass.iProfile, dT );
+				}
+				else if ( fSide < 0.f )
+				{
+					//----------------------------------------------------
+					//	Grid position is to the left of the fault line
+					//----------------------------------------------------
+					if ( pass.bRetain )
+					{
+						pdCells[iCell] += (double)iFaultDepth;
+					}
+					else if ( pbCells[iCell] + iFaultDepth < pass.iMaxHeight )
+					{
+						pbCells[iCell] += iFaultDepth;
+					}
+				}
+				else
+				{
+					//---------------------------------------------------------------
+					//	Grid position is to the right of the fault line, or on it
+					//---------------------------------------------------------------
+					if ( pass.bRetain )
+					{
+						pdCells[iCell] -= (double)iFaultDepth;
+					}
+					else if ( pbCells[iCell] - iFaultDepth > pass.iMinHeight )
+					{
+						pbCells[iCell] -= iFaultDepth;
+					}
+				}
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	A smooth profile's value at t, -1 at t <= -1 up to 1 at t >= 1
+//------------------------------------------------------------------------------
+double CReference::Profile( int iProfile, double dT )
+{
+	dT = dT < -1.0 ? -1.0 : ( dT > 1.0 ? 1.0 : dT );
+
+	switch ( iProfile )
+	{
+		case FAULT_PROFILE_COSINE:	return -cos( FAULT_PI * ( dT + 1.0 ) * 0.5 );
+		case FAULT_PROFILE_SIGMOID:	return tanh( FAULT_SIGMOID * dT ) / tanh( FAULT_SIGMOID );
+	}
+
+	return dT;
+}
+
+//------------------------------------------------------------------------------------
+//	An orbit's Lyapunov exponent, the mean of ln|M (1 - 2x)| over iIterates
+//	after iTransient, iterated by CLogFunc itself and the log taken every step
+//------------------------------------------------------------------------------------
+double CReference::LyapunovExponent( FLOAT fM, FLOAT fSeed, int iTransient, int iIterates )
+{
+	CLogFunc logFunc( fM, fSeed );
+	double dSum = 0.0;
+	int i;
+
+	for ( i = 0; i < iTransient; i++ )
+	{
+		logFunc.Iterate();
+	}
+
+	for ( i = 0; i < iIterates; i++ )
+	{
+		double dSlope = fabs( (double)fM * ( 1.0 - 2.0 * (double)logFunc.LastIterate() ) );
+
+		dSum += log( dSlope > LOGISTIC_MIN_SLOPE ? dSlope : LOGISTIC_MIN_SLOPE );
+
+		logFunc.Iterate();
+	}
+
+	return dSum / (double)iIterates;
+}
+
+//------------------------------------------------------------------------------------
+//	Fractal dimension of a periodic surface by its variogram
+//
+//	The mean squared height difference at lag r grows as r^(2H) for fBm, and
+//	D = 3 - H. Lags 1, 2, 4 up to iMaxLag, along both axes with wrap around,
+//	fitted by least squares in log-log.
+//------------------------------------------------------------------------------------
+double CReference::VariogramDimension( const double* pdHeights, int iTileSq, int iMaxLag )
+{
+	double dSumX = 0.0, dSumY = 0.0, dSumXX = 0.0, dSumXY = 0.0;
+	int iLags = 0;
+
+	#define CELL( iX, iY ) pdHeights[(iX) * iTileSq + (iY)]
+
+	for ( int iLag = 1; iLag <= iMaxLag; iLag *= 2 )
+	{
+		double dSquares = 0.0;
+
+		for ( int i = 0; i < iTileSq; i++ )
+		{
+			for ( int j = 0; j < iTileSq; j++ )
+			{
+				double dAlongX = CELL( ( i + iLag ) % iTileSq, j ) - CELL( i, j );
+				double dAlongY = CELL( i, ( j + iLag ) % iTileSq ) - CELL( i, j );
+
+				dSquares += dAlongX * dAlongX + dAlongY * dAlongY;
+			}
+		}
+
+		double dLogLag = log( (double)iLag );
+		double dLogVariance = log( dSquares / ( 2.0 * (double)iTileSq * (double)iTileSq ) );
+
+		dSumX += dLogLag;
+		dSumY += dLogVariance;
+		dSumXX += dLogLag * dLogLag;
+		dSumXY += dLogLag * dLogVariance;
+		iLags++;
+	}
+
+	#undef CELL
+
+	double dSlope = ( (double)iLags * dSumXY - dSumX * dSumY ) / ( (double)iLags * dSumXX - dSumX * dSumX );
+
+	return 3.0 - 0.5 * dSlope;
+}
+
+//------------------------------------------------------------------------------------
+//	Stretch the heights' full range over levels 0..iTop
+//
+//	The original started its range at 65536 and 0, which lost a maximum
+//	below zero, and divided by zero on a flat field. Here the range starts
+//	from the first cell and a flat field goes to level 0.
+//------------------------------------------------------------------------------------
+void CReference::Quantize( const double* pdHeights, int iTileSq, int iTop, WORD* pwLevels )
+{
+	//	Get min and max retained values
+	//-------------------------------------
+	double dMIN = pdHeights[0];
+	double dMAX = pdHeights[0];
+	double dRange, dRatio;
+	int iCell;
+
+	for ( iCell = 0; iCell < iTileSq * iTileSq; iCell++ )
+	{
+		if ( pdHeights[iCell] < dMIN )
+		{
+			dMIN = pdHeights[iCell];
+		}
+		if ( pdHeights[iCell] > dMAX )
+		{
+			dMAX = pdHeights[iCell];
+		}
+	}
+
+	dRange = dMAX - dMIN;
+	dRatio = dRange / (double)iTop;
+
+	for ( iCell = 0; iCell < iTileSq * iTileSq; iCell++ )
+	{
+		double dValue = dRatio > 0.0 ? (pdHeights[iCell] - dMIN) / dRatio : 0.0;
+
+		pwLevels[iCell] = (WORD)dValue;
+	}
+}
+
+//------------------------------------------------------------------------------------
+//	Blur by averaging neighbours, alternate cells along each axis in turn
+//------------------------------------------------------------------------------------
+void CReference::Blur( BYTE* pbCells, int iTileSq, int iBlurFactor )
+{
+	int i, j;
+
+	#define CELL( iX, iY ) pbCells[(iX) * iTileSq + (iY)]
+
+	for ( int k = 0; k < iBlurFactor; k++ )
+	{
+		// Horizontal
+		for ( j = 0; j < iTileSq; j++ )
+		{
+			for ( i = 1; i < iTileSq-1; i += 2 )
+			{
+				CELL(i,j) = ( CELL(i-1,j) + CELL(i+1,j) ) / 2;
+			}
+		}
+
+		// Vertical
+		for ( j = 1; j < iTileSq-1; j += 2 )
+		{
+			for ( i = 0; i < iTileSq; i++ )
+			{
+				CELL(i,j) = ( CELL(i,j-1) + CELL(i,j+1) ) / 2;
+			}
+		}
+
+		// Horizontal + 1
+		for ( j = 0; j < iTileSq; j++ )
+		{
+			for ( i = 2; i < iTileSq-1; i += 2 )
+			{
+				CELL(i,j) = ( CELL(i-1,j) + CELL(i+1,j) ) / 2;
+			}
+		}
+
+		// Vertical + 1
+		for ( j = 2; j < iTileSq-1; j += 2 )
+		{
+			for ( i = 0; i < iTileSq; i++ )
+			{
+				CELL(i,j) = ( CELL(i,j-1) + CELL(i,j+1) ) / 2;
+			}
+		}
+	}
+
+	#undef CELL
+}
+
+//------------------------------------------------------------------------------------
+//	Box counting fractal dimension, as CTerrain::CalcFractalDimension
+//------------------------------------------------------------------------------------
+FLOAT CReference::FractalDimension( const BYTE* pbCells, int iTileSq )
+{
+	INT aiResults[32][2];
+	int iResultIDX = 0;
+	int iOutput;
+
+	for ( int i = 0; i < 32; i++ )
+	{
+		aiResults[i][0] = aiResults[i][1] = -1;
+	}
+
+	INT iBBoxSq = iTileSq;
+
+	//	Fit bouding boxes from the tile size itself, right down to 1
+	//------------------------------------------------------------------
+	while ( iBBoxSq >= 1 )
+	{
+		if ( iResultIDX == 0 )
+		{
+			aiResults[iResultIDX][0] = iBBoxSq;
+			aiResults[iResultIDX][1] = 1;
+		}
+		else
+		{
+			int iEpsn = iTileSq / iBBoxSq;
+			int iBlockCount = 0;
+
+			for ( int iXPatch = 0; iXPatch < iEpsn; iXPatch++ )
+			{
+				for ( int iYPatch = 0; iYPatch < iEpsn; iYPatch++ )
+				{
+					int iHeightToReach = PatchMaxHeight( pbCells, iTileSq, iXPatch * iBBoxSq, iBBoxSq, iYPatch * iBBoxSq , iBBoxSq );
+
+					//	Conservative block count
+					//------------------------------
+					int iStackSize = ( iHeightToReach + 1 ) / iBBoxSq;
+					iBlockCount += iStackSize;
+
+					if ( iStackSize * iBBoxSq < ( iHeightToReach + 1 ) )
+					{
+						iBlockCount++;
+					}
+				}
+			}
+
+			aiResults[iResultIDX][0] = iBBoxSq;
+			aiResults[iResultIDX][1] = iBlockCount;
+		}
+
+		iBBoxSq /= 2;
+		iResultIDX++;
+	}
+
+	FLOAT afResults[32][2];
+
+	for ( iOutput = 0; iOutput < iResultIDX; iOutput++ )
+	{
+		afResults[iOutput][0] = (FLOAT)log10( (double)(1.f / (FLOAT)aiResults[iOutput][0]) );
+		afResults[iOutput][1] = (FLOAT)log10( (double)aiResults[iOutput][1] );
+	}
+
+	//	(y2-y1)/(x2-x1), averaged along the results
+	//-------------------------------------------------
+	FLOAT fFracDim = (FLOAT)(afResults[1][1] - afResults[0][1]) / (FLOAT)(afResults[1][0] - afResults[0][0]);
+
+	for ( iOutput = 1; iOutput < iResultIDX - 1; iOutput++ )
+	{
+		FLOAT fThisGradient = (FLOAT)(afResults[iOutput+1][1] - afResults[iOutput][1]) / (FLOAT)(afResults[iOutput+1][0] - afResults[iOutput][0]);
+
+		fFracDim = (fFracDim + fThisGradient) / 2;
+	}
+
+	return fFracDim;
+}
+
+INT CReference::PatchMaxHeight( const BYTE* pbCells, int iTileSq, int iStartX, int iWidth, int iStartY, int iHeight )
+{
+	INT iMax = 0;
+
+	for ( int iX = iStartX; iX < iStartX + iWidth; iX++ )
+	{
+		for ( int iY = iStartY; iY < iStartY + iHeight; iY++ )
+		{
+			BYTE bHeight = pbCells[iX * iTileSq + iY];
+
+			iMax = bHeight > (BYTE)iMax ? bHeight : iMax;
+		}
+	}
+
+	return iMax;
+}
+
+//------------------------------------------------------------------------------------
+//	Fill depressions as Planchon and Darboux do with no slope: flood every cell
+//	but the edges to the top, then sweep the tile, draining water down to any
+//	neighbour's level until nothing changes
+//------------------------------------------------------------------------------------
+void CReference::FillDepressions( BYTE* pbCells, int iTileSq )
+{
+	BYTE* pbWater = new BYTE[iTileSq * iTileSq];
+	BOOL bChanged = TRUE;
+	int iSweep = 0;
+
+	for ( int iX = 0; iX < iTileSq; iX++ )
+	{
+		for ( int iY = 0; iY < iTileSq; iY++ )
+		{
+			BOOL bEdge = iX == 0 || iY == 0 || iX == iTileSq - 1 || iY == iTileSq - 1;
+
+			pbWater[iX * iTileSq + iY] = bEdge ? pbCells[iX * iTileSq + iY] : 255;
+		}
+	}
+
+	while ( bChanged )
+	{
+		bChanged = FALSE;
+
+		//	Alternate directions so water drains in a few sweeps
+		//----------------------------------------------------------
+		for ( int i = 1; i < iTileSq - 1; i++ )
+		{
+			for ( int j = 1; j < iTileSq - 1; j++ )
+			{
+				int x = ( iSweep & 1 ) ? iTileSq - 1 - i : i;
+				int y = ( iSweep & 2 ) ? iTileSq - 1 - j : j;
+				BYTE& bWater = pbWater[x * iTileSq + y];
+				BYTE bHeight = pbCells[x * iTileSq + y];
+
+				for ( int n = 0; n < 9 && bWater > bHeight; n++ )
+				{
+					BYTE bNeighbour = pbWater[( x + n / 3 - 1 ) * iTileSq + y + n % 3 - 1];
+
+					if ( n == 4 )
+					{
+						continue;
+					}
+
+					if ( bHeight >= bNeighbour )
+					{
+						bWater = bHeight;
+						bChanged = TRUE;
+					}
+					else if ( bWater > bNeighbour )
+					{
+						bWater = bNeighbour;
+						bChanged = TRUE;
+					}
+				}
+			}
+		}
+
+		iSweep++;
+	}
+
+	memcpy( pbCells, pbWater, iTileSq * iTileSq );
+
+	delete [] pbWater;
+}
+
+//------------------------------------------------------------------------------------
+//	Marching squares at one level, each square on its own. Segments are x0, y0,
+//	x1, y1 with cells at or above the level on the left, walking the square's
+//	sides clockwise from the top left for where its corners cross the level.
+//	Returns how many, at most two a square.
+//------------------------------------------------------------------------------------
+int CReference::ContourSegments( const BYTE* pbCells, int iTileSq, int iLevel, FLOAT* pfSegments )
+{
+	FLOAT fLevel = (FLOAT)iLevel - 0.5f;
+	int iSegments = 0;
+
+	for ( int y = 0; y < iTileSq - 1; y++ )
+	{
+		for ( int x = 0; x < iTileSq - 1; x++ )
+		{
+			int aiX[4] = { x, x + 1, x + 1, x };
+			int aiY[4] = { y, y, y + 1, y + 1 };
+			int aiHeight[4];
+			FLOAT afPointX[4];
+			FLOAT afPointY[4];
+			int aiEnter[2];
+			int iEnters = 0;
+			int i;
+
+			for ( i = 0; i < 4; i++ )
+			{
+				aiHeight[i] = pbCells[aiX[i] * iTileSq + aiY[i]];
+			}
+
+			//	Side i runs from corner i to the next, each point found from
+			//	its edge's top or left end
+			//-------------------------------------------------------------------
+			for ( i = 0; i < 4; i++ )
+			{
+				int j = ( i + 1 ) % 4;
+				BOOL bAbove = aiHeight[i] >= iLevel;
+				BOOL bNextAbove = aiHeight[j] >= iLevel;
+
+				if ( bAbove == bNextAbove )
+				{
+					continue;
+				}
+
+				int iStart = i == 2 || i == 3 ? ( i + 1 ) % 4 : i;
+				int iEnd = iStart == i ? j : i;
+				FLOAT fAlong = ( fLevel - (FLOAT)aiHeight[iStart] ) / (FLOAT)( aiHeight[iEnd] - aiHeight[iStart] );
+
+				afPointX[i] = (FLOAT)aiX[iStart] + ( aiY[iStart] == aiY[iEnd] ? fAlong : 0.f );
+				afPointY[i] = (FLOAT)aiY[iStart] + ( aiX[iStart] == aiX[iEnd] ? fAlong : 0.f );
+
+				if ( bNextAbove )
+				{
+					aiEnter[iEnters++] = i;
+				}
+			}
+
+			//	An entry goes to the exit clockwise of it, except across a
+			//	square of alternate corners with the centre above, where it
+			//	goes to the exit before it
+			//-------------------------------------------------------------------
+			BOOL bCentreAbove = aiHeight[0] + aiHeight[1] + aiHeight[2] + aiHeight[3] >= 4 * iLevel - 2;
+
+			for ( int k = 0; k < iEnters; k++ )
+			{
+				int iExit = ( aiEnter[k] + 1 ) % 4;
+
+				if ( iEnters == 1 )
+				{
+					while ( aiHeight[iExit] < iLevel || aiHeight[( iExit + 1 ) % 4] >= iLevel )
+					{
+						iExit = ( iExit + 1 ) % 4;
+					}
+				}
+				else if ( bCentreAbove )
+				{
+					iExit = ( aiEnter[k] + 3 ) % 4;
+				}
+
+				pfSegments[4 * iSegments] = afPointX[aiEnter[k]];
+				pfSegments[4 * iSegments + 1] = afPointY[aiEnter[k]];
+				pfSegments[4 * iSegments + 2] = afPointX[iExit];
+				pfSegments[4 * iSegments + 3] = afPointY[iExit];
+				iSegments++;
+			}
+		}
+	}
+
+	return iSegments;
+}
+
+//------------------------------------------------------------------------------------
+//	The height and gradient at (dX, dY) in cells, held to the tile, by the
+//	textbook bilinear or Catmull-Rom polynomial along each row and then down
+//	the rows, cells off the tile repeating its edge
+//------------------------------------------------------------------------------------
+void CReference::Sample( const BYTE* pbCells, int iTileSq, int iFilter, double dX, double dY, double* pdHeight, double* pdGradX, double* pdGradY )
+{
+	int iTaps = iFilter == SAMPLE_BICUBIC ? 4 : 2;
+	int iFirstTap = iFilter == SAMPLE_BICUBIC ? -1 : 0;
+	double adRow[4];
+	double adRowSlope[4];
+	double dUnused;
+
+	dX = dX < 0.0 ? 0.0 : ( dX > (double)( iTileSq - 1 ) ? (double)( iTileSq - 1 ) : dX );
+	dY = dY < 0.0 ? 0.0 : ( dY > (double)( iTileSq - 1 ) ? (double)( iTileSq - 1 ) : dY );
+
+	int x = (int)floor( dX ) < iTileSq - 2 ? (int)floor( dX ) : iTileSq - 2;
+	int y = (int)floor( dY ) < iTileSq - 2 ? (int)floor( dY ) : iTileSq - 2;
+
+	for ( int j = 0; j < iTaps; j++ )
+	{
+		double adCells[4];
+		int iRow = y + iFirstTap + j;
+
+		iRow = iRow < 0 ? 0 : ( iRow > iTileSq - 1 ? iTileSq - 1 : iRow );
+
+		for ( int i = 0; i < iTaps; i++ )
+		{
+			int iColumn = x + iFirstTap + i;
+
+			iColumn = iColumn < 0 ? 0 : ( iColumn > iTileSq - 1 ? iTileSq - 1 : iColumn );
+			adCells[i] = (double)pbCells[iColumn * iTileSq + iRow];
+		}
+
+		Interpolate( adCells, iTaps, dX - (double)x, &adRow[j], &adRowSlope[j] );
+	}
+
+	Interpolate( adRow, iTaps, dY - (double)y, pdHeight, pdGradY );
+	Interpolate( adRowSlope, iTaps, dY - (double)y, pdGradX, &dUnused );
+}
+
+//------------------------------------------------------------------------------------
+//	A line through two points, or Catmull-Rom through the middle two of four,
+//	and its slope, at t from the first (or second) point
+//------------------------------------------------------------------------------------
+void CReference::Interpolate( const double* pdPoints, int iPoints, double dT, double* pdValue, double* pdSlope )
+{
+	if ( iPoints == 2 )
+	{
+		*pdValue = pdPoints[0] + ( pdPoints[1] - pdPoints[0] ) * dT;
+		*pdSlope = pdPoints[1] - pdPoints[0];
+		return;
+	}
+
+	double dA = -pdPoints[0] + pdPoints[2];
+	double dB = 2.0 * pdPoints[0] - 5.0 * pdPoints[1] + 4.0 * pdPoints[2] - pdPoints[3];
+	double dC = -pdPoints[0] + 3.0 * pdPoints[1] - 3.0 * pdPoints[2] + pdPoints[3];
+
+	*pdValue = 0.5 * ( 2.0 * pdPoints[1] + dA * dT + dB * dT * dT + dC * dT * dT * dT );
+	*pdSlope = 0.5 * ( dA + 2.0 * dB * dT + 3.0 * dC * dT * dT );
+}
+
+//------------------------------------------------------------------------------------
+//	Write the cells as a 24 bit TGA, a byte at a time, bottom row first
+//------------------------------------------------------------------------------------
+BOOL CReference::SaveTga( LPCSTR szFilename, const BYTE* pbCells, int iTileSq )
+{
+	FILE* file;
+	BYTE head[TGA_HEADER_SIZE];
+
+	FillTgaHeader( head, iTileSq, iTileSq );
+
+	if ( ( file = fopen( szFilename, "wb" ) ) == NULL )
+	{
+		return FALSE;
+	}
+
+	fwrite( &head, TGA_HEADER_SIZE, 1, file );
+
+	for ( int y = iTileSq - 1; y >= 0; y-- )
+	{
+		for ( int x = 0; x < iTileSq; x++ )
+		{
+			fwrite( &pbCells[x * iTileSq + y], sizeof(BYTE), 1, file );		// as Red
+			fwrite( &pbCells[x * iTileSq + y], sizeof(BYTE), 1, file );		// as Green
+			fwrite( &pbCells[x * iTileSq + y], sizeof(BYTE), 1, file );		// as Blue
+		}
+	}
+
+	fclose( file );
+
+	return TRUE;
+}
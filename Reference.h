@@ -0,0 +1,59 @@
+/*--------------------------------------------------------------------------------
+
+	Reference.h
+
+	Provides the original scalar implementations of the terrain operations,
+	kept unoptimized so the optimized paths can be checked against them
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _REFERENCE_H
+#define _REFERENCE_H
+
+//-------------
+//	Includes
+//-------------
+#include "FaultKernel.h"
+#include "Logistic.h"
+#include "Sample.h"
+
+//------------------------------------------------------------------------------
+//	The reference implementations
+//
+//	Each is the loop the tile first shipped with, cell by cell over a plain
+//	column-major grid, [x * iTileSq + y], of any size. Nothing here should be
+//	made faster: the point is that it is obviously what the tile has always
+//	done. See CVerifier for the optimized code each one checks.
+//
+//	Faults take a FAULTPASS so a run is described exactly as the kernel
+//	gets it. pvCells holds BYTE cells for a clamped pass and doubles for a
+//	retained one, and the cell type and layout are ignored. Smooth profiles
+//	are only run retained, evaluated directly rather than through a table.
+//------------------------------------------------------------------------------
+class CReference
+{
+public:
+	static void Faults( const FAULTPASS& pass );
+	static void Quantize( const double* pdHeights, int iTileSq, int iTop, WORD* pwLevels );
+	static void Blur( BYTE* pbCells, int iTileSq, int iBlurFactor );
+	static void FillDepressions( BYTE* pbCells, int iTileSq );
+	static int ContourSegments( const BYTE* pbCells, int iTileSq, int iLevel, FLOAT* pfSegments );
+	static void Sample( const BYTE* pbCells, int iTileSq, int iFilter, double dX, double dY, double* pdHeight, double* pdGradX, double* pdGradY );
+	static FLOAT FractalDimension( const BYTE* pbCells, int iTileSq );
+	static BOOL SaveTga( LPCSTR szFilename, const BYTE* pbCells, int iTileSq );
+
+	static double Profile( int iProfile, double dT );
+	static double LyapunovExponent( FLOAT fM, FLOAT fSeed, int iTransient, int iIterates );
+	static double VariogramDimension( const double* pdHeights, int iTileSq, int iMaxLag );
+
+private:
+	static INT PatchMaxHeight( const BYTE* pbCells, int iTileSq, int iStartX, int iWidth, int iStartY, int iHeight );
+	static void Interpolate( const double* pdPoints, int iPoints, double dT, double* pdValue, double* pdSlope );
+};
+
+#endif
@@ -0,0 +1,357 @@
+/*--------------------------------------------------------------------------------
+
+	ResultCache.cpp
+
+	Provides a content addressed cache of generated heightfields on disk,
+	so pipelines that repeat an earlier run's generation skip straight to
+	its output
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <string.h>
+
+#include "ResultCache.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+typedef struct tagRESULTFILE
+{
+	FILETIME	ftWrite;
+	ULONGLONG	ullSize;
+	TCHAR		szName[32];
+} RESULTFILE;
+
+//---------------------------------------
+//	Oldest first, for eviction order
+//---------------------------------------
+static int CompareResultFiles( const void* pvA, const void* pvB )
+{
+	return CompareFileTime( &( (const RESULTFILE*)pvA )->ftWrite, &( (const RESULTFILE*)pvB )->ftWrite );
+}
+
+//----------------------------------------
+//
+//	CLASS: CResultCache implementation
+//
+//----------------------------------------
+CResultCache::CResultCache()
+{
+	m_szDirectory[0] = 0;
+	m_ullBudget = 0;
+	m_szError[0] = 0;
+
+	memset( &m_stats, 0, sizeof(m_stats) );
+}
+
+CResultCache::~CResultCache()
+{
+}
+
+LPCSTR CResultCache::GetError()
+{
+	return m_szError;
+}
+
+void CResultCache::GetStats( RESULTCACHESTATS* pStats )
+{
+	*pStats = m_stats;
+}
+
+//------------------------------------------------------------------
+//	64 bit FNV-1a, continued from ullHash (0 starts a new hash)
+//------------------------------------------------------------------
+ULONGLONG CResultCache::Hash( ULONGLONG ullHash, const void* pvData, DWORD dwSize )
+{
+	const BYTE* pbData = (const BYTE*)pvData;
+
+	if ( ullHash == 0 )
+	{
+		ullHash = ( (ULONGLONG)0xCBF29CE4 << 32 ) | 0x84222325;
+	}
+
+	for ( DWORD dwByte = 0; dwByte < dwSize; dwByte++ )
+	{
+		ullHash ^= pbData[dwByte];
+		ullHash *= ( (ULONGLONG)0x00000100 << 32 ) | 0x000001B3;
+	}
+
+	return ullHash;
+}
+
+//------------------------------------------------------------------------------
+//	Use szDirectory for the cache, creating it if need be, keeping it to
+//	dwBudgetMB megabytes
+//------------------------------------------------------------------------------
+BOOL CResultCache::Open( LPCSTR szDirectory, DWORD dwBudgetMB )
+{
+	m_szError[0] = 0;
+
+	CreateDirectory( szDirectory, NULL );
+
+	DWORD dwAttributes = GetFileAttributes( szDirectory );
+
+	if ( dwAttributes == 0xFFFFFFFF || !( dwAttributes & FILE_ATTRIBUTE_DIRECTORY ) )
+	{
+		sprintf( m_szError, "Unable to use %.200s as a cache directory", szDirectory );
+		return FALSE;
+	}
+
+	strncpy( m_szDirectory, szDirectory, MAX_PATH - 1 );
+	m_szDirectory[MAX_PATH - 1] = 0;
+	m_ullBudget = (ULONGLONG)dwBudgetMB * 1024 * 1024;
+
+	return TRUE;
+}
+
+void CResultCache::EntryPath( ULONGLONG ullKey, LPCSTR szExtension, LPSTR szPath )
+{
+	_snprintf( szPath, MAX_PATH - 1, "%s\\%08lx%08lx%s", m_szDirectory, (unsigned long)( ullKey >> 32 ), (unsigned long)( ullKey & 0xFFFFFFFF ), szExtension );
+	szPath[MAX_PATH - 1] = 0;
+}
+
+//------------------------------------------------------------------------------
+//	Fill the tile from the entry for ullKey, if there is one
+//
+//	The grid takes the layout it was stored in. On a miss the tile is left
+//	untouched and FALSE is returned.
+//------------------------------------------------------------------------------
+BOOL CResultCache::Load( ULONGLONG ullKey, CTerrain* pTerrain, FLOAT* pfLogIterate )
+{
+	TRACE_SPAN( "result cache load" );
+
+	TCHAR szPath[MAX_PATH];
+	int iTileSq = pTerrain->TileSize();
+	DWORD dwExpected = sizeof(RESULTHEADER) + iTileSq * iTileSq;
+	BOOL bHit = FALSE;
+
+	EntryPath( ullKey, RESULTCACHE_EXTENSION, szPath );
+
+	//	Read only, and sharing both ways, so any number of runs can load an
+	//	entry at once. Touching the time needs only the attributes, which
+	//	sharing does not guard.
+	//--------------------------------------------------------------------------
+	HANDLE hFile = CreateFile( szPath, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( hFile != INVALID_HANDLE_VALUE )
+	{
+		HANDLE hMapping = GetFileSize( hFile, NULL ) == dwExpected ? CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL ) : NULL;
+		const BYTE* pbView = hMapping != NULL ? (const BYTE*)MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+
+		if ( pbView != NULL )
+		{
+			const RESULTHEADER* pHeader = (const RESULTHEADER*)pbView;
+
+			if ( pHeader->dwMagic == RESULTCACHE_MAGIC && pHeader->dwVersion == RESULTCACHE_VERSION
+				&& pHeader->dwKeyLow == (DWORD)( ullKey & 0xFFFFFFFF ) && pHeader->dwKeyHigh == (DWORD)( ullKey >> 32 )
+				&& pHeader->dwTileSq == (DWORD)iTileSq && pTerrain->HeightGrid().SetLayout( (int)pHeader->dwLayout ) )
+			{
+				pTerrain->HeightGrid().FromColumns( pbView + sizeof(RESULTHEADER) );
+				*pfLogIterate = pHeader->fLogIterate;
+				bHit = TRUE;
+
+				TRACE_BYTES( (ULONGLONG)iTileSq * iTileSq );
+			}
+
+			UnmapViewOfFile( pbView );
+		}
+
+		if ( hMapping != NULL )
+		{
+			CloseHandle( hMapping );
+		}
+
+		//	A hit counts as a fresh use, for eviction
+		//------------------------------------------------
+		if ( bHit )
+		{
+			FILETIME ftNow;
+			SYSTEMTIME stNow;
+
+			GetSystemTime( &stNow );
+			SystemTimeToFileTime( &stNow, &ftNow );
+			SetFileTime( hFile, NULL, NULL, &ftNow );
+		}
+
+		CloseHandle( hFile );
+	}
+
+	if ( bHit )
+	{
+		m_stats.iHits++;
+	}
+	else
+	{
+		m_stats.iMisses++;
+	}
+
+	return bHit;
+}
+
+//------------------------------------------------------------------------------
+//	Store the tile's grid under ullKey, then trim the cache to its budget
+//------------------------------------------------------------------------------
+BOOL CResultCache::Store( ULONGLONG ullKey, CTerrain* pTerrain, FLOAT fLogIterate )
+{
+	TRACE_SPAN( "result cache store" );
+
+	TCHAR szTemp[MAX_PATH];
+	TCHAR szPath[MAX_PATH];
+	RESULTHEADER header;
+	int iTileSq = pTerrain->TileSize();
+	DWORD dwCells = iTileSq * iTileSq;
+	DWORD dwWritten = 0;
+
+	EntryPath( ullKey, ".tmp", szTemp );
+	EntryPath( ullKey, RESULTCACHE_EXTENSION, szPath );
+
+	memset( &header, 0, sizeof(header) );
+	header.dwMagic = RESULTCACHE_MAGIC;
+	header.dwVersion = RESULTCACHE_VERSION;
+	header.dwKeyLow = (DWORD)( ullKey & 0xFFFFFFFF );
+	header.dwKeyHigh = (DWORD)( ullKey >> 32 );
+	header.dwTileSq = (DWORD)iTileSq;
+	header.dwLayout = (DWORD)pTerrain->HeightGrid().Layout();
+	header.fLogIterate = fLogIterate;
+
+	BYTE* pbColumns = new BYTE[dwCells];
+
+	if ( pbColumns == NULL )
+	{
+		sprintf( m_szError, "Out of memory storing %.200s", szPath );
+		return FALSE;
+	}
+
+	pTerrain->HeightGrid().ToColumns( pbColumns );
+
+	HANDLE hFile = CreateFile( szTemp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	BOOL bResult = hFile != INVALID_HANDLE_VALUE;
+
+	if ( bResult )
+	{
+		bResult = WriteFile( hFile, &header, sizeof(header), &dwWritten, NULL ) && dwWritten == sizeof(header)
+			&& WriteFile( hFile, pbColumns, dwCells, &dwWritten, NULL ) && dwWritten == dwCells;
+
+		CloseHandle( hFile );
+	}
+
+	delete [] pbColumns;
+
+	//	Readers only ever see whole entries, and never a missing one where
+	//	an older entry is replaced. Windows 9x has no MoveFileEx, so there
+	//	the old entry is deleted first and a reader may miss.
+	//-------------------------------------------------------------------------
+	if ( bResult && !MoveFileEx( szTemp, szPath, MOVEFILE_REPLACE_EXISTING ) )
+	{
+		bResult = GetLastError() == ERROR_CALL_NOT_IMPLEMENTED;
+
+		if ( bResult )
+		{
+			DeleteFile( szPath );
+			bResult = MoveFile( szTemp, szPath );
+		}
+	}
+
+	if ( !bResult )
+	{
+		DeleteFile( szTemp );
+		sprintf( m_szError, "Unable to store %.200s", szPath );
+		return FALSE;
+	}
+
+	TRACE_BYTES( sizeof(header) + dwCells );
+
+	m_stats.iStores++;
+
+	Trim();
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Delete the oldest entries until the directory is within budget
+//------------------------------------------------------------------------------
+void CResultCache::Trim()
+{
+	TCHAR szPattern[MAX_PATH];
+	WIN32_FIND_DATA findData;
+	RESULTFILE* pFiles = NULL;
+	int iFiles = 0;
+	int iCapacity = 0;
+	ULONGLONG ullTotal = 0;
+
+	_snprintf( szPattern, MAX_PATH - 1, "%s\\*%s", m_szDirectory, RESULTCACHE_EXTENSION );
+	szPattern[MAX_PATH - 1] = 0;
+
+	HANDLE hFind = FindFirstFile( szPattern, &findData );
+
+	if ( hFind == INVALID_HANDLE_VALUE )
+	{
+		return;
+	}
+
+	do
+	{
+		if ( iFiles == iCapacity )
+		{
+			iCapacity = iCapacity > 0 ? iCapacity * 2 : 64;
+
+			RESULTFILE* pGrown = new RESULTFILE[iCapacity];
+
+			if ( pGrown == NULL )
+			{
+				break;		// Trim what is listed, the next store sees the rest
+			}
+
+			if ( pFiles != NULL )
+			{
+				memcpy( pGrown, pFiles, sizeof(RESULTFILE) * iFiles );
+				delete [] pFiles;
+			}
+
+			pFiles = pGrown;
+		}
+
+		RESULTFILE& file = pFiles[iFiles];
+
+		file.ftWrite = findData.ftLastWriteTime;
+		file.ullSize = ( (ULONGLONG)findData.nFileSizeHigh << 32 ) | findData.nFileSizeLow;
+		strncpy( file.szName, findData.cFileName, sizeof(file.szName) - 1 );
+		file.szName[sizeof(file.szName) - 1] = 0;
+
+		ullTotal += file.ullSize;
+		iFiles++;
+	}
+	while ( FindNextFile( hFind, &findData ) );
+
+	FindClose( hFind );
+
+	if ( ullTotal > m_ullBudget )
+	{
+		qsort( pFiles, iFiles, sizeof(RESULTFILE), CompareResultFiles );
+
+		for ( int iFile = 0; iFile < iFiles && ullTotal > m_ullBudget; iFile++ )
+		{
+			TCHAR szPath[MAX_PATH];
+
+			_snprintf( szPath, MAX_PATH - 1, "%s\\%s", m_szDirectory, pFiles[iFile].szName );
+			szPath[MAX_PATH - 1] = 0;
+
+			if ( DeleteFile( szPath ) )
+			{
+				ullTotal -= pFiles[iFile].ullSize;
+				m_stats.iEvictions++;
+			}
+		}
+	}
+
+	delete [] pFiles;
+}
@@ -0,0 +1,97 @@
+/*--------------------------------------------------------------------------------
+
+	ResultCache.h
+
+	Provides a content addressed cache of generated heightfields on disk,
+	so pipelines that repeat an earlier run's generation skip straight to
+	its output
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _RESULTCACHE_H
+#define _RESULTCACHE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define RESULTCACHE_MAGIC			0x48434652		// 'RFCH'
+#define RESULTCACHE_VERSION			1
+#define RESULTCACHE_DEFAULT_SIZE	256				// Megabytes
+#define RESULTCACHE_EXTENSION		".hfc"
+
+//	File layout:	RESULTHEADER
+//					BYTE cells[dwTileSq * dwTileSq], column-major
+//
+//	Named by the key in hex, so a lookup is one open
+//------------------------------------------------------------------------
+typedef struct tagRESULTHEADER
+{
+	DWORD	dwMagic;
+	DWORD	dwVersion;
+	DWORD	dwKeyLow;
+	DWORD	dwKeyHigh;
+	DWORD	dwTileSq;
+	DWORD	dwLayout;			// GRIDLAYOUT the grid was left in
+	FLOAT	fLogIterate;		// Logistic function state after the run
+	DWORD	dwReserved;
+} RESULTHEADER;
+
+typedef struct tagRESULTCACHESTATS
+{
+	int		iHits;
+	int		iMisses;
+	int		iStores;
+	int		iEvictions;
+} RESULTCACHESTATS;
+
+//------------------------------------------------------------------------------
+//	A heightfield cache
+//
+//	Entries are whole grids keyed by a 64 bit hash of everything that made
+//	them, kept as one file each in a directory of their own. A hit maps the
+//	file and copies the cells straight into the tile. Storing writes a
+//	temporary file and renames it into place, then trims the directory to
+//	its size budget, dropping the entries least recently stored or hit
+//	(a hit refreshes the file's write time).
+//------------------------------------------------------------------------------
+class CResultCache
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CResultCache();
+	virtual ~CResultCache();
+
+	//----------------------------
+	//	CResultCache Interface
+	//----------------------------
+	BOOL Open( LPCSTR szDirectory, DWORD dwBudgetMB );
+	BOOL Load( ULONGLONG ullKey, CTerrain* pTerrain, FLOAT* pfLogIterate );
+	BOOL Store( ULONGLONG ullKey, CTerrain* pTerrain, FLOAT fLogIterate );
+
+	void GetStats( RESULTCACHESTATS* pStats );
+	LPCSTR GetError();
+
+	static ULONGLONG Hash( ULONGLONG ullHash, const void* pvData, DWORD dwSize );
+
+private:
+	void EntryPath( ULONGLONG ullKey, LPCSTR szExtension, LPSTR szPath );
+	void Trim();
+
+	TCHAR m_szDirectory[MAX_PATH];
+	ULONGLONG m_ullBudget;
+	RESULTCACHESTATS m_stats;
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,853 @@
+/*--------------------------------------------------------------------------------
+
+	Sample.cpp
+
+	Provides batched height queries at arbitrary points, interpolated over
+	a tile's cells or evaluated from a fault run when there is no tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+#include <string.h>
+
+#include "Sample.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef SAMPLE_SIMD
+#define SAMPLE_SIMD		1		// 0 takes every query through the scalar loops only
+#endif
+
+#if SAMPLE_SIMD
+#include <emmintrin.h>
+#endif
+
+//	A batch split over the scheduler, SAMPLE_TASK queries a task
+//------------------------------------------------------------------
+typedef struct tagSAMPLEJOB
+{
+	CHeightSampler*		pSampler;
+	const SAMPLEBATCH*	pBatch;
+} SAMPLEJOB;
+
+//------------------------------------------------------------------------------
+//	Catmull-Rom weights of the four cells around t in [0, 1], and their
+//	slopes, for the cells at -1, 0, 1 and 2
+//------------------------------------------------------------------------------
+static void CubicWeights( FLOAT fT, FLOAT* pfWeights, FLOAT* pfSlopes )
+{
+	pfWeights[0] = fT * ( ( 2.f - fT ) * fT - 1.f ) * 0.5f;
+	pfWeights[1] = ( fT * fT * ( 3.f * fT - 5.f ) + 2.f ) * 0.5f;
+	pfWeights[2] = fT * ( ( 4.f - 3.f * fT ) * fT + 1.f ) * 0.5f;
+	pfWeights[3] = fT * fT * ( fT - 1.f ) * 0.5f;
+
+	pfSlopes[0] = ( ( 4.f - 3.f * fT ) * fT - 1.f ) * 0.5f;
+	pfSlopes[1] = fT * ( 9.f * fT - 10.f ) * 0.5f;
+	pfSlopes[2] = ( ( 8.f - 9.f * fT ) * fT + 1.f ) * 0.5f;
+	pfSlopes[3] = fT * ( 3.f * fT - 2.f ) * 0.5f;
+}
+
+#if SAMPLE_SIMD
+static void CubicWeights( __m128 vT, __m128* pvWeights, __m128* pvSlopes )
+{
+	__m128 vHalf = _mm_set1_ps( 0.5f );
+	__m128 vOne = _mm_set1_ps( 1.f );
+	__m128 vTT = _mm_mul_ps( vT, vT );
+	__m128 vThreeT = _mm_mul_ps( _mm_set1_ps( 3.f ), vT );
+	__m128 vNineT = _mm_mul_ps( _mm_set1_ps( 9.f ), vT );
+
+	pvWeights[0] = _mm_mul_ps( _mm_mul_ps( vT, _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 2.f ), vT ), vT ), vOne ) ), vHalf );
+	pvWeights[1] = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( vTT, _mm_sub_ps( vThreeT, _mm_set1_ps( 5.f ) ) ), _mm_set1_ps( 2.f ) ), vHalf );
+	pvWeights[2] = _mm_mul_ps( _mm_mul_ps( vT, _mm_add_ps( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 4.f ), vThreeT ), vT ), vOne ) ), vHalf );
+	pvWeights[3] = _mm_mul_ps( _mm_mul_ps( vTT, _mm_sub_ps( vT, vOne ) ), vHalf );
+
+	pvSlopes[0] = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 4.f ), vThreeT ), vT ), vOne ), vHalf );
+	pvSlopes[1] = _mm_mul_ps( _mm_mul_ps( vT, _mm_sub_ps( vNineT, _mm_set1_ps( 10.f ) ) ), vHalf );
+	pvSlopes[2] = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 8.f ), vNineT ), vT ), vOne ), vHalf );
+	pvSlopes[3] = _mm_mul_ps( _mm_mul_ps( vT, _mm_sub_ps( vThreeT, _mm_set1_ps( 2.f ) ) ), vHalf );
+}
+
+//	The cell below four clamped coordinates, kept off the last cell so the
+//	cell after it is always on the tile, and how far past it they are
+//-----------------------------------------------------------------------------
+static __m128i CellFloor( __m128 vCell, __m128 vLast, __m128* pvFraction )
+{
+	__m128 vFloor = _mm_min_ps( _mm_cvtepi32_ps( _mm_cvttps_epi32( vCell ) ), vLast );
+
+	*pvFraction = _mm_sub_ps( vCell, vFloor );
+
+	return _mm_cvttps_epi32( vFloor );
+}
+#endif
+
+static int CellFloor( FLOAT fCell, int iLast, FLOAT* pfFraction )
+{
+	int iCell = (int)fCell < iLast ? (int)fCell : iLast;
+
+	*pfFraction = fCell - (FLOAT)iCell;
+
+	return iCell;
+}
+
+//------------------------------------------
+//
+//	CLASS: CHeightSampler implementation
+//
+//------------------------------------------
+CHeightSampler::CHeightSampler()
+{
+	m_iSource = SAMPLE_SOURCE_NONE;
+	m_fOriginX = 0.f;
+	m_fOriginY = 0.f;
+	m_fCellSize = 1.f;
+	m_pGrid = NULL;
+	m_pbCells = NULL;
+	m_iSize = 0;
+	m_iLayout = GRID_LAYOUT_COLUMN;
+	m_iFilter = SAMPLE_BILINEAR;
+	m_piXOffset = NULL;
+	m_piYOffset = NULL;
+	m_pFaults = NULL;
+	m_iFaults = 0;
+	m_iProfile = FAULT_PROFILE_STEP;
+	m_dBase = 0.0;
+	m_szError[0] = 0;
+}
+
+CHeightSampler::~CHeightSampler()
+{
+	Clear();
+}
+
+//------------------------------------------------------------------------------
+//	Sample a tile's cells with a SAMPLEFILTER, until another source is set.
+//	The tile must keep its size and layout while it is sampled.
+//------------------------------------------------------------------------------
+BOOL CHeightSampler::SetGrid( CTerrain* pTerrain, int iFilter )
+{
+	int iSize = pTerrain->TileSize();
+
+	if ( iSize < 2 || iSize > SAMPLE_MAX_SIZE )
+	{
+		sprintf( m_szError, "Sampling needs a tile of 2 to %d cells, not %d", SAMPLE_MAX_SIZE, iSize );
+		return FALSE;
+	}
+
+	if ( iFilter != SAMPLE_BILINEAR && iFilter != SAMPLE_BICUBIC )
+	{
+		sprintf( m_szError, "Unknown sample filter %d", iFilter );
+		return FALSE;
+	}
+
+	Clear();
+
+	//	Offsets are kept from column (and row) -1 to size, those off the
+	//	tile repeating its edge, so a bicubic filter never clamps a cell
+	//-----------------------------------------------------------------------
+	int* piXOffset = new int[iSize + 2];
+	int* piYOffset = new int[iSize + 2];
+
+	if ( piXOffset == NULL || piYOffset == NULL )
+	{
+		delete [] piXOffset;
+		delete [] piYOffset;
+
+		sprintf( m_szError, "Out of memory for the offsets of a %d cell tile", iSize );
+		return FALSE;
+	}
+
+	m_pGrid = &pTerrain->HeightGrid();
+	m_pbCells = m_pGrid->Cells();
+	m_iSize = iSize;
+	m_iLayout = m_pGrid->Layout();
+	m_iFilter = iFilter;
+	m_piXOffset = piXOffset + 1;
+	m_piYOffset = piYOffset + 1;
+
+	for ( int iCell = -1; iCell <= iSize; iCell++ )
+	{
+		int iClamped = iCell < 0 ? 0 : iCell < iSize ? iCell : iSize - 1;
+
+		m_piXOffset[iCell] = CHeightGrid::LayoutOffset( m_iLayout, iSize, iClamped, 0 );
+		m_piYOffset[iCell] = CHeightGrid::LayoutOffset( m_iLayout, iSize, 0, iClamped );
+	}
+
+	m_iSource = SAMPLE_SOURCE_GRID;
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Sample a fault run over an iTileSq tile from dBase, its endpoints from
+//	a generator seeded with dwSeed, or from the logistic function started
+//	at the run's seed, as CTerrain and TerraGenFaults start a run
+//------------------------------------------------------------------------------
+BOOL CHeightSampler::SetFaults( const FAULTRUN& run, DWORD dwSeed, int iTileSq, double dBase )
+{
+	if ( iTileSq < 2 || iTileSq > SAMPLE_MAX_SIZE )
+	{
+		sprintf( m_szError, "Sampling needs a tile of 2 to %d cells, not %d", SAMPLE_MAX_SIZE, iTileSq );
+		return FALSE;
+	}
+
+	if ( !run.bUseLogisticFunc && dwSeed == 0 )
+	{
+		sprintf( m_szError, "A fault run needs its seed to be sampled, 0 takes the clock" );
+		return FALSE;
+	}
+
+	if ( run.iIterations < 0 || run.iProfile < FAULT_PROFILE_STEP || run.iProfile > FAULT_PROFILE_SIGMOID )
+	{
+		sprintf( m_szError, "Can't sample %d faults with profile %d", run.iIterations, run.iProfile );
+		return FALSE;
+	}
+
+	SAMPLEFAULT* pFaults = new SAMPLEFAULT[run.iIterations > 0 ? run.iIterations : 1];
+
+	if ( pFaults == NULL )
+	{
+		sprintf( m_szError, "Out of memory for %d faults", run.iIterations );
+		return FALSE;
+	}
+
+	Clear();
+
+	//	The faults as the kernel picks and cuts them, see ApplyFaultPass
+	//-----------------------------------------------------------------------
+	CRandom random( dwSeed );
+	CLogFunc logFunc( run.fLogM, run.fLogSeed );
+	FAULTLINE aLines[SAMPLE_PICK];
+	FAULTPASS pass;
+	FLOAT fWidth = run.fProfileWidth > 0.f ? run.fProfileWidth : FAULT_PROFILE_WIDTH;
+
+	memset( &pass, 0, sizeof(pass) );
+
+	pass.bLogistic = run.bUseLogisticFunc;
+	pass.iProfile = run.iProfile;
+	pass.fProfileWidth = fWidth;
+	pass.iTileSq = iTileSq;
+	pass.iSample = 1;
+	pass.iFirst = 0;
+	pass.iLast = run.iIterations;
+	pass.iIterations = run.iIterations;
+	pass.iDepthInit = run.iDepthInit;
+	pass.iDepthEnd = run.iDepthEnd;
+	pass.iFixedFaultDepth = run.iFixedFaultDepth;
+	pass.pRandom = &random;
+	pass.pLogFunc = &logFunc;
+
+	for ( int iChunk = 0; iChunk < run.iIterations; iChunk += SAMPLE_PICK )
+	{
+		int iLines = run.iIterations - iChunk < SAMPLE_PICK ? run.iIterations - iChunk : SAMPLE_PICK;
+
+		PickFaultLines( pass, iChunk, iLines, aLines );
+
+		for ( int iLine = 0; iLine < iLines; iLine++ )
+		{
+			const FAULTLINE& line = aLines[iLine];
+			SAMPLEFAULT& fault = pFaults[iChunk + iLine];
+			FLOAT fDX = line.fX2 - line.fX1;
+			FLOAT fDY = line.fY2 - line.fY1;
+			FLOAT fLength = (FLOAT)sqrt( (double)( fDX * fDX + fDY * fDY ) );
+			FLOAT fInvBand = fLength > 0.f ? 1.f / ( fLength * fWidth ) : 0.f;
+
+			fault.fX1 = line.fX1;
+			fault.fY1 = line.fY1;
+			fault.fDX = fDX;
+			fault.fDY = fDY;
+			fault.fNegInvBand = -fInvBand;
+			fault.fDepth = (FLOAT)line.iDepth;
+			fault.fGradX = -fDY * fInvBand * fault.fDepth;
+			fault.fGradY = fDX * fInvBand * fault.fDepth;
+		}
+	}
+
+	TabulateFaultProfile( run.iProfile, m_afProfile );
+
+	m_pFaults = pFaults;
+	m_iFaults = run.iIterations;
+	m_iProfile = run.iProfile;
+	m_dBase = dBase;
+	m_iSize = iTileSq;
+	m_iSource = SAMPLE_SOURCE_FAULTS;
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Where cell (0, 0) is in world units, and how wide a cell is
+//------------------------------------------------------------------------------
+void CHeightSampler::SetTransform( FLOAT fOriginX, FLOAT fOriginY, FLOAT fCellSize )
+{
+	m_fOriginX = fOriginX;
+	m_fOriginY = fOriginY;
+	m_fCellSize = fCellSize > 0.f ? fCellSize : 1.f;
+}
+
+//------------------------------------------------------------------------------
+//	Heights at iCount points, and their gradients if pfGradX or pfGradY is
+//	not NULL
+//------------------------------------------------------------------------------
+BOOL CHeightSampler::Sample( const FLOAT* pfX, const FLOAT* pfY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY )
+{
+	if ( m_iSource == SAMPLE_SOURCE_NONE )
+	{
+		sprintf( m_szError, "Nothing to sample, set a grid or a fault run first" );
+		return FALSE;
+	}
+
+	if ( m_iSource == SAMPLE_SOURCE_GRID && ( m_pGrid->Size() != m_iSize || m_pGrid->Layout() != m_iLayout || m_pGrid->Cells() != m_pbCells ) )
+	{
+		sprintf( m_szError, "The tile has changed size or layout since it was set" );
+		return FALSE;
+	}
+
+	if ( iCount <= 0 )
+	{
+		return TRUE;
+	}
+
+	TRACE_SPAN( "sample" );
+	TRACE_CELLS( iCount );
+
+	SAMPLEBATCH batch;
+
+	batch.pfX = pfX;
+	batch.pfY = pfY;
+	batch.iCount = iCount;
+	batch.pfHeights = pfHeights;
+	batch.pfGradX = pfGradX;
+	batch.pfGradY = pfGradY;
+
+	if ( iCount >= SAMPLE_PARALLEL )
+	{
+		SAMPLEJOB job;
+
+		job.pSampler = this;
+		job.pBatch = &batch;
+
+		ParallelFor( ( iCount + SAMPLE_TASK - 1 ) / SAMPLE_TASK, SampleTask, &job );
+	}
+	else
+	{
+		SampleRange( batch, 0, iCount );
+	}
+
+	return TRUE;
+}
+
+int CHeightSampler::Source()
+{
+	return m_iSource;
+}
+
+LPCSTR CHeightSampler::GetError()
+{
+	return m_szError;
+}
+
+void CHeightSampler::SampleTask( int iIndex, int iWorker, void* pContext )
+{
+	SAMPLEJOB* pJob = (SAMPLEJOB*)pContext;
+	int iFirst = iIndex * SAMPLE_TASK;
+	int iCount = pJob->pBatch->iCount - iFirst < SAMPLE_TASK ? pJob->pBatch->iCount - iFirst : SAMPLE_TASK;
+
+	pJob->pSampler->SampleRange( *pJob->pBatch, iFirst, iCount );
+}
+
+//------------------------------------------------------------------------------
+//	Queries [iFirst, iFirst + iCount) of a batch, a block at a time
+//
+//	Each block's points are put in cells, padded out to a whole number of
+//	lane groups with the block's last, and its cells prefetched, a block
+//	before it is worked out.
+//------------------------------------------------------------------------------
+void CHeightSampler::SampleRange( const SAMPLEBATCH& batch, int iFirst, int iCount )
+{
+	FLOAT aafCellX[2][SAMPLE_BLOCK];
+	FLOAT aafCellY[2][SAMPLE_BLOCK];
+	FLOAT afHeights[SAMPLE_BLOCK];
+	FLOAT afGradX[SAMPLE_BLOCK];
+	FLOAT afGradY[SAMPLE_BLOCK];
+	BOOL bGradients = batch.pfGradX != NULL || batch.pfGradY != NULL;
+	int iBuffer = 0;
+
+	ToCells( batch, iFirst, iCount < SAMPLE_BLOCK ? iCount : SAMPLE_BLOCK, aafCellX[0], aafCellY[0] );
+	Prefetch( aafCellX[0], aafCellY[0], iCount < SAMPLE_BLOCK ? iCount : SAMPLE_BLOCK );
+
+	for ( int iBlock = 0; iBlock < iCount; iBlock += SAMPLE_BLOCK )
+	{
+		int iQueries = iCount - iBlock < SAMPLE_BLOCK ? iCount - iBlock : SAMPLE_BLOCK;
+		int iLanes = ( iQueries + 3 ) & ~3;
+		int iNext = iBlock + SAMPLE_BLOCK;
+
+		if ( iNext < iCount )
+		{
+			int iNextQueries = iCount - iNext < SAMPLE_BLOCK ? iCount - iNext : SAMPLE_BLOCK;
+
+			ToCells( batch, iFirst + iNext, iNextQueries, aafCellX[iBuffer ^ 1], aafCellY[iBuffer ^ 1] );
+			Prefetch( aafCellX[iBuffer ^ 1], aafCellY[iBuffer ^ 1], iNextQueries );
+		}
+
+		switch ( m_iSource )
+		{
+			case SAMPLE_SOURCE_GRID:
+				if ( m_iFilter == SAMPLE_BICUBIC )
+				{
+					Bicubic( aafCellX[iBuffer], aafCellY[iBuffer], iLanes, afHeights, afGradX, afGradY );
+				}
+				else
+				{
+					Bilinear( aafCellX[iBuffer], aafCellY[iBuffer], iLanes, afHeights, afGradX, afGradY );
+				}
+				break;
+
+			case SAMPLE_SOURCE_FAULTS:
+				Faults( aafCellX[iBuffer], aafCellY[iBuffer], iLanes, bGradients, afHeights, afGradX, afGradY );
+				break;
+		}
+
+		memcpy( batch.pfHeights + iFirst + iBlock, afHeights, sizeof(FLOAT) * iQueries );
+
+		if ( batch.pfGradX != NULL )
+		{
+			memcpy( batch.pfGradX + iFirst + iBlock, afGradX, sizeof(FLOAT) * iQueries );
+		}
+
+		if ( batch.pfGradY != NULL )
+		{
+			memcpy( batch.pfGradY + iFirst + iBlock, afGradY, sizeof(FLOAT) * iQueries );
+		}
+
+		iBuffer ^= 1;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	A block of iCount queries from iFirst in cells, clamped to a grid's
+//	tile, and padded to SAMPLE_BLOCK with the last
+//------------------------------------------------------------------------------
+void CHeightSampler::ToCells( const SAMPLEBATCH& batch, int iFirst, int iCount, FLOAT* pfCellX, FLOAT* pfCellY )
+{
+	FLOAT fScale = 1.f / m_fCellSize;
+	FLOAT fLast = (FLOAT)( m_iSize - 1 );
+	BOOL bClamp = m_iSource == SAMPLE_SOURCE_GRID;
+
+	for ( int iQuery = 0; iQuery < SAMPLE_BLOCK; iQuery++ )
+	{
+		int iFrom = iFirst + ( iQuery < iCount ? iQuery : iCount - 1 );
+		FLOAT fX = ( batch.pfX[iFrom] - m_fOriginX ) * fScale;
+		FLOAT fY = ( batch.pfY[iFrom] - m_fOriginY ) * fScale;
+
+		//	Written so that a NaN lands on cell 0
+		//-------------------------------------------
+		if ( bClamp )
+		{
+			fX = fX > 0.f ? fX : 0.f;
+			fX = fX < fLast ? fX : fLast;
+			fY = fY > 0.f ? fY : 0.f;
+			fY = fY < fLast ? fY : fLast;
+		}
+
+		pfCellX[iQuery] = fX;
+		pfCellY[iQuery] = fY;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Start loading the cells a block of grid queries will read
+//------------------------------------------------------------------------------
+void CHeightSampler::Prefetch( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount )
+{
+#if SAMPLE_SIMD
+	if ( m_iSource != SAMPLE_SOURCE_GRID )
+	{
+		return;
+	}
+
+	int iFirstTap = m_iFilter == SAMPLE_BICUBIC ? -1 : 0;
+	int iLastTap = m_iFilter == SAMPLE_BICUBIC ? 2 : 1;
+	FLOAT fFraction;
+
+	for ( int iQuery = 0; iQuery < iCount; iQuery++ )
+	{
+		int iX = CellFloor( pfCellX[iQuery], m_iSize - 2, &fFraction );
+		int iY = CellFloor( pfCellY[iQuery], m_iSize - 2, &fFraction );
+
+		for ( int iTapY = iFirstTap; iTapY <= iLastTap; iTapY++ )
+		{
+			for ( int iTapX = iFirstTap; iTapX <= iLastTap; iTapX++ )
+			{
+				_mm_prefetch( (const char*)( m_pbCells + m_piXOffset[iX + iTapX] + m_piYOffset[iY + iTapY] ), _MM_HINT_T0 );
+			}
+		}
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+//	Bilinear heights and gradients for iCount clamped queries, a multiple
+//	of 4
+//------------------------------------------------------------------------------
+void CHeightSampler::Bilinear( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY )
+{
+	const BYTE* pbCells = m_pbCells;
+	const int* piXOffset = m_piXOffset;
+	const int* piYOffset = m_piYOffset;
+	FLOAT fScale = 1.f / m_fCellSize;
+	int iQuery = 0;
+
+#if SAMPLE_SIMD
+	__m128 vLast = _mm_set1_ps( (FLOAT)( m_iSize - 2 ) );
+	__m128 vScale = _mm_set1_ps( fScale );
+
+	for ( ; iQuery + 4 <= iCount; iQuery += 4 )
+	{
+		__m128 vFX, vFY;
+		int aiX[4], aiY[4];
+		FLOAT afA[4], afB[4], afC[4], afD[4];
+
+		_mm_storeu_si128( (__m128i*)aiX, CellFloor( _mm_loadu_ps( pfCellX + iQuery ), vLast, &vFX ) );
+		_mm_storeu_si128( (__m128i*)aiY, CellFloor( _mm_loadu_ps( pfCellY + iQuery ), vLast, &vFY ) );
+
+		//	SSE2 has no gather, so the corners are loaded a lane at a time
+		//---------------------------------------------------------------------
+		for ( int iLane = 0; iLane < 4; iLane++ )
+		{
+			const BYTE* pbTop = pbCells + piYOffset[aiY[iLane]];
+			const BYTE* pbBottom = pbCells + piYOffset[aiY[iLane] + 1];
+			int iLeft = piXOffset[aiX[iLane]];
+			int iRight = piXOffset[aiX[iLane] + 1];
+
+			afA[iLane] = (FLOAT)pbTop[iLeft];
+			afB[iLane] = (FLOAT)pbTop[iRight];
+			afC[iLane] = (FLOAT)pbBottom[iLeft];
+			afD[iLane] = (FLOAT)pbBottom[iRight];
+		}
+
+		__m128 vA = _mm_loadu_ps( afA );
+		__m128 vAcross = _mm_sub_ps( _mm_loadu_ps( afB ), vA );
+		__m128 vC = _mm_loadu_ps( afC );
+		__m128 vAcrossBottom = _mm_sub_ps( _mm_loadu_ps( afD ), vC );
+		__m128 vTop = _mm_add_ps( vA, _mm_mul_ps( vAcross, vFX ) );
+		__m128 vDown = _mm_sub_ps( _mm_add_ps( vC, _mm_mul_ps( vAcrossBottom, vFX ) ), vTop );
+
+		_mm_storeu_ps( pfHeights + iQuery, _mm_add_ps( vTop, _mm_mul_ps( vDown, vFY ) ) );
+		_mm_storeu_ps( pfGradX + iQuery, _mm_mul_ps( _mm_add_ps( vAcross, _mm_mul_ps( _mm_sub_ps( vAcrossBottom, vAcross ), vFY ) ), vScale ) );
+		_mm_storeu_ps( pfGradY + iQuery, _mm_mul_ps( vDown, vScale ) );
+	}
+#endif
+
+	for ( ; iQuery < iCount; iQuery++ )
+	{
+		FLOAT fFX, fFY;
+		int iX = CellFloor( pfCellX[iQuery], m_iSize - 2, &fFX );
+		int iY = CellFloor( pfCellY[iQuery], m_iSize - 2, &fFY );
+		const BYTE* pbTop = pbCells + piYOffset[iY];
+		const BYTE* pbBottom = pbCells + piYOffset[iY + 1];
+		FLOAT fA = (FLOAT)pbTop[piXOffset[iX]];
+		FLOAT fAcross = (FLOAT)pbTop[piXOffset[iX + 1]] - fA;
+		FLOAT fC = (FLOAT)pbBottom[piXOffset[iX]];
+		FLOAT fAcrossBottom = (FLOAT)pbBottom[piXOffset[iX + 1]] - fC;
+		FLOAT fTop = fA + fAcross * fFX;
+		FLOAT fDown = ( fC + fAcrossBottom * fFX ) - fTop;
+
+		pfHeights[iQuery] = fTop + fDown * fFY;
+		pfGradX[iQuery] = ( fAcross + ( fAcrossBottom - fAcross ) * fFY ) * fScale;
+		pfGradY[iQuery] = fDown * fScale;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Catmull-Rom heights and gradients for iCount clamped queries, a
+//	multiple of 4, over the 4 x 4 cells around each
+//------------------------------------------------------------------------------
+void CHeightSampler::Bicubic( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY )
+{
+	const BYTE* pbCells = m_pbCells;
+	const int* piXOffset = m_piXOffset;
+	const int* piYOffset = m_piYOffset;
+	FLOAT fScale = 1.f / m_fCellSize;
+	int iQuery = 0;
+	int iRow, iColumn;
+
+#if SAMPLE_SIMD
+	__m128 vLast = _mm_set1_ps( (FLOAT)( m_iSize - 2 ) );
+	__m128 vScale = _mm_set1_ps( fScale );
+
+	for ( ; iQuery + 4 <= iCount; iQuery += 4 )
+	{
+		__m128 vFX, vFY;
+		__m128 avWeightX[4], avSlopeX[4], avWeightY[4], avSlopeY[4];
+		int aiX[4], aiY[4];
+		int aaiColumn[4][4];
+
+		_mm_storeu_si128( (__m128i*)aiX, CellFloor( _mm_loadu_ps( pfCellX + iQuery ), vLast, &vFX ) );
+		_mm_storeu_si128( (__m128i*)aiY, CellFloor( _mm_loadu_ps( pfCellY + iQuery ), vLast, &vFY ) );
+
+		CubicWeights( vFX, avWeightX, avSlopeX );
+		CubicWeights( vFY, avWeightY, avSlopeY );
+
+		for ( int iLane = 0; iLane < 4; iLane++ )
+		{
+			for ( iColumn = 0; iColumn < 4; iColumn++ )
+			{
+				aaiColumn[iLane][iColumn] = piXOffset[aiX[iLane] - 1 + iColumn];
+			}
+		}
+
+		__m128 vHeight = _mm_setzero_ps();
+		__m128 vGradX = _mm_setzero_ps();
+		__m128 vGradY = _mm_setzero_ps();
+
+		for ( iRow = 0; iRow < 4; iRow++ )
+		{
+			__m128 vRow = _mm_setzero_ps();
+			__m128 vRowSlope = _mm_setzero_ps();
+			const BYTE* apbRow[4];
+
+			for ( int iLane = 0; iLane < 4; iLane++ )
+			{
+				apbRow[iLane] = pbCells + piYOffset[aiY[iLane] - 1 + iRow];
+			}
+
+			for ( iColumn = 0; iColumn < 4; iColumn++ )
+			{
+				__m128 vCell = _mm_set_ps( (FLOAT)apbRow[3][aaiColumn[3][iColumn]], (FLOAT)apbRow[2][aaiColumn[2][iColumn]], (FLOAT)apbRow[1][aaiColumn[1][iColumn]], (FLOAT)apbRow[0][aaiColumn[0][iColumn]] );
+
+				vRow = _mm_add_ps( vRow, _mm_mul_ps( avWeightX[iColumn], vCell ) );
+				vRowSlope = _mm_add_ps( vRowSlope, _mm_mul_ps( avSlopeX[iColumn], vCell ) );
+			}
+
+			vHeight = _mm_add_ps( vHeight, _mm_mul_ps( avWeightY[iRow], vRow ) );
+			vGradX = _mm_add_ps( vGradX, _mm_mul_ps( avWeightY[iRow], vRowSlope ) );
+			vGradY = _mm_add_ps( vGradY, _mm_mul_ps( avSlopeY[iRow], vRow ) );
+		}
+
+		_mm_storeu_ps( pfHeights + iQuery, vHeight );
+		_mm_storeu_ps( pfGradX + iQuery, _mm_mul_ps( vGradX, vScale ) );
+		_mm_storeu_ps( pfGradY + iQuery, _mm_mul_ps( vGradY, vScale ) );
+	}
+#endif
+
+	for ( ; iQuery < iCount; iQuery++ )
+	{
+		FLOAT fFX, fFY;
+		FLOAT afWeightX[4], afSlopeX[4], afWeightY[4], afSlopeY[4];
+		int iX = CellFloor( pfCellX[iQuery], m_iSize - 2, &fFX );
+		int iY = CellFloor( pfCellY[iQuery], m_iSize - 2, &fFY );
+		FLOAT fHeight = 0.f;
+		FLOAT fGradX = 0.f;
+		FLOAT fGradY = 0.f;
+
+		CubicWeights( fFX, afWeightX, afSlopeX );
+		CubicWeights( fFY, afWeightY, afSlopeY );
+
+		for ( iRow = 0; iRow < 4; iRow++ )
+		{
+			const BYTE* pbRow = pbCells + piYOffset[iY - 1 + iRow];
+			FLOAT fRow = 0.f;
+			FLOAT fRowSlope = 0.f;
+
+			for ( iColumn = 0; iColumn < 4; iColumn++ )
+			{
+				FLOAT fCell = (FLOAT)pbRow[piXOffset[iX - 1 + iColumn]];
+
+				fRow += afWeightX[iColumn] * fCell;
+				fRowSlope += afSlopeX[iColumn] * fCell;
+			}
+
+			fHeight += afWeightY[iRow] * fRow;
+			fGradX += afWeightY[iRow] * fRowSlope;
+			fGradY += afSlopeY[iRow] * fRow;
+		}
+
+		pfHeights[iQuery] = fHeight;
+		pfGradX[iQuery] = fGradX * fScale;
+		pfGradY[iQuery] = fGradY * fScale;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Heights, and gradients if bGradients, for iCount queries, a multiple of
+//	4, summed over the run's faults
+//
+//	Each fault's offset is formed as the kernel forms it, the cross product
+//	and t to the bit, so the doubles summed are the ones a retained run
+//	adds, in the same order. t is held to [-2, 2] first, where the table is
+//	flat, so a point far off the tile can't overflow its entry.
+//------------------------------------------------------------------------------
+void CHeightSampler::Faults( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, BOOL bGradients, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY )
+{
+	const FLOAT* pfTable = m_afProfile;
+	const FLOAT fScale = (FLOAT)FAULT_LUT_SIZE * 0.5f;
+	BOOL bStep = m_iProfile == FAULT_PROFILE_STEP;
+	double adHeights[SAMPLE_BLOCK];
+	int iQuery;
+
+	for ( iQuery = 0; iQuery < iCount; iQuery++ )
+	{
+		adHeights[iQuery] = m_dBase;
+		pfGradX[iQuery] = 0.f;
+		pfGradY[iQuery] = 0.f;
+	}
+
+	for ( int iFault = 0; iFault < m_iFaults; iFault++ )
+	{
+		const SAMPLEFAULT& fault = m_pFaults[iFault];
+
+		iQuery = 0;
+
+#if SAMPLE_SIMD
+		__m128 vX1 = _mm_set1_ps( fault.fX1 );
+		__m128 vY1 = _mm_set1_ps( fault.fY1 );
+		__m128 vDX = _mm_set1_ps( fault.fDX );
+		__m128 vDY = _mm_set1_ps( fault.fDY );
+		__m128 vDepth = _mm_set1_ps( fault.fDepth );
+		__m128 vNegDepth = _mm_set1_ps( -fault.fDepth );
+		__m128 vNegInvBand = _mm_set1_ps( fault.fNegInvBand );
+		__m128 vFaultGradX = _mm_set1_ps( fault.fGradX );
+		__m128 vFaultGradY = _mm_set1_ps( fault.fGradY );
+		__m128 vZero = _mm_setzero_ps();
+		__m128 vOne = _mm_set1_ps( 1.f );
+		__m128 vTwo = _mm_set1_ps( 2.f );
+		__m128 vNegTwo = _mm_set1_ps( -2.f );
+		__m128 vScale = _mm_set1_ps( fScale );
+		__m128 vHalf = _mm_set1_ps( 0.5f );
+		__m128 vSign = _mm_set1_ps( -0.f );
+		__m128i viZero = _mm_setzero_si128();
+		__m128i viLast = _mm_set1_epi32( FAULT_LUT_SIZE );
+		__m128i viLastSegment = _mm_set1_epi32( FAULT_LUT_SIZE - 1 );
+
+		for ( ; iQuery + 4 <= iCount; iQuery += 4 )
+		{
+			__m128 vCross = _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( pfCellX + iQuery ), vX1 ), vDY ), _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( pfCellY + iQuery ), vY1 ), vDX ) );
+			__m128 vDelta;
+
+			if ( bStep )
+			{
+				__m128 vLeft = _mm_cmplt_ps( vCross, vZero );
+
+				vDelta = _mm_or_ps( _mm_and_ps( vLeft, vDepth ), _mm_andnot_ps( vLeft, vNegDepth ) );
+			}
+			else
+			{
+				__m128 vT = _mm_min_ps( _mm_max_ps( _mm_mul_ps( vCross, vNegInvBand ), vNegTwo ), vTwo );
+				__m128i viEntry = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( _mm_add_ps( vT, vOne ), vScale ), vHalf ) );
+				int aiEntry[4];
+
+				//	Clamp to the table, SSE2 has no 32 bit min and max
+				//----------------------------------------------------------
+				viEntry = _mm_and_si128( viEntry, _mm_cmpgt_epi32( viEntry, viZero ) );
+				__m128i viOver = _mm_cmpgt_epi32( viEntry, viLast );
+				viEntry = _mm_or_si128( _mm_andnot_si128( viOver, viEntry ), _mm_and_si128( viOver, viLast ) );
+
+				_mm_storeu_si128( (__m128i*)aiEntry, viEntry );
+
+				vDelta = _mm_mul_ps( _mm_set_ps( pfTable[aiEntry[3]], pfTable[aiEntry[2]], pfTable[aiEntry[1]], pfTable[aiEntry[0]] ), vDepth );
+
+				if ( bGradients )
+				{
+					__m128i viSegment = _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( vT, vOne ), vScale ) );
+					__m128 vInside = _mm_cmplt_ps( _mm_andnot_ps( vSign, vT ), vOne );
+
+					viSegment = _mm_and_si128( viSegment, _mm_cmpgt_epi32( viSegment, viZero ) );
+					viOver = _mm_cmpgt_epi32( viSegment, viLastSegment );
+					viSegment = _mm_or_si128( _mm_andnot_si128( viOver, viSegment ), _mm_and_si128( viOver, viLastSegment ) );
+
+					_mm_storeu_si128( (__m128i*)aiEntry, viSegment );
+
+					__m128 vSlope = _mm_set_ps( pfTable[aiEntry[3] + 1] - pfTable[aiEntry[3]], pfTable[aiEntry[2] + 1] - pfTable[aiEntry[2]],
+						pfTable[aiEntry[1] + 1] - pfTable[aiEntry[1]], pfTable[aiEntry[0] + 1] - pfTable[aiEntry[0]] );
+
+					vSlope = _mm_and_ps( _mm_mul_ps( vSlope, vScale ), vInside );
+
+					_mm_storeu_ps( pfGradX + iQuery, _mm_add_ps( _mm_loadu_ps( pfGradX + iQuery ), _mm_mul_ps( vSlope, vFaultGradX ) ) );
+					_mm_storeu_ps( pfGradY + iQuery, _mm_add_ps( _mm_loadu_ps( pfGradY + iQuery ), _mm_mul_ps( vSlope, vFaultGradY ) ) );
+				}
+			}
+
+			_mm_storeu_pd( adHeights + iQuery, _mm_add_pd( _mm_loadu_pd( adHeights + iQuery ), _mm_cvtps_pd( vDelta ) ) );
+			_mm_storeu_pd( adHeights + iQuery + 2, _mm_add_pd( _mm_loadu_pd( adHeights + iQuery + 2 ), _mm_cvtps_pd( _mm_movehl_ps( vDelta, vDelta ) ) ) );
+		}
+#endif
+
+		for ( ; iQuery < iCount; iQuery++ )
+		{
+			FLOAT fCross = ( pfCellX[iQuery] - fault.fX1 ) * fault.fDY - ( pfCellY[iQuery] - fault.fY1 ) * fault.fDX;
+
+			if ( bStep )
+			{
+				adHeights[iQuery] += fCross < 0.f ? fault.fDepth : -fault.fDepth;
+				continue;
+			}
+
+			FLOAT fT = fCross * fault.fNegInvBand;
+
+			fT = fT > -2.f ? fT : -2.f;
+			fT = fT < 2.f ? fT : 2.f;
+
+			int iEntry = (int)( ( fT + 1.f ) * fScale + 0.5f );
+
+			iEntry = iEntry > 0 ? iEntry : 0;
+			iEntry = iEntry < FAULT_LUT_SIZE ? iEntry : FAULT_LUT_SIZE;
+
+			adHeights[iQuery] += (double)( pfTable[iEntry] * fault.fDepth );
+
+			if ( bGradients && fT > -1.f && fT < 1.f )
+			{
+				int iSegment = (int)( ( fT + 1.f ) * fScale );
+
+				iSegment = iSegment > 0 ? iSegment : 0;
+				iSegment = iSegment < FAULT_LUT_SIZE - 1 ? iSegment : FAULT_LUT_SIZE - 1;
+
+				FLOAT fSlope = ( pfTable[iSegment + 1] - pfTable[iSegment] ) * fScale;
+
+				pfGradX[iQuery] += fSlope * fault.fGradX;
+				pfGradY[iQuery] += fSlope * fault.fGradY;
+			}
+		}
+	}
+
+	FLOAT fWorld = 1.f / m_fCellSize;
+
+	for ( iQuery = 0; iQuery < iCount; iQuery++ )
+	{
+		pfHeights[iQuery] = (FLOAT)adHeights[iQuery];
+		pfGradX[iQuery] *= fWorld;
+		pfGradY[iQuery] *= fWorld;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Drop the source
+//------------------------------------------------------------------------------
+void CHeightSampler::Clear()
+{
+	if ( m_piXOffset != NULL )
+	{
+		delete [] ( m_piXOffset - 1 );
+		delete [] ( m_piYOffset - 1 );
+	}
+
+	delete [] m_pFaults;
+
+	m_piXOffset = NULL;
+	m_piYOffset = NULL;
+	m_pFaults = NULL;
+	m_iFaults = 0;
+	m_pGrid = NULL;
+	m_pbCells = NULL;
+	m_iSource = SAMPLE_SOURCE_NONE;
+}
@@ -0,0 +1,162 @@
+/*--------------------------------------------------------------------------------
+
+	Sample.h
+
+	Provides batched height queries at arbitrary points, interpolated over
+	a tile's cells or evaluated from a fault run when there is no tile
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+#include "FaultKernel.h"
+#include "Checkpoint.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define SAMPLE_BLOCK		64			// Queries evaluated together, a multiple of 4, and prefetched a block ahead
+#define SAMPLE_TASK			4096		// Queries per scheduler task, a multiple of SAMPLE_BLOCK
+#define SAMPLE_PARALLEL		16384		// Smaller batches are done on the calling thread
+#define SAMPLE_MAX_SIZE		32768
+#define SAMPLE_PICK			256			// Faults picked at a time setting a run
+
+enum SAMPLEFILTER
+{
+	SAMPLE_BILINEAR,
+	SAMPLE_BICUBIC				// Catmull-Rom, through the cells
+};
+
+enum SAMPLESOURCE
+{
+	SAMPLE_SOURCE_NONE,
+	SAMPLE_SOURCE_GRID,
+	SAMPLE_SOURCE_FAULTS
+};
+
+//	One fault of a run, as its queries need it
+//------------------------------------------------
+typedef struct tagSAMPLEFAULT
+{
+	FLOAT	fX1;
+	FLOAT	fY1;
+	FLOAT	fDX;
+	FLOAT	fDY;
+	FLOAT	fNegInvBand;		// Smooth profiles, t per unit of the cross product
+	FLOAT	fDepth;
+	FLOAT	fGradX;				// Smooth profiles, height per unit of P'( t ) per cell
+	FLOAT	fGradY;
+} SAMPLEFAULT;
+
+//	A batch of queries, and where their results go
+//-----------------------------------------------------
+typedef struct tagSAMPLEBATCH
+{
+	const FLOAT*	pfX;
+	const FLOAT*	pfY;
+	int				iCount;
+	FLOAT*			pfHeights;
+	FLOAT*			pfGradX;			// Either may be NULL
+	FLOAT*			pfGradY;
+} SAMPLEBATCH;
+
+//------------------------------------------------------------------------------
+//	Heights at arbitrary points, a batch at a time
+//
+//	A point is in world units, (x - origin) / cell size cells from cell
+//	(0, 0), 0 and 1 unless SetTransform says otherwise. Gradients are per
+//	world unit.
+//
+//	Over a grid, a point outside the tile is moved onto its edge, and the
+//	height is bilinear or Catmull-Rom bicubic over the cells around it, the
+//	gradient being the interpolant's own. Cells are found through an offset
+//	per column and one per row, which sum to a cell's offset in any of the
+//	grid's layouts, so no query tests the layout. Queries are taken four to
+//	an SSE2 register, with the cells gathered by hand as SSE2 has no gather,
+//	and the cells of the next block of queries are prefetched while this
+//	block is worked out.
+//
+//	Without a grid, SetFaults picks a run's faults from its seed as the
+//	kernel would and each query sums their offsets directly, so a height is
+//	what a retained run from a level tile of the base height accumulates,
+//	before it is quantized, and at a cell the same as the run's to a FLOAT.
+//	Points off the tile are evaluated as they are, the faults running on
+//	past its edge. A step has no gradient off its line, a smooth profile's
+//	is the slope of its table. Blocks of queries take the faults in turn, so
+//	a long run is read from memory once a block.
+//
+//	Large batches are split over the scheduler. Sample leaves the sampler
+//	as it was, so the scheduler's tasks may share one once its source is set.
+//------------------------------------------------------------------------------
+class CHeightSampler
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CHeightSampler();
+	virtual ~CHeightSampler();
+
+	//------------------------------
+	//	CHeightSampler Interface
+	//------------------------------
+	BOOL SetGrid( CTerrain* pTerrain, int iFilter );
+	BOOL SetFaults( const FAULTRUN& run, DWORD dwSeed, int iTileSq, double dBase );
+	void SetTransform( FLOAT fOriginX, FLOAT fOriginY, FLOAT fCellSize );
+
+	BOOL Sample( const FLOAT* pfX, const FLOAT* pfY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY );
+
+	int Source();
+	LPCSTR GetError();
+
+private:
+	static void SampleTask( int iIndex, int iWorker, void* pContext );
+
+	void SampleRange( const SAMPLEBATCH& batch, int iFirst, int iCount );
+	void ToCells( const SAMPLEBATCH& batch, int iFirst, int iCount, FLOAT* pfCellX, FLOAT* pfCellY );
+	void Prefetch( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount );
+	void Bilinear( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY );
+	void Bicubic( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY );
+	void Faults( const FLOAT* pfCellX, const FLOAT* pfCellY, int iCount, BOOL bGradients, FLOAT* pfHeights, FLOAT* pfGradX, FLOAT* pfGradY );
+	void Clear();
+
+	int m_iSource;				// SAMPLESOURCE
+
+	//	The transform
+	//-------------------
+	FLOAT m_fOriginX;
+	FLOAT m_fOriginY;
+	FLOAT m_fCellSize;
+
+	//	A grid
+	//------------
+	CHeightGrid* m_pGrid;
+	const BYTE* m_pbCells;
+	int m_iSize;
+	int m_iLayout;
+	int m_iFilter;				// SAMPLEFILTER
+	int* m_piXOffset;			// Per column from -1 to size, clamped to the tile
+	int* m_piYOffset;			// and per row
+
+	//	A fault run
+	//-----------------
+	SAMPLEFAULT* m_pFaults;
+	int m_iFaults;
+	int m_iProfile;				// FAULTPROFILE
+	double m_dBase;
+	FLOAT m_afProfile[FAULT_LUT_SIZE + 1];
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
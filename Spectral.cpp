@@ -0,0 +1,306 @@
+/*--------------------------------------------------------------------------------
+
+	Spectral.cpp
+
+	Provides spectral synthesis, 1/f^beta noise shaped in the frequency domain
+	and brought back to heights with an in-tree 2D real FFT
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+
+#include "Spectral.h"
+#include "Arena.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define SPECTRAL_PI		3.14159265358979323846
+
+//-----------------------------------------
+//
+//	CLASS: CSpectralSynth implementation
+//
+//-----------------------------------------
+CSpectralSynth::CSpectralSynth()
+{
+	m_iSize = 0;
+	m_iHalf = 0;
+	m_dBeta = 0.0;
+	m_dwSeed = 0;
+	m_pSpectrum = NULL;
+	m_pTwiddles = NULL;
+	m_pdHeights = NULL;
+	m_szError[0] = '\0';
+}
+
+CSpectralSynth::~CSpectralSynth()
+{
+}
+
+LPCSTR CSpectralSynth::GetError()
+{
+	return m_szError;
+}
+
+BOOL CSpectralSynth::IsPowerOfTwo( int iValue )
+{
+	return iValue > 1 && ( iValue & ( iValue - 1 ) ) == 0;
+}
+
+//------------------------------------------------------------------------------
+//	Synthesize an iTileSq^2 grid of heights into pdHeights, [x * iTileSq + y]
+//
+//	fDimension is the target fractal dimension, clamped to 2..3. Heights are
+//	unscaled, so quantize them into a tile with CTerrain::QuantizeRetained.
+//	Returns FALSE if the tile is not a power of two or memory runs out.
+//------------------------------------------------------------------------------
+BOOL CSpectralSynth::Synthesize( int iTileSq, FLOAT fDimension, DWORD dwSeed, double* pdHeights )
+{
+	if ( !IsPowerOfTwo( iTileSq ) )
+	{
+		sprintf( m_szError, "Spectral synthesis needs a power of two tile size" );
+		return FALSE;
+	}
+
+	fDimension = fDimension < SPECTRAL_MIN_DIMENSION ? SPECTRAL_MIN_DIMENSION : fDimension;
+	fDimension = fDimension > SPECTRAL_MAX_DIMENSION ? SPECTRAL_MAX_DIMENSION : fDimension;
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+
+	m_iSize = iTileSq;
+	m_iHalf = iTileSq / 2;
+	m_dBeta = 8.0 - 2.0 * (double)fDimension;
+	m_dwSeed = dwSeed;
+	m_pdHeights = pdHeights;
+	m_pSpectrum = (COMPLEX*)pArena->Alloc( sizeof(COMPLEX) * ( m_iHalf + 1 ) * m_iSize );
+	m_pTwiddles = (COMPLEX*)pArena->Alloc( sizeof(COMPLEX) * m_iHalf );
+
+	if ( m_pSpectrum == NULL || m_pTwiddles == NULL )
+	{
+		sprintf( m_szError, "Out of memory for the spectrum of a %d cell tile", iTileSq );
+		return FALSE;
+	}
+
+	for ( int iTwiddle = 0; iTwiddle < m_iHalf; iTwiddle++ )
+	{
+		double dAngle = 2.0 * SPECTRAL_PI * (double)iTwiddle / (double)m_iSize;
+
+		m_pTwiddles[iTwiddle].dRe = cos( dAngle );
+		m_pTwiddles[iTwiddle].dIm = sin( dAngle );
+	}
+
+	//	Gathered block plus the half length transforms made from it
+	//-------------------------------------------------------------------
+	for ( int iWorker = 0; iWorker < GetWorkerCount(); iWorker++ )
+	{
+		m_apScratch[iWorker] = (COMPLEX*)pArena->Alloc( sizeof(COMPLEX) * SPECTRAL_BLOCK * ( 2 * m_iHalf + 1 ) );
+
+		if ( m_apScratch[iWorker] == NULL )
+		{
+			sprintf( m_szError, "Out of memory for the spectrum of a %d cell tile", iTileSq );
+			return FALSE;
+		}
+	}
+
+	ParallelFor( m_iHalf + 1, SpectrumTask, this );
+	ParallelFor( m_iHalf + 1, ColumnTask, this );
+	ParallelFor( ( m_iSize + SPECTRAL_BLOCK - 1 ) / SPECTRAL_BLOCK, RowTask, this );
+
+	return TRUE;
+}
+
+//--------------------------------------------------------------------
+//	A standard normal deviate, by Box-Muller
+//--------------------------------------------------------------------
+double CSpectralSynth::Gaussian( CRandom& random )
+{
+	double dU1 = ( (double)( random.Next() >> 8 ) + 1.0 ) / 16777217.0;
+	double dU2 = (double)( random.Next() >> 8 ) / 16777216.0;
+
+	return sqrt( -2.0 * log( dU1 ) ) * cos( 2.0 * SPECTRAL_PI * dU2 );
+}
+
+//------------------------------------------------------------------------------
+//	Fill spectrum row kx = iIndex
+//
+//	Rows kx = 0 and kx = N/2 are their own mirror images, so their upper
+//	half is the conjugate of the lower and the self-mirrored terms are real
+//------------------------------------------------------------------------------
+void CSpectralSynth::SpectrumTask( int iIndex, int iWorker, void* pContext )
+{
+	CSpectralSynth* pThis = (CSpectralSynth*)pContext;
+	int iSize = pThis->m_iSize;
+	int iHalf = pThis->m_iHalf;
+	COMPLEX* pRow = pThis->m_pSpectrum + iIndex * iSize;
+	CRandom random( CRandom::Hash( pThis->m_dwSeed, (DWORD)iIndex ) );
+	BOOL bMirrored = iIndex == 0 || iIndex == iHalf;
+	int iLast = bMirrored ? iHalf : iSize - 1;
+
+	for ( int iKY = 0; iKY <= iLast; iKY++ )
+	{
+		double dFY = (double)( iKY <= iHalf ? iKY : iKY - iSize );
+		double dFrequency = sqrt( (double)iIndex * (double)iIndex + dFY * dFY );
+		double dAmplitude = dFrequency > 0.0 ? pow( dFrequency, -0.5 * pThis->m_dBeta ) : 0.0;
+
+		pRow[iKY].dRe = pThis->Gaussian( random ) * dAmplitude;
+		pRow[iKY].dIm = pThis->Gaussian( random ) * dAmplitude;
+	}
+
+	if ( bMirrored )
+	{
+		pRow[0].dIm = 0.0;
+		pRow[iHalf].dIm = 0.0;
+
+		for ( int iMirror = 1; iMirror < iHalf; iMirror++ )
+		{
+			pRow[iSize - iMirror].dRe = pRow[iMirror].dRe;
+			pRow[iSize - iMirror].dIm = -pRow[iMirror].dIm;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+//	Inverse transform spectrum row kx = iIndex along ky, in place
+//------------------------------------------------------------------------
+void CSpectralSynth::ColumnTask( int iIndex, int iWorker, void* pContext )
+{
+	CSpectralSynth* pThis = (CSpectralSynth*)pContext;
+
+	pThis->InverseFFT( pThis->m_pSpectrum + iIndex * pThis->m_iSize, pThis->m_iSize );
+}
+
+//------------------------------------------------------------------------------
+//	Inverse transform block iIndex of rows along x, into the heights
+//
+//	For each row y, X[k] = G[k][y] for k <= N/2 and the heights are real, so
+//	the even and odd heights are the real and imaginary parts of a half
+//	length inverse transform of
+//
+//		Z[k] = ( X[k] + X*[N/2 - k] ) + i W^k ( X[k] - X*[N/2 - k] )
+//
+//	with W = e^(2 pi i / N)
+//------------------------------------------------------------------------------
+void CSpectralSynth::RowTask( int iIndex, int iWorker, void* pContext )
+{
+	CSpectralSynth* pThis = (CSpectralSynth*)pContext;
+	int iSize = pThis->m_iSize;
+	int iHalf = pThis->m_iHalf;
+	int iFirstY = iIndex * SPECTRAL_BLOCK;
+	int iRows = iSize - iFirstY < SPECTRAL_BLOCK ? iSize - iFirstY : SPECTRAL_BLOCK;
+	COMPLEX* pGather = pThis->m_apScratch[iWorker];
+	COMPLEX* pZ = pGather + SPECTRAL_BLOCK * ( iHalf + 1 );
+
+	//	Gather the block, a short contiguous run from each kx row
+	//---------------------------------------------------------------
+	for ( int iKX = 0; iKX <= iHalf; iKX++ )
+	{
+		const COMPLEX* pFrom = pThis->m_pSpectrum + iKX * iSize + iFirstY;
+
+		for ( int iRow = 0; iRow < iRows; iRow++ )
+		{
+			pGather[iRow * ( iHalf + 1 ) + iKX] = pFrom[iRow];
+		}
+	}
+
+	for ( int iPacked = 0; iPacked < iRows; iPacked++ )
+	{
+		const COMPLEX* pX = pGather + iPacked * ( iHalf + 1 );
+		COMPLEX* pRowZ = pZ + iPacked * iHalf;
+
+		for ( int iK = 0; iK < iHalf; iK++ )
+		{
+			const COMPLEX& w = pThis->m_pTwiddles[iK];
+			double dSumRe = pX[iK].dRe + pX[iHalf - iK].dRe;
+			double dSumIm = pX[iK].dIm - pX[iHalf - iK].dIm;
+			double dDiffRe = pX[iK].dRe - pX[iHalf - iK].dRe;
+			double dDiffIm = pX[iK].dIm + pX[iHalf - iK].dIm;
+
+			//	i W^k ( diff )
+			//--------------------
+			double dRotRe = dDiffRe * w.dRe - dDiffIm * w.dIm;
+			double dRotIm = dDiffRe * w.dIm + dDiffIm * w.dRe;
+
+			pRowZ[iK].dRe = dSumRe - dRotIm;
+			pRowZ[iK].dIm = dSumIm + dRotRe;
+		}
+
+		pThis->InverseFFT( pRowZ, iHalf );
+	}
+
+	//	Scatter, a short contiguous run into each x column
+	//--------------------------------------------------------
+	for ( int iM = 0; iM < iHalf; iM++ )
+	{
+		double* pdEven = pThis->m_pdHeights + ( 2 * iM ) * iSize + iFirstY;
+		double* pdOdd = pdEven + iSize;
+
+		for ( int iOut = 0; iOut < iRows; iOut++ )
+		{
+			pdEven[iOut] = pZ[iOut * iHalf + iM].dRe;
+			pdOdd[iOut] = pZ[iOut * iHalf + iM].dIm;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Unnormalised inverse FFT of iLength (a power of two, dividing m_iSize)
+//	points in place, iterative radix-2 with the shared twiddle table
+//------------------------------------------------------------------------------
+void CSpectralSynth::InverseFFT( COMPLEX* pData, int iLength )
+{
+	int iStride = m_iSize / iLength;
+	int iReversed = 0;
+
+	for ( int iPos = 1; iPos < iLength; iPos++ )
+	{
+		int iBit = iLength >> 1;
+
+		for ( ; iReversed & iBit; iBit >>= 1 )
+		{
+			iReversed ^= iBit;
+		}
+
+		iReversed ^= iBit;
+
+		if ( iPos < iReversed )
+		{
+			COMPLEX swap = pData[iPos];
+
+			pData[iPos] = pData[iReversed];
+			pData[iReversed] = swap;
+		}
+	}
+
+	for ( int iSpan = 1; iSpan < iLength; iSpan <<= 1 )
+	{
+		int iStep = ( iLength / ( 2 * iSpan ) ) * iStride;
+
+		for ( int iStart = 0; iStart < iLength; iStart += 2 * iSpan )
+		{
+			COMPLEX* pA = pData + iStart;
+			COMPLEX* pB = pA + iSpan;
+
+			for ( int iK = 0; iK < iSpan; iK++ )
+			{
+				const COMPLEX& w = m_pTwiddles[iK * iStep];
+				double dRe = pB[iK].dRe * w.dRe - pB[iK].dIm * w.dIm;
+				double dIm = pB[iK].dRe * w.dIm + pB[iK].dIm * w.dRe;
+
+				pB[iK].dRe = pA[iK].dRe - dRe;
+				pB[iK].dIm = pA[iK].dIm - dIm;
+				pA[iK].dRe += dRe;
+				pA[iK].dIm += dIm;
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/*--------------------------------------------------------------------------------
+
+	Spectral.h
+
+	Provides spectral synthesis, 1/f^beta noise shaped in the frequency domain
+	and brought back to heights with an in-tree 2D real FFT
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _SPECTRAL_H
+#define _SPECTRAL_H
+
+//-------------
+//	Includes
+//-------------
+#include "Terrain.h"
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define SPECTRAL_DEFAULT_DIMENSION	2.2f
+#define SPECTRAL_MIN_DIMENSION		2.0f
+#define SPECTRAL_MAX_DIMENSION		3.0f
+#define SPECTRAL_BLOCK				8		// Rows per transpose block, a cache line of doubles per column
+
+typedef struct tagCOMPLEX
+{
+	double	dRe;
+	double	dIm;
+} COMPLEX;
+
+//------------------------------------------------------------------------------
+//	Spectral synthesis
+//
+//	A surface of fractal dimension D has a power spectrum falling off as
+//	1/f^beta with beta = 8 - 2D (7 - 2D is a profile's, one dimension down),
+//	so each frequency is given a complex gaussian (a random phase) scaled by
+//	f^(-beta/2), f being the radial frequency. Only the half
+//	spectrum kx <= N/2 is built, the rest follows from the heights being
+//	real. The inverse transform runs down each contiguous kx row first, then
+//	across x in blocks of SPECTRAL_BLOCK rows gathered into per-thread
+//	scratch, each as a half length complex FFT. Both passes are split over
+//	the worker threads, and each kx row draws from its own random stream so
+//	the result depends only on the seed. The tile must be a power of two,
+//	and the spectrum and scratch come from the calling thread's arena.
+//------------------------------------------------------------------------------
+class CSpectralSynth
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CSpectralSynth();
+	virtual ~CSpectralSynth();
+
+	//-----------------------------
+	//	CSpectralSynth Interface
+	//-----------------------------
+	BOOL Synthesize( int iTileSq, FLOAT fDimension, DWORD dwSeed, double* pdHeights );
+
+	LPCSTR GetError();
+
+	static BOOL IsPowerOfTwo( int iValue );
+
+private:
+	//	Per-row work, called from worker threads
+	//-----------------------------------------------
+	static void SpectrumTask( int iIndex, int iWorker, void* pContext );
+	static void ColumnTask( int iIndex, int iWorker, void* pContext );
+	static void RowTask( int iIndex, int iWorker, void* pContext );
+
+	void InverseFFT( COMPLEX* pData, int iLength );
+	double Gaussian( CRandom& random );
+
+	//	Per-run state
+	//-------------------
+	int m_iSize;
+	int m_iHalf;
+	double m_dBeta;
+	DWORD m_dwSeed;
+	COMPLEX* m_pSpectrum;			// (m_iSize/2 + 1) rows of m_iSize, [kx * m_iSize + ky]
+	COMPLEX* m_pTwiddles;			// e^(2 pi i k / m_iSize), k < m_iSize/2
+	double* m_pdHeights;			// Output, [x * m_iSize + y]
+	COMPLEX* m_apScratch[MAX_WORKERS];
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
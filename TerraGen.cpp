@@ -0,0 +1,283 @@
+/*--------------------------------------------------------------------------------
+
+	TerraGen.cpp
+
+	Provides a C interface to the terrain operations, working in place on
+	rasters the caller owns
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "TerraGen.h"
+#include "Raster.h"
+
+//-----------------
+//	Definitions
+//-----------------
+
+//	The TERRAGENFAULTS of TERRAGEN_VERSION 1, the least cbSize accepted
+//-------------------------------------------------------------------------
+#define TERRAGEN_FAULTS_SIZE_1	( offsetof( TERRAGENFAULTS, fProfileWidth ) + sizeof(float) )
+
+//	Behind an HTERRAGEN. Each handle has its own generator and logistic
+//	function, so handles on different threads never share state, and
+//	nothing here touches the tile or g_LogFunc.
+//-------------------------------------------------------------------------
+struct tagTERRAGEN
+{
+	int			iSize;
+	int			iMinHeight;
+	int			iMaxHeight;
+	CRandom		random;
+	CLogFunc	logFunc;
+	char		szError[256];
+};
+
+//------------------------------------------------------------------------------
+//	Check a caller's raster and describe it as a RASTER
+//
+//	The stride must hold a row and be a whole number of cells, so every
+//	cell stays aligned for its type, and the raster's cells must be within
+//	reach of the fault kernel's int offsets
+//------------------------------------------------------------------------------
+static BOOL MakeRaster( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, LPCSTR szName, RASTER& raster )
+{
+	if ( pRaster == NULL || pRaster->pvCells == NULL )
+	{
+		sprintf( hTerraGen->szError, "No %s raster", szName );
+		return FALSE;
+	}
+
+	if ( pRaster->iFormat < TERRAGEN_FORMAT_U8 || pRaster->iFormat > TERRAGEN_FORMAT_F64 )
+	{
+		sprintf( hTerraGen->szError, "The %s raster has unknown format %d", szName, pRaster->iFormat );
+		return FALSE;
+	}
+
+	int iCellSize = FaultCellSize( pRaster->iFormat );
+
+	if ( hTerraGen->iSize > INT_MAX / iCellSize )
+	{
+		sprintf( hTerraGen->szError, "A row of %d cells of %d bytes is too large for the %s raster", hTerraGen->iSize, iCellSize, szName );
+		return FALSE;
+	}
+
+	if ( pRaster->iStride < hTerraGen->iSize * iCellSize || pRaster->iStride % iCellSize != 0 )
+	{
+		sprintf( hTerraGen->szError, "The %s raster's stride of %d bytes does not fit %d cells of %d bytes", szName, pRaster->iStride, hTerraGen->iSize, iCellSize );
+		return FALSE;
+	}
+
+	raster.pvCells = pRaster->pvCells;
+	raster.iCellType = pRaster->iFormat;
+	raster.iSize = hTerraGen->iSize;
+	raster.iPitch = pRaster->iStride / iCellSize;
+
+	if ( (LONGLONG)raster.iSize * raster.iPitch > INT_MAX )
+	{
+		sprintf( hTerraGen->szError, "The %s raster's %d rows of %d cells are too many to address", szName, raster.iSize, raster.iPitch );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-----------------
+//	Functions
+//-----------------
+
+//	TERRAGEN_VERSION of the code behind the calls, to check against the
+//	header a caller was built with
+//-------------------------------------------------------------------------
+int TERRAGENCALL TerraGenGetVersion( void )
+{
+	return TERRAGEN_VERSION;
+}
+
+//------------------------------------------------------------------------------
+//	A handle for rasters of iSize^2 cells, heights 0..255 until set
+//
+//	Returns NULL for a size below 2 or out of memory
+//------------------------------------------------------------------------------
+HTERRAGEN TERRAGENCALL TerraGenCreate( int iSize )
+{
+	if ( iSize < 2 )
+	{
+		return NULL;
+	}
+
+	HTERRAGEN hTerraGen = new tagTERRAGEN;
+
+	if ( hTerraGen == NULL )
+	{
+		return NULL;
+	}
+
+	hTerraGen->iSize = iSize;
+	hTerraGen->iMinHeight = 0;
+	hTerraGen->iMaxHeight = 255;
+	hTerraGen->szError[0] = 0;
+
+	return hTerraGen;
+}
+
+void TERRAGENCALL TerraGenDestroy( HTERRAGEN hTerraGen )
+{
+	delete hTerraGen;
+}
+
+//------------------------------------------------------------------------------
+//	The range integer faults clamp to and quantize spreads levels over
+//------------------------------------------------------------------------------
+int TERRAGENCALL TerraGenSetHeights( HTERRAGEN hTerraGen, int iMinHeight, int iMaxHeight )
+{
+	if ( hTerraGen == NULL )
+	{
+		return 0;
+	}
+
+	if ( iMinHeight >= iMaxHeight )
+	{
+		sprintf( hTerraGen->szError, "Height range %d..%d is empty", iMinHeight, iMaxHeight );
+		return 0;
+	}
+
+	hTerraGen->iMinHeight = iMinHeight;
+	hTerraGen->iMaxHeight = iMaxHeight;
+
+	return 1;
+}
+
+int TERRAGENCALL TerraGenClear( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, double dHeight )
+{
+	RASTER raster;
+
+	if ( hTerraGen == NULL || !MakeRaster( hTerraGen, pRaster, "height", raster ) )
+	{
+		return 0;
+	}
+
+	CRaster::Fill( raster, dHeight );
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+//	Run a fault run on the raster in place
+//
+//	Integer rasters clamp to the heights as the tile does. Float rasters
+//	accumulate unclamped, as a tile retaining all values does, for the
+//	caller to quantize. Either way a seed gives the same faults the tile
+//	makes from it.
+//------------------------------------------------------------------------------
+int TERRAGENCALL TerraGenFaults( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, const TERRAGENFAULTS* pFaults )
+{
+	RASTER raster;
+	TERRAGENFAULTS faults;
+
+	if ( hTerraGen == NULL || !MakeRaster( hTerraGen, pRaster, "height", raster ) )
+	{
+		return 0;
+	}
+
+	if ( pFaults == NULL || pFaults->cbSize < TERRAGEN_FAULTS_SIZE_1 )
+	{
+		sprintf( hTerraGen->szError, "The fault run is missing or smaller than the first header's" );
+		return 0;
+	}
+
+	//	Fields an older header lacks are 0, which asks for their default,
+	//	and fields a newer one added are not known here so are left out
+	//-----------------------------------------------------------------------
+	memset( &faults, 0, sizeof(faults) );
+	memcpy( &faults, pFaults, pFaults->cbSize < sizeof(faults) ? pFaults->cbSize : sizeof(faults) );
+	pFaults = &faults;
+
+	if ( pFaults->iProfile < TERRAGEN_PROFILE_STEP || pFaults->iProfile > TERRAGEN_PROFILE_SIGMOID )
+	{
+		sprintf( hTerraGen->szError, "Unknown fault profile %d", pFaults->iProfile );
+		return 0;
+	}
+
+	FAULTPASS pass;
+
+	hTerraGen->random.Seed( pFaults->dwSeed != 0 ? (DWORD)pFaults->dwSeed : (DWORD)time( NULL ) );
+	hTerraGen->logFunc = CLogFunc( pFaults->fLogM, pFaults->fLogSeed );
+
+	pass.bRetain = raster.iCellType == FAULT_CELL_F32 || raster.iCellType == FAULT_CELL_F64;
+	pass.bLogistic = pFaults->bLogistic != 0;
+	pass.iProfile = pFaults->iProfile;
+	pass.fProfileWidth = pFaults->fProfileWidth > 0.f ? pFaults->fProfileWidth : FAULT_PROFILE_WIDTH;
+	pass.iFirst = 0;
+	pass.iLast = pFaults->iIterations;
+	pass.iIterations = pFaults->iIterations;
+	pass.iDepthInit = pFaults->iDepthInit;
+	pass.iDepthEnd = pFaults->iDepthEnd;
+	pass.iFixedFaultDepth = pFaults->iFixedDepth;
+	pass.iMinHeight = hTerraGen->iMinHeight;
+	pass.iMaxHeight = hTerraGen->iMaxHeight;
+	pass.pRandom = &hTerraGen->random;
+	pass.pLogFunc = &hTerraGen->logFunc;
+	pass.hWnd = NULL;
+	pass.pdMin = NULL;
+	pass.pdMax = NULL;
+
+	CRaster::Faults( raster, pass );
+
+	return 1;
+}
+
+int TERRAGENCALL TerraGenBlur( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, int iBlurFactor )
+{
+	RASTER raster;
+
+	if ( hTerraGen == NULL || !MakeRaster( hTerraGen, pRaster, "height", raster ) )
+	{
+		return 0;
+	}
+
+	CRaster::Blur( raster, iBlurFactor );
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+//	Stretch the heights' range linearly over levels 0..(max - min) of the
+//	heights set, written to a second raster of any format. The two may
+//	not overlap. A format with fewer levels stretches over all it has.
+//------------------------------------------------------------------------------
+int TERRAGENCALL TerraGenQuantize( HTERRAGEN hTerraGen, const TERRAGENRASTER* pHeights, const TERRAGENRASTER* pLevels )
+{
+	RASTER heights;
+	RASTER levels;
+
+	if ( hTerraGen == NULL || !MakeRaster( hTerraGen, pHeights, "height", heights ) || !MakeRaster( hTerraGen, pLevels, "level", levels ) )
+	{
+		return 0;
+	}
+
+	CRaster::Quantize( heights, hTerraGen->iMaxHeight - hTerraGen->iMinHeight, levels );
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+//	Why the last call on the handle that returned 0 did, or "" if none has
+//------------------------------------------------------------------------------
+const char* TERRAGENCALL TerraGenGetError( HTERRAGEN hTerraGen )
+{
+	return hTerraGen != NULL ? hTerraGen->szError : "No handle";
+}
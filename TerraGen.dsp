@@ -42,7 +42,7 @@ RSC=rc.exe
 # PROP Intermediate_Dir "Release"
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
-# ADD CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
+# ADD CPP /nologo /MT /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
 # ADD BASE MTL /nologo /D "NDEBUG" /mktyplib203 /win32
 # ADD MTL /nologo /D "NDEBUG" /mktyplib203 /win32
 # ADD BASE RSC /l 0x809 /d "NDEBUG"
@@ -52,7 +52,7 @@ BSC32=bscmake.exe
 # ADD BSC32 /nologo
 LINK32=link.exe
 # ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /machine:I386
-# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /machine:I386
+# ADD LINK32 wsock32.lib kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /machine:I386
 
 !ELSEIF  "$(CFG)" == "TerraGen - Win32 Debug"
 
@@ -68,7 +68,7 @@ LINK32=link.exe
 # PROP Ignore_Export_Lib 0
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /GZ /c
-# ADD CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /FR /YX /FD /GZ /c
+# ADD CPP /nologo /MTd /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /FR /YX /FD /GZ /c
 # ADD BASE MTL /nologo /D "_DEBUG" /mktyplib203 /win32
 # ADD MTL /nologo /D "_DEBUG" /mktyplib203 /win32
 # ADD BASE RSC /l 0x809 /d "_DEBUG"
@@ -78,7 +78,7 @@ BSC32=bscmake.exe
 # ADD BSC32 /nologo
 LINK32=link.exe
 # ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept
-# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept
+# ADD LINK32 wsock32.lib kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept
 
 !ENDIF 
 
@@ -91,10 +91,106 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=.\Archive.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Arena.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\AsyncWriter.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Batch.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Checkpoint.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Contour.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Drainage.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Erosion.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\FaultKernel.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Generate.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Grid.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Logistic.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Parallel.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Pipeline.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Quantize.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Raster.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Reference.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\ResultCache.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Sample.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Spectral.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\TerraGen.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\Terrain.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\TileServer.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Trace.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Verify.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\Win32.cpp
 # End Source File
 # End Group
@@ -103,12 +199,108 @@ SOURCE=.\Win32.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=.\Archive.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Arena.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\AsyncWriter.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Batch.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Checkpoint.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Contour.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Drainage.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Erosion.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\FaultKernel.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Generate.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Grid.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Logistic.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Parallel.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Pipeline.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Quantize.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Raster.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Reference.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\resource.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\ResultCache.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Sample.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Spectral.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\TerraGen.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\Terrain.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\TileServer.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Trace.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Verify.h
+# End Source File
 # End Group
 # Begin Group "Resource Files"
 
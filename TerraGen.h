@@ -0,0 +1,104 @@
+/*--------------------------------------------------------------------------------
+
+	TerraGen.h
+
+	Provides a C interface to the terrain operations, working in place on
+	rasters the caller owns
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _TERRAGEN_H
+#define _TERRAGEN_H
+
+//-----------------
+//	Definitions
+//-----------------
+#if defined( TERRAGEN_BUILD_DLL )
+#define TERRAGENAPI		__declspec( dllexport )
+#elif defined( TERRAGEN_USE_DLL )
+#define TERRAGENAPI		__declspec( dllimport )
+#else
+#define TERRAGENAPI
+#endif
+
+#define TERRAGENCALL	__stdcall
+
+#define TERRAGEN_VERSION	1			// Bumped only when something below changes incompatibly
+
+//	Cell formats, the fault kernel's FAULTCELL types
+//------------------------------------------------------
+#define TERRAGEN_FORMAT_U8		0		// unsigned char
+#define TERRAGEN_FORMAT_U16		1		// unsigned short
+#define TERRAGEN_FORMAT_I32		2		// int
+#define TERRAGEN_FORMAT_F32		3		// float
+#define TERRAGEN_FORMAT_F64		4		// double
+
+//	Fault cross sections, FAULTPROFILE
+//----------------------------------------
+#define TERRAGEN_PROFILE_STEP		0
+#define TERRAGEN_PROFILE_LINEAR		1
+#define TERRAGEN_PROFILE_COSINE		2
+#define TERRAGEN_PROFILE_SIGMOID	3
+
+typedef struct tagTERRAGEN* HTERRAGEN;
+
+//	Size^2 cells of iFormat in the caller's memory, row-major with rows
+//	iStride bytes apart, so cell (x, y) starts y * iStride + x * cell
+//	bytes in. Never copied, kept or freed.
+//---------------------------------------------------------------------------
+typedef struct tagTERRAGENRASTER
+{
+	void*	pvCells;
+	int		iStride;
+	int		iFormat;
+} TERRAGENRASTER;
+
+//	A fault run. cbSize is sizeof(TERRAGENFAULTS), so fields can be added
+//	on the end without breaking callers built against an older header.
+//	Fields past a caller's cbSize take their default, as 0 asks for.
+//---------------------------------------------------------------------------
+typedef struct tagTERRAGENFAULTS
+{
+	unsigned int	cbSize;
+	int				iIterations;
+	int				iDepthInit;
+	int				iDepthEnd;
+	int				iFixedDepth;		// Every fault this deep if not 0
+	unsigned long	dwSeed;				// 0 for the clock
+	int				bLogistic;			// Endpoints from the logistic function
+	float			fLogM;
+	float			fLogSeed;
+	int				iProfile;			// TERRAGEN_PROFILE_*
+	float			fProfileWidth;		// Band half width in cells, 0 for the default
+} TERRAGENFAULTS;
+
+//-----------------
+//	Functions
+//-----------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TERRAGENAPI int TERRAGENCALL TerraGenGetVersion( void );
+
+TERRAGENAPI HTERRAGEN TERRAGENCALL TerraGenCreate( int iSize );
+TERRAGENAPI void TERRAGENCALL TerraGenDestroy( HTERRAGEN hTerraGen );
+
+TERRAGENAPI int TERRAGENCALL TerraGenSetHeights( HTERRAGEN hTerraGen, int iMinHeight, int iMaxHeight );
+TERRAGENAPI int TERRAGENCALL TerraGenClear( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, double dHeight );
+TERRAGENAPI int TERRAGENCALL TerraGenFaults( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, const TERRAGENFAULTS* pFaults );
+TERRAGENAPI int TERRAGENCALL TerraGenBlur( HTERRAGEN hTerraGen, const TERRAGENRASTER* pRaster, int iBlurFactor );
+TERRAGENAPI int TERRAGENCALL TerraGenQuantize( HTERRAGEN hTerraGen, const TERRAGENRASTER* pHeights, const TERRAGENRASTER* pLevels );
+
+TERRAGENAPI const char* TERRAGENCALL TerraGenGetError( HTERRAGEN hTerraGen );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
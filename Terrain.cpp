@@ -20,9 +20,48 @@
 //	Includes
 //--------------
 #include "Terrain.h"
+#include "Arena.h"
+#include "Checkpoint.h"
+#include "FaultKernel.h"
+#include "Parallel.h"
+#include "Spectral.h"
+#include "Trace.h"
 extern CLogFunc g_LogFunc;
 extern HWND g_hWnd;
 
+//-----------------
+//	Definitions
+//-----------------
+
+//	Context for the tasks CTerrain hands the scheduler
+//--------------------------------------------------------
+typedef struct tagTERRAINJOB
+{
+	CTerrain*	pTerrain;
+	double*		pdRetainGrid;			// RetainTask
+	BOOL		bAlongX;				// BlurTask
+	int			iFirst;
+	int			iEnd;
+	FILE*		apFiles[MAX_WORKERS];	// SaveBandTask, a handle and a band's
+	BYTE*		apbBands[MAX_WORKERS];	// pixels per worker, and whether
+	BOOL		abFailed[MAX_WORKERS];	// any of its writes failed
+	BYTE*		pbStripe;				// SaveStripeTask, rows iFirst up to iEnd
+	int			iBBoxSq;				// PatchTask, patch side and patches per
+	int			iTilePatches;			// tile side, and block counts per worker
+	int			iPatches;
+	int			aiBlocks[MAX_WORKERS];
+} TERRAINJOB;
+
+//	Outer rows, or columns, [iOuterFirst, iOuterLast) of band iIndex
+//-----------------------------------------------------------------------
+static void BandRange( CHeightGrid& grid, int iIndex, int& iOuterFirst, int& iOuterLast )
+{
+	int iBandWidth = CHeightGrid::BandWidth( grid.Layout() );
+
+	iOuterFirst = iIndex * iBandWidth;
+	iOuterLast = iOuterFirst + iBandWidth < grid.Size() ? iOuterFirst + iBandWidth : grid.Size();
+}
+
 //--------------------------------------
 //
 //	CLASS: CFaultLine implementation
@@ -80,6 +119,10 @@ CTerrain::CTerrain()
 	memset( (void*)&m_lpstrFilename, 0, sizeof(TCHAR) * MAX_PATH );	
 	sprintf( m_lpstrFilename, TEXT( "fractal01" ) );
 
+	m_grid.Create( m_iTileSq, GRID_LAYOUT_ROW );
+	SetFaultProfile( FAULT_PROFILE_STEP, FAULT_PROFILE_WIDTH );
+	SetFaultSeed( 0 );
+	CQuantizer::DefaultParams( &m_quantize );
 	ClearGrid( m_iMinHeight + ( ( m_iMaxHeight - m_iMinHeight ) / 2 ) );
 	
 	//------------------------------------------------------------------------------
@@ -98,13 +141,7 @@ CTerrain::~CTerrain()
 //---------------------------------------
 void CTerrain::ClearGrid( int iValue )
 {
-	for ( int iX = 0; iX < m_iTileSq; iX++ )
-	{
-		for ( int iY = 0; iY < m_iTileSq; iY++ )
-		{
-			m_abGrid[iX][iY] = iValue;
-		}
-	}
+	m_grid.Fill( (BYTE)iValue );
 
 	InvalidateRect( NULL, NULL, TRUE );
 }
@@ -114,7 +151,24 @@ void CTerrain::ClearGrid( int iValue )
 //-------------------------
 BYTE& CTerrain::Grid( int iXPos, int iYPos )
 {
-	return m_abGrid[iXPos][iYPos];
+	return m_grid.At( iXPos, iYPos );
+}
+
+//---------------------------------------------------------------
+//	The grid itself, for passes that walk it in memory order
+//---------------------------------------------------------------
+CHeightGrid& CTerrain::HeightGrid()
+{
+	return m_grid;
+}
+
+//---------------------------------------------------------------
+//	The generator placing faults, for saving and restoring where
+//	a run has got to
+//---------------------------------------------------------------
+CRandom& CTerrain::FaultRandom()
+{
+	return m_random;
 }
 
 //-----------------------------------------------------------------
@@ -123,6 +177,16 @@ BYTE& CTerrain::Grid( int iXPos, int iYPos )
 //	Pass -1 for both values if you wish the tile to be centered
 //-----------------------------------------------------------------
 void CTerrain::Draw( HWND hWnd, HDC hdc, int iClientX, int iClientY )
+{
+	Draw( hWnd, hdc, iClientX, iClientY, NULL );
+}
+
+//-----------------------------------------------------------------
+//	As above, drawing pbColumns in place of the tile's own cells if
+//	it is not NULL, a copy [x * m_iTileSq + y] such as a snapshot
+//	from CGenerationTask
+//-----------------------------------------------------------------
+void CTerrain::Draw( HWND hWnd, HDC hdc, int iClientX, int iClientY, const BYTE* pbColumns )
 {
 	//-----------------------------------
 	//	Get current window dimensions
@@ -159,11 +223,16 @@ void CTerrain::Draw( HWND hWnd, HDC hdc, int iClientX, int iClientY )
 	//----------------------
 	//	Draw the terrain
 	//----------------------
-	for ( INT iXidx = 0; iXidx < m_iTileSq; iXidx++ )
+	BOOL bRowsOuter = m_grid.RowsOuter();
+
+	for ( INT iOuter = 0; iOuter < m_iTileSq; iOuter++ )
 	{
-		for ( INT iYidx = 0; iYidx < m_iTileSq; iYidx++ )
+		for ( INT iInner = 0; iInner < m_iTileSq; iInner++ )
 		{
-			BYTE bGrey = m_abGrid[iXidx][iYidx];
+			INT iXidx = bRowsOuter ? iInner : iOuter;
+			INT iYidx = bRowsOuter ? iOuter : iInner;
+
+			BYTE bGrey = pbColumns != NULL ? pbColumns[iXidx * m_iTileSq + iYidx] : m_grid.At( iXidx, iYidx );
 			SetPixel( hdc, iXidx + iOriginX, iYidx + iOriginY, COLOUR( bGrey, bGrey, bGrey ) );
 		}
 	}
@@ -186,7 +255,7 @@ FLOAT CTerrain::PickPoint( CLogFunc* pLogFunc )
 	}
 	else
 	{
-		fResult = (FLOAT)(rand() % m_iTileSq);
+		fResult = (FLOAT)(m_random.Next() % m_iTileSq);
 	}
 
 	return fResult;
@@ -200,147 +269,386 @@ FLOAT CTerrain::PickPoint( CLogFunc* pLogFunc )
 //	every fault line
 //
 //	bUseLogisticFunc	-	Use the logisitic function to generate random numbers
+//
+//	Returns FALSE, with the tile as it was, if there is no memory to retain
 //------------------------------------------------------------------------------------
-void CTerrain::GenerateFaultLines( int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd )
+BOOL CTerrain::GenerateFaultLines( int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd )
 { 
-	int iFaultDepth;
-	double adRetainGrid[256][256];
+	//	The retained grid is scratch from this thread's arena, so repeated
+	//	runs reuse the same memory
+	//------------------------------------------------------------------------
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	double* pdRetainGrid = NULL;
+	double dMin, dMax;
 
-	for ( int i = 0; i < 256; i++ )
+	if ( bRetainAllValues )
 	{
-		for ( int j = 0; j < 256; j++ )
+		pdRetainGrid = (double*)pArena->Alloc( sizeof(double) * m_iTileSq * m_iTileSq );
+
+		if ( pdRetainGrid == NULL )
 		{
-			adRetainGrid[i][j] = (double)Grid(i,j);
+			return FALSE;
 		}
+
+		RetainGrid( pdRetainGrid );
 	}
 
-	//------------------------------------------------------------------------------
-	//	Seed the random generator for when we're not using the logistic function
-	//------------------------------------------------------------------------------
-	srand( (unsigned)time( NULL ) );
+	ApplyFaultLines( pdRetainGrid, iIterations, iDepthInit, iDepthEnd, iFixedFaultDepth, bUseLogisticFunc, hWnd, &dMin, &dMax );
+
+	//	If we retained all values, we need to quantize the retained value grid
+	//	to fill our BYTE values. The last fault gathered its range.
+	//----------------------------------------------------------------------------
+	BOOL bResult = TRUE;
 
-	for ( int iFaultIDX = 0; iFaultIDX < iIterations; iFaultIDX++ )
+	if ( bRetainAllValues && iIterations > 0 )
 	{
-		//-----------------------------------------------------
-		//	Generate two points to describe this fault line
-		//-----------------------------------------------------
-		FLOAT x1, y1, x2, y2;
+		bResult = QuantizeRetained( pdRetainGrid, dMin, dMax );
+	}
+	else if ( bRetainAllValues )
+	{
+		bResult = QuantizeRetained( pdRetainGrid );
+	}
 
-		if ( bUseLogisticFunc )
-		{
-			x1 = PickPoint( &g_LogFunc );
-			y1 = PickPoint( &g_LogFunc );
-			x2 = PickPoint( &g_LogFunc );
-			y2 = PickPoint( &g_LogFunc );
-		}
-		else
-		{
-			x1 = PickPoint( NULL );
-			y1 = PickPoint( NULL );
-			x2 = PickPoint( NULL );
-			y2 = PickPoint( NULL );
-		}
+	InvalidateRect( NULL, NULL, TRUE );
 
-		CFaultLine faultLine( CVector(x1, y1, 0.f), CVector(x2, y2, 0.f) );
-		
-		//----------------------------------------------------------------------------------
-		//	Use a fixed fault depth, or, linearly interpolate between the desired values
-		//----------------------------------------------------------------------------------
-		iFaultDepth = iFixedFaultDepth != 0 ? iFixedFaultDepth : iDepthInit + ( (int)( (FLOAT)iFaultIDX / (FLOAT)iIterations ) * ( iDepthEnd - iDepthInit ) );
+	return bResult;
+}
 
-		for ( int iXPos = 0; iXPos < m_iTileSq; iXPos++ )
+//------------------------------------------------------------------------------------
+//	Run the fault line iterations
+//
+//	pdRetainGrid		-	If NULL, faults are applied straight to the grid and
+//							clamped to the min/max heights, otherwise they are
+//							accumulated unclamped into this m_iTileSq^2 grid,
+//							indexed [iXPos * m_iTileSq + iYPos]
+//
+//	pdMin, pdMax		-	If not NULL, receive the range of pdRetainGrid,
+//							gathered during the last fault so no separate pass
+//							over the grid is needed to quantize it
+//------------------------------------------------------------------------------------
+void CTerrain::ApplyFaultLines( double* pdRetainGrid, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, HWND hWnd, double* pdMin, double* pdMax )
+{
+	SeedFaults();
+	ApplyFaultRange( NULL, pdRetainGrid, 0, iIterations, iIterations, iDepthInit, iDepthEnd, iFixedFaultDepth, bUseLogisticFunc, hWnd, pdMin, pdMax );
+}
+
+//------------------------------------------------------------------------------
+//	Seed the random generator for when we're not using the logistic
+//	function, from the fault seed or else the clock
+//------------------------------------------------------------------------------
+void CTerrain::SeedFaults()
+{
+	m_random.Seed( m_dwFaultSeed != 0 ? m_dwFaultSeed : (DWORD)time( NULL ) );
+}
+
+//------------------------------------------------------------------------------
+//	Copy the cells into a retained grid, [x * m_iTileSq + y], for faults
+//	to accumulate into
+//------------------------------------------------------------------------------
+void CTerrain::RetainGrid( double* pdRetainGrid )
+{
+	//	A large grid's columns are copied by the workers that will
+	//	fault them, see ApplyFaultPass
+	//----------------------------------------------------------------
+	if ( CHeightGrid::Parallel( m_iTileSq ) )
+	{
+		TERRAINJOB job;
+
+		job.pTerrain = this;
+		job.pdRetainGrid = pdRetainGrid;
+
+		CHeightGrid::ForBands( GRID_LAYOUT_COLUMN, m_iTileSq, RetainTask, &job );
+	}
+	else
+	{
+		for ( int i = 0; i < m_iTileSq; i++ )
 		{
-			for ( int iYPos = 0; iYPos < m_iTileSq; iYPos++ )
+			for ( int j = 0; j < m_iTileSq; j++ )
 			{
-				CVector vGridLoc((FLOAT)iXPos, (FLOAT)iYPos, 0.f);
-
-				if ( faultLine.TestPoint( vGridLoc ) < 0.f )
-				{
-					//----------------------------------------------------
-					//	Grid position is to the left of the fault line
-					//----------------------------------------------------
-					if ( bRetainAllValues )
-					{
-						adRetainGrid[iXPos][iYPos] += (double)iFaultDepth;
-					}
-					else
-					{
-						if ( m_abGrid[iXPos][iYPos] + iFaultDepth < m_iMaxHeight )
-						{
-							m_abGrid[iXPos][iYPos] += iFaultDepth;
-						}
-					}
-				}
-				else
-				{
-					//---------------------------------------------------------------
-					//	Grid position is to the right of the fault line, or on it
-					//---------------------------------------------------------------
-					if ( bRetainAllValues )
-					{
-						adRetainGrid[iXPos][iYPos] -= (double)iFaultDepth;
-					}
-					else
-					{
-						if ( m_abGrid[iXPos][iYPos] - iFaultDepth > m_iMinHeight )
-						{
-							m_abGrid[iXPos][iYPos] -= iFaultDepth;
-						}
-					}
-				}
-			}				
+				pdRetainGrid[i * m_iTileSq + j] = (double)Grid(i,j);
+			}
 		}
+	}
+}
 
-		int iProgress = (int)(((FLOAT)iFaultIDX / (FLOAT)iIterations) * 100.f);
+//------------------------------------------------------------------------------
+//	Choose the profile faults are cut with from now on, a FAULTPROFILE, and
+//	for the smooth ones the half width of the band, in cells
+//------------------------------------------------------------------------------
+void CTerrain::SetFaultProfile( int iProfile, FLOAT fWidth )
+{
+	m_iFaultProfile = iProfile;
+	m_fProfileWidth = fWidth > 0.f ? fWidth : FAULT_PROFILE_WIDTH;
+}
 
-		SendMessage( GetDlgItem( hWnd, IDC_PROGRESS ), WM_USER+2, (WPARAM)iProgress, 0 );
+//------------------------------------------------------------------------------
+//	Seed the generator that places faults when not using the logistic
+//	function, so runs can be repeated. 0 goes back to seeding each run from
+//	the clock.
+//------------------------------------------------------------------------------
+void CTerrain::SetFaultSeed( DWORD dwSeed )
+{
+	m_dwFaultSeed = dwSeed;
+}
+
+//------------------------------------------------------------------------------------
+//	Run faults [iFirst, iLast) of an iIterations long run
+//
+//	pdSource			-	If not NULL, the retained grid before iFirst. The
+//							first fault reads it and writes pdRetainGrid, so the
+//							source is left untouched
+//------------------------------------------------------------------------------------
+void CTerrain::ApplyFaultRange( const double* pdSource, double* pdRetainGrid, int iFirst, int iLast, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, HWND hWnd, double* pdMin, double* pdMax )
+{
+	//	The kernel is chosen once for the whole range, rather than testing
+	//	the mode and endpoint source for every cell
+	//------------------------------------------------------------------------
+	FAULTPASS pass;
+
+	pass.pvCells = pdRetainGrid != NULL ? (void*)pdRetainGrid : (void*)m_grid.Cells();
+	pass.pvSource = pdSource;
+	pass.iCellType = pdRetainGrid != NULL ? FAULT_CELL_F64 : FAULT_CELL_U8;
+	pass.iLayout = pdRetainGrid != NULL ? GRID_LAYOUT_COLUMN : m_grid.Layout();
+	pass.bRetain = pdRetainGrid != NULL;
+	pass.bLogistic = bUseLogisticFunc;
+	pass.iProfile = m_iFaultProfile;
+	pass.fProfileWidth = m_fProfileWidth;
+	pass.iTileSq = m_iTileSq;
+	pass.iPitch = m_iTileSq;
+	pass.iSample = 1;
+	pass.iFirst = iFirst;
+	pass.iLast = iLast;
+	pass.iIterations = iIterations;
+	pass.iDepthInit = iDepthInit;
+	pass.iDepthEnd = iDepthEnd;
+	pass.iFixedFaultDepth = iFixedFaultDepth;
+	pass.iMinHeight = m_iMinHeight;
+	pass.iMaxHeight = m_iMaxHeight;
+	pass.pRandom = &m_random;
+	pass.pLogFunc = &g_LogFunc;
+	pass.hWnd = hWnd;
+	pass.pdMin = pdMin;
+	pass.pdMax = pdMax;
+
+	ApplyFaultPass( pass );
+}
+
+//------------------------------------------------------------------------------------
+//	Move the generator or g_LogFunc past faults [iFirst, iLast) without
+//	applying them, so the next range carries on as if they had been
+//------------------------------------------------------------------------------------
+void CTerrain::SkipFaultRange( int iFirst, int iLast, bool bUseLogisticFunc )
+{
+	FAULTPASS pass;
+
+	memset( &pass, 0, sizeof(pass) );
+
+	pass.bLogistic = bUseLogisticFunc;
+	pass.iTileSq = m_iTileSq;
+	pass.iSample = 1;
+	pass.iFirst = iFirst;
+	pass.iLast = iLast;
+	pass.iIterations = iLast;
+	pass.pRandom = &m_random;
+	pass.pLogFunc = &g_LogFunc;
+
+	SkipFaultPass( pass );
+}
+
+//------------------------------------------------------------------------------------
+//	Generate fault lines as above, checkpointing to szCheckpoint every
+//	iInterval faults so that an interrupted run can be resumed
+//
+//	Returns FALSE if the checkpoint could not be written, or the retained
+//	result could not be quantized
+//------------------------------------------------------------------------------------
+BOOL CTerrain::GenerateFaultLines( LPCSTR szCheckpoint, int iInterval, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd )
+{
+	CFaultCheckpoint checkpoint;
+	FAULTRUN run;
+	FAULTCURSOR cursor;
+
+	run.iIterations = iIterations;
+	run.iDepthInit = iDepthInit;
+	run.iDepthEnd = iDepthEnd;
+	run.iFixedFaultDepth = iFixedFaultDepth;
+	run.bUseLogisticFunc = bUseLogisticFunc;
+	run.bRetainAllValues = bRetainAllValues;
+	run.fLogM = g_LogFunc.M();
+	run.fLogSeed = g_LogFunc.Seed();
+	run.iProfile = m_iFaultProfile;
+	run.fProfileWidth = m_fProfileWidth;
+
+	if ( !checkpoint.Create( szCheckpoint, m_iTileSq, run ) )
+	{
+		return FALSE;
 	}
 
-	//	If we retained all values, we need to quantize the retained value grid
-	//	to fill our BYTE values
-	//----------------------------------------------------------------------------
+	//	The first checkpoint is the grid the run starts from
+	//----------------------------------------------------------
+	SeedFaults();
+
+	cursor.iNextFault = 0;
+	cursor.dwRandomState = m_random.State();
+	cursor.fLogIterate = g_LogFunc.LastIterate();
+
 	if ( bRetainAllValues )
 	{
-		//	Get min and max retained values
-		//-------------------------------------
-		double dMIN = 65536;
-		double dMAX = 0;
-		double dRange, dRatio;
-		for ( int iXPos = 0; iXPos < m_iTileSq; iXPos++ )
+		m_grid.ToColumns( (double*)checkpoint.WorkSlot() );
+	}
+	else
+	{
+		m_grid.ToColumns( (BYTE*)checkpoint.WorkSlot() );
+	}
+
+	if ( !checkpoint.Commit( cursor ) )
+	{
+		return FALSE;
+	}
+
+	return RunCheckpointed( checkpoint, iInterval, hWnd );
+}
+
+//------------------------------------------------------------------------------------
+//	Carry on the run saved in szCheckpoint, the result matches the run
+//	having never stopped
+//------------------------------------------------------------------------------------
+BOOL CTerrain::ResumeFaultLines( LPCSTR szCheckpoint, int iInterval, HWND hWnd )
+{
+	CFaultCheckpoint checkpoint;
+
+	if ( !checkpoint.Open( szCheckpoint, m_iTileSq ) )
+	{
+		return FALSE;
+	}
+
+	g_LogFunc.M() = checkpoint.Run().fLogM;
+	g_LogFunc.Seed() = checkpoint.Run().fLogSeed;
+
+	return RunCheckpointed( checkpoint, iInterval, hWnd );
+}
+
+//------------------------------------------------------------------------------------
+//	Run from the checkpoint's cursor to the end, committing every iInterval
+//
+//	A retained run accumulates straight into the mapped file, each interval
+//	reading the active slot and writing the work slot. A clamped run works
+//	on the BYTE grid and copies it into the work slot at each commit.
+//------------------------------------------------------------------------------------
+BOOL CTerrain::RunCheckpointed( CFaultCheckpoint& checkpoint, int iInterval, HWND hWnd )
+{
+	FAULTRUN run = checkpoint.Run();
+	FAULTCURSOR cursor = checkpoint.Cursor();
+
+	iInterval = iInterval > 0 ? iInterval : CHECKPOINT_INTERVAL;
+
+	m_random.SetState( cursor.dwRandomState );
+	g_LogFunc.LastIterate() = cursor.fLogIterate;
+	SetFaultProfile( run.iProfile, run.fProfileWidth );
+
+	if ( !run.bRetainAllValues )
+	{
+		m_grid.FromColumns( (const BYTE*)checkpoint.ActiveSlot() );
+	}
+
+	while ( cursor.iNextFault < run.iIterations )
+	{
+		int iLast = run.iIterations - cursor.iNextFault > iInterval ? cursor.iNextFault + iInterval : run.iIterations;
+
+		if ( run.bRetainAllValues )
 		{
-			for ( int iYPos = 0; iYPos < m_iTileSq; iYPos++ )
-			{
-				if ( adRetainGrid[iXPos][iYPos] > 65536 )
-				{
-					exit(0);
-				}
+			ApplyFaultRange( (const double*)checkpoint.ActiveSlot(), (double*)checkpoint.WorkSlot(), cursor.iNextFault, iLast, run.iIterations,
+							 run.iDepthInit, run.iDepthEnd, run.iFixedFaultDepth, run.bUseLogisticFunc != FALSE, hWnd, NULL, NULL );
+		}
+		else
+		{
+			ApplyFaultRange( NULL, NULL, cursor.iNextFault, iLast, run.iIterations,
+							 run.iDepthInit, run.iDepthEnd, run.iFixedFaultDepth, run.bUseLogisticFunc != FALSE, hWnd, NULL, NULL );
 
-				if ( adRetainGrid[iXPos][iYPos] < dMIN )
-				{
-					dMIN = adRetainGrid[iXPos][iYPos];
-				}
-				if ( adRetainGrid[iXPos][iYPos] > dMAX )
-				{
-					dMAX = adRetainGrid[iXPos][iYPos];
-				}
-			}
+			m_grid.ToColumns( (BYTE*)checkpoint.WorkSlot() );
 		}
-		
-		dRange = dMAX - dMIN;
-		dRatio = dRange / (double)(m_iMaxHeight - m_iMinHeight);
 
-		for ( iXPos = 0; iXPos < m_iTileSq; iXPos++ )
-		{
-			for ( int iYPos = 0; iYPos < m_iTileSq; iYPos++ )
-			{
-				double dValue = (adRetainGrid[iXPos][iYPos] - dMIN) / dRatio;
+		cursor.iNextFault = iLast;
+		cursor.dwRandomState = m_random.State();
+		cursor.fLogIterate = g_LogFunc.LastIterate();
 
-				m_abGrid[iXPos][iYPos] = (BYTE)dValue;
-			}
+		if ( !checkpoint.Commit( cursor ) )
+		{
+			return FALSE;
 		}
 	}
 
+	if ( run.bRetainAllValues && !QuantizeRetained( (const double*)checkpoint.ActiveSlot() ) )
+	{
+		return FALSE;
+	}
+
+	InvalidateRect( NULL, NULL, TRUE );
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Replace the tile with spectral synthesis noise of roughly the given
+//	fractal dimension, stretched over the min/max heights
+//
+//	Returns FALSE if the tile size is not a power of two or memory runs out
+//------------------------------------------------------------------------------
+BOOL CTerrain::GenerateSpectral( FLOAT fDimension, DWORD dwSeed )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CSpectralSynth synth;
+	double* pdHeights = (double*)pArena->Alloc( sizeof(double) * m_iTileSq * m_iTileSq );
+
+	if ( pdHeights == NULL || !synth.Synthesize( m_iTileSq, fDimension, dwSeed, pdHeights ) || !QuantizeRetained( pdHeights ) )
+	{
+		return FALSE;
+	}
+
 	InvalidateRect( NULL, NULL, TRUE );
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------
+//	Choose how retained heights are spread over the height range
+//------------------------------------------------------------------------
+void CTerrain::SetQuantize( const QUANTIZEPARAMS& params )
+{
+	m_quantize = params;
+}
+
+const QUANTIZEPARAMS& CTerrain::GetQuantize()
+{
+	return m_quantize;
+}
+
+//------------------------------------------------------------------------
+//	Quantize an accumulated grid from ApplyFaultLines into our BYTE grid,
+//	FALSE with the grid as it was if the quantizer is out of memory
+//------------------------------------------------------------------------
+BOOL CTerrain::QuantizeRetained( const double* pdRetainGrid )
+{
+	CQuantizer quantizer;
+
+	quantizer.Params() = m_quantize;
+
+	return quantizer.Quantize( pdRetainGrid, m_iTileSq, m_iMaxHeight - m_iMinHeight, &m_grid );
+}
+
+//------------------------------------------------------------------------
+//	As above, for a grid whose range is already known
+//------------------------------------------------------------------------
+BOOL CTerrain::QuantizeRetained( const double* pdRetainGrid, double dMin, double dMax )
+{
+	CQuantizer quantizer;
+
+	quantizer.Params() = m_quantize;
+	quantizer.SetRange( dMin, dMax );
+
+	return quantizer.Quantize( pdRetainGrid, m_iTileSq, m_iMaxHeight - m_iMinHeight, &m_grid );
 }
 
 //-----------------------------------------------------------------------
@@ -364,6 +672,9 @@ FLOAT CTerrain::CalcFractalDimension()
 	//------------------------------------------------------------------
 	while ( iBBoxSq >= 1 )
 	{
+		TRACE_SPAN( "fractal dimension level" );
+		TRACE_CELLS( iResultIDX == 0 ? 0 : (ULONGLONG)m_iTileSq * m_iTileSq );
+
 		if ( iResultIDX == 0 )
 		{
 			//	The first bounding box needs one to bound the terrain tile,
@@ -379,29 +690,35 @@ FLOAT CTerrain::CalcFractalDimension()
 			//---------------------------------------------------------------------
 			int iEpsn = m_iTileSq / iBBoxSq;
 						
-			//	Count the number of blocks needed to cover each vertical extrusion
+			//	Count the number of blocks needed to cover each vertical extrusion,
+			//	on a larger grid over tiles of patches at least FRACTAL_TILE wide
 			//------------------------------------------------------------------------
 			int iBlockCount = 0;
 
-			for ( int iXPatch = 0; iXPatch < iEpsn; iXPatch++ )
+			if ( CHeightGrid::Parallel( m_iTileSq ) )
 			{
-				for ( int iYPatch = 0; iYPatch < iEpsn; iYPatch++ )
+				TERRAINJOB job;
+				int iTiles;
+
+				job.pTerrain = this;
+				job.iBBoxSq = iBBoxSq;
+				job.iTilePatches = iBBoxSq < FRACTAL_TILE ? FRACTAL_TILE / iBBoxSq : 1;
+				job.iPatches = iEpsn;
+
+				memset( job.aiBlocks, 0, sizeof(job.aiBlocks) );
+
+				iTiles = ( iEpsn + job.iTilePatches - 1 ) / job.iTilePatches;
+				ParallelFor2D( iTiles, iTiles, PatchTask, &job );
+
+				for ( int iWorker = 0; iWorker < MAX_WORKERS; iWorker++ )
 				{
-					int iHeightToReach = PatchMaxHeight( iXPatch * iBBoxSq, iBBoxSq, iYPatch * iBBoxSq , iBBoxSq );
-
-					//	Conservative block count
-					//------------------------------
-					int iStackSize = ( iHeightToReach + 1 ) / iBBoxSq;
-					iBlockCount += iStackSize;
-					
-					// If this many blocks don't clear the max height, add one more
-					//-----------------------------------------------------------------
-					if ( iStackSize * iBBoxSq < ( iHeightToReach + 1 ) )
-					{
-						iBlockCount++;
-					}
+					iBlockCount += job.aiBlocks[iWorker];
 				}
 			}
+			else
+			{
+				iBlockCount = CountBlocks( iBBoxSq, 0, iEpsn, 0, iEpsn );
+			}
 
 			aiResults[iResultIDX][0] = iBBoxSq;
 			aiResults[iResultIDX][1] = iBlockCount;
@@ -445,6 +762,48 @@ FLOAT CTerrain::CalcFractalDimension()
 	return fFracDim;
 }
 
+//-------------------------------------------------------------------------------------
+//	Blocks of side iBBoxSq needed to cover the vertical extrusions of patches
+//	[iXFirst, iXLast) by [iYFirst, iYLast)
+//-------------------------------------------------------------------------------------
+int CTerrain::CountBlocks( int iBBoxSq, int iXFirst, int iXLast, int iYFirst, int iYLast )
+{
+	int iBlockCount = 0;
+
+	for ( int iXPatch = iXFirst; iXPatch < iXLast; iXPatch++ )
+	{
+		for ( int iYPatch = iYFirst; iYPatch < iYLast; iYPatch++ )
+		{
+			int iHeightToReach = PatchMaxHeight( iXPatch * iBBoxSq, iBBoxSq, iYPatch * iBBoxSq , iBBoxSq );
+
+			//	Conservative block count
+			//------------------------------
+			int iStackSize = ( iHeightToReach + 1 ) / iBBoxSq;
+			iBlockCount += iStackSize;
+			
+			// If this many blocks don't clear the max height, add one more
+			//-----------------------------------------------------------------
+			if ( iStackSize * iBBoxSq < ( iHeightToReach + 1 ) )
+			{
+				iBlockCount++;
+			}
+		}
+	}
+
+	return iBlockCount;
+}
+
+void CTerrain::PatchTask( int iX, int iY, int iWorker, void* pContext )
+{
+	TERRAINJOB* pJob = (TERRAINJOB*)pContext;
+	int iXFirst = iX * pJob->iTilePatches;
+	int iYFirst = iY * pJob->iTilePatches;
+	int iXLast = iXFirst + pJob->iTilePatches < pJob->iPatches ? iXFirst + pJob->iTilePatches : pJob->iPatches;
+	int iYLast = iYFirst + pJob->iTilePatches < pJob->iPatches ? iYFirst + pJob->iTilePatches : pJob->iPatches;
+
+	pJob->aiBlocks[iWorker] += pJob->pTerrain->CountBlocks( pJob->iBBoxSq, iXFirst, iXLast, iYFirst, iYLast );
+}
+
 //-------------------------------------------------------------------------------------
 //	Returns the greatest height encountered in the given patch of the terrain tile
 //
@@ -453,12 +812,19 @@ FLOAT CTerrain::CalcFractalDimension()
 INT CTerrain::PatchMaxHeight( int iStartX, int iWidth, int iStartY, int iHeight )
 {
 	INT iMax = 0;
+	BOOL bRowsOuter = m_grid.RowsOuter();
+	int iOuterStart = bRowsOuter ? iStartY : iStartX;
+	int iOuterEnd = bRowsOuter ? iStartY + iHeight : iStartX + iWidth;
+	int iInnerStart = bRowsOuter ? iStartX : iStartY;
+	int iInnerEnd = bRowsOuter ? iStartX + iWidth : iStartY + iHeight;
 
-	for ( int iX = iStartX; iX < iStartX + iWidth; iX++ )
+	for ( int iOuter = iOuterStart; iOuter < iOuterEnd; iOuter++ )
 	{
-		for ( int iY = iStartY; iY < iStartY + iHeight; iY++ )
+		for ( int iInner = iInnerStart; iInner < iInnerEnd; iInner++ )
 		{
-			iMax = Grid( iX, iY ) > (BYTE)iMax ? Grid( iX, iY ) : iMax;
+			BYTE bHeight = bRowsOuter ? m_grid.At( iInner, iOuter ) : m_grid.At( iOuter, iInner );
+
+			iMax = bHeight > (BYTE)iMax ? bHeight : iMax;
 		}	
 	}
 	
@@ -469,9 +835,9 @@ FLOAT CTerrain::GetAvgHeight()
 {
 	int iHeight = Grid(0,0);
 	
-	for ( int iX = 0; iX < 256; iX++ )
+	for ( int iX = 0; iX < m_iTileSq; iX++ )
 	{
-		for ( int iY = 0; iY < 256; iY++ )
+		for ( int iY = 0; iY < m_iTileSq; iY++ )
 		{
 			iHeight = (INT)((FLOAT)( iHeight + Grid( iX, iY ) ) / 2.f);
 		}
@@ -490,6 +856,30 @@ int& CTerrain::MinHeight()
 	return m_iMinHeight;
 }
 
+int CTerrain::TileSize()
+{
+	return m_iTileSq;
+}
+
+//------------------------------------------------------------------------------
+//	Resize the tile, keeping the grid's layout and clearing it to the middle
+//	height. A tiled grid needs a multiple of GRID_BLOCK. The new grid is
+//	allocated before the old one is freed, so on failure the tile is left
+//	as it was.
+//------------------------------------------------------------------------------
+BOOL CTerrain::SetTileSize( int iTileSq )
+{
+	if ( iTileSq < 2 || iTileSq > GRID_MAX_SIZE || !m_grid.Create( iTileSq, m_grid.Layout() ) )
+	{
+		return FALSE;
+	}
+
+	m_iTileSq = iTileSq;
+	ClearGrid( m_iMinHeight + ( ( m_iMaxHeight - m_iMinHeight ) / 2 ) );
+
+	return TRUE;
+}
+
 void CTerrain::SetFilename( LPSTR szNewFilename )
 {
 	strcpy( &m_lpstrFilename[0], szNewFilename );
@@ -500,14 +890,12 @@ LPSTR CTerrain::GetFilename()
 	return m_lpstrFilename;
 }
 
-void CTerrain::Save()
+//-----------------------------------------------------------------
+//	Fill in an 18 byte header for an uncompressed 24 bit TGA file
+//-----------------------------------------------------------------
+void FillTgaHeader( BYTE* pbHead, int iWidth, int iHeight )
 {
-	FILE* file;
-	int width = GRID_X;
-	int height = GRID_Y;
-	TCHAR acBuffer[MAX_PATH];
-
-	BYTE head[18]=         // header of tga file 
+	BYTE head[TGA_HEADER_SIZE]=         // header of tga file 
 	{
       0,                   // id length
       0,                   // colormap type
@@ -521,76 +909,343 @@ void CTerrain::Save()
 	  0,                   // x origin [2/2 bytes]
 	  0,                   // y origin [1/2 bytes]
 	  0,                   // y origin [2/2 bytes]
-      width%256,           // width [1/2]
-	  (width>>8)%256,      // width [2/2]
-      height%256,          // height [1/2]
-	  (height>>8)%256,     // height [2/2]
+      iWidth%256,          // width [1/2]
+	  (iWidth>>8)%256,     // width [2/2]
+      iHeight%256,         // height [1/2]
+	  (iHeight>>8)%256,    // height [2/2]
       24,                  // pixel size
 	  0,                   // attrib. [alway 0 for 24bit]
 	};
+
+	memcpy( pbHead, head, TGA_HEADER_SIZE );
+}
+
+//------------------------------------------------------------------------------
+//	Write the tile to its filename as a TGA, FALSE (after telling the user)
+//	if the file could not be opened or any write to it failed
+//------------------------------------------------------------------------------
+BOOL CTerrain::Save()
+{
+	TRACE_SPAN( "save" );
+	TRACE_CELLS( (ULONGLONG)m_iTileSq * m_iTileSq );
+	TRACE_BYTES( TGA_HEADER_SIZE + (ULONGLONG)m_iTileSq * m_iTileSq * 3 );
+
+	FILE* file;
+	int width = m_iTileSq;
+	int height = m_iTileSq;
+	TCHAR acBuffer[MAX_PATH];
+	BYTE head[TGA_HEADER_SIZE];
+	BOOL bResult;
+
+	FillTgaHeader( head, width, height );
 	
-	if ((file = fopen(m_lpstrFilename, "wb"))==NULL) MessageBox(NULL,"Failed","TGA",ERROR);                                    
+	if ((file = fopen(m_lpstrFilename, "wb"))==NULL)
+	{
+		MessageBox(NULL,"Failed","TGA",ERROR);
+		return FALSE;
+	}
 
-    fwrite(&head,18,1,file);
+	bResult = fwrite(&head,18,1,file) == 1;
 	
-	for (int y=height-1;y>=0;y--)
-		for (int x=0;x<width;x++)
-		{
-		  fwrite(&m_abGrid[x][y],sizeof(BYTE),1,file);			// as Red		
-		  fwrite(&m_abGrid[x][y],sizeof(BYTE),1,file);			// as Green		
-		  fwrite(&m_abGrid[x][y],sizeof(BYTE),1,file);			// as Blue		
-		}
+	if ( bResult && CHeightGrid::Parallel( m_iTileSq ) )
+	{
+		bResult = SaveBands( file );
+	}
+	else if ( bResult )
+	{
+		for (int y=height-1;y>=0;y--)
+			for (int x=0;x<width;x++)
+			{
+			  fwrite(&m_grid.At(x,y),sizeof(BYTE),1,file);			// as Red		
+			  fwrite(&m_grid.At(x,y),sizeof(BYTE),1,file);			// as Green		
+			  fwrite(&m_grid.At(x,y),sizeof(BYTE),1,file);			// as Blue		
+			}
+
+		bResult = ferror( file ) == 0;
+	}
+
+	bResult = fclose( file ) == 0 && bResult;
+
+	if ( !bResult )
+	{
+		MessageBox(NULL,"Failed","TGA",ERROR);
+		return FALSE;
+	}
 
 	sprintf( acBuffer, "Fractal Terrain Generator - [%s]", m_lpstrFilename );
 	SetWindowText( g_hWnd, acBuffer );
 
-	fclose( file );
+	return TRUE;
 }
 
-void CTerrain::Blur( int iBlurFactor )
+//----------------------------------------------------------------------------
+//	Write a grid's pixels after the header, encoded by the scheduler
+//
+//	On a grid with owned bands in the row or tiled layout, a band's rows
+//	are also contiguous in the file, so each owner writes its own through a
+//	handle of its own. Otherwise workers fill a stripe of rows at a time,
+//	a row or (column-major) a column band each, that this thread then
+//	writes in order.
+//
+//	Every handle is opened before any band is written, so a file that cannot
+//	be opened again fails the save up front. FALSE if anything failed.
+//----------------------------------------------------------------------------
+BOOL CTerrain::SaveBands( FILE* file )
 {
-	unsigned int i, j;
+	BOOL bResult = TRUE;
 
-	for ( int k = 0; k < iBlurFactor; k++ )
+	TERRAINJOB job;
+	int iRowBytes = m_iTileSq * 3;
+	int iWorker;
+
+	job.pTerrain = this;
+
+	if ( !m_grid.RowsOuter() || !CHeightGrid::Owned( m_iTileSq ) )
 	{
-		// Horizontal
-		for ( j = 0; j < GRID_Y; j++ )
+		job.pbStripe = new BYTE[SAVE_STRIPE_ROWS * iRowBytes];
+
+		for ( job.iEnd = m_iTileSq; job.iEnd > 0; job.iEnd = job.iFirst )
 		{
-			for ( i = 1; i < GRID_X-1; i += 2 )
+			job.iFirst = job.iEnd - SAVE_STRIPE_ROWS > 0 ? job.iEnd - SAVE_STRIPE_ROWS : 0;
+
+			if ( m_grid.RowsOuter() )
 			{
-				m_abGrid[i][j]=( m_abGrid[i-1][j] + m_abGrid[i + 1][j] ) / 2;
+				ParallelFor( job.iEnd - job.iFirst, SaveStripeTask, &job );
+			}
+			else
+			{
+				CHeightGrid::ForBands( GRID_LAYOUT_COLUMN, m_iTileSq, SaveStripeTask, &job );
 			}
-		}
 
-		// Vertical
-		for ( j = 1; j < GRID_Y-1; j += 2 )
-		{
-			for ( i = 0; i < GRID_X; i++ )
+			if ( fwrite( job.pbStripe, iRowBytes, job.iEnd - job.iFirst, file ) != (size_t)( job.iEnd - job.iFirst ) )
 			{
-				m_abGrid[i][j] = ( m_abGrid[i][j - 1] + m_abGrid[i][j + 1] ) / 2;
+				bResult = FALSE;
+				break;
 			}
 		}
 
-		// Horizontal + 1
-		for ( j = 0; j < GRID_Y; j++ )
+		delete [] job.pbStripe;
+
+		return bResult;
+	}
+
+	//	Every band is written at its own offset, so the header must be out
+	//	before the other handles open
+	//------------------------------------------------------------------------
+	if ( fflush( file ) != 0 )
+	{
+		return FALSE;
+	}
+
+	for ( iWorker = 0; iWorker < GetWorkerCount(); iWorker++ )
+	{
+		job.apFiles[iWorker] = iWorker == 0 ? file : fopen( m_lpstrFilename, "r+b" );
+		job.apbBands[iWorker] = new BYTE[CHeightGrid::BandWidth( m_grid.Layout() ) * iRowBytes];
+		job.abFailed[iWorker] = FALSE;
+
+		bResult = bResult && job.apFiles[iWorker] != NULL;
+	}
+
+	if ( bResult )
+	{
+		ParallelForOwned( CHeightGrid::Bands( m_grid.Layout(), m_iTileSq ), SaveBandTask, &job );
+	}
+
+	for ( iWorker = 0; iWorker < GetWorkerCount(); iWorker++ )
+	{
+		bResult = bResult && !job.abFailed[iWorker];
+
+		if ( iWorker != 0 && job.apFiles[iWorker] != NULL && fclose( job.apFiles[iWorker] ) != 0 )
+		{
+			bResult = FALSE;
+		}
+
+		delete [] job.apbBands[iWorker];
+	}
+
+	return bResult;
+}
+
+void CTerrain::SaveBandTask( int iIndex, int iWorker, void* pContext )
+{
+	TERRAINJOB* pJob = (TERRAINJOB*)pContext;
+	CTerrain* pTerrain = pJob->pTerrain;
+	CHeightGrid& grid = pTerrain->m_grid;
+	int iTileSq = pTerrain->m_iTileSq;
+	BYTE* pbPixel = pJob->apbBands[iWorker];
+	FILE* file = pJob->apFiles[iWorker];
+	int iYFirst, iYLast;
+	fpos_t posBand;
+
+	BandRange( grid, iIndex, iYFirst, iYLast );
+
+	for ( int iYPos = iYLast - 1; iYPos >= iYFirst; iYPos-- )
+	{
+		for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
 		{
-			for ( i = 2; i < GRID_X; i += 2 )
+			BYTE bGrey = grid.At( iXPos, iYPos );
+
+			*pbPixel++ = bGrey;
+			*pbPixel++ = bGrey;
+			*pbPixel++ = bGrey;
+		}
+	}
+
+	//	Bottom row first, so the band's top row sets where it goes. The
+	//	offset passes 2GB on a large tile, and fpos_t is 64 bit where fseek
+	//	only takes a long
+	//-----------------------------------------------------------------------
+	posBand = (fpos_t)TGA_HEADER_SIZE + (fpos_t)( iTileSq - iYLast ) * iTileSq * 3;
+
+	if ( fsetpos( file, &posBand ) != 0
+		|| fwrite( pJob->apbBands[iWorker], iTileSq * 3, iYLast - iYFirst, file ) != (size_t)( iYLast - iYFirst ) )
+	{
+		pJob->abFailed[iWorker] = TRUE;
+	}
+}
+
+//	Row iFirst + iIndex of the stripe, or column iIndex when column-major
+//-------------------------------------------------------------------------
+void CTerrain::SaveStripeTask( int iIndex, int iWorker, void* pContext )
+{
+	TERRAINJOB* pJob = (TERRAINJOB*)pContext;
+	CTerrain* pTerrain = pJob->pTerrain;
+	int iTileSq = pTerrain->m_iTileSq;
+
+	if ( pTerrain->m_grid.RowsOuter() )
+	{
+		int iRow = pJob->iFirst + iIndex;
+		BYTE* pbRow = pJob->pbStripe + ( pJob->iEnd - 1 - iRow ) * iTileSq * 3;
+
+		for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+		{
+			BYTE bGrey = pTerrain->m_grid.At( iXPos, iRow );
+
+			*pbRow++ = bGrey;
+			*pbRow++ = bGrey;
+			*pbRow++ = bGrey;
+		}
+
+		return;
+	}
+
+	const BYTE* pbColumn = pTerrain->m_grid.Cells() + iIndex * iTileSq;
+
+	for ( int iYPos = pJob->iFirst; iYPos < pJob->iEnd; iYPos++ )
+	{
+		BYTE* pbPixel = pJob->pbStripe + ( ( pJob->iEnd - 1 - iYPos ) * iTileSq + iIndex ) * 3;
+
+		pbPixel[0] = pbColumn[iYPos];
+		pbPixel[1] = pbColumn[iYPos];
+		pbPixel[2] = pbColumn[iYPos];
+	}
+}
+
+//	Column iIndex of a retained grid, from the same column of the tile
+//------------------------------------------------------------------------
+void CTerrain::RetainTask( int iIndex, int iWorker, void* pContext )
+{
+	TERRAINJOB* pJob = (TERRAINJOB*)pContext;
+	CTerrain* pTerrain = pJob->pTerrain;
+	int iTileSq = pTerrain->m_iTileSq;
+	double* pdColumn = pJob->pdRetainGrid + iIndex * iTileSq;
+
+	for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+	{
+		pdColumn[iYPos] = (double)pTerrain->m_grid.At( iIndex, iYPos );
+	}
+}
+
+//	Every pass stops short of the last cell, so an odd sized tile never
+//	reads past its edge
+//------------------------------------------------------------------------
+void CTerrain::Blur( int iBlurFactor )
+{
+	for ( int k = 0; k < iBlurFactor; k++ )
+	{
+		BlurPass( TRUE, 1, m_iTileSq - 1 );		// Horizontal
+		BlurPass( FALSE, 1, m_iTileSq - 1 );	// Vertical
+		BlurPass( TRUE, 2, m_iTileSq - 1 );		// Horizontal + 1
+		BlurPass( FALSE, 2, m_iTileSq - 1 );	// Vertical + 1
+	}
+
+	InvalidateRect( NULL, NULL, TRUE );
+}
+
+//----------------------------------------------------------------------------
+//	Set every other cell along one axis, iFirst up to iEnd, to the mean of
+//	its two neighbours on that axis
+//
+//	Each pass only reads cells it does not write, so the order is free and
+//	the grid is walked in memory order for its layout. That also lets the
+//	scheduler take a larger grid a band at a time.
+//----------------------------------------------------------------------------
+void CTerrain::BlurPass( BOOL bAlongX, int iFirst, int iEnd )
+{
+	TRACE_SPAN( bAlongX ? "blur pass x" : "blur pass y" );
+	TRACE_CELLS( (ULONGLONG)( ( iEnd - iFirst + 1 ) / 2 ) * m_iTileSq * 3 );
+	TRACE_BYTES( (ULONGLONG)( ( iEnd - iFirst + 1 ) / 2 ) * m_iTileSq );
+
+	if ( !CHeightGrid::Parallel( m_iTileSq ) )
+	{
+		BlurBand( bAlongX, iFirst, iEnd, 0, m_iTileSq );
+		return;
+	}
+
+	TERRAINJOB job;
+
+	job.pTerrain = this;
+	job.bAlongX = bAlongX;
+	job.iFirst = iFirst;
+	job.iEnd = iEnd;
+
+	CHeightGrid::ForBands( m_grid.Layout(), m_iTileSq, BlurTask, &job );
+}
+
+void CTerrain::BlurTask( int iIndex, int iWorker, void* pContext )
+{
+	TERRAINJOB* pJob = (TERRAINJOB*)pContext;
+	int iOuterFirst, iOuterLast;
+
+	BandRange( pJob->pTerrain->m_grid, iIndex, iOuterFirst, iOuterLast );
+	pJob->pTerrain->BlurBand( pJob->bAlongX, pJob->iFirst, pJob->iEnd, iOuterFirst, iOuterLast );
+}
+
+//	The pass over outer rows (or columns) [iOuterFirst, iOuterLast) only
+//------------------------------------------------------------------------------
+void CTerrain::BlurBand( BOOL bAlongX, int iFirst, int iEnd, int iOuterFirst, int iOuterLast )
+{
+	if ( bAlongX == m_grid.RowsOuter() )
+	{
+		for ( int iAcross = iOuterFirst; iAcross < iOuterLast; iAcross++ )
+		{
+			for ( int iAlong = iFirst; iAlong < iEnd; iAlong += 2 )
 			{
-				m_abGrid[i][j] = ( m_abGrid[i - 1][j] + m_abGrid[i + 1][j] ) / 2;
+				BYTE& bCell = bAlongX ? m_grid.At( iAlong, iAcross ) : m_grid.At( iAcross, iAlong );
+
+				bCell = bAlongX ? ( m_grid.At( iAlong - 1, iAcross ) + m_grid.At( iAlong + 1, iAcross ) ) / 2
+								: ( m_grid.At( iAcross, iAlong - 1 ) + m_grid.At( iAcross, iAlong + 1 ) ) / 2;
 			}
 		}
+	}
+	else
+	{
+		//	The first cell of the pass in the band, keeping its parity
+		//-----------------------------------------------------------------
+		int iStart = iFirst + ( iOuterFirst > iFirst ? ( iOuterFirst - iFirst + 1 ) / 2 * 2 : 0 );
+		int iStop = iEnd < iOuterLast ? iEnd : iOuterLast;
 
-		// Vertical + 1
-		for ( j = 2; j < GRID_Y; j += 2 )
+		for ( int iAlong = iStart; iAlong < iStop; iAlong += 2 )
 		{
-			for ( i = 0;i < GRID_X; i++ )
+			for ( int iAcross = 0; iAcross < m_iTileSq; iAcross++ )
 			{
-				m_abGrid[i][j] = ( m_abGrid[i][j - 1] + m_abGrid[i][j + 1] ) / 2;
+				BYTE& bCell = bAlongX ? m_grid.At( iAlong, iAcross ) : m_grid.At( iAcross, iAlong );
+
+				bCell = bAlongX ? ( m_grid.At( iAlong - 1, iAcross ) + m_grid.At( iAlong + 1, iAcross ) ) / 2
+								: ( m_grid.At( iAcross, iAlong - 1 ) + m_grid.At( iAcross, iAlong + 1 ) ) / 2;
 			}
 		}
 	}
-
-	InvalidateRect( NULL, NULL, TRUE );
 }
 
 //------------------------------------
@@ -633,4 +1288,97 @@ void CLogFunc::Reset()
 float& CLogFunc::Seed()
 {
 	return m_fSeed;
-}
\ No newline at end of file
+}
+
+float& CLogFunc::M()
+{
+	return m_fM;
+}
+
+//------------------------------------------------------------------
+//	The last iterate returned, which is where the function resumes
+//------------------------------------------------------------------
+float& CLogFunc::LastIterate()
+{
+	return m_fLastIterate;
+}
+
+//------------------------------------
+//
+//	CLASS: CRandom implementation
+//
+//------------------------------------
+CRandom::CRandom()
+{
+	Seed( 1 );
+}
+
+CRandom::CRandom( DWORD dwSeed )
+{
+	Seed( dwSeed );
+}
+
+CRandom::~CRandom()
+{
+}
+
+//---------------------------------------------------------------------
+//	Reseed the generator, xorshift must never be left in the 0 state
+//---------------------------------------------------------------------
+void CRandom::Seed( DWORD dwSeed )
+{
+	m_dwState = Hash( dwSeed, 0x9E3779B9 );
+
+	if ( m_dwState == 0 )
+	{
+		m_dwState = 0x6D2B79F5;
+	}
+}
+
+DWORD CRandom::Next()
+{
+	m_dwState ^= m_dwState << 13;
+	m_dwState ^= m_dwState >> 17;
+	m_dwState ^= m_dwState << 5;
+
+	return m_dwState;
+}
+
+//---------------------------------------------------------------
+//	The raw generator state, to save a stream and restore it
+//	later exactly where it left off
+//---------------------------------------------------------------
+DWORD CRandom::State()
+{
+	return m_dwState;
+}
+
+void CRandom::SetState( DWORD dwState )
+{
+	m_dwState = dwState != 0 ? dwState : 0x6D2B79F5;
+}
+
+//-----------------------------
+//	Returns a value in [0,1)
+//-----------------------------
+FLOAT CRandom::NextFloat()
+{
+	return (FLOAT)( Next() >> 8 ) * ( 1.f / 16777216.f );
+}
+
+//----------------------------------------------------------------------
+//	Mix two values into a well distributed seed, used to derive
+//	independent streams for tiles, passes etc. from one master seed
+//----------------------------------------------------------------------
+DWORD CRandom::Hash( DWORD dwA, DWORD dwB )
+{
+	DWORD dwHash = dwA * 0x85EBCA6B ^ ( dwB + 0x7F4A7C15 + ( dwA << 6 ) + ( dwA >> 2 ) );
+
+	dwHash ^= dwHash >> 16;
+	dwHash *= 0x7FEB352D;
+	dwHash ^= dwHash >> 15;
+	dwHash *= 0x846CA68B;
+	dwHash ^= dwHash >> 16;
+
+	return dwHash;
+}
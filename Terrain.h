@@ -24,6 +24,10 @@
 #include <math.h>
 
 #include "resource.h"
+#include "Grid.h"
+#include "Quantize.h"
+
+class CFaultCheckpoint;
 
 //-----------------
 //	Definitions
@@ -31,6 +35,14 @@
 #define COLOUR(r,g,b) ((COLORREF)((((0)&0xff)<<24)|(((b)&0xff)<<16)|(((g)&0xff)<<8)|((r)&0xff)))
 #define GRID_X 256
 #define GRID_Y 256
+#define TGA_HEADER_SIZE 18
+#define SAVE_STRIPE_ROWS 256		// Rows encoded at a time saving a grid through the scheduler
+#define FRACTAL_TILE 64				// Cells per side of the patch tiles fractal dimension levels share out
+//-----------------
+//	Functions
+//-----------------
+void FillTgaHeader( BYTE* pbHead, int iWidth, int iHeight );
+
 //----------------------------------
 //	A simple mathematical vector
 //----------------------------------
@@ -117,6 +129,7 @@ public:
 	//------------------------
 	float& Seed();
 	float& M();
+	float& LastIterate();
 
 	float Iterate();
 	void Reset();
@@ -127,6 +140,36 @@ private:
 	float m_fLastIterate;
 };
 
+//-----------------------------------------------------------------------------
+//	A small deterministic random number generator (xorshift), so that work
+//	split across threads can be seeded reproducibly, unlike rand()
+//-----------------------------------------------------------------------------
+class CRandom
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CRandom();
+	CRandom( DWORD dwSeed );
+	virtual ~CRandom();
+
+	//-----------------------
+	//	CRandom Interface
+	//-----------------------
+	void Seed( DWORD dwSeed );
+	DWORD Next();
+	FLOAT NextFloat();
+
+	DWORD State();
+	void SetState( DWORD dwState );
+
+	static DWORD Hash( DWORD dwA, DWORD dwB );
+
+private:
+	DWORD m_dwState;
+};
+
 //--------------------------------------------------------------------------------------
 //	A terrain tile, used for generating the heightmaps and interrogating the results
 //--------------------------------------------------------------------------------------
@@ -143,13 +186,32 @@ public:
 	//	CTerrain Interface
 	//------------------------
 	BYTE& Grid( int iXPos, int iYPos );
+	CHeightGrid& HeightGrid();
+	CRandom& FaultRandom();
 	int& MaxHeight();
 	int& MinHeight();
+	int TileSize();
+	BOOL SetTileSize( int iTileSq );
 
 	void ClearGrid( int iValue );
 	void Draw( HWND hWnd, HDC hdc, int iClientX, int iClientY );
+	void Draw( HWND hWnd, HDC hdc, int iClientX, int iClientY, const BYTE* pbColumns );
 	FLOAT PickPoint( CLogFunc* pLogFunc );
-	void GenerateFaultLines( int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd );
+	BOOL GenerateFaultLines( int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd );
+	void ApplyFaultLines( double* pdRetainGrid, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, HWND hWnd, double* pdMin, double* pdMax );
+	void ApplyFaultRange( const double* pdSource, double* pdRetainGrid, int iFirst, int iLast, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, HWND hWnd, double* pdMin, double* pdMax );
+	void SkipFaultRange( int iFirst, int iLast, bool bUseLogisticFunc );
+	void SeedFaults();
+	void RetainGrid( double* pdRetainGrid );
+	BOOL GenerateFaultLines( LPCSTR szCheckpoint, int iInterval, int iIterations, int iDepthInit, int iDepthEnd, int iFixedFaultDepth, bool bUseLogisticFunc, bool bRetainAllValues, HWND hWnd );
+	BOOL ResumeFaultLines( LPCSTR szCheckpoint, int iInterval, HWND hWnd );
+	BOOL GenerateSpectral( FLOAT fDimension, DWORD dwSeed );
+	void SetFaultProfile( int iProfile, FLOAT fWidth );
+	void SetFaultSeed( DWORD dwSeed );
+	void SetQuantize( const QUANTIZEPARAMS& params );
+	const QUANTIZEPARAMS& GetQuantize();
+	BOOL QuantizeRetained( const double* pdRetainGrid );
+	BOOL QuantizeRetained( const double* pdRetainGrid, double dMin, double dMax );
 	FLOAT CalcFractalDimension();
 	INT PatchMaxHeight( int iStartX, int iWidth, int iStartY, int iHeight );
 	FLOAT GetAvgHeight();
@@ -157,14 +219,31 @@ public:
 	void SetFilename( LPSTR szNewFilename );
 	LPSTR GetFilename();
 
-	void Save();
+	BOOL Save();
 	void Blur( int iBlurFactor );
 
 private:
+	BOOL RunCheckpointed( CFaultCheckpoint& checkpoint, int iInterval, HWND hWnd );
+	void BlurPass( BOOL bAlongX, int iFirst, int iEnd );
+	void BlurBand( BOOL bAlongX, int iFirst, int iEnd, int iOuterFirst, int iOuterLast );
+	int CountBlocks( int iBBoxSq, int iXFirst, int iXLast, int iYFirst, int iYLast );
+	BOOL SaveBands( FILE* file );
+
+	static void RetainTask( int iIndex, int iWorker, void* pContext );
+	static void BlurTask( int iIndex, int iWorker, void* pContext );
+	static void SaveBandTask( int iIndex, int iWorker, void* pContext );
+	static void SaveStripeTask( int iIndex, int iWorker, void* pContext );
+	static void PatchTask( int iX, int iY, int iWorker, void* pContext );
+
 	int m_iMaxHeight;
 	int m_iMinHeight;
 	int m_iTileSq;
-	BYTE m_abGrid[256][256];
+	CHeightGrid m_grid;				// Row-major unless a pipeline asks otherwise
+	CRandom m_random;				// Picks fault points when not using the logistic function
+	int m_iFaultProfile;			// FAULTPROFILE for the faults that follow
+	FLOAT m_fProfileWidth;
+	DWORD m_dwFaultSeed;			// Seeds m_random for each run, 0 takes the clock
+	QUANTIZEPARAMS m_quantize;		// How retained heights become cells
 	TCHAR m_lpstrFilename[MAX_PATH];
 };
 
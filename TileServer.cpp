@@ -0,0 +1,990 @@
+/*--------------------------------------------------------------------------------
+
+	TileServer.cpp
+
+	Provides a local HTTP server for heightmap tiles, generated on a pool of
+	worker threads and kept in a memory bounded LRU cache
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <process.h>
+#include <string.h>
+
+#include "TileServer.h"
+#include "FaultKernel.h"
+#include "Arena.h"
+#include "Trace.h"
+
+//--------------------------------------
+//
+//	CLASS: CTileCache implementation
+//
+//--------------------------------------
+CTileCache::CTileCache( DWORD dwBudget )
+{
+	for ( int iBucket = 0; iBucket < TILECACHE_BUCKETS; iBucket++ )
+	{
+		m_apBuckets[iBucket] = NULL;
+	}
+
+	m_pNewest = NULL;
+	m_pOldest = NULL;
+
+	memset( &m_stats, 0, sizeof(m_stats) );
+	m_stats.dwBudget = dwBudget;
+
+	InitializeCriticalSection( &m_cs );
+}
+
+CTileCache::~CTileCache()
+{
+	while ( m_pOldest != NULL )
+	{
+		TILEENTRY* pEntry = m_pOldest;
+
+		Unlink( pEntry );
+		Destroy( pEntry );
+	}
+
+	DeleteCriticalSection( &m_cs );
+}
+
+void CTileCache::GetStats( TILECACHESTATS* pStats )
+{
+	EnterCriticalSection( &m_cs );
+	*pStats = m_stats;
+	LeaveCriticalSection( &m_cs );
+}
+
+DWORD CTileCache::HashKey( const TILEKEY& key )
+{
+	const DWORD* pdwWords = (const DWORD*)&key;
+	DWORD dwHash = 0;
+
+	for ( int iWord = 0; iWord < (int)( sizeof(TILEKEY) / sizeof(DWORD) ); iWord++ )
+	{
+		dwHash = CRandom::Hash( dwHash, pdwWords[iWord] );
+	}
+
+	return dwHash;
+}
+
+//------------------------------------------------------------------------------
+//	Look up a tile, returning it held, with how it was found in *piLookup
+//
+//	TILE_MISS hands the caller a new pending entry, which it must generate
+//	and Publish. The other results return once the tile has left
+//	TILE_PENDING, and the caller checks iState in case its generation
+//	failed. Every entry returned is given back with Release.
+//------------------------------------------------------------------------------
+TILEENTRY* CTileCache::Acquire( const TILEKEY& key, int* piLookup )
+{
+	DWORD dwHash = HashKey( key );
+	TILEENTRY** ppBucket = &m_apBuckets[dwHash & ( TILECACHE_BUCKETS - 1 )];
+	TILEENTRY* pEntry;
+
+	EnterCriticalSection( &m_cs );
+
+	for ( pEntry = *ppBucket; pEntry != NULL; pEntry = pEntry->pNextInBucket )
+	{
+		if ( pEntry->dwHash == dwHash && memcmp( &pEntry->key, &key, sizeof(TILEKEY) ) == 0 )
+		{
+			break;
+		}
+	}
+
+	if ( pEntry != NULL )
+	{
+		pEntry->lRefs++;
+
+		//	Move to the new end of the LRU list
+		//------------------------------------------
+		if ( pEntry != m_pNewest )
+		{
+			pEntry->pNewer->pOlder = pEntry->pOlder;
+
+			if ( pEntry->pOlder != NULL )
+			{
+				pEntry->pOlder->pNewer = pEntry->pNewer;
+			}
+			else
+			{
+				m_pOldest = pEntry->pNewer;
+			}
+
+			pEntry->pOlder = m_pNewest;
+			pEntry->pNewer = NULL;
+			m_pNewest->pNewer = pEntry;
+			m_pNewest = pEntry;
+		}
+
+		BOOL bPending = pEntry->iState == TILE_PENDING;
+
+		if ( bPending )
+		{
+			m_stats.dwCoalesced++;
+		}
+		else
+		{
+			m_stats.dwHits++;
+		}
+
+		LeaveCriticalSection( &m_cs );
+
+		if ( bPending )
+		{
+			WaitForSingleObject( pEntry->hReady, INFINITE );
+		}
+
+		*piLookup = bPending ? TILE_COALESCED : TILE_HIT;
+
+		return pEntry;
+	}
+
+	pEntry = new TILEENTRY;
+
+	memset( pEntry, 0, sizeof(TILEENTRY) );
+	pEntry->key = key;
+	pEntry->dwHash = dwHash;
+	pEntry->iState = TILE_PENDING;
+	pEntry->lRefs = 1;
+	pEntry->bCached = TRUE;
+	pEntry->hReady = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+	pEntry->pNextInBucket = *ppBucket;
+	*ppBucket = pEntry;
+
+	pEntry->pOlder = m_pNewest;
+
+	if ( m_pNewest != NULL )
+	{
+		m_pNewest->pNewer = pEntry;
+	}
+	else
+	{
+		m_pOldest = pEntry;
+	}
+
+	m_pNewest = pEntry;
+
+	m_stats.dwMisses++;
+	m_stats.iEntries++;
+
+	LeaveCriticalSection( &m_cs );
+
+	*piLookup = TILE_MISS;
+
+	return pEntry;
+}
+
+//------------------------------------------------------------------------------
+//	Complete a pending entry with its cells, allocated with new [], which
+//	the cache now owns. NULL cells mark it failed, taking it out of the
+//	cache so that the next request tries again.
+//------------------------------------------------------------------------------
+void CTileCache::Publish( TILEENTRY* pEntry, BYTE* pbCells, DWORD dwSize )
+{
+	EnterCriticalSection( &m_cs );
+
+	if ( pbCells != NULL )
+	{
+		pEntry->pbCells = pbCells;
+		pEntry->dwSize = dwSize;
+		pEntry->iState = TILE_READY;
+		m_stats.dwBytes += dwSize;
+	}
+	else
+	{
+		pEntry->iState = TILE_FAILED;
+		m_stats.dwFailures++;
+		Unlink( pEntry );
+	}
+
+	Trim();
+
+	LeaveCriticalSection( &m_cs );
+
+	SetEvent( pEntry->hReady );
+}
+
+void CTileCache::Release( TILEENTRY* pEntry )
+{
+	EnterCriticalSection( &m_cs );
+
+	if ( --pEntry->lRefs == 0 )
+	{
+		if ( pEntry->bCached )
+		{
+			Trim();
+		}
+		else
+		{
+			Destroy( pEntry );
+		}
+	}
+
+	LeaveCriticalSection( &m_cs );
+}
+
+//--------------------------------------------------------------------------
+//	Evict the least recently used tiles no request holds until the cache
+//	is within budget. Called with m_cs held.
+//--------------------------------------------------------------------------
+void CTileCache::Trim()
+{
+	TILEENTRY* pEntry = m_pOldest;
+
+	while ( pEntry != NULL && m_stats.dwBytes > m_stats.dwBudget )
+	{
+		TILEENTRY* pNewer = pEntry->pNewer;
+
+		if ( pEntry->lRefs == 0 && pEntry->iState == TILE_READY )
+		{
+			Unlink( pEntry );
+			Destroy( pEntry );
+			m_stats.dwEvictions++;
+		}
+
+		pEntry = pNewer;
+	}
+}
+
+//--------------------------------------------------------------------
+//	Take an entry out of the table and the LRU list, but not free it
+//--------------------------------------------------------------------
+void CTileCache::Unlink( TILEENTRY* pEntry )
+{
+	if ( !pEntry->bCached )
+	{
+		return;
+	}
+
+	TILEENTRY** ppLink = &m_apBuckets[pEntry->dwHash & ( TILECACHE_BUCKETS - 1 )];
+
+	while ( *ppLink != pEntry )
+	{
+		ppLink = &(*ppLink)->pNextInBucket;
+	}
+
+	*ppLink = pEntry->pNextInBucket;
+
+	if ( pEntry->pNewer != NULL )
+	{
+		pEntry->pNewer->pOlder = pEntry->pOlder;
+	}
+	else
+	{
+		m_pNewest = pEntry->pOlder;
+	}
+
+	if ( pEntry->pOlder != NULL )
+	{
+		pEntry->pOlder->pNewer = pEntry->pNewer;
+	}
+	else
+	{
+		m_pOldest = pEntry->pNewer;
+	}
+
+	pEntry->bCached = FALSE;
+	pEntry->pNewer = NULL;
+	pEntry->pOlder = NULL;
+	pEntry->pNextInBucket = NULL;
+
+	m_stats.dwBytes -= pEntry->dwSize;
+	m_stats.iEntries--;
+}
+
+void CTileCache::Destroy( TILEENTRY* pEntry )
+{
+	delete [] pEntry->pbCells;
+	CloseHandle( pEntry->hReady );
+	delete pEntry;
+}
+
+//---------------------------------------
+//
+//	CLASS: CTileServer implementation
+//
+//---------------------------------------
+CTileServer::CTileServer()
+{
+	m_sockListen = INVALID_SOCKET;
+	m_hAccept = NULL;
+	m_iWorkers = 0;
+	m_bStopping = FALSE;
+	m_bWinsock = FALSE;
+	m_hFree = NULL;
+	m_hQueued = NULL;
+	m_iQueueHead = 0;
+	m_iQueueTail = 0;
+	m_pCache = NULL;
+	m_lRequests = 0;
+	m_szError[0] = 0;
+
+	InitializeCriticalSection( &m_cs );
+}
+
+CTileServer::~CTileServer()
+{
+	Stop();
+
+	DeleteCriticalSection( &m_cs );
+}
+
+CTileCache* CTileServer::Cache()
+{
+	return m_pCache;
+}
+
+LPCSTR CTileServer::GetError()
+{
+	return m_szError;
+}
+
+BOOL CTileServer::Fail( LPCSTR szWhat )
+{
+	sprintf( m_szError, "%.200s (error %d)", szWhat, WSAGetLastError() );
+	Close();
+
+	return FALSE;
+}
+
+//------------------------------------------------------------------------------
+//	Listen on 127.0.0.1:iPort and start serving, iWorkers of 0 uses one
+//	worker per processor. Returns once the server is running.
+//------------------------------------------------------------------------------
+BOOL CTileServer::Start( int iPort, int iWorkers, DWORD dwCacheBytes )
+{
+	WSADATA wsaData;
+	struct sockaddr_in addr;
+
+	m_szError[0] = 0;
+
+	if ( WSAStartup( MAKEWORD( 1, 1 ), &wsaData ) != 0 )
+	{
+		sprintf( m_szError, "Unable to start Winsock" );
+		return FALSE;
+	}
+
+	m_bWinsock = TRUE;
+
+	if ( ( m_sockListen = socket( AF_INET, SOCK_STREAM, 0 ) ) == INVALID_SOCKET )
+	{
+		return Fail( "Unable to create a socket" );
+	}
+
+	memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( (u_short)iPort );
+	addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+
+	if ( bind( m_sockListen, (struct sockaddr*)&addr, sizeof(addr) ) == SOCKET_ERROR )
+	{
+		return Fail( "Unable to bind the port" );
+	}
+
+	if ( listen( m_sockListen, SOMAXCONN ) == SOCKET_ERROR )
+	{
+		return Fail( "Unable to listen" );
+	}
+
+	iWorkers = iWorkers > 0 ? iWorkers : GetWorkerCount();
+	iWorkers = iWorkers < MAX_WORKERS ? iWorkers : MAX_WORKERS;
+
+	m_pCache = new CTileCache( dwCacheBytes );
+	m_bStopping = FALSE;
+	m_iQueueHead = 0;
+	m_iQueueTail = 0;
+	m_hFree = CreateSemaphore( NULL, TILESERVER_QUEUE, TILESERVER_QUEUE, NULL );
+	m_hQueued = CreateSemaphore( NULL, 0, TILESERVER_QUEUE, NULL );
+
+	for ( m_iWorkers = 0; m_iWorkers < iWorkers; m_iWorkers++ )
+	{
+		m_ahWorkers[m_iWorkers] = (HANDLE)_beginthreadex( NULL, 0, WorkerProc, this, 0, NULL );
+	}
+
+	m_hAccept = (HANDLE)_beginthreadex( NULL, 0, AcceptProc, this, 0, NULL );
+
+	return TRUE;
+}
+
+//---------------------------------------------------
+//	Block until the server stops, for headless use
+//---------------------------------------------------
+void CTileServer::Wait()
+{
+	if ( m_hAccept != NULL )
+	{
+		WaitForSingleObject( m_hAccept, INFINITE );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Stop accepting, let the workers finish the connections already queued,
+//	and free the cache
+//------------------------------------------------------------------------------
+void CTileServer::Stop()
+{
+	m_bStopping = TRUE;
+
+	//	Closing the listening socket fails the accept thread out of accept
+	//-------------------------------------------------------------------------
+	if ( m_sockListen != INVALID_SOCKET )
+	{
+		closesocket( m_sockListen );
+		m_sockListen = INVALID_SOCKET;
+	}
+
+	if ( m_hAccept != NULL )
+	{
+		WaitForSingleObject( m_hAccept, INFINITE );
+		CloseHandle( m_hAccept );
+		m_hAccept = NULL;
+	}
+
+	//	Then one stop request per worker, queued behind any connections
+	//----------------------------------------------------------------------
+	for ( int iStop = 0; iStop < m_iWorkers; iStop++ )
+	{
+		WaitForSingleObject( m_hFree, INFINITE );
+
+		EnterCriticalSection( &m_cs );
+		m_aQueue[m_iQueueTail] = INVALID_SOCKET;
+		m_iQueueTail = ( m_iQueueTail + 1 ) % TILESERVER_QUEUE;
+		LeaveCriticalSection( &m_cs );
+
+		ReleaseSemaphore( m_hQueued, 1, NULL );
+	}
+
+	for ( int iWorker = 0; iWorker < m_iWorkers; iWorker++ )
+	{
+		WaitForSingleObject( m_ahWorkers[iWorker], INFINITE );
+		CloseHandle( m_ahWorkers[iWorker] );
+	}
+
+	m_iWorkers = 0;
+
+	Close();
+}
+
+void CTileServer::Close()
+{
+	if ( m_sockListen != INVALID_SOCKET )
+	{
+		closesocket( m_sockListen );
+		m_sockListen = INVALID_SOCKET;
+	}
+
+	if ( m_hFree != NULL )
+	{
+		CloseHandle( m_hFree );
+		CloseHandle( m_hQueued );
+		m_hFree = NULL;
+		m_hQueued = NULL;
+	}
+
+	delete m_pCache;
+	m_pCache = NULL;
+
+	if ( m_bWinsock )
+	{
+		WSACleanup();
+		m_bWinsock = FALSE;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	The accept thread, queues connections for the workers
+//
+//	It waits for a free slot before accepting, so when every worker is busy
+//	and the queue is full, new connections back up in the listen backlog
+//------------------------------------------------------------------------------
+unsigned __stdcall CTileServer::AcceptProc( void* pParam )
+{
+	CTileServer* pThis = (CTileServer*)pParam;
+
+	for ( ;; )
+	{
+		WaitForSingleObject( pThis->m_hFree, INFINITE );
+
+		SOCKET sock = accept( pThis->m_sockListen, NULL, NULL );
+
+		if ( sock == INVALID_SOCKET )
+		{
+			ReleaseSemaphore( pThis->m_hFree, 1, NULL );
+
+			if ( pThis->m_bStopping )
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		EnterCriticalSection( &pThis->m_cs );
+		pThis->m_aQueue[pThis->m_iQueueTail] = sock;
+		pThis->m_iQueueTail = ( pThis->m_iQueueTail + 1 ) % TILESERVER_QUEUE;
+		LeaveCriticalSection( &pThis->m_cs );
+
+		ReleaseSemaphore( pThis->m_hQueued, 1, NULL );
+	}
+
+	return 0;
+}
+
+//---------------------------------------------------------------
+//	A worker, serves one queued connection at a time until it
+//	is handed INVALID_SOCKET
+//---------------------------------------------------------------
+unsigned __stdcall CTileServer::WorkerProc( void* pParam )
+{
+	CTileServer* pThis = (CTileServer*)pParam;
+	BYTE* pbScratch = NULL;
+	DWORD dwScratch = 0;
+
+	for ( ;; )
+	{
+		WaitForSingleObject( pThis->m_hQueued, INFINITE );
+
+		EnterCriticalSection( &pThis->m_cs );
+		SOCKET sock = pThis->m_aQueue[pThis->m_iQueueHead];
+		pThis->m_iQueueHead = ( pThis->m_iQueueHead + 1 ) % TILESERVER_QUEUE;
+		LeaveCriticalSection( &pThis->m_cs );
+
+		ReleaseSemaphore( pThis->m_hFree, 1, NULL );
+
+		if ( sock == INVALID_SOCKET )
+		{
+			break;
+		}
+
+		pThis->Serve( sock, pbScratch, dwScratch );
+
+		closesocket( sock );
+	}
+
+	delete [] pbScratch;
+	CScratchArena::ReleaseThread();
+	CTrace::ReleaseThread();
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+//	Read a request head and answer it
+//
+//	pbScratch is the worker's encoding buffer, grown as needed and kept
+//	between requests
+//------------------------------------------------------------------------------
+void CTileServer::Serve( SOCKET sock, BYTE*& pbScratch, DWORD& dwScratch )
+{
+	TRACE_SPAN( "serve request" );
+
+	char acRequest[TILESERVER_REQUEST];
+	char szMethod[8];
+	char szPath[512];
+	int iRead = 0;
+
+	InterlockedIncrement( &m_lRequests );
+
+	//	Only the head matters, stop at the blank line ending it
+	//--------------------------------------------------------------
+	while ( iRead < TILESERVER_REQUEST - 1 )
+	{
+		int iBytes = recv( sock, acRequest + iRead, TILESERVER_REQUEST - 1 - iRead, 0 );
+
+		if ( iBytes <= 0 )
+		{
+			break;
+		}
+
+		iRead += iBytes;
+		acRequest[iRead] = 0;
+
+		if ( strstr( acRequest, "\r\n\r\n" ) != NULL )
+		{
+			break;
+		}
+	}
+
+	acRequest[iRead] = 0;
+
+	if ( sscanf( acRequest, "%7s %511s", szMethod, szPath ) != 2 )
+	{
+		SendResponse( sock, "400 Bad Request", "text/plain", NULL, (const BYTE*)"Bad request\n", 12 );
+		return;
+	}
+
+	if ( strcmp( szMethod, "GET" ) != 0 )
+	{
+		SendResponse( sock, "405 Method Not Allowed", "text/plain", NULL, (const BYTE*)"GET only\n", 9 );
+		return;
+	}
+
+	if ( strncmp( szPath, "/tile/", 6 ) == 0 )
+	{
+		ServeTile( sock, szPath, pbScratch, dwScratch );
+	}
+	else if ( strcmp( szPath, "/stats" ) == 0 )
+	{
+		ServeStats( sock );
+	}
+	else
+	{
+		SendResponse( sock, "404 Not Found", "text/plain", NULL, (const BYTE*)"Not found\n", 10 );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Answer a tile request from the cache, generating the tile on a miss
+//------------------------------------------------------------------------------
+void CTileServer::ServeTile( SOCKET sock, LPCSTR szPath, BYTE*& pbScratch, DWORD& dwScratch )
+{
+	static const LPCSTR s_aszLookups[] = { "hit", "coalesced", "miss" };
+
+	TILEKEY key;
+	BOOL bTga;
+	int iLookup;
+	char szExtra[64];
+
+	if ( !ParseTileRequest( szPath, &key, &bTga ) )
+	{
+		SendResponse( sock, "400 Bad Request", "text/plain", NULL, (const BYTE*)"Bad tile request\n", 17 );
+		return;
+	}
+
+	TILEENTRY* pEntry = m_pCache->Acquire( key, &iLookup );
+
+	if ( iLookup == TILE_MISS )
+	{
+		DWORD dwSize = (DWORD)key.iTileSq * (DWORD)key.iTileSq;
+		BYTE* pbCells = new BYTE[dwSize];
+
+		if ( pbCells == NULL )
+		{
+			m_pCache->Publish( pEntry, NULL, dwSize );
+			m_pCache->Release( pEntry );
+			SendResponse( sock, "503 Service Unavailable", "text/plain", NULL, (const BYTE*)"Out of memory\n", 14 );
+			return;
+		}
+
+		if ( !Generate( key, pbCells ) )
+		{
+			delete [] pbCells;
+			pbCells = NULL;
+		}
+
+		m_pCache->Publish( pEntry, pbCells, dwSize );
+	}
+
+	if ( pEntry->iState != TILE_READY )
+	{
+		SendResponse( sock, "500 Internal Server Error", "text/plain", NULL, (const BYTE*)"Generation failed\n", 18 );
+		m_pCache->Release( pEntry );
+		return;
+	}
+
+	sprintf( szExtra, "X-Tile-Cache: %s\r\n", s_aszLookups[iLookup] );
+
+	if ( bTga )
+	{
+		//	Bottom row first, each cell as grey, as CTerrain::Save writes
+		//--------------------------------------------------------------------
+		int iTileSq = key.iTileSq;
+		DWORD dwImage = TGA_HEADER_SIZE + pEntry->dwSize * 3;
+
+		if ( dwScratch < dwImage )
+		{
+			delete [] pbScratch;
+			pbScratch = new BYTE[dwImage];
+			dwScratch = pbScratch != NULL ? dwImage : 0;
+		}
+
+		if ( pbScratch == NULL )
+		{
+			m_pCache->Release( pEntry );
+			SendResponse( sock, "503 Service Unavailable", "text/plain", NULL, (const BYTE*)"Out of memory\n", 14 );
+			return;
+		}
+
+		FillTgaHeader( pbScratch, iTileSq, iTileSq );
+
+		BYTE* pbPixel = pbScratch + TGA_HEADER_SIZE;
+
+		for ( int iRow = iTileSq - 1; iRow >= 0; iRow-- )
+		{
+			const BYTE* pbRow = pEntry->pbCells + iRow * iTileSq;
+
+			for ( int iCol = 0; iCol < iTileSq; iCol++ )
+			{
+				pbPixel[0] = pbPixel[1] = pbPixel[2] = pbRow[iCol];
+				pbPixel += 3;
+			}
+		}
+
+		SendResponse( sock, "200 OK", "image/x-tga", szExtra, pbScratch, dwImage );
+	}
+	else
+	{
+		SendResponse( sock, "200 OK", "application/octet-stream", szExtra, pEntry->pbCells, pEntry->dwSize );
+	}
+
+	m_pCache->Release( pEntry );
+}
+
+void CTileServer::ServeStats( SOCKET sock )
+{
+	TILECACHESTATS stats;
+	char acBody[512];
+
+	m_pCache->GetStats( &stats );
+
+	int iLength = sprintf( acBody, "requests %ld\nhits %lu\nmisses %lu\ncoalesced %lu\nevictions %lu\nfailures %lu\ntiles %d\nbytes %lu\nbudget %lu\n",
+		(long)m_lRequests, (unsigned long)stats.dwHits, (unsigned long)stats.dwMisses, (unsigned long)stats.dwCoalesced, (unsigned long)stats.dwEvictions,
+		(unsigned long)stats.dwFailures, stats.iEntries, (unsigned long)stats.dwBytes, (unsigned long)stats.dwBudget );
+
+	SendResponse( sock, "200 OK", "text/plain", NULL, (const BYTE*)acBody, (DWORD)iLength );
+}
+
+BOOL CTileServer::SendResponse( SOCKET sock, LPCSTR szStatus, LPCSTR szType, LPCSTR szExtra, const BYTE* pbBody, DWORD dwBody )
+{
+	char acHead[512];
+
+	int iHead = sprintf( acHead, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\n%sConnection: close\r\n\r\n",
+		szStatus, szType, (unsigned long)dwBody, szExtra != NULL ? szExtra : "" );
+
+	return SendAll( sock, (const BYTE*)acHead, (DWORD)iHead ) && SendAll( sock, pbBody, dwBody );
+}
+
+BOOL CTileServer::SendAll( SOCKET sock, const BYTE* pbData, DWORD dwSize )
+{
+	TRACE_BYTES( dwSize );
+
+	while ( dwSize > 0 )
+	{
+		int iSent = send( sock, (const char*)pbData, (int)dwSize, 0 );
+
+		if ( iSent <= 0 )
+		{
+			return FALSE;
+		}
+
+		pbData += iSent;
+		dwSize -= (DWORD)iSent;
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	Parse /tile/<x>/<y>.<raw|tga>[?query] into a key
+//
+//	The query takes seed, size, iterations, depth=<start>[,<finish>] (a
+//	finish goes to FaultDepth as the dialog's check box sends it, which as
+//	yet cuts every fault to the start depth either way), profile and width, each defaulting as the fault dialog does, and
+//	map=<mapping> with clip=<low>,<high> for percentile and gamma=<exponent>
+//	for gamma, linear by default. Runs of more than TILESERVER_MAX_FAULT_CELLS
+//	fault cells are refused, so one request cannot tie up a worker for long.
+//------------------------------------------------------------------------------
+BOOL CTileServer::ParseTileRequest( LPCSTR szPath, TILEKEY* pKey, BOOL* pbTga )
+{
+	char szFormat[8];
+	char acQuery[512];
+	int iConsumed = 0;
+
+	memset( pKey, 0, sizeof(TILEKEY) );
+	pKey->iTileSq = 256;
+	pKey->iIterations = 512;
+	pKey->iDepthInit = 10;
+	pKey->iDepthEnd = 10;
+	pKey->iFixedFaultDepth = 10;
+	pKey->iProfile = FAULT_PROFILE_STEP;
+	pKey->fProfileWidth = FAULT_PROFILE_WIDTH;
+
+	CQuantizer::DefaultParams( &pKey->quantize );
+
+	if ( sscanf( szPath, "/tile/%d/%d.%3[a-z]%n", &pKey->iTileX, &pKey->iTileY, szFormat, &iConsumed ) != 3 )
+	{
+		return FALSE;
+	}
+
+	if ( strcmp( szFormat, "tga" ) == 0 )
+	{
+		*pbTga = TRUE;
+	}
+	else if ( strcmp( szFormat, "raw" ) == 0 )
+	{
+		*pbTga = FALSE;
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	szPath += iConsumed;
+
+	if ( szPath[0] != 0 && szPath[0] != '?' )
+	{
+		return FALSE;
+	}
+
+	strncpy( acQuery, szPath[0] == '?' ? szPath + 1 : szPath, sizeof(acQuery) - 1 );
+	acQuery[sizeof(acQuery) - 1] = 0;
+
+	for ( char* szPair = strtok( acQuery, "&" ); szPair != NULL; szPair = strtok( NULL, "&" ) )
+	{
+		char* szValue = strchr( szPair, '=' );
+
+		if ( szValue == NULL )
+		{
+			return FALSE;
+		}
+
+		*szValue++ = 0;
+
+		if ( strcmp( szPair, "seed" ) == 0 )
+		{
+			pKey->dwSeed = (DWORD)strtoul( szValue, NULL, 10 );
+		}
+		else if ( strcmp( szPair, "size" ) == 0 )
+		{
+			pKey->iTileSq = atoi( szValue );
+		}
+		else if ( strcmp( szPair, "iterations" ) == 0 )
+		{
+			pKey->iIterations = atoi( szValue );
+		}
+		else if ( strcmp( szPair, "depth" ) == 0 )
+		{
+			char* szFinish = strchr( szValue, ',' );
+
+			pKey->iDepthInit = atoi( szValue );
+			pKey->iDepthEnd = szFinish != NULL ? atoi( szFinish + 1 ) : pKey->iDepthInit;
+			pKey->iFixedFaultDepth = szFinish != NULL ? 0 : pKey->iDepthInit;
+		}
+		else if ( strcmp( szPair, "profile" ) == 0 )
+		{
+			pKey->iProfile = ParseFaultProfile( szValue );
+		}
+		else if ( strcmp( szPair, "width" ) == 0 )
+		{
+			pKey->fProfileWidth = (FLOAT)atof( szValue );
+		}
+		else if ( strcmp( szPair, "map" ) == 0 )
+		{
+			pKey->quantize.iMapping = CQuantizer::ParseMapping( szValue );
+		}
+		else if ( strcmp( szPair, "clip" ) == 0 )
+		{
+			char* szHigh = strchr( szValue, ',' );
+
+			if ( szHigh == NULL )
+			{
+				return FALSE;
+			}
+
+			pKey->quantize.fLow = (FLOAT)atof( szValue );
+			pKey->quantize.fHigh = (FLOAT)atof( szHigh + 1 );
+		}
+		else if ( strcmp( szPair, "gamma" ) == 0 )
+		{
+			pKey->quantize.fGamma = (FLOAT)atof( szValue );
+		}
+		else
+		{
+			return FALSE;
+		}
+	}
+
+	const QUANTIZEPARAMS& quantize = pKey->quantize;
+
+	return pKey->iTileSq >= GRID_BLOCK && pKey->iTileSq <= TILESERVER_MAX_TILESQ && pKey->iIterations >= 0
+		&& (double)pKey->iIterations * (double)pKey->iTileSq * (double)pKey->iTileSq <= TILESERVER_MAX_FAULT_CELLS
+		&& pKey->iProfile >= 0 && pKey->fProfileWidth > 0.f
+		&& quantize.iMapping >= 0 && quantize.fLow >= 0.f && quantize.fLow < quantize.fHigh && quantize.fHigh <= 100.f && quantize.fGamma > 0.f;
+}
+
+//------------------------------------------------------------------------------
+//	Generate a tile's cells, row-major with the top row first
+//
+//	Faults are retained unclamped and quantized to 0..255 afterwards with
+//	the key's mapping, as a retained run in the dialog is, into a row-major
+//	grid that is the tile as served. A flat tile is mid grey. Everything
+//	comes from the key, so this is safe on any number of threads at once.
+//	Returns FALSE if there is no memory to retain or quantize the faults.
+//------------------------------------------------------------------------------
+BOOL CTileServer::Generate( const TILEKEY& key, BYTE* pbCells )
+{
+	TRACE_SPAN( "generate tile" );
+
+	int iTileSq = key.iTileSq;
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	double* pdRetained = (double*)pArena->Alloc( sizeof(double) * iTileSq * iTileSq );
+	double dMin = 0.0;
+	double dMax = 0.0;
+	CRandom random( CRandom::Hash( CRandom::Hash( key.dwSeed, (DWORD)key.iTileX ), (DWORD)key.iTileY ) );
+	FAULTPASS pass;
+
+	if ( pdRetained == NULL )
+	{
+		return FALSE;
+	}
+
+	memset( pdRetained, 0, sizeof(double) * iTileSq * iTileSq );
+	memset( &pass, 0, sizeof(pass) );
+
+	pass.pvCells = pdRetained;
+	pass.iCellType = FAULT_CELL_F64;
+	pass.iLayout = GRID_LAYOUT_COLUMN;
+	pass.bRetain = TRUE;
+	pass.bLogistic = FALSE;
+	pass.iProfile = key.iProfile;
+	pass.fProfileWidth = key.fProfileWidth;
+	pass.iTileSq = iTileSq;
+	pass.iPitch = iTileSq;
+	pass.iSample = 1;
+	pass.iFirst = 0;
+	pass.iLast = key.iIterations;
+	pass.iIterations = key.iIterations;
+	pass.iDepthInit = key.iDepthInit;
+	pass.iDepthEnd = key.iDepthEnd;
+	pass.iFixedFaultDepth = key.iFixedFaultDepth;
+	pass.iMinHeight = 0;
+	pass.iMaxHeight = 255;
+	pass.pRandom = &random;
+	pass.pdMin = &dMin;
+	pass.pdMax = &dMax;
+
+	ApplyFaultPass( pass );
+
+	if ( dMax <= dMin )
+	{
+		memset( pbCells, 128, iTileSq * iTileSq );
+		return TRUE;
+	}
+
+	CHeightGrid grid;
+	CQuantizer quantizer;
+
+	quantizer.Params() = key.quantize;
+	quantizer.SetRange( dMin, dMax );
+
+	if ( !grid.Create( iTileSq, GRID_LAYOUT_ROW ) || !quantizer.Quantize( pdRetained, iTileSq, 255, &grid ) )
+	{
+		return FALSE;
+	}
+
+	memcpy( pbCells, grid.Cells(), iTileSq * iTileSq );
+
+	return TRUE;
+}
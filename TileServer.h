@@ -0,0 +1,216 @@
+/*--------------------------------------------------------------------------------
+
+	TileServer.h
+
+	Provides a local HTTP server for heightmap tiles, generated on a pool of
+	worker threads and kept in a memory bounded LRU cache
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _TILESERVER_H
+#define _TILESERVER_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+#include <winsock.h>
+
+#include "Parallel.h"
+#include "Quantize.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define TILESERVER_DEFAULT_PORT		8642
+#define TILESERVER_DEFAULT_CACHE	64				// Megabytes
+#define TILESERVER_QUEUE			64				// Accepted connections waiting for a worker
+#define TILESERVER_REQUEST			2048			// Longest request head read
+#define TILESERVER_MAX_TILESQ		2048
+#define TILESERVER_MAX_FAULT_CELLS	4294967296.0	// Iterations times cells a tile may ask for, 1024 faults at the largest size
+#define TILECACHE_BUCKETS			1024			// A power of two
+
+enum TILESTATE
+{
+	TILE_PENDING,			// Being generated, wait on hReady
+	TILE_READY,
+	TILE_FAILED
+};
+
+enum TILELOOKUP
+{
+	TILE_HIT,				// Ready in the cache
+	TILE_COALESCED,			// Was being generated for another request, waited for it
+	TILE_MISS				// Caller generates it and calls Publish
+};
+
+//	Everything a tile's cells depend on. Compared with memcmp, so fill it
+//	through memset and keep every field four bytes wide.
+//--------------------------------------------------------------------------
+typedef struct tagTILEKEY
+{
+	DWORD	dwSeed;
+	int		iTileX;
+	int		iTileY;
+	int		iTileSq;
+	int		iIterations;
+	int		iDepthInit;
+	int		iDepthEnd;
+	int		iFixedFaultDepth;
+	int		iProfile;			// FAULTPROFILE
+	FLOAT	fProfileWidth;
+	QUANTIZEPARAMS quantize;	// How the faults' heights map to the 256 levels
+} TILEKEY;
+
+typedef struct tagTILEENTRY
+{
+	TILEKEY		key;
+	DWORD		dwHash;
+	int			iState;			// TILESTATE
+	LONG		lRefs;			// Requests holding it, never evicted while above 0
+	BOOL		bCached;		// In the table and the LRU list
+	BYTE*		pbCells;		// iTileSq^2, row-major, top row first
+	DWORD		dwSize;
+	HANDLE		hReady;			// Manual reset, set once it leaves TILE_PENDING
+
+	struct tagTILEENTRY*	pNextInBucket;
+	struct tagTILEENTRY*	pNewer;
+	struct tagTILEENTRY*	pOlder;
+} TILEENTRY;
+
+typedef struct tagTILECACHESTATS
+{
+	DWORD	dwHits;
+	DWORD	dwMisses;
+	DWORD	dwCoalesced;
+	DWORD	dwEvictions;
+	DWORD	dwFailures;
+	DWORD	dwBytes;
+	DWORD	dwBudget;
+	int		iEntries;
+} TILECACHESTATS;
+
+//------------------------------------------------------------------------------
+//	A cache of generated tiles, least recently used first out
+//
+//	Acquire either finds a tile, waits for the request already generating
+//	it, or adds a pending entry and leaves the caller to generate and
+//	Publish it, so concurrent requests for one tile generate it once. Tiles
+//	are only evicted when no request holds them, which can leave the cache
+//	over its budget for as long as every tile in it is being sent.
+//------------------------------------------------------------------------------
+class CTileCache
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CTileCache( DWORD dwBudget );
+	virtual ~CTileCache();
+
+	//--------------------------
+	//	CTileCache Interface
+	//--------------------------
+	TILEENTRY* Acquire( const TILEKEY& key, int* piLookup );
+	void Publish( TILEENTRY* pEntry, BYTE* pbCells, DWORD dwSize );
+	void Release( TILEENTRY* pEntry );
+
+	void GetStats( TILECACHESTATS* pStats );
+
+private:
+	static DWORD HashKey( const TILEKEY& key );
+
+	void Unlink( TILEENTRY* pEntry );
+	void Destroy( TILEENTRY* pEntry );
+	void Trim();
+
+	CRITICAL_SECTION m_cs;
+	TILEENTRY* m_apBuckets[TILECACHE_BUCKETS];
+	TILEENTRY* m_pNewest;
+	TILEENTRY* m_pOldest;
+	TILECACHESTATS m_stats;
+};
+
+//------------------------------------------------------------------------------
+//	The tile server
+//
+//	Listens on 127.0.0.1 only. One thread accepts connections into a
+//	bounded queue and a pool of workers serves them, one request per
+//	connection:
+//
+//		GET /tile/<x>/<y>.raw	iTileSq^2 bytes, rows top first
+//		GET /tile/<x>/<y>.tga	24 bit grey TGA, as CTerrain::Save writes
+//		GET /stats				cache counters, as text
+//
+//	taking the generation parameters as a query string, for example
+//
+//		/tile/3/-2.tga?seed=7&size=512&iterations=1000&depth=10,1&profile=cosine&width=8&map=equalize
+//
+//	Each tile's faults are drawn from a stream seeded by the seed and its
+//	coordinates, so a tile is the same whenever and wherever it is made.
+//	Tiles are independent, neighbouring tiles do not meet seamlessly.
+//------------------------------------------------------------------------------
+class CTileServer
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CTileServer();
+	virtual ~CTileServer();
+
+	//---------------------------
+	//	CTileServer Interface
+	//---------------------------
+	BOOL Start( int iPort, int iWorkers, DWORD dwCacheBytes );
+	void Wait();
+	void Stop();
+
+	CTileCache* Cache();
+	LPCSTR GetError();
+
+	static BOOL ParseTileRequest( LPCSTR szPath, TILEKEY* pKey, BOOL* pbTga );
+	static BOOL Generate( const TILEKEY& key, BYTE* pbCells );
+
+private:
+	static unsigned __stdcall AcceptProc( void* pParam );
+	static unsigned __stdcall WorkerProc( void* pParam );
+
+	void Serve( SOCKET sock, BYTE*& pbScratch, DWORD& dwScratch );
+	void ServeTile( SOCKET sock, LPCSTR szPath, BYTE*& pbScratch, DWORD& dwScratch );
+	void ServeStats( SOCKET sock );
+	static BOOL SendResponse( SOCKET sock, LPCSTR szStatus, LPCSTR szType, LPCSTR szExtra, const BYTE* pbBody, DWORD dwBody );
+	static BOOL SendAll( SOCKET sock, const BYTE* pbData, DWORD dwSize );
+
+	BOOL Fail( LPCSTR szWhat );
+	void Close();
+
+	SOCKET m_sockListen;
+	HANDLE m_hAccept;
+	HANDLE m_ahWorkers[MAX_WORKERS];
+	int m_iWorkers;
+	volatile BOOL m_bStopping;
+	BOOL m_bWinsock;
+
+	//	Accepted connections, a ring guarded by m_cs, INVALID_SOCKET
+	//	stops a worker
+	//------------------------------------------------------------------
+	CRITICAL_SECTION m_cs;
+	HANDLE m_hFree;				// Semaphore, counts free queue slots
+	HANDLE m_hQueued;			// Semaphore, counts connections waiting
+	SOCKET m_aQueue[TILESERVER_QUEUE];
+	int m_iQueueHead;
+	int m_iQueueTail;
+
+	CTileCache* m_pCache;
+	volatile LONG m_lRequests;
+
+	TCHAR m_szError[MAX_PATH];
+};
+
+#endif
@@ -0,0 +1,307 @@
+/*--------------------------------------------------------------------------------
+
+	Trace.cpp
+
+	Provides lightweight timing spans and per-thread counters over the hot
+	paths, written out as Chrome trace JSON for chrome://tracing or Perfetto
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <stdio.h>
+#include <string.h>
+
+#include "Trace.h"
+
+//-----------------
+//	Definitions
+//-----------------
+static TRACETHREAD s_aThreads[TRACE_MAX_THREADS];
+static volatile LONG s_alClaimed[TRACE_MAX_THREADS];	// 1 while a thread other than a pool worker holds the slot
+static DWORD s_dwTlsIndex = TlsAlloc();
+static int s_iCapacity = 0;
+static LONGLONG s_llBase = 0;
+
+volatile BOOL CTrace::s_bEnabled = FALSE;
+
+//----------------------------------
+//
+//	CLASS: CTrace implementation
+//
+//----------------------------------
+
+//------------------------------------------------------------------------
+//	Discard anything recorded and start tracing, keeping up to
+//	iEventsPerThread spans on each thread
+//
+//	Start, Stop and Write must not overlap traced work on other threads
+//------------------------------------------------------------------------
+void CTrace::Start( int iEventsPerThread )
+{
+	LARGE_INTEGER liNow;
+
+	iEventsPerThread = iEventsPerThread > 0 ? iEventsPerThread : TRACE_DEFAULT_EVENTS;
+
+	for ( int iThread = 0; iThread < TRACE_MAX_THREADS; iThread++ )
+	{
+		TRACETHREAD* pThread = &s_aThreads[iThread];
+
+		if ( iEventsPerThread != s_iCapacity )
+		{
+			delete [] pThread->pEvents;
+			pThread->pEvents = NULL;
+		}
+
+		pThread->iEvents = 0;
+		pThread->iDropped = 0;
+		pThread->bDisabled = FALSE;
+		pThread->ullCells = 0;
+		pThread->ullBytes = 0;
+	}
+
+	s_iCapacity = iEventsPerThread;
+
+	QueryPerformanceCounter( &liNow );
+	s_llBase = liNow.QuadPart;
+	s_bEnabled = TRUE;
+}
+
+void CTrace::Stop()
+{
+	s_bEnabled = FALSE;
+}
+
+//-----------------------------------------------------------------
+//	ParallelFor's pool threads trace into worker iWorker's slot.
+//	Pool workers start at 1, slot 0 going to the first other thread.
+//-----------------------------------------------------------------
+void CTrace::BindWorker( int iWorker )
+{
+	if ( iWorker > 0 && iWorker < MAX_WORKERS )
+	{
+		s_aThreads[iWorker].dwThreadId = GetCurrentThreadId();
+
+		TlsSetValue( s_dwTlsIndex, &s_aThreads[iWorker] );
+	}
+}
+
+//-----------------------------------------------------------------------
+//	The calling thread's slot, claimed on first use from slot 0 and
+//	those above the pool workers' that no thread holds. NULL once every
+//	slot is held, and the thread goes untraced.
+//-----------------------------------------------------------------------
+TRACETHREAD* CTrace::Thread()
+{
+	TRACETHREAD* pThread = (TRACETHREAD*)TlsGetValue( s_dwTlsIndex );
+
+	if ( pThread == NULL )
+	{
+		for ( int iSlot = 0; iSlot < TRACE_MAX_THREADS; iSlot = iSlot == 0 ? MAX_WORKERS : iSlot + 1 )
+		{
+			if ( InterlockedExchange( (LONG*)&s_alClaimed[iSlot], 1 ) == 0 )
+			{
+				pThread = &s_aThreads[iSlot];
+				pThread->dwThreadId = GetCurrentThreadId();
+
+				TlsSetValue( s_dwTlsIndex, pThread );
+
+				return pThread;
+			}
+		}
+	}
+
+	return pThread;
+}
+
+//-----------------------------------------------------------------------
+//	Hand the calling thread's slot back, keeping what it recorded, for
+//	threads that are about to exit. Pool workers keep theirs.
+//-----------------------------------------------------------------------
+void CTrace::ReleaseThread()
+{
+	TRACETHREAD* pThread = (TRACETHREAD*)TlsGetValue( s_dwTlsIndex );
+
+	if ( pThread == NULL )
+	{
+		return;
+	}
+
+	int iSlot = (int)( pThread - s_aThreads );
+
+	TlsSetValue( s_dwTlsIndex, NULL );
+
+	if ( iSlot == 0 || iSlot >= MAX_WORKERS )
+	{
+		InterlockedExchange( (LONG*)&s_alClaimed[iSlot], 0 );
+	}
+}
+
+void CTrace::AddCells( ULONGLONG ullCells )
+{
+	TRACETHREAD* pThread = Thread();
+
+	if ( pThread != NULL )
+	{
+		pThread->ullCells += ullCells;
+	}
+}
+
+void CTrace::AddBytes( ULONGLONG ullBytes )
+{
+	TRACETHREAD* pThread = Thread();
+
+	if ( pThread != NULL )
+	{
+		pThread->ullBytes += ullBytes;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Write everything recorded as Chrome trace JSON
+//
+//	Each span is a complete ("X") event carrying the cells and bytes its
+//	thread counted during it, and each thread's running totals are counter
+//	("C") events, drawn as a graph under the tracks
+//------------------------------------------------------------------------------
+BOOL CTrace::Write( LPCSTR szFilename )
+{
+	FILE* file;
+	LARGE_INTEGER liFrequency;
+
+	if ( ( file = fopen( szFilename, "w" ) ) == NULL )
+	{
+		return FALSE;
+	}
+
+	QueryPerformanceFrequency( &liFrequency );
+
+	//	Counts go through LONGLONG on the way to double, VC6 can't convert
+	//	an unsigned 64-bit value directly
+	//-----------------------------------------------------------------------
+	double dTicksToMicros = 1000000.0 / (double)liFrequency.QuadPart;
+
+	fprintf( file, "{\"traceEvents\":[\n" );
+	fprintf( file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"TerraGen\"}}" );
+
+	for ( int iThread = 0; iThread < TRACE_MAX_THREADS; iThread++ )
+	{
+		TRACETHREAD* pThread = &s_aThreads[iThread];
+		char acName[64];
+
+		if ( pThread->iEvents == 0 )
+		{
+			continue;
+		}
+
+		if ( iThread > 0 && iThread < MAX_WORKERS )
+		{
+			sprintf( acName, "worker %d", iThread );
+		}
+		else
+		{
+			sprintf( acName, "thread %lu", pThread->dwThreadId );
+		}
+
+		fprintf( file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", iThread, acName );
+
+		for ( int iEvent = 0; iEvent < pThread->iEvents; iEvent++ )
+		{
+			const TRACEEVENT& event = pThread->pEvents[iEvent];
+			double dStart = (double)( event.llStart - s_llBase ) * dTicksToMicros;
+			double dEnd = (double)( event.llEnd - s_llBase ) * dTicksToMicros;
+
+			fprintf( file, ",\n{\"name\":\"%s\",\"cat\":\"terragen\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cells\":%.0f,\"bytes\":%.0f}}",
+					 event.szName, iThread, dStart, dEnd - dStart, (double)(LONGLONG)event.ullCells, (double)(LONGLONG)event.ullBytes );
+
+			if ( event.ullCellsTotal != 0 || event.ullBytesTotal != 0 )
+			{
+				fprintf( file, ",\n{\"name\":\"cells touched\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"%s\":%.0f}}", dEnd, acName, (double)(LONGLONG)event.ullCellsTotal );
+				fprintf( file, ",\n{\"name\":\"bytes written\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"%s\":%.0f}}", dEnd, acName, (double)(LONGLONG)event.ullBytesTotal );
+			}
+		}
+
+		if ( pThread->iDropped > 0 )
+		{
+			fprintf( file, ",\n{\"name\":\"dropped %d spans\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+					 pThread->iDropped, iThread, (double)( pThread->pEvents[pThread->iEvents - 1].llEnd - s_llBase ) * dTicksToMicros );
+		}
+
+	}
+
+	fprintf( file, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+
+	BOOL bResult = !ferror( file );
+
+	fclose( file );
+
+	return bResult;
+}
+
+//--------------------------------------
+//
+//	CLASS: CTraceSpan implementation
+//
+//--------------------------------------
+void CTraceSpan::Begin( LPCSTR szName )
+{
+	LARGE_INTEGER liNow;
+
+	if ( ( m_pThread = CTrace::Thread() ) == NULL )
+	{
+		return;
+	}
+
+	if ( m_pThread->bDisabled )
+	{
+		m_pThread = NULL;
+		return;
+	}
+
+	QueryPerformanceCounter( &liNow );
+
+	m_szName = szName;
+	m_llStart = liNow.QuadPart;
+	m_ullCells = m_pThread->ullCells;
+	m_ullBytes = m_pThread->ullBytes;
+}
+
+void CTraceSpan::End()
+{
+	LARGE_INTEGER liNow;
+
+	QueryPerformanceCounter( &liNow );
+
+	if ( m_pThread->pEvents == NULL )
+	{
+		m_pThread->pEvents = new TRACEEVENT[s_iCapacity];
+
+		if ( m_pThread->pEvents == NULL )
+		{
+			m_pThread->bDisabled = TRUE;
+			return;
+		}
+	}
+
+	if ( m_pThread->iEvents >= s_iCapacity )
+	{
+		m_pThread->iDropped++;
+		return;
+	}
+
+	TRACEEVENT& event = m_pThread->pEvents[m_pThread->iEvents++];
+
+	event.szName = m_szName;
+	event.llStart = m_llStart;
+	event.llEnd = liNow.QuadPart;
+	event.ullCells = m_pThread->ullCells - m_ullCells;
+	event.ullBytes = m_pThread->ullBytes - m_ullBytes;
+	event.ullCellsTotal = m_pThread->ullCells;
+	event.ullBytesTotal = m_pThread->ullBytes;
+}
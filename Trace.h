@@ -0,0 +1,163 @@
+/*--------------------------------------------------------------------------------
+
+	Trace.h
+
+	Provides lightweight timing spans and per-thread counters over the hot
+	paths, written out as Chrome trace JSON for chrome://tracing or Perfetto
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+//-------------
+//	Includes
+//-------------
+#include <windows.h>
+
+#include "Parallel.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED			1		// 0 compiles every span and counter out
+#endif
+
+#define TRACE_MAX_THREADS		( MAX_WORKERS + 64 )	// Pool workers, then any other thread
+#define TRACE_DEFAULT_EVENTS	65536					// Spans kept per thread, later ones are dropped
+
+typedef struct tagTRACEEVENT
+{
+	LPCSTR		szName;				// Must be a literal, only the pointer is kept
+	LONGLONG	llStart;			// Performance counter ticks
+	LONGLONG	llEnd;
+	ULONGLONG	ullCells;			// Counted on this thread during the span
+	ULONGLONG	ullBytes;
+	ULONGLONG	ullCellsTotal;		// Thread's running totals at the end
+	ULONGLONG	ullBytesTotal;
+} TRACEEVENT;
+
+typedef struct tagTRACETHREAD
+{
+	TRACEEVENT*	pEvents;
+	int			iEvents;
+	int			iDropped;
+	BOOL		bDisabled;			// Its buffer could not be allocated, so it goes untraced
+	ULONGLONG	ullCells;			// Cells touched, running total
+	ULONGLONG	ullBytes;			// Bytes written, running total
+	DWORD		dwThreadId;
+} TRACETHREAD;
+
+//------------------------------------------------------------------------------
+//	Tracing
+//
+//	Spans are timed into a buffer owned by the thread that runs them, so
+//	recording takes no locks. ParallelFor's pool threads are numbered by
+//	worker and reuse worker N's buffer, so a run that starts thousands of
+//	short-lived threads still shows one track per worker. Other threads
+//	claim a free buffer the first time they trace, slot 0 first, as the
+//	first is usually the one that calls ParallelFor and so works as worker
+//	0. Threads that come and go should call ReleaseThread before they exit,
+//	handing their slot, and its track, on to the next thread.
+//
+//	Cells and bytes are counted in 64 bits, so callers should widen a
+//	product before it can overflow an int.
+//
+//	While stopped, a span or counter costs one test of a flag, so tracing
+//	can stay compiled into release builds. Define TRACE_ENABLED as 0 to
+//	remove it altogether.
+//------------------------------------------------------------------------------
+class CTrace
+{
+public:
+	//---------------------
+	//	CTrace Interface
+	//---------------------
+	static void Start( int iEventsPerThread );
+	static void Stop();
+	static BOOL Write( LPCSTR szFilename );
+
+	static BOOL Enabled();
+	static void BindWorker( int iWorker );
+	static TRACETHREAD* Thread();
+	static void ReleaseThread();
+
+	static void AddCells( ULONGLONG ullCells );
+	static void AddBytes( ULONGLONG ullBytes );
+
+private:
+	static volatile BOOL s_bEnabled;
+};
+
+//------------------------------------------------------------------------------
+//	A span, timed from construction to the end of its scope
+//------------------------------------------------------------------------------
+class CTraceSpan
+{
+public:
+	CTraceSpan( LPCSTR szName );
+	~CTraceSpan();
+
+private:
+	void Begin( LPCSTR szName );
+	void End();
+
+	TRACETHREAD* m_pThread;
+	LPCSTR m_szName;
+	LONGLONG m_llStart;
+	ULONGLONG m_ullCells;
+	ULONGLONG m_ullBytes;
+};
+
+//------------------------------------------------------------------------------
+//	Inlines, so that a stopped trace costs a test and a branch
+//------------------------------------------------------------------------------
+inline BOOL CTrace::Enabled()
+{
+	return s_bEnabled;
+}
+
+inline CTraceSpan::CTraceSpan( LPCSTR szName )
+{
+	m_pThread = NULL;
+
+	if ( CTrace::Enabled() )
+	{
+		Begin( szName );
+	}
+}
+
+inline CTraceSpan::~CTraceSpan()
+{
+	if ( m_pThread != NULL )
+	{
+		End();
+	}
+}
+
+//------------------
+//	Macros
+//------------------
+#if TRACE_ENABLED
+
+#define TRACE_PASTE2( a, b )	a##b
+#define TRACE_PASTE( a, b )		TRACE_PASTE2( a, b )
+#define TRACE_SPAN( szName )	CTraceSpan TRACE_PASTE( traceSpan, __LINE__ )( szName )
+#define TRACE_CELLS( ullCells )	if ( !CTrace::Enabled() ) ; else CTrace::AddCells( (ULONGLONG)( ullCells ) )
+#define TRACE_BYTES( ullBytes )	if ( !CTrace::Enabled() ) ; else CTrace::AddBytes( (ULONGLONG)( ullBytes ) )
+
+#else
+
+#define TRACE_SPAN( szName )
+#define TRACE_CELLS( ullCells )
+#define TRACE_BYTES( ullBytes )
+
+#endif
+
+#endif
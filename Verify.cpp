@@ -0,0 +1,2244 @@
+/*--------------------------------------------------------------------------------
+
+	Verify.cpp
+
+	Provides a differential check of the optimized terrain operations
+	against the reference implementations, over randomized cases
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+//--------------
+//	Includes
+//--------------
+#include <string.h>
+
+#include "Verify.h"
+#include "Arena.h"
+#include "Pipeline.h"
+#include "Generate.h"
+#include "TerraGen.h"
+#include "Logistic.h"
+#include "Drainage.h"
+#include "Contour.h"
+#include "Sample.h"
+#include "Erosion.h"
+#include "Spectral.h"
+extern CLogFunc g_LogFunc;
+
+//-----------------
+//	Definitions
+//-----------------
+static const LPCSTR s_aszCellNames[] = { "u8", "u16", "i32", "f32", "f64" };
+static const LPCSTR s_aszLayoutNames[] = { "column", "row", "tiled" };
+
+static const int s_aiClampedCells[] = { FAULT_CELL_U8, FAULT_CELL_U16 };
+static const int s_aiRetainedCells[] = { FAULT_CELL_I32, FAULT_CELL_F32, FAULT_CELL_F64 };
+static const int s_aiProfileCells[] = { FAULT_CELL_F32, FAULT_CELL_F64 };
+
+#define VERIFY_LAYOUTS		3
+#define VERIFY_COUNT(a)		( (int)( sizeof(a) / sizeof(a[0]) ) )
+
+//---------------------------------------
+//
+//	CLASS: CVerifier implementation
+//
+//---------------------------------------
+CVerifier::CVerifier()
+{
+	LARGE_INTEGER liFreq;
+	TCHAR szTempPath[MAX_PATH];
+
+	QueryPerformanceFrequency( &liFreq );
+
+	m_dTickSeconds = 1.0 / (double)liFreq.QuadPart;
+	m_iVariants = 0;
+	m_iFailures = 0;
+
+	if ( GetTempPath( MAX_PATH - 32, szTempPath ) == 0 )
+	{
+		szTempPath[0] = 0;
+	}
+
+	sprintf( m_szReferenceFile, "%sverify_reference.tga", szTempPath );
+	sprintf( m_szResultFile, "%sverify_result.tga", szTempPath );
+
+	m_pbClamped = new BYTE[VERIFY_MAX_SIZE * VERIFY_MAX_SIZE];
+	m_pdRetained = new double[VERIFY_MAX_SIZE * VERIFY_MAX_SIZE];
+	m_pdStart = new double[VERIFY_MAX_SIZE * VERIFY_MAX_SIZE];
+}
+
+CVerifier::~CVerifier()
+{
+	delete [] m_pbClamped;
+	delete [] m_pdRetained;
+	delete [] m_pdStart;
+
+	DeleteFile( m_szReferenceFile );
+	DeleteFile( m_szResultFile );
+}
+
+int CVerifier::Failures()
+{
+	return m_iFailures;
+}
+
+//------------------------------------------------------------------------------
+//	Run iCases cases, the first from dwSeed itself and the rest from seeds
+//	drawn from it, then print the summary
+//
+//	Returns FALSE if any variant differed from its reference
+//------------------------------------------------------------------------------
+BOOL CVerifier::Run( int iCases, DWORD dwSeed )
+{
+	CRandom random( dwSeed );
+	VERIFYCASE vc;
+
+	printf( "Verifying %d cases from seed %lu\n", iCases, (unsigned long)dwSeed );
+
+	for ( int iCase = 0; iCase < iCases; iCase++ )
+	{
+		MakeCase( iCase == 0 ? dwSeed : random.Next(), &vc );
+
+		//	Later checks start from the reference results of earlier ones
+		//-------------------------------------------------------------------
+		VerifyFaults( vc );
+		VerifyProfiles( vc );
+		VerifyQuantize( vc );
+		VerifyTerrain( vc );
+		VerifyPipeline( vc, FALSE );
+		VerifyPipeline( vc, TRUE );
+		VerifyTask( vc );
+		VerifyTuning( vc );
+		VerifyRaster( vc );
+		VerifyLogistic( vc );
+		VerifySpectral( vc );
+		VerifyDrainage( vc );
+		VerifyContours( vc );
+		VerifySampling( vc );
+		VerifyErosion( vc );
+	}
+
+	Report();
+
+	return m_iFailures == 0;
+}
+
+//------------------------------------------------------------------------------
+//	Draw a case from its seed
+//------------------------------------------------------------------------------
+void CVerifier::MakeCase( DWORD dwSeed, VERIFYCASE* pCase )
+{
+	CRandom random( dwSeed );
+
+	//	The common tile size a quarter of the time, as it has its own
+	//	kernels, otherwise any multiple of the block size
+	//-------------------------------------------------------------------
+	pCase->dwSeed = dwSeed;
+	pCase->iTileSq = random.Next() % 4 == 0 ? VERIFY_MAX_SIZE : GRID_BLOCK * ( 1 + (int)( random.Next() % ( VERIFY_MAX_SIZE / GRID_BLOCK ) ) );
+	pCase->iLayout = (int)( random.Next() % VERIFY_LAYOUTS );
+	pCase->iIterations = 1 + (int)( random.Next() % VERIFY_MAX_ITERATIONS );
+	pCase->iDepthInit = 1 + (int)( random.Next() % 12 );
+	pCase->iDepthEnd = 1 + (int)( random.Next() % 4 );
+	pCase->iFixedFaultDepth = random.Next() % 2 == 0 ? 0 : 1 + (int)( random.Next() % 8 );
+	pCase->iMinHeight = (int)( random.Next() % 32 );
+	pCase->iMaxHeight = 255 - (int)( random.Next() % 32 );
+	pCase->iClear = pCase->iMinHeight + (int)( random.Next() % ( pCase->iMaxHeight - pCase->iMinHeight + 1 ) );
+	pCase->dwFaultSeed = random.Next() | 1;
+	pCase->bLogistic = random.Next() % 3 == 0;
+	pCase->fLogM = 3.6f + 0.39f * random.NextFloat();
+	pCase->fLogSeed = 0.05f + 0.9f * random.NextFloat();
+	pCase->iProfile = FAULT_PROFILE_LINEAR + (int)( random.Next() % 3 );
+	pCase->fProfileWidth = 1.f + 15.f * random.NextFloat();
+	pCase->iBlurFactor = 1 + (int)( random.Next() % 3 );
+}
+
+//------------------------------------------------------------------------------
+//	Describe the case's whole fault run over pvCells, restarting the
+//	endpoint streams so every variant cuts the same lines
+//------------------------------------------------------------------------------
+void CVerifier::MakePass( const VERIFYCASE& vc, void* pvCells, int iCellType, int iLayout, BOOL bRetain, int iProfile, FAULTPASS* pPass )
+{
+	m_random.Seed( vc.dwFaultSeed );
+	m_logFunc = CLogFunc( vc.fLogM, vc.fLogSeed );
+
+	pPass->pvCells = pvCells;
+	pPass->pvSource = NULL;
+	pPass->iCellType = iCellType;
+	pPass->iLayout = iLayout;
+	pPass->bRetain = bRetain;
+	pPass->bLogistic = vc.bLogistic;
+	pPass->iProfile = iProfile;
+	pPass->fProfileWidth = vc.fProfileWidth;
+	pPass->iTileSq = vc.iTileSq;
+	pPass->iPitch = vc.iTileSq;
+	pPass->iSample = 1;
+	pPass->iFirst = 0;
+	pPass->iLast = vc.iIterations;
+	pPass->iIterations = vc.iIterations;
+	pPass->iDepthInit = vc.iDepthInit;
+	pPass->iDepthEnd = vc.iDepthEnd;
+	pPass->iFixedFaultDepth = vc.iFixedFaultDepth;
+	pPass->iMinHeight = vc.iMinHeight;
+	pPass->iMaxHeight = vc.iMaxHeight;
+	pPass->pRandom = &m_random;
+	pPass->pLogFunc = &m_logFunc;
+	pPass->hWnd = NULL;
+	pPass->pdMin = NULL;
+	pPass->pdMax = NULL;
+}
+
+//------------------------------------------------------------------------------
+//	The step fault kernel, clamped and retained, for each cell type and
+//	layout, a retained run split in two, the range the kernel gathers and
+//	coarse previews of the run
+//------------------------------------------------------------------------------
+void CVerifier::VerifyFaults( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdSource = (double*)pArena->Alloc( sizeof(double) * iCells );
+	void* pvCells = pArena->Alloc( sizeof(double) * iCells );
+	TCHAR szVariant[32];
+	FAULTPASS pass;
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell, iType, iLayout;
+
+	if ( pdReference == NULL || pdResult == NULL || pdSource == NULL || pvCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the faults checks", 0, 0 );
+		return;
+	}
+
+	//	Clamped, from the cleared tile
+	//------------------------------------
+	memset( m_pbClamped, vc.iClear, iCells );
+	MakePass( vc, m_pbClamped, FAULT_CELL_U8, GRID_LAYOUT_COLUMN, FALSE, FAULT_PROFILE_STEP, &pass );
+
+	llStart = Ticks();
+	CReference::Faults( pass );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)m_pbClamped[iCell];
+		pdSource[iCell] = (double)vc.iClear;
+	}
+
+	for ( iType = 0; iType < VERIFY_COUNT(s_aiClampedCells); iType++ )
+	{
+		for ( iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+		{
+			FillCells( pvCells, s_aiClampedCells[iType], iLayout, iTileSq, pdSource );
+			MakePass( vc, pvCells, s_aiClampedCells[iType], iLayout, FALSE, FAULT_PROFILE_STEP, &pass );
+
+			llStart = Ticks();
+			ApplyFaultPass( pass );
+			llTicks = Ticks() - llStart;
+
+			ToColumns( pvCells, s_aiClampedCells[iType], iLayout, iTileSq, pdResult );
+
+			sprintf( szVariant, "faults %s %s", s_aszCellNames[s_aiClampedCells[iType]], s_aszLayoutNames[iLayout] );
+			Check( szVariant, vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+		}
+	}
+
+	//	Retained, from the clamped result so the start isn't flat
+	//---------------------------------------------------------------
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		m_pdStart[iCell] = m_pdRetained[iCell] = (double)m_pbClamped[iCell];
+	}
+
+	MakePass( vc, m_pdRetained, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, FAULT_PROFILE_STEP, &pass );
+
+	llStart = Ticks();
+	CReference::Faults( pass );
+	llRefTicks = Ticks() - llStart;
+
+	double dMin = m_pdRetained[0];
+	double dMax = m_pdRetained[0];
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		dMin = m_pdRetained[iCell] < dMin ? m_pdRetained[iCell] : dMin;
+		dMax = m_pdRetained[iCell] > dMax ? m_pdRetained[iCell] : dMax;
+	}
+
+	for ( iType = 0; iType < VERIFY_COUNT(s_aiRetainedCells); iType++ )
+	{
+		for ( iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+		{
+			double dKernelMin = 0.0;
+			double dKernelMax = 0.0;
+
+			FillCells( pvCells, s_aiRetainedCells[iType], iLayout, iTileSq, m_pdStart );
+			MakePass( vc, pvCells, s_aiRetainedCells[iType], iLayout, TRUE, FAULT_PROFILE_STEP, &pass );
+
+			pass.pdMin = &dKernelMin;
+			pass.pdMax = &dKernelMax;
+
+			llStart = Ticks();
+			ApplyFaultPass( pass );
+			llTicks = Ticks() - llStart;
+
+			ToColumns( pvCells, s_aiRetainedCells[iType], iLayout, iTileSq, pdResult );
+
+			sprintf( szVariant, "faults %s %s", s_aszCellNames[s_aiRetainedCells[iType]], s_aszLayoutNames[iLayout] );
+			Check( szVariant, vc, m_pdRetained, pdResult, 0.0, llRefTicks, llTicks );
+
+			if ( s_aiRetainedCells[iType] == FAULT_CELL_F64 && iLayout == GRID_LAYOUT_COLUMN )
+			{
+				TCHAR szDetail[128];
+				double dDifference = fabs( dKernelMin - dMin ) > fabs( dKernelMax - dMax ) ? fabs( dKernelMin - dMin ) : fabs( dKernelMax - dMax );
+
+				sprintf( szDetail, "range %g..%g against %g..%g", dKernelMin, dKernelMax, dMin, dMax );
+				Record( "faults range", vc, dDifference, !( dDifference == 0.0 ), szDetail, llRefTicks, llTicks );
+			}
+		}
+	}
+
+	//	Split in two as a checkpointed run is, the first half reading a
+	//	separate source and the second carrying on in place
+	//----------------------------------------------------------------------
+	memcpy( pdSource, m_pdStart, sizeof(double) * iCells );
+	MakePass( vc, pvCells, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, FAULT_PROFILE_STEP, &pass );
+
+	llStart = Ticks();
+
+	pass.pvSource = pdSource;
+	pass.iLast = ( vc.iIterations + 1 ) / 2;
+	ApplyFaultPass( pass );
+
+	pass.pvSource = NULL;
+	pass.iFirst = pass.iLast;
+	pass.iLast = vc.iIterations;
+	ApplyFaultPass( pass );
+
+	llTicks = Ticks() - llStart;
+
+	Check( "faults f64 split", vc, m_pdRetained, (const double*)pvCells, 0.0, llRefTicks, llTicks );
+
+	//	Previews sampling every 2nd and 4th cell, against those cells of
+	//	the whole run
+	//----------------------------------------------------------------------
+	for ( int iScale = 2; iScale <= 4; iScale *= 2 )
+	{
+		VERIFYCASE preview = vc;
+		int iSize = iTileSq / iScale;
+		int iX, iY;
+
+		preview.iTileSq = iSize;
+
+		for ( iX = 0; iX < iSize; iX++ )
+		{
+			for ( iY = 0; iY < iSize; iY++ )
+			{
+				pdSource[iX * iSize + iY] = m_pdStart[iX * iScale * iTileSq + iY * iScale];
+				pdReference[iX * iSize + iY] = m_pdRetained[iX * iScale * iTileSq + iY * iScale];
+			}
+		}
+
+		MakePass( vc, pdSource, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, FAULT_PROFILE_STEP, &pass );
+
+		pass.iTileSq = iSize;
+		pass.iPitch = iSize;
+		pass.iSample = iScale;
+
+		llStart = Ticks();
+		ApplyFaultPass( pass );
+		llTicks = Ticks() - llStart;
+
+		sprintf( szVariant, "faults preview 1/%d", iScale * iScale );
+		Check( szVariant, preview, pdReference, pdSource, 0.0, llRefTicks, llTicks );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	The smooth profile kernel, retained, against the profile evaluated
+//	directly
+//------------------------------------------------------------------------------
+void CVerifier::VerifyProfiles( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	void* pvCells = pArena->Alloc( sizeof(double) * iCells );
+	TCHAR szVariant[32];
+	FAULTPASS pass;
+	LONGLONG llStart, llRefTicks, llTicks;
+
+	if ( pdReference == NULL || pdResult == NULL || pvCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the profiles checks", 0, 0 );
+		return;
+	}
+
+	memcpy( pdReference, m_pdStart, sizeof(double) * iCells );
+	MakePass( vc, pdReference, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, vc.iProfile, &pass );
+
+	llStart = Ticks();
+	CReference::Faults( pass );
+	llRefTicks = Ticks() - llStart;
+
+	//	Each fault may be off by its share of the table's spacing
+	//---------------------------------------------------------------
+	double dTolerance = VERIFY_ROUNDING;
+
+	for ( int iFaultIDX = 0; iFaultIDX < vc.iIterations; iFaultIDX++ )
+	{
+		int iFaultDepth = vc.iFixedFaultDepth != 0 ? vc.iFixedFaultDepth : vc.iDepthInit + ( (int)( (FLOAT)iFaultIDX / (FLOAT)vc.iIterations ) * ( vc.iDepthEnd - vc.iDepthInit ) );
+
+		dTolerance += fabs( (double)iFaultDepth ) * VERIFY_PROFILE_SLOPE / (double)FAULT_LUT_SIZE;
+	}
+
+	for ( int iType = 0; iType < VERIFY_COUNT(s_aiProfileCells); iType++ )
+	{
+		for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+		{
+			FillCells( pvCells, s_aiProfileCells[iType], iLayout, iTileSq, m_pdStart );
+			MakePass( vc, pvCells, s_aiProfileCells[iType], iLayout, TRUE, vc.iProfile, &pass );
+
+			llStart = Ticks();
+			ApplyFaultPass( pass );
+			llTicks = Ticks() - llStart;
+
+			ToColumns( pvCells, s_aiProfileCells[iType], iLayout, iTileSq, pdResult );
+
+			sprintf( szVariant, "profile %s %s", s_aszCellNames[s_aiProfileCells[iType]], s_aszLayoutNames[iLayout] );
+			Check( szVariant, vc, pdReference, pdResult, dTolerance, llRefTicks, llTicks );
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	The quantizer's linear stretch of the retained faults, into a grid in
+//	each layout and to 16 bits
+//------------------------------------------------------------------------------
+void CVerifier::VerifyQuantize( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+	BYTE* pbLevels = (BYTE*)pArena->Alloc( iCells );
+	TCHAR szVariant[32];
+	CHeightGrid grid;
+	CQuantizer quantizer;
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell;
+
+	if ( pdReference == NULL || pdResult == NULL || pwLevels == NULL || pbLevels == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the quantize checks", 0, 0 );
+		return;
+	}
+
+	llStart = Ticks();
+	CReference::Quantize( m_pdRetained, iTileSq, 255, pwLevels );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pwLevels[iCell];
+	}
+
+	for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+	{
+		grid.Create( iTileSq, iLayout );
+
+		llStart = Ticks();
+		quantizer.Quantize( m_pdRetained, iTileSq, 255, &grid );
+		llTicks = Ticks() - llStart;
+
+		grid.ToColumns( pbLevels );
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdResult[iCell] = (double)pbLevels[iCell];
+		}
+
+		sprintf( szVariant, "quantize %s", s_aszLayoutNames[iLayout] );
+		Check( szVariant, vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+	}
+
+	llStart = Ticks();
+	CReference::Quantize( m_pdRetained, iTileSq, QUANTIZE_TOP_16, pwLevels );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pwLevels[iCell];
+	}
+
+	llStart = Ticks();
+	quantizer.Quantize( m_pdRetained, iTileSq, QUANTIZE_TOP_16, pwLevels );
+	llTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdResult[iCell] = (double)pwLevels[iCell];
+	}
+
+	Check( "quantize 16 bit", vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	The tile's own blur, fractal dimension and save in each layout, on the
+//	clamped faults
+//------------------------------------------------------------------------------
+void CVerifier::VerifyTerrain( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	TCHAR szVariant[32];
+	TCHAR szDetail[128];
+	LONGLONG llStart, llBlurTicks, llFractalTicks, llSaveTicks, llTicks;
+	int iCell;
+
+	if ( pdReference == NULL || pdResult == NULL || pbCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the terrain checks", 0, 0 );
+		return;
+	}
+
+	memcpy( pbCells, m_pbClamped, iCells );
+
+	llStart = Ticks();
+	CReference::Blur( pbCells, iTileSq, vc.iBlurFactor );
+	llBlurTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pbCells[iCell];
+	}
+
+	llStart = Ticks();
+	FLOAT fReference = CReference::FractalDimension( m_pbClamped, iTileSq );
+	llFractalTicks = Ticks() - llStart;
+
+	llStart = Ticks();
+	CReference::SaveTga( m_szReferenceFile, m_pbClamped, iTileSq );
+	llSaveTicks = Ticks() - llStart;
+
+	m_terrain.SetTileSize( iTileSq );
+	m_terrain.SetFilename( m_szResultFile );
+
+	for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+	{
+		CHeightGrid& grid = m_terrain.HeightGrid();
+
+		grid.SetLayout( iLayout );
+		grid.FromColumns( m_pbClamped );
+
+		llStart = Ticks();
+		m_terrain.Blur( vc.iBlurFactor );
+		llTicks = Ticks() - llStart;
+
+		grid.ToColumns( pbCells );
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdResult[iCell] = (double)pbCells[iCell];
+		}
+
+		sprintf( szVariant, "blur %s", s_aszLayoutNames[iLayout] );
+		Check( szVariant, vc, pdReference, pdResult, 0.0, llBlurTicks, llTicks );
+
+		grid.FromColumns( m_pbClamped );
+
+		llStart = Ticks();
+		FLOAT fResult = m_terrain.CalcFractalDimension();
+		llTicks = Ticks() - llStart;
+
+		sprintf( szVariant, "fractal %s", s_aszLayoutNames[iLayout] );
+		sprintf( szDetail, "dimension %.9g against %.9g", fResult, fReference );
+		Record( szVariant, vc, fabs( (double)fResult - (double)fReference ), !( fResult == fReference ), szDetail, llFractalTicks, llTicks );
+
+		llStart = Ticks();
+		m_terrain.Save();
+		llTicks = Ticks() - llStart;
+
+		sprintf( szVariant, "save %s", s_aszLayoutNames[iLayout] );
+		CheckFiles( szVariant, vc, m_szReferenceFile, m_szResultFile, llSaveTicks, llTicks );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	A whole pipeline, clear, retained faults and save, which quantizes
+//	straight into the TGA rows, against the reference run end to end
+//------------------------------------------------------------------------------
+void CVerifier::VerifyPipeline( const VERIFYCASE& vc, BOOL bAsync )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdHeights = (double*)pArena->Alloc( sizeof(double) * iCells );
+	WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	CPipeline pipeline;
+	CAsyncWriter writer( VERIFY_WRITER_BUFFERS );
+	PIPELINESTAGE stage;
+	FAULTPASS pass;
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell;
+
+	if ( pdHeights == NULL || pwLevels == NULL || pbCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the pipeline checks", 0, 0 );
+		return;
+	}
+
+	//	The reference, run end to end
+	//-----------------------------------
+	llStart = Ticks();
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdHeights[iCell] = (double)vc.iClear;
+	}
+
+	MakePass( vc, pdHeights, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, FAULT_PROFILE_STEP, &pass );
+	CReference::Faults( pass );
+	CReference::Quantize( pdHeights, iTileSq, vc.iMaxHeight - vc.iMinHeight, pwLevels );
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pbCells[iCell] = (BYTE)pwLevels[iCell];
+	}
+
+	CReference::SaveTga( m_szReferenceFile, pbCells, iTileSq );
+
+	llRefTicks = Ticks() - llStart;
+
+	//	The same as a pipeline
+	//----------------------------
+	memset( &stage, 0, sizeof(stage) );
+	stage.iOp = PIPE_CLEAR;
+	stage.aiArgs[0] = vc.iClear;
+	pipeline.AddStage( stage );
+
+	memset( &stage, 0, sizeof(stage) );
+	stage.iOp = PIPE_FAULTS;
+	stage.aiArgs[0] = vc.iIterations;
+	stage.aiArgs[1] = vc.iFixedFaultDepth != 0 ? vc.iFixedFaultDepth : vc.iDepthInit;
+	stage.aiArgs[2] = vc.iDepthEnd;
+	stage.dwSeed = vc.dwFaultSeed;
+	stage.dwFlags = PIPE_FLAG_RETAIN | ( vc.iFixedFaultDepth != 0 ? 0 : PIPE_FLAG_INTERPOLATE ) | ( vc.bLogistic ? PIPE_FLAG_LOGISTIC : 0 );
+	pipeline.AddStage( stage );
+
+	memset( &stage, 0, sizeof(stage) );
+	stage.iOp = PIPE_SAVE;
+	strcpy( stage.szFilename, m_szResultFile );
+	pipeline.AddStage( stage );
+
+	pipeline.SetWriter( bAsync ? &writer : NULL );
+
+	m_terrain.SetTileSize( iTileSq );
+	m_terrain.HeightGrid().SetLayout( vc.iLayout );
+	m_terrain.MinHeight() = vc.iMinHeight;
+	m_terrain.MaxHeight() = vc.iMaxHeight;
+
+	CLogFunc logFunc = g_LogFunc;
+
+	g_LogFunc = CLogFunc( vc.fLogM, vc.fLogSeed );
+
+	llStart = Ticks();
+
+	pipeline.Execute( &m_terrain, FALSE, NULL, NULL );
+	writer.Flush();
+
+	llTicks = Ticks() - llStart;
+
+	g_LogFunc = logFunc;
+	m_terrain.MinHeight() = 0;
+	m_terrain.MaxHeight() = 255;
+
+	CheckFiles( bAsync ? "pipeline async save" : "pipeline save", vc, m_szReferenceFile, m_szResultFile, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Faults run by a CGenerationTask with previews, paused and resumed on
+//	the way, clamped and retained against the reference, then a cancelled
+//	run against its own last snapshot
+//------------------------------------------------------------------------------
+void CVerifier::VerifyTask( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdHeights = (double*)pArena->Alloc( sizeof(double) * iCells );
+	WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	CGenerationTask task;
+	FAULTRUN run;
+	FAULTPASS pass;
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell, iRetain;
+
+	if ( pdReference == NULL || pdResult == NULL || pdHeights == NULL || pwLevels == NULL || pbCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the task checks", 0, 0 );
+		return;
+	}
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+	CLogFunc logFunc = g_LogFunc;
+
+	m_terrain.SetTileSize( iTileSq );
+	m_terrain.SetFaultSeed( vc.dwFaultSeed );
+	m_terrain.MinHeight() = vc.iMinHeight;
+	m_terrain.MaxHeight() = vc.iMaxHeight;
+	grid.SetLayout( vc.iLayout );
+
+	run.iIterations = vc.iIterations;
+	run.iDepthInit = vc.iDepthInit;
+	run.iDepthEnd = vc.iDepthEnd;
+	run.iFixedFaultDepth = vc.iFixedFaultDepth;
+	run.bUseLogisticFunc = vc.bLogistic;
+	run.fLogM = vc.fLogM;
+	run.fLogSeed = vc.fLogSeed;
+	run.iProfile = FAULT_PROFILE_STEP;
+	run.fProfileWidth = vc.fProfileWidth;
+
+	//	Previews come first, and must leave the run itself alone
+	//--------------------------------------------------------------
+	task.SetPreview( TRUE );
+
+	for ( iRetain = 0; iRetain < 2; iRetain++ )
+	{
+		//	The retained run starts from the clamped result, as the
+		//	reference's did
+		//-------------------------------------------------------------
+		run.bRetainAllValues = iRetain;
+
+		if ( iRetain )
+		{
+			memcpy( pdHeights, m_pdStart, sizeof(double) * iCells );
+			MakePass( vc, pdHeights, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, FAULT_PROFILE_STEP, &pass );
+
+			llStart = Ticks();
+			CReference::Faults( pass );
+			CReference::Quantize( pdHeights, iTileSq, vc.iMaxHeight - vc.iMinHeight, pwLevels );
+			llRefTicks = Ticks() - llStart;
+
+			for ( iCell = 0; iCell < iCells; iCell++ )
+			{
+				pdReference[iCell] = (double)pwLevels[iCell];
+			}
+
+			grid.FromColumns( m_pbClamped );
+		}
+		else
+		{
+			memset( pbCells, vc.iClear, iCells );
+			MakePass( vc, pbCells, FAULT_CELL_U8, GRID_LAYOUT_COLUMN, FALSE, FAULT_PROFILE_STEP, &pass );
+
+			llStart = Ticks();
+			CReference::Faults( pass );
+			llRefTicks = Ticks() - llStart;
+
+			for ( iCell = 0; iCell < iCells; iCell++ )
+			{
+				pdReference[iCell] = (double)pbCells[iCell];
+			}
+
+			m_terrain.ClearGrid( vc.iClear );
+		}
+
+		llStart = Ticks();
+
+		task.Start( &m_terrain, run, vc.iIterations / 3 + 1, NULL );
+		task.Pause();
+		task.Resume();
+		task.Wait( INFINITE );
+
+		llTicks = Ticks() - llStart;
+
+		grid.ToColumns( pbCells );
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdResult[iCell] = (double)pbCells[iCell];
+		}
+
+		Check( iRetain ? "task retained" : "task clamped", vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+
+		sprintf( szDetail, "finished in state %d after %d of %d faults at 1/%d", task.State(), task.FaultsDone(), vc.iIterations, task.SnapshotScale() );
+		Record( "task state", vc, 0.0, task.State() != GENERATE_DONE || task.FaultsDone() != vc.iIterations || task.SnapshotScale() != 1, szDetail, llRefTicks, llTicks );
+	}
+
+	//	Cancelled while paused, the tile must be left as the snapshot
+	//	whichever chunk it stopped after
+	//-------------------------------------------------------------------
+	m_terrain.ClearGrid( vc.iClear );
+	run.bRetainAllValues = FALSE;
+
+	llStart = Ticks();
+
+	task.Start( &m_terrain, run, 1, NULL );
+	task.Pause();
+	task.Cancel();
+	task.Wait( INFINITE );
+
+	llTicks = Ticks() - llStart;
+
+	task.Snapshot( pbCells );
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pbCells[iCell];
+	}
+
+	grid.ToColumns( pbCells );
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdResult[iCell] = (double)pbCells[iCell];
+	}
+
+	Check( "task cancelled", vc, pdReference, pdResult, 0.0, llTicks, llTicks );
+
+	g_LogFunc = logFunc;
+	m_terrain.SetFaultSeed( 0 );
+	m_terrain.MinHeight() = 0;
+	m_terrain.MaxHeight() = 255;
+}
+
+//------------------------------------------------------------------------------
+//	A CGenerationTask session tuned twice as long, back to a quarter and
+//	then twice as deep, each against a fresh reference run from the same
+//	start, and the faults each tune cut against just the change
+//
+//	A retained session takes faults out and scales them, so only the
+//	extension cuts any. A clamped one, or a retained one with the case's
+//	smooth profile, can only extend, replaying the rest. The smooth one is
+//	held to the kernel run whole, the reference's curve not being its table.
+//------------------------------------------------------------------------------
+void CVerifier::VerifyTuning( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdHeights = (double*)pArena->Alloc( sizeof(double) * iCells );
+	WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	static const LPCSTR s_aszSteps[] = { "task tune extend", "task tune shrink", "task tune depth" };
+	static const LPCSTR s_aszRuns[] = { "clamped", "retained", "retained profile" };
+	CGenerationTask task;
+	FAULTRUN run;
+	FAULTPASS pass;
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell, iRun, iRetain, iStep, iExpected;
+	BOOL bExact;
+
+	if ( pdReference == NULL || pdResult == NULL || pdHeights == NULL || pwLevels == NULL || pbCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the tuning checks", 0, 0 );
+		return;
+	}
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+	CLogFunc logFunc = g_LogFunc;
+
+	m_terrain.SetTileSize( iTileSq );
+	m_terrain.SetFaultSeed( vc.dwFaultSeed );
+	m_terrain.MinHeight() = vc.iMinHeight;
+	m_terrain.MaxHeight() = vc.iMaxHeight;
+	grid.SetLayout( vc.iLayout );
+
+	run.bUseLogisticFunc = vc.bLogistic;
+	run.fLogM = vc.fLogM;
+	run.fLogSeed = vc.fLogSeed;
+	run.fProfileWidth = vc.fProfileWidth;
+
+	for ( iRun = 0; iRun < VERIFY_COUNT(s_aszRuns); iRun++ )
+	{
+		iRetain = iRun > 0;
+		bExact = iRun == 1;
+
+		run.iProfile = iRun == 2 ? vc.iProfile : FAULT_PROFILE_STEP;
+		run.iIterations = vc.iIterations;
+		run.iDepthInit = vc.iDepthInit;
+		run.iDepthEnd = vc.iDepthEnd;
+		run.iFixedFaultDepth = vc.iFixedFaultDepth;
+		run.bRetainAllValues = iRetain;
+
+		if ( iRetain )
+		{
+			grid.FromColumns( m_pbClamped );
+		}
+		else
+		{
+			m_terrain.ClearGrid( vc.iClear );
+		}
+
+		task.Start( &m_terrain, run, vc.iIterations / 3 + 1, NULL );
+		task.Wait( INFINITE );
+
+		for ( iStep = 0; iStep < 3; iStep++ )
+		{
+			switch ( iStep )
+			{
+				case 0:
+					run.iIterations = vc.iIterations * 2;
+					iExpected = vc.iIterations;
+					break;
+
+				case 1:
+					run.iIterations = vc.iIterations / 4;
+					iExpected = bExact ? vc.iIterations * 2 - run.iIterations : run.iIterations;
+					break;
+
+				default:
+					run.iDepthInit *= 2;
+					run.iDepthEnd *= 2;
+					run.iFixedFaultDepth *= 2;
+					iExpected = bExact ? 0 : run.iIterations;
+					break;
+			}
+
+			//	The reference runs the tuned run whole, from the start
+			//------------------------------------------------------------
+			if ( iRetain )
+			{
+				memcpy( pdHeights, m_pdStart, sizeof(double) * iCells );
+				MakePass( vc, pdHeights, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, run.iProfile, &pass );
+			}
+			else
+			{
+				memset( pbCells, vc.iClear, iCells );
+				MakePass( vc, pbCells, FAULT_CELL_U8, GRID_LAYOUT_COLUMN, FALSE, FAULT_PROFILE_STEP, &pass );
+			}
+
+			pass.iLast = pass.iIterations = run.iIterations;
+			pass.iDepthInit = run.iDepthInit;
+			pass.iDepthEnd = run.iDepthEnd;
+			pass.iFixedFaultDepth = run.iFixedFaultDepth;
+
+			llStart = Ticks();
+
+			if ( run.iProfile == FAULT_PROFILE_STEP )
+			{
+				CReference::Faults( pass );
+			}
+			else
+			{
+				ApplyFaultPass( pass );
+			}
+
+			if ( iRetain )
+			{
+				CReference::Quantize( pdHeights, iTileSq, vc.iMaxHeight - vc.iMinHeight, pwLevels );
+			}
+
+			llRefTicks = Ticks() - llStart;
+
+			for ( iCell = 0; iCell < iCells; iCell++ )
+			{
+				pdReference[iCell] = iRetain ? (double)pwLevels[iCell] : (double)pbCells[iCell];
+			}
+
+			llStart = Ticks();
+
+			task.Tune( &m_terrain, run, vc.iIterations / 3 + 1, NULL );
+			task.Wait( INFINITE );
+
+			llTicks = Ticks() - llStart;
+
+			grid.ToColumns( pbCells );
+
+			for ( iCell = 0; iCell < iCells; iCell++ )
+			{
+				pdResult[iCell] = (double)pbCells[iCell];
+			}
+
+			Check( s_aszSteps[iStep], vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+
+			sprintf( szDetail, "%s %s cut %d faults, not %d", s_aszRuns[iRun], s_aszSteps[iStep], task.FaultsApplied(), iExpected );
+			Record( "task tune faults", vc, 0.0, task.FaultsApplied() != iExpected, szDetail, llRefTicks, llTicks );
+		}
+	}
+
+	g_LogFunc = logFunc;
+	m_terrain.SetFaultSeed( 0 );
+	m_terrain.MinHeight() = 0;
+	m_terrain.MaxHeight() = 255;
+}
+
+//------------------------------------------------------------------------------
+//	The C interface on padded rasters the verifier owns: clamped and
+//	retained faults, blur and quantize against the reference, and the
+//	padding between rows left alone throughout
+//------------------------------------------------------------------------------
+void CVerifier::VerifyRaster( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	int iPitch = iTileSq + 1 + (int)( vc.dwSeed % VERIFY_RASTER_PADDING );
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	WORD* pwLevels = (WORD*)pArena->Alloc( sizeof(WORD) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	void* pvHeights = pArena->Alloc( sizeof(double) * iPitch * iTileSq );
+	void* pvLevels = pArena->Alloc( sizeof(WORD) * iPitch * iTileSq );
+	HTERRAGEN hTerraGen = TerraGenCreate( iTileSq );
+	TERRAGENRASTER heights, levels;
+	TERRAGENFAULTS faults;
+	FAULTPASS pass;
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iCell;
+	BOOL bFailed = FALSE;
+
+	if ( pdReference == NULL || pdResult == NULL || pwLevels == NULL || pbCells == NULL || pvHeights == NULL || pvLevels == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the raster checks", 0, 0 );
+		return;
+	}
+
+	faults.cbSize = sizeof(faults);
+	faults.iIterations = vc.iIterations;
+	faults.iDepthInit = vc.iDepthInit;
+	faults.iDepthEnd = vc.iDepthEnd;
+	faults.iFixedDepth = vc.iFixedFaultDepth;
+	faults.dwSeed = vc.dwFaultSeed;
+	faults.bLogistic = vc.bLogistic;
+	faults.fLogM = vc.fLogM;
+	faults.fLogSeed = vc.fLogSeed;
+	faults.iProfile = TERRAGEN_PROFILE_STEP;
+	faults.fProfileWidth = vc.fProfileWidth;
+
+	heights.pvCells = pvHeights;
+	levels.pvCells = pvLevels;
+	levels.iFormat = TERRAGEN_FORMAT_U16;
+	levels.iStride = iPitch * sizeof(WORD);
+
+	memset( pvHeights, VERIFY_RASTER_GUARD, sizeof(double) * iPitch * iTileSq );
+	memset( pvLevels, VERIFY_RASTER_GUARD, sizeof(WORD) * iPitch * iTileSq );
+
+	TerraGenSetHeights( hTerraGen, vc.iMinHeight, vc.iMaxHeight );
+
+	//	Clamped, from the cleared raster
+	//--------------------------------------
+	heights.iFormat = TERRAGEN_FORMAT_U8;
+	heights.iStride = iPitch;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)m_pbClamped[iCell];
+	}
+
+	llStart = Ticks();
+	bFailed |= !TerraGenClear( hTerraGen, &heights, vc.iClear );
+	bFailed |= !TerraGenFaults( hTerraGen, &heights, &faults );
+	llTicks = Ticks() - llStart;
+
+	bFailed |= !CheckPadding( pvHeights, iPitch, iTileSq, 1 );
+
+	RasterToColumns( pvHeights, FAULT_CELL_U8, iPitch, iTileSq, pdResult );
+	Check( "raster u8", vc, pdReference, pdResult, 0.0, llTicks, llTicks );
+
+	//	Blurred in place
+	//----------------------
+	memcpy( pbCells, m_pbClamped, iCells );
+
+	llStart = Ticks();
+	CReference::Blur( pbCells, iTileSq, vc.iBlurFactor );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pbCells[iCell];
+	}
+
+	ColumnsToRaster( pvHeights, FAULT_CELL_U8, iPitch, iTileSq, m_pdStart );
+
+	llStart = Ticks();
+	bFailed |= !TerraGenBlur( hTerraGen, &heights, vc.iBlurFactor );
+	llTicks = Ticks() - llStart;
+
+	bFailed |= !CheckPadding( pvHeights, iPitch, iTileSq, 1 );
+
+	RasterToColumns( pvHeights, FAULT_CELL_U8, iPitch, iTileSq, pdResult );
+	Check( "raster blur", vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+
+	//	Retained, from the clamped result as the reference's was, then
+	//	quantized into the level raster
+	//--------------------------------------------------------------------
+	heights.iFormat = TERRAGEN_FORMAT_F64;
+	heights.iStride = iPitch * sizeof(double);
+
+	memset( pvHeights, VERIFY_RASTER_GUARD, sizeof(double) * iPitch * iTileSq );
+	ColumnsToRaster( pvHeights, FAULT_CELL_F64, iPitch, iTileSq, m_pdStart );
+
+	llStart = Ticks();
+	bFailed |= !TerraGenFaults( hTerraGen, &heights, &faults );
+	llTicks = Ticks() - llStart;
+
+	bFailed |= !CheckPadding( pvHeights, iPitch, iTileSq, sizeof(double) );
+
+	RasterToColumns( pvHeights, FAULT_CELL_F64, iPitch, iTileSq, pdResult );
+	Check( "raster f64", vc, m_pdRetained, pdResult, 0.0, llTicks, llTicks );
+
+	llStart = Ticks();
+	CReference::Quantize( m_pdRetained, iTileSq, vc.iMaxHeight - vc.iMinHeight, pwLevels );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pwLevels[iCell];
+	}
+
+	llStart = Ticks();
+	bFailed |= !TerraGenQuantize( hTerraGen, &heights, &levels );
+	llTicks = Ticks() - llStart;
+
+	bFailed |= !CheckPadding( pvLevels, iPitch, iTileSq, sizeof(WORD) );
+
+	RasterToColumns( pvLevels, FAULT_CELL_U16, iPitch, iTileSq, pdResult );
+	Check( "raster quantize", vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+
+	//	A stride that cannot hold a row is refused
+	//-------------------------------------------------
+	heights.iStride = ( iTileSq - 1 ) * sizeof(double);
+	bFailed |= TerraGenClear( hTerraGen, &heights, 0.0 );
+
+	Record( "raster checks", vc, 0.0, bFailed, bFailed ? "a call failed, padding changed or a short stride was taken" : "", llTicks, llTicks );
+
+	TerraGenDestroy( hTerraGen );
+}
+
+//------------------------------------------------------------------------------
+//	A small logistic sweep around the case's M and seed, each orbit's
+//	exponent against the log summed every step, and each column's
+//	histogram holding every iterate measured
+//------------------------------------------------------------------------------
+void CVerifier::VerifyLogistic( const VERIFYCASE& vc )
+{
+	CLogisticAnalysis analysis;
+	LOGISTICPARAMS params;
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	double dWorst = 0.0;
+	int iDiffering = 0;
+	int iColumn, iSeed;
+
+	//	Seeds not a whole number of lanes, and iterates not a whole number
+	//	of renormalizations
+	//------------------------------------------------------------------------
+	CLogisticAnalysis::DefaultParams( &params );
+	params.fMinM = vc.fLogM - 0.2f;
+	params.fMaxM = vc.fLogM;
+	params.iColumns = VERIFY_LOGISTIC_COLUMNS;
+	params.fMinSeed = vc.fLogSeed * 0.5f;
+	params.fMaxSeed = vc.fLogSeed;
+	params.iSeeds = VERIFY_LOGISTIC_SEEDS;
+	params.iTransient = vc.iIterations;
+	params.iIterates = 256 + vc.iIterations;
+
+	llStart = Ticks();
+	analysis.Run( params );
+	llTicks = Ticks() - llStart;
+
+	llStart = Ticks();
+
+	for ( iColumn = 0; iColumn < analysis.Columns(); iColumn++ )
+	{
+		for ( iSeed = 0; iSeed < params.iSeeds; iSeed++ )
+		{
+			double dReference = CReference::LyapunovExponent( analysis.Column( iColumn ).fM, analysis.Seed( iSeed ), params.iTransient, params.iIterates );
+			double dDifference = fabs( (double)analysis.Exponent( iColumn, iSeed ) - dReference );
+
+			if ( !( dDifference <= VERIFY_LYAPUNOV ) )
+			{
+				if ( iDiffering++ == 0 )
+				{
+					sprintf( szDetail, "M %.6g seed %.6g: %.9g against %.9g", analysis.Column( iColumn ).fM, analysis.Seed( iSeed ), analysis.Exponent( iColumn, iSeed ), dReference );
+				}
+			}
+
+			dWorst = dDifference > dWorst || dDifference != dDifference ? dDifference : dWorst;
+		}
+	}
+
+	llRefTicks = Ticks() - llStart;
+
+	Record( "logistic exponents", vc, dWorst, iDiffering > 0 || analysis.Columns() != params.iColumns, iDiffering > 0 ? szDetail : "", llRefTicks, llTicks );
+
+	//	Every measured iterate lands in a bin
+	//-------------------------------------------
+	iDiffering = 0;
+
+	for ( iColumn = 0; iColumn < analysis.Columns(); iColumn++ )
+	{
+		DWORD dwTotal = 0;
+
+		for ( int iBin = 0; iBin < LOGISTIC_BINS; iBin++ )
+		{
+			dwTotal += analysis.Histogram( iColumn )[iBin];
+		}
+
+		iDiffering += dwTotal != (DWORD)( params.iSeeds * params.iIterates );
+	}
+
+	sprintf( szDetail, "%d columns' histograms hold the wrong number of iterates", iDiffering );
+	Record( "logistic orbits", vc, (double)iDiffering, iDiffering > 0, iDiffering > 0 ? szDetail : "", llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Spectral surfaces from the case's seed over the whole range of targets,
+//	each measured by its variogram: within VERIFY_DIMENSION of its target,
+//	and rougher than the one before
+//------------------------------------------------------------------------------
+void CVerifier::VerifySpectral( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CSpectralSynth synth;
+	double* pdHeights = (double*)pArena->Alloc( sizeof(double) * VERIFY_SPECTRAL_SIZE * VERIFY_SPECTRAL_SIZE );
+	TCHAR szDetail[128];
+	LONGLONG llStart;
+	LONGLONG llRefTicks = 0;
+	LONGLONG llTicks = 0;
+	double dWorst = 0.0;
+	double dPrevious = 0.0;
+	int iWrong = 0;
+
+	if ( pdHeights == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the spectral checks", 0, 0 );
+		return;
+	}
+
+	szDetail[0] = 0;
+
+	for ( int iStep = 0; iStep < VERIFY_SPECTRAL_STEPS; iStep++ )
+	{
+		double dTarget = SPECTRAL_MIN_DIMENSION + ( SPECTRAL_MAX_DIMENSION - SPECTRAL_MIN_DIMENSION ) * (double)iStep / (double)( VERIFY_SPECTRAL_STEPS - 1 );
+
+		llStart = Ticks();
+		BOOL bMade = synth.Synthesize( VERIFY_SPECTRAL_SIZE, (FLOAT)dTarget, vc.dwFaultSeed, pdHeights );
+		llTicks += Ticks() - llStart;
+
+		llStart = Ticks();
+		double dMeasured = bMade ? CReference::VariogramDimension( pdHeights, VERIFY_SPECTRAL_SIZE, VERIFY_SPECTRAL_SIZE / 16 ) : 0.0;
+		llRefTicks += Ticks() - llStart;
+
+		double dDifference = fabs( dMeasured - dTarget );
+
+		if ( !bMade || !( dDifference <= VERIFY_DIMENSION ) || ( iStep > 0 && !( dMeasured > dPrevious ) ) )
+		{
+			if ( iWrong++ == 0 )
+			{
+				sprintf( szDetail, "target %.3g measured %.4g, the target below %.4g", dTarget, dMeasured, dPrevious );
+			}
+		}
+
+		dWorst = dDifference > dWorst || dDifference != dDifference ? dDifference : dWorst;
+		dPrevious = dMeasured;
+	}
+
+	Record( "spectral dimension", vc, dWorst, iWrong > 0, szDetail, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Priority flood fills against sweeps to a fixed point, in each layout,
+//	then a flow on the case's layout: each direction must be the steepest
+//	drop, or on a flat lead to a cell as high, and each accumulation must
+//	be the number of cells whose path runs through it
+//------------------------------------------------------------------------------
+void CVerifier::VerifyDrainage( const VERIFYCASE& vc )
+{
+	static const int s_aiDirX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+	static const int s_aiDirY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CDrainage drainage;
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	BYTE* pbFilled = (BYTE*)pArena->Alloc( iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	DWORD* pdwThrough = (DWORD*)pArena->Alloc( sizeof(DWORD) * iCells );
+	TCHAR szVariant[32];
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	BOOL bFailed = FALSE;
+	int iCell, iXPos, iYPos;
+
+	if ( pdReference == NULL || pdResult == NULL || pbFilled == NULL || pbCells == NULL || pdwThrough == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the drainage checks", 0, 0 );
+		return;
+	}
+
+	memcpy( pbFilled, m_pbClamped, iCells );
+
+	llStart = Ticks();
+	CReference::FillDepressions( pbFilled, iTileSq );
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pbFilled[iCell];
+	}
+
+	m_terrain.SetTileSize( iTileSq );
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+
+	for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+	{
+		grid.SetLayout( iLayout );
+		grid.FromColumns( m_pbClamped );
+
+		llStart = Ticks();
+		bFailed |= !drainage.Fill( &m_terrain, NULL );
+		llTicks = Ticks() - llStart;
+
+		grid.ToColumns( pbCells );
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdResult[iCell] = (double)pbCells[iCell];
+		}
+
+		sprintf( szVariant, "fill %s", s_aszLayoutNames[iLayout] );
+		Check( szVariant, vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+	}
+
+	grid.SetLayout( vc.iLayout );
+	grid.FromColumns( m_pbClamped );
+
+	llStart = Ticks();
+	BOOL bFlowed = drainage.Flow( &m_terrain, NULL );
+	llTicks = Ticks() - llStart;
+
+	if ( !bFlowed )
+	{
+		Record( "drainage checks", vc, 0.0, TRUE, drainage.GetError(), llTicks, llTicks );
+		return;
+	}
+
+	grid.ToColumns( pbCells );
+	bFailed |= memcmp( pbCells, pbFilled, iCells ) != 0;
+
+	//	Directions, by the rule rather than against a second implementation
+	//-------------------------------------------------------------------------
+	int iWrong = 0;
+
+	llStart = Ticks();
+
+	for ( iXPos = 0; iXPos < iTileSq; iXPos++ )
+	{
+		for ( iYPos = 0; iYPos < iTileSq; iYPos++ )
+		{
+			int iHeight = pbFilled[iXPos * iTileSq + iYPos];
+			int iDir = drainage.Direction( iXPos, iYPos );
+			int iExpected = -1;
+			FLOAT fSteepest = 0.f;
+			BOOL bRight;
+
+			if ( iXPos == 0 || iYPos == 0 || iXPos == iTileSq - 1 || iYPos == iTileSq - 1 )
+			{
+				bRight = iDir == DRAINAGE_OUTLET;
+			}
+			else
+			{
+				for ( int iN = 0; iN < 8; iN++ )
+				{
+					int iDrop = iHeight - pbFilled[( iXPos + s_aiDirX[iN] ) * iTileSq + iYPos + s_aiDirY[iN]];
+					FLOAT fSlope = (FLOAT)iDrop * ( ( iN & 1 ) ? 0.70710678f : 1.f );
+
+					if ( iDrop > 0 && fSlope > fSteepest )
+					{
+						fSteepest = fSlope;
+						iExpected = iN;
+					}
+				}
+
+				bRight = iExpected >= 0
+					? iDir == iExpected
+					: iDir < DRAINAGE_OUTLET && pbFilled[( iXPos + s_aiDirX[iDir] ) * iTileSq + iYPos + s_aiDirY[iDir]] == iHeight;
+			}
+
+			if ( !bRight && iWrong++ == 0 )
+			{
+				sprintf( szDetail, "(%d, %d) at %d drains %d, expected %d", iXPos, iYPos, iHeight, iDir, iExpected );
+			}
+		}
+	}
+
+	llRefTicks = Ticks() - llStart;
+
+	Record( "flow directions", vc, (double)iWrong, iWrong > 0, iWrong > 0 ? szDetail : "", llRefTicks, llTicks );
+
+	//	Accumulation, walking every cell's path to its outlet. A path longer
+	//	than the tile has looped.
+	//--------------------------------------------------------------------------
+	memset( pdwThrough, 0, sizeof(DWORD) * iCells );
+
+	llStart = Ticks();
+
+	for ( iCell = 0; iCell < iCells && !bFailed; iCell++ )
+	{
+		int iPathX = iCell % iTileSq;
+		int iPathY = iCell / iTileSq;
+		int iSteps = 0;
+
+		do
+		{
+			pdwThrough[iPathY * iTileSq + iPathX]++;
+			bFailed |= ++iSteps > iCells;
+		}
+		while ( !bFailed && CDrainage::Downstream( drainage.Direction( iPathX, iPathY ), &iPathX, &iPathY ) );
+	}
+
+	llRefTicks = Ticks() - llStart;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pdReference[iCell] = (double)pdwThrough[iCell];
+		pdResult[iCell] = (double)drainage.Accumulation()[iCell];
+	}
+
+	Check( "flow accumulation", vc, pdReference, pdResult, 0.0, llRefTicks, llTicks );
+
+	Record( "drainage checks", vc, 0.0, bFailed, bFailed ? "a call failed, the flow left the tile unfilled or a path looped" : "", llTicks, llTicks );
+}
+
+//	Orders segments x0, y0, x1, y1 for comparing as sets
+//------------------------------------------------------------
+static int CompareSegments( const void* pvA, const void* pvB )
+{
+	const FLOAT* pfA = (const FLOAT*)pvA;
+	const FLOAT* pfB = (const FLOAT*)pvB;
+
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( pfA[i] != pfB[i] )
+		{
+			return pfA[i] < pfB[i] ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+//	Contours in each layout, every line broken back into segments against
+//	each square's own at every level. Lines that are not closed must end
+//	on the tile's edge, so none was left unstitched at a band. The saved
+//	stream must read back to within half a step of the lines.
+//------------------------------------------------------------------------------
+void CVerifier::VerifyContours( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CContours contours;
+	CONTOURPARAMS params;
+	int iTileSq = vc.iTileSq;
+	int iMostSegments = 2 * ( iTileSq - 1 ) * ( iTileSq - 1 );
+	FLOAT* pfReference = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * 4 * iMostSegments );
+	FLOAT* pfResult = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * 4 * iMostSegments );
+	TCHAR szVariant[32];
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	int iLevel;
+
+	if ( pfReference == NULL || pfResult == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the contours checks", 0, 0 );
+		return;
+	}
+
+	params.iInterval = vc.iDepthInit;
+	params.iSeaLevel = vc.iClear;
+
+	m_terrain.SetTileSize( iTileSq );
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+
+	for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+	{
+		grid.SetLayout( iLayout );
+		grid.FromColumns( m_pbClamped );
+
+		llStart = Ticks();
+		BOOL bFailed = !contours.Extract( &m_terrain, params, NULL );
+		llTicks = Ticks() - llStart;
+
+		int iWrong = 0;
+		int iLine;
+
+		szDetail[0] = 0;
+		llRefTicks = 0;
+
+		for ( iLevel = 1; iLevel < 256 && !bFailed; iLevel++ )
+		{
+			if ( iLevel % params.iInterval != 0 && iLevel != params.iSeaLevel )
+			{
+				continue;
+			}
+
+			llStart = Ticks();
+			int iReference = CReference::ContourSegments( m_pbClamped, iTileSq, iLevel, pfReference );
+			llRefTicks += Ticks() - llStart;
+
+			int iResult = 0;
+
+			for ( iLine = 0; iLine < contours.Lines(); iLine++ )
+			{
+				const CONTOURLINE& line = contours.Line( iLine );
+				const FLOAT* pfPoints = contours.Points() + 2 * line.iFirst;
+				int iSegments = ( line.dwFlags & CONTOUR_CLOSED ) ? line.iPoints : line.iPoints - 1;
+
+				if ( line.iLevel != iLevel )
+				{
+					continue;
+				}
+
+				for ( int iSegment = 0; iSegment < iSegments && iResult < iMostSegments; iSegment++ )
+				{
+					int iNext = ( iSegment + 1 ) % line.iPoints;
+
+					pfResult[4 * iResult] = pfPoints[2 * iSegment];
+					pfResult[4 * iResult + 1] = pfPoints[2 * iSegment + 1];
+					pfResult[4 * iResult + 2] = pfPoints[2 * iNext];
+					pfResult[4 * iResult + 3] = pfPoints[2 * iNext + 1];
+					iResult++;
+				}
+			}
+
+			qsort( pfReference, iReference, 4 * sizeof(FLOAT), CompareSegments );
+			qsort( pfResult, iResult, 4 * sizeof(FLOAT), CompareSegments );
+
+			if ( iResult != iReference || memcmp( pfResult, pfReference, sizeof(FLOAT) * 4 * iResult ) != 0 )
+			{
+				if ( iWrong++ == 0 )
+				{
+					sprintf( szDetail, "level %d has %d segments, expected %d", iLevel, iResult, iReference );
+				}
+			}
+		}
+
+		for ( iLine = 0; iLine < contours.Lines() && !bFailed; iLine++ )
+		{
+			const CONTOURLINE& line = contours.Line( iLine );
+			const FLOAT* pfPoints = contours.Points() + 2 * line.iFirst;
+			const FLOAT* pfLast = pfPoints + 2 * ( line.iPoints - 1 );
+			FLOAT fEdge = (FLOAT)( iTileSq - 1 );
+
+			BOOL bEnds = ( pfPoints[0] == 0.f || pfPoints[0] == fEdge || pfPoints[1] == 0.f || pfPoints[1] == fEdge )
+				&& ( pfLast[0] == 0.f || pfLast[0] == fEdge || pfLast[1] == 0.f || pfLast[1] == fEdge );
+
+			if ( !( line.dwFlags & CONTOUR_CLOSED ) && !bEnds && iWrong++ == 0 )
+			{
+				sprintf( szDetail, "a level %d line ends inside the tile at (%g, %g)", line.iLevel, pfLast[0], pfLast[1] );
+			}
+
+			if ( ( line.dwFlags & CONTOUR_COAST ) != 0 != ( line.iLevel == params.iSeaLevel ) && iWrong++ == 0 )
+			{
+				sprintf( szDetail, "a level %d line is wrongly marked as coast or not", line.iLevel );
+			}
+		}
+
+		sprintf( szVariant, "contours %s", s_aszLayoutNames[iLayout] );
+		Record( szVariant, vc, (double)iWrong, bFailed || iWrong > 0, bFailed ? contours.GetError() : szDetail, llRefTicks, llTicks );
+	}
+
+	//	The stream, from the last layout's lines
+	//-----------------------------------------------
+	CContours loaded;
+	double dWorst = 0.0;
+	BOOL bRead;
+
+	llStart = Ticks();
+	bRead = contours.Save( m_szResultFile ) && loaded.Load( m_szResultFile ) && loaded.Lines() == contours.Lines();
+	llTicks = Ticks() - llStart;
+
+	for ( int iLine = 0; iLine < contours.Lines() && bRead; iLine++ )
+	{
+		const CONTOURLINE& line = contours.Line( iLine );
+		const CONTOURLINE& read = loaded.Line( iLine );
+
+		bRead = read.iLevel == line.iLevel && read.dwFlags == line.dwFlags && read.iPoints == line.iPoints;
+
+		for ( int iCoord = 0; iCoord < 2 * line.iPoints && bRead; iCoord++ )
+		{
+			double dDifference = fabs( (double)loaded.Points()[2 * read.iFirst + iCoord] - (double)contours.Points()[2 * line.iFirst + iCoord] );
+
+			dWorst = dDifference > dWorst ? dDifference : dWorst;
+		}
+	}
+
+	Record( "contours stream", vc, dWorst, !bRead || dWorst > 0.5 / CONTOUR_FIXED + VERIFY_ROUNDING / CONTOUR_FIXED, bRead ? "points moved more than half a step" : "the stream did not read back", llTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Batched height queries: each filter over each layout against the
+//	textbook interpolant, at points on the tile and a cell around it through
+//	a transform, then the case's faults sampled without a grid against the
+//	kernel's retained run at every cell, and a smooth profile's gradients
+//	against its curve's slope
+//------------------------------------------------------------------------------
+void CVerifier::VerifySampling( const VERIFYCASE& vc )
+{
+	static const LPCSTR s_aszFilterNames[] = { "bilinear", "bicubic" };
+
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CHeightSampler sampler;
+	CRandom random( vc.dwSeed );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	int iQueries = VERIFY_SAMPLES > iCells ? VERIFY_SAMPLES : iCells;
+	FLOAT* pfX = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * iQueries );
+	FLOAT* pfY = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * iQueries );
+	FLOAT* pfHeights = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * iQueries );
+	FLOAT* pfGradX = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * iQueries );
+	FLOAT* pfGradY = (FLOAT*)pArena->Alloc( sizeof(FLOAT) * iQueries );
+	double* pdRun = (double*)pArena->Alloc( sizeof(double) * iCells );
+	TCHAR szVariant[32];
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	double dWorst;
+	int iWrong, iQuery, iCell;
+	BOOL bFailed;
+
+	if ( pfX == NULL || pfY == NULL || pfHeights == NULL || pfGradX == NULL || pfGradY == NULL || pdRun == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the sampling checks", 0, 0 );
+		return;
+	}
+
+	//	A power of two cell size, and the reference is given the cells the
+	//	transform puts each point in. Every 16th point is on a cell.
+	//--------------------------------------------------------------------------
+	FLOAT fCellSize = 0.25f * (FLOAT)( 1 << ( random.Next() % 5 ) );
+	FLOAT fOriginX = 0.5f * (FLOAT)(int)( random.Next() % 64 ) - 16.f;
+	FLOAT fOriginY = 0.5f * (FLOAT)(int)( random.Next() % 64 ) - 16.f;
+
+	for ( iQuery = 0; iQuery < VERIFY_SAMPLES; iQuery++ )
+	{
+		FLOAT fCellX = random.NextFloat() * (FLOAT)( iTileSq + 1 ) - 1.f;
+		FLOAT fCellY = random.NextFloat() * (FLOAT)( iTileSq + 1 ) - 1.f;
+
+		if ( iQuery % 16 == 0 )
+		{
+			fCellX = (FLOAT)(int)( random.Next() % iTileSq );
+			fCellY = (FLOAT)(int)( random.Next() % iTileSq );
+		}
+
+		pfX[iQuery] = fOriginX + fCellX * fCellSize;
+		pfY[iQuery] = fOriginY + fCellY * fCellSize;
+	}
+
+	m_terrain.SetTileSize( iTileSq );
+	sampler.SetTransform( fOriginX, fOriginY, fCellSize );
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+
+	for ( int iFilter = SAMPLE_BILINEAR; iFilter <= SAMPLE_BICUBIC; iFilter++ )
+	{
+		for ( int iLayout = 0; iLayout < VERIFY_LAYOUTS; iLayout++ )
+		{
+			grid.SetLayout( iLayout );
+			grid.FromColumns( m_pbClamped );
+
+			llStart = Ticks();
+			bFailed = !sampler.SetGrid( &m_terrain, iFilter ) || !sampler.Sample( pfX, pfY, VERIFY_SAMPLES, pfHeights, pfGradX, pfGradY );
+			llTicks = Ticks() - llStart;
+
+			llRefTicks = 0;
+			dWorst = 0.0;
+			iWrong = 0;
+			szDetail[0] = 0;
+
+			for ( iQuery = 0; iQuery < VERIFY_SAMPLES && !bFailed; iQuery++ )
+			{
+				double adResult[3] = { pfHeights[iQuery], pfGradX[iQuery] * fCellSize, pfGradY[iQuery] * fCellSize };
+				double adReference[3];
+				double dX = (double)( ( pfX[iQuery] - fOriginX ) * ( 1.f / fCellSize ) );
+				double dY = (double)( ( pfY[iQuery] - fOriginY ) * ( 1.f / fCellSize ) );
+
+				llStart = Ticks();
+				CReference::Sample( m_pbClamped, iTileSq, iFilter, dX, dY, &adReference[0], &adReference[1], &adReference[2] );
+				llRefTicks += Ticks() - llStart;
+
+				for ( int iValue = 0; iValue < 3; iValue++ )
+				{
+					double dDifference = fabs( adResult[iValue] - adReference[iValue] );
+
+					dWorst = dDifference > dWorst ? dDifference : dWorst;
+
+					if ( dDifference > 255.0 * VERIFY_SAMPLE_ROUNDING && iWrong++ == 0 )
+					{
+						sprintf( szDetail, "value %d at (%g, %g) is %g, expected %g", iValue, dX, dY, adResult[iValue], adReference[iValue] );
+					}
+				}
+			}
+
+			sprintf( szVariant, "sample %s %s", s_aszFilterNames[iFilter], s_aszLayoutNames[iLayout] );
+			Record( szVariant, vc, dWorst, bFailed || iWrong > 0, bFailed ? sampler.GetError() : szDetail, llRefTicks, llTicks );
+		}
+	}
+
+	//	Without a grid, at every cell, against the kernel's run from the
+	//	cleared tile
+	//------------------------------------------------------------------------
+	FAULTRUN run;
+	FAULTPASS pass;
+
+	run.iIterations = vc.iIterations;
+	run.iDepthInit = vc.iDepthInit;
+	run.iDepthEnd = vc.iDepthEnd;
+	run.iFixedFaultDepth = vc.iFixedFaultDepth;
+	run.bUseLogisticFunc = vc.bLogistic;
+	run.bRetainAllValues = TRUE;
+	run.fLogM = vc.fLogM;
+	run.fLogSeed = vc.fLogSeed;
+	run.fProfileWidth = vc.fProfileWidth;
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		pfX[iCell] = (FLOAT)( iCell / iTileSq );
+		pfY[iCell] = (FLOAT)( iCell % iTileSq );
+	}
+
+	sampler.SetTransform( 0.f, 0.f, 1.f );
+
+	for ( int iSmooth = 0; iSmooth < 2; iSmooth++ )
+	{
+		run.iProfile = iSmooth ? vc.iProfile : FAULT_PROFILE_STEP;
+
+		for ( iCell = 0; iCell < iCells; iCell++ )
+		{
+			pdRun[iCell] = (double)vc.iClear;
+		}
+
+		MakePass( vc, pdRun, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, run.iProfile, &pass );
+
+		llStart = Ticks();
+		ApplyFaultPass( pass );
+		llRefTicks = Ticks() - llStart;
+
+		llStart = Ticks();
+		bFailed = !sampler.SetFaults( run, vc.dwFaultSeed, iTileSq, (double)vc.iClear ) || !sampler.Sample( pfX, pfY, iCells, pfHeights, NULL, NULL );
+		llTicks = Ticks() - llStart;
+
+		dWorst = 0.0;
+		iWrong = 0;
+		szDetail[0] = 0;
+
+		for ( iCell = 0; iCell < iCells && !bFailed; iCell++ )
+		{
+			if ( pfHeights[iCell] != (FLOAT)pdRun[iCell] )
+			{
+				double dDifference = fabs( (double)pfHeights[iCell] - pdRun[iCell] );
+
+				dWorst = dDifference > dWorst ? dDifference : dWorst;
+
+				if ( iWrong++ == 0 )
+				{
+					sprintf( szDetail, "cell (%d, %d) is %g, expected %g", iCell / iTileSq, iCell % iTileSq, pfHeights[iCell], pdRun[iCell] );
+				}
+			}
+		}
+
+		Record( iSmooth ? "sample faults profile" : "sample faults step", vc, dWorst, bFailed || iWrong > 0, bFailed ? sampler.GetError() : szDetail, llRefTicks, llTicks );
+	}
+
+	//	The smooth profile's gradients between the cells, against the slope
+	//	of the curve it tabulates, at each fault's own t
+	//-------------------------------------------------------------------------
+	FAULTLINE aLines[VERIFY_MAX_ITERATIONS];
+
+	MakePass( vc, NULL, FAULT_CELL_F64, GRID_LAYOUT_COLUMN, TRUE, vc.iProfile, &pass );
+	PickFaultLines( pass, 0, vc.iIterations, aLines );
+
+	for ( iQuery = 0; iQuery < VERIFY_SAMPLES; iQuery++ )
+	{
+		pfX[iQuery] = random.NextFloat() * (FLOAT)( iTileSq + 1 ) - 1.f;
+		pfY[iQuery] = random.NextFloat() * (FLOAT)( iTileSq + 1 ) - 1.f;
+	}
+
+	llStart = Ticks();
+	bFailed = !sampler.Sample( pfX, pfY, VERIFY_SAMPLES, pfHeights, pfGradX, pfGradY );
+	llTicks = Ticks() - llStart;
+
+	llRefTicks = 0;
+	dWorst = 0.0;
+	iWrong = 0;
+	szDetail[0] = 0;
+
+	for ( iQuery = 0; iQuery < VERIFY_SAMPLES && !bFailed; iQuery++ )
+	{
+		double dGradX = 0.0;
+		double dGradY = 0.0;
+		double dTolerance = VERIFY_ROUNDING;
+
+		llStart = Ticks();
+
+		for ( int iLine = 0; iLine < vc.iIterations; iLine++ )
+		{
+			const FAULTLINE& line = aLines[iLine];
+			double dDX = (double)line.fX2 - (double)line.fX1;
+			double dDY = (double)line.fY2 - (double)line.fY1;
+			double dLength = sqrt( dDX * dDX + dDY * dDY );
+
+			if ( dLength == 0.0 )
+			{
+				continue;
+			}
+
+			double dInvBand = 1.0 / ( dLength * (double)vc.fProfileWidth );
+			double dT = -( ( (double)pfX[iQuery] - (double)line.fX1 ) * dDY - ( (double)pfY[iQuery] - (double)line.fY1 ) * dDX ) * dInvBand;
+			double dDepth = (double)line.iDepth;
+
+			if ( dT > -1.0 && dT < 1.0 )
+			{
+				double dSlope = ( CReference::Profile( vc.iProfile, dT + 1e-7 ) - CReference::Profile( vc.iProfile, dT - 1e-7 ) ) / 2e-7;
+
+				dGradX += dDepth * dSlope * -dDY * dInvBand;
+				dGradY += dDepth * dSlope * dDX * dInvBand;
+			}
+
+			dTolerance += fabs( dDepth ) * dInvBand * dLength * VERIFY_PROFILE_BEND * 2.0 / (double)FAULT_LUT_SIZE;
+		}
+
+		llRefTicks += Ticks() - llStart;
+
+		double dDifference = fabs( (double)pfGradX[iQuery] - dGradX ) + fabs( (double)pfGradY[iQuery] - dGradY );
+
+		dWorst = dDifference > dWorst ? dDifference : dWorst;
+
+		if ( dDifference > dTolerance && iWrong++ == 0 )
+		{
+			sprintf( szDetail, "(%g, %g) slopes %g, %g, expected %g, %g", pfX[iQuery], pfY[iQuery], pfGradX[iQuery], pfGradY[iQuery], dGradX, dGradY );
+		}
+	}
+
+	Record( "sample gradients", vc, dWorst, bFailed || iWrong > 0, bFailed ? sampler.GetError() : szDetail, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Erosion tiled as small as its halo allows, against the same erosion as
+//	one tile. Thermal steps alone must come out the same to within a unit
+//	of rounding, at rates too low to move a cell in one pass too. Droplets,
+//	which each tiling releases differently, must neither make nor lose
+//	material, in particular where they cross between tiles, which is
+//	checked on the heights before they are rounded as rounding many small
+//	moves is biased.
+//------------------------------------------------------------------------------
+void CVerifier::VerifyErosion( const VERIFYCASE& vc )
+{
+	CScratchArena* pArena = CScratchArena::ForThread();
+	CArenaScope scope( pArena );
+	CRandom random( vc.dwSeed );
+	int iTileSq = vc.iTileSq;
+	int iCells = iTileSq * iTileSq;
+	double* pdReference = (double*)pArena->Alloc( sizeof(double) * iCells );
+	double* pdResult = (double*)pArena->Alloc( sizeof(double) * iCells );
+	BYTE* pbCells = (BYTE*)pArena->Alloc( iCells );
+	EROSIONPARAMS params;
+	TCHAR szDetail[128];
+	LONGLONG llStart, llRefTicks, llTicks;
+	double dStart = 0.0;
+	int iCell;
+
+	if ( pdReference == NULL || pdResult == NULL || pbCells == NULL )
+	{
+		Record( "memory", vc, 0.0, TRUE, "out of memory for the erosion checks", 0, 0 );
+		return;
+	}
+
+	for ( iCell = 0; iCell < iCells; iCell++ )
+	{
+		dStart += (double)m_pbClamped[iCell];
+	}
+
+	CErosion::DefaultParams( &params );
+
+	params.dwSeed = vc.dwFaultSeed;
+	params.iPasses = 1 + (int)( random.Next() % 3 );
+	params.iThermalIterations = 1 + (int)( random.Next() % 4 );
+	params.fTalus = 4.f * random.NextFloat();
+	params.fThermalRate = random.Next() % 2 == 0 ? 0.01f : 0.25f * random.NextFloat();
+	params.iDropletsPerTile = 0;
+
+	m_terrain.SetTileSize( iTileSq );
+	m_terrain.MinHeight() = 0;
+	m_terrain.MaxHeight() = 255;
+
+	CHeightGrid& grid = m_terrain.HeightGrid();
+
+	grid.SetLayout( vc.iLayout );
+
+	for ( int iDroplets = 0; iDroplets < 2; iDroplets++ )
+	{
+		if ( iDroplets == 1 )
+		{
+			params.iDropletsPerTile = 16 + (int)( random.Next() % 128 );
+			params.iDropletLifetime = 4 + (int)( random.Next() % 12 );
+			params.iErosionRadius = 1 + (int)( random.Next() % 3 );
+		}
+
+		for ( int iTiled = 0; iTiled < 2; iTiled++ )
+		{
+			CErosion erosion( params );
+			EROSIONSTATS stats;
+
+			erosion.Params().iTileSize = iTiled == 1 ? 1 : iTileSq;
+			grid.FromColumns( m_pbClamped );
+
+			llStart = Ticks();
+			BOOL bEroded = erosion.Erode( &m_terrain, &stats );
+			llTicks = Ticks() - llStart;
+
+			grid.ToColumns( pbCells );
+
+			for ( iCell = 0; iCell < iCells; iCell++ )
+			{
+				pdResult[iCell] = (double)pbCells[iCell];
+			}
+
+			if ( iTiled == 0 )
+			{
+				memcpy( pdReference, pdResult, sizeof(double) * iCells );
+				llRefTicks = llTicks;
+			}
+			else if ( iDroplets == 0 )
+			{
+				Check( "erosion thermal tiled", vc, pdReference, pdResult, 1.0, llRefTicks, llTicks );
+			}
+
+			if ( iDroplets == 1 )
+			{
+				double dDifference = bEroded ? fabs( stats.dMassChange ) / dStart : 0.0;
+
+				sprintf( szDetail, "%s", bEroded ? "" : erosion.GetError() );
+
+				if ( dDifference > VERIFY_EROSION_MASS )
+				{
+					sprintf( szDetail, "the heights' sum moved %g, from %g", stats.dMassChange, dStart );
+					bEroded = FALSE;
+				}
+
+				Record( iTiled == 1 ? "erosion mass tiled" : "erosion mass", vc, dDifference, !bEroded, szDetail, llRefTicks, llTicks );
+			}
+			else if ( !bEroded )
+			{
+				Record( "erosion thermal tiled", vc, 0.0, TRUE, erosion.GetError(), llRefTicks, llTicks );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Compare a result with its reference, cell by cell
+//------------------------------------------------------------------------------
+void CVerifier::Check( LPCSTR szVariant, const VERIFYCASE& vc, const double* pdReference, const double* pdResult, double dTolerance, LONGLONG llRefTicks, LONGLONG llTicks )
+{
+	TCHAR szDetail[128];
+	int iTileSq = vc.iTileSq;
+	int iDiffering = 0;
+	int iFirst = -1;
+	double dWorst = 0.0;
+
+	for ( int iCell = 0; iCell < iTileSq * iTileSq; iCell++ )
+	{
+		double dDifference = fabs( pdResult[iCell] - pdReference[iCell] );
+
+		//	Written so that a NaN fails
+		//---------------------------------
+		if ( !( dDifference <= dTolerance ) )
+		{
+			iFirst = iFirst < 0 ? iCell : iFirst;
+			iDiffering++;
+		}
+
+		dWorst = dDifference > dWorst || dDifference != dDifference ? dDifference : dWorst;
+	}
+
+	szDetail[0] = 0;
+
+	if ( iFirst >= 0 )
+	{
+		sprintf( szDetail, "%d cells differ, first at (%d, %d): %.9g against %.9g", iDiffering, iFirst / iTileSq, iFirst % iTileSq, pdResult[iFirst], pdReference[iFirst] );
+	}
+
+	Record( szVariant, vc, dWorst, iDiffering > 0, szDetail, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Compare two files byte for byte
+//------------------------------------------------------------------------------
+void CVerifier::CheckFiles( LPCSTR szVariant, const VERIFYCASE& vc, LPCSTR szReference, LPCSTR szResult, LONGLONG llRefTicks, LONGLONG llTicks )
+{
+	TCHAR szDetail[128];
+	FILE* pfReference = fopen( szReference, "rb" );
+	FILE* pfResult = fopen( szResult, "rb" );
+	long lOffset = 0;
+	long lDiffering = 0;
+	long lFirst = -1;
+
+	if ( pfReference == NULL || pfResult == NULL )
+	{
+		sprintf( szDetail, "unable to read %.100s", pfResult == NULL ? szResult : szReference );
+		lDiffering = 1;
+	}
+	else
+	{
+		for ( ;; )
+		{
+			int iReference = fgetc( pfReference );
+			int iResult = fgetc( pfResult );
+
+			if ( iReference == EOF && iResult == EOF )
+			{
+				break;
+			}
+
+			if ( iReference != iResult )
+			{
+				lFirst = lFirst < 0 ? lOffset : lFirst;
+				lDiffering++;
+			}
+
+			lOffset++;
+		}
+
+		sprintf( szDetail, "%ld of %ld bytes differ, first at %ld", lDiffering, lOffset, lFirst );
+	}
+
+	if ( pfReference != NULL )
+	{
+		fclose( pfReference );
+	}
+
+	if ( pfResult != NULL )
+	{
+		fclose( pfResult );
+	}
+
+	DeleteFile( szResult );
+
+	Record( szVariant, vc, (double)lDiffering, lDiffering > 0, szDetail, llRefTicks, llTicks );
+}
+
+//------------------------------------------------------------------------------
+//	Add one case's outcome to the variant's totals, printing it if it failed
+//------------------------------------------------------------------------------
+void CVerifier::Record( LPCSTR szVariant, const VERIFYCASE& vc, double dDifference, BOOL bFailed, LPCSTR szDetail, LONGLONG llRefTicks, LONGLONG llTicks )
+{
+	VERIFYVARIANT* pVariant = NULL;
+
+	for ( int iVariant = 0; iVariant < m_iVariants && pVariant == NULL; iVariant++ )
+	{
+		if ( strcmp( m_aVariants[iVariant].szName, szVariant ) == 0 )
+		{
+			pVariant = &m_aVariants[iVariant];
+		}
+	}
+
+	if ( pVariant == NULL && m_iVariants < VERIFY_MAX_VARIANTS )
+	{
+		pVariant = &m_aVariants[m_iVariants++];
+
+		memset( pVariant, 0, sizeof(VERIFYVARIANT) );
+		strncpy( pVariant->szName, szVariant, sizeof(pVariant->szName) - 1 );
+	}
+
+	if ( pVariant != NULL )
+	{
+		pVariant->iCases++;
+		pVariant->iFailed += bFailed ? 1 : 0;
+		pVariant->dWorst = dDifference > pVariant->dWorst || dDifference != dDifference ? dDifference : pVariant->dWorst;
+		pVariant->dRefSeconds += (double)llRefTicks * m_dTickSeconds;
+		pVariant->dSeconds += (double)llTicks * m_dTickSeconds;
+	}
+
+	if ( bFailed )
+	{
+		m_iFailures++;
+
+		printf( "FAILED %s, case %lu (size %d, %s, %d faults%s): %s\n", szVariant, (unsigned long)vc.dwSeed, vc.iTileSq, s_aszLayoutNames[vc.iLayout],
+				vc.iIterations, vc.bLogistic ? ", logistic" : "", szDetail );
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Print each variant's totals and its speed against the reference
+//------------------------------------------------------------------------------
+void CVerifier::Report()
+{
+	int iChecks = 0;
+
+	printf( "\n%-22s %6s %7s %12s %10s %10s %8s\n", "variant", "cases", "failed", "worst", "ref ms", "ms", "speedup" );
+
+	for ( int iVariant = 0; iVariant < m_iVariants; iVariant++ )
+	{
+		const VERIFYVARIANT& variant = m_aVariants[iVariant];
+
+		printf( "%-22s %6d %7d %12.6g %10.2f %10.2f %7.1fx\n", variant.szName, variant.iCases, variant.iFailed, variant.dWorst,
+				variant.dRefSeconds * 1000.0, variant.dSeconds * 1000.0, variant.dSeconds > 0.0 ? variant.dRefSeconds / variant.dSeconds : 0.0 );
+
+		iChecks += variant.iCases;
+	}
+
+	printf( "\n%d of %d checks failed\n", m_iFailures, iChecks );
+}
+
+//------------------------------------------------------------------------------
+//	Cells in any FAULTCELL type and layout to and from column-major doubles
+//------------------------------------------------------------------------------
+void CVerifier::ToColumns( const void* pvCells, int iCellType, int iLayout, int iTileSq, double* pdColumns )
+{
+	for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+	{
+		for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+		{
+			int iOffset = CHeightGrid::LayoutOffset( iLayout, iTileSq, iXPos, iYPos );
+			double& dColumn = pdColumns[iXPos * iTileSq + iYPos];
+
+			switch ( iCellType )
+			{
+				case FAULT_CELL_U8:		dColumn = (double)( (const BYTE*)pvCells )[iOffset];		break;
+				case FAULT_CELL_U16:	dColumn = (double)( (const WORD*)pvCells )[iOffset];		break;
+				case FAULT_CELL_I32:	dColumn = (double)( (const INT*)pvCells )[iOffset];			break;
+				case FAULT_CELL_F32:	dColumn = (double)( (const FLOAT*)pvCells )[iOffset];		break;
+				case FAULT_CELL_F64:	dColumn = ( (const double*)pvCells )[iOffset];				break;
+			}
+		}
+	}
+}
+
+void CVerifier::FillCells( void* pvCells, int iCellType, int iLayout, int iTileSq, const double* pdColumns )
+{
+	for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+	{
+		for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+		{
+			int iOffset = CHeightGrid::LayoutOffset( iLayout, iTileSq, iXPos, iYPos );
+			double dColumn = pdColumns[iXPos * iTileSq + iYPos];
+
+			switch ( iCellType )
+			{
+				case FAULT_CELL_U8:		( (BYTE*)pvCells )[iOffset] = (BYTE)dColumn;		break;
+				case FAULT_CELL_U16:	( (WORD*)pvCells )[iOffset] = (WORD)dColumn;		break;
+				case FAULT_CELL_I32:	( (INT*)pvCells )[iOffset] = (INT)dColumn;			break;
+				case FAULT_CELL_F32:	( (FLOAT*)pvCells )[iOffset] = (FLOAT)dColumn;		break;
+				case FAULT_CELL_F64:	( (double*)pvCells )[iOffset] = dColumn;			break;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Whether the bytes past each of a raster's rows still hold the guard
+//------------------------------------------------------------------------------
+BOOL CVerifier::CheckPadding( const void* pvCells, int iPitch, int iTileSq, int iCellSize )
+{
+	for ( int iRow = 0; iRow < iTileSq; iRow++ )
+	{
+		const BYTE* pbRow = (const BYTE*)pvCells + iRow * iPitch * iCellSize;
+
+		for ( int iByte = iTileSq * iCellSize; iByte < iPitch * iCellSize; iByte++ )
+		{
+			if ( pbRow[iByte] != VERIFY_RASTER_GUARD )
+			{
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+//------------------------------------------------------------------------------
+//	A row-major raster of any FAULTCELL type, rows iPitch cells apart, to
+//	and from column-major doubles
+//------------------------------------------------------------------------------
+void CVerifier::RasterToColumns( const void* pvCells, int iCellType, int iPitch, int iTileSq, double* pdColumns )
+{
+	for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+	{
+		for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+		{
+			int iOffset = iYPos * iPitch + iXPos;
+			double& dColumn = pdColumns[iXPos * iTileSq + iYPos];
+
+			switch ( iCellType )
+			{
+				case FAULT_CELL_U8:		dColumn = (double)( (const BYTE*)pvCells )[iOffset];		break;
+				case FAULT_CELL_U16:	dColumn = (double)( (const WORD*)pvCells )[iOffset];		break;
+				case FAULT_CELL_I32:	dColumn = (double)( (const INT*)pvCells )[iOffset];			break;
+				case FAULT_CELL_F32:	dColumn = (double)( (const FLOAT*)pvCells )[iOffset];		break;
+				case FAULT_CELL_F64:	dColumn = ( (const double*)pvCells )[iOffset];				break;
+			}
+		}
+	}
+}
+
+void CVerifier::ColumnsToRaster( void* pvCells, int iCellType, int iPitch, int iTileSq, const double* pdColumns )
+{
+	for ( int iXPos = 0; iXPos < iTileSq; iXPos++ )
+	{
+		for ( int iYPos = 0; iYPos < iTileSq; iYPos++ )
+		{
+			int iOffset = iYPos * iPitch + iXPos;
+			double dColumn = pdColumns[iXPos * iTileSq + iYPos];
+
+			switch ( iCellType )
+			{
+				case FAULT_CELL_U8:		( (BYTE*)pvCells )[iOffset] = (BYTE)dColumn;		break;
+				case FAULT_CELL_U16:	( (WORD*)pvCells )[iOffset] = (WORD)dColumn;		break;
+				case FAULT_CELL_I32:	( (INT*)pvCells )[iOffset] = (INT)dColumn;			break;
+				case FAULT_CELL_F32:	( (FLOAT*)pvCells )[iOffset] = (FLOAT)dColumn;		break;
+				case FAULT_CELL_F64:	( (double*)pvCells )[iOffset] = dColumn;			break;
+			}
+		}
+	}
+}
+
+LONGLONG CVerifier::Ticks()
+{
+	LARGE_INTEGER liNow;
+
+	QueryPerformanceCounter( &liNow );
+
+	return liNow.QuadPart;
+}
@@ -0,0 +1,196 @@
+/*--------------------------------------------------------------------------------
+
+	Verify.h
+
+	Provides a differential check of the optimized terrain operations
+	against the reference implementations, over randomized cases
+
+
+	History:
+
+	Created by Scott Wakeling
+
+--------------------------------------------------------------------------------*/
+
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+//-------------
+//	Includes
+//-------------
+#include "Reference.h"
+
+//-----------------
+//	Definitions
+//-----------------
+#define VERIFY_DEFAULT_CASES	20
+#define VERIFY_MAX_VARIANTS		96
+#define VERIFY_MAX_SIZE			256		// Largest tile a case uses
+#define VERIFY_MAX_ITERATIONS	48
+#define VERIFY_WRITER_BUFFERS	2		// For the overlapped pipeline saves
+#define VERIFY_RASTER_PADDING	7		// Raster rows get 1 to this many cells of padding
+#define VERIFY_RASTER_GUARD		0xA5	// Byte the padding holds
+
+//	A profile's table is read at the nearest of FAULT_LUT_SIZE intervals
+//	over [-1, 1], so each fault may be off by its depth times the steepest
+//	slope (the sigmoid's, about 3) over FAULT_LUT_SIZE, plus rounding
+//--------------------------------------------------------------------------
+#define VERIFY_PROFILE_SLOPE	4.0
+#define VERIFY_ROUNDING			1e-3
+
+//	The sweep and the reference iterate the same single precision orbits,
+//	so exponents only differ by how their logs are summed
+//--------------------------------------------------------------------------
+#define VERIFY_LOGISTIC_COLUMNS	5
+#define VERIFY_LOGISTIC_SEEDS	6
+#define VERIFY_LYAPUNOV			1e-4
+
+//	Sampling takes more queries than a batch the scheduler splits, and not
+//	a whole number of blocks. Single precision interpolation of BYTE
+//	heights is held to VERIFY_SAMPLE_ROUNDING of them. A profile's gradient
+//	is its table's slope, off the curve's by at most the curve's steepest
+//	bend (the sigmoid's, about 7) over the table's spacing.
+//--------------------------------------------------------------------------
+#define VERIFY_SAMPLES			( SAMPLE_PARALLEL + 19 )
+#define VERIFY_SAMPLE_ROUNDING	1e-5
+#define VERIFY_PROFILE_BEND		8.0
+
+//	Spectral surfaces are measured by their variogram at lags up to a
+//	sixteenth of the tile. On a finite lattice that reads the ends of the
+//	range toward the middle, about 0.15 high at D = 2 and 0.25 low at D = 3,
+//	so each target gets this much slack, and must still read higher than
+//	the one below it.
+//--------------------------------------------------------------------------
+#define VERIFY_SPECTRAL_SIZE	128
+#define VERIFY_SPECTRAL_STEPS	5			// Targets 2, 2.25 .. 3
+#define VERIFY_DIMENSION		0.3
+
+//	Erosion moves material between float heights, so their sum may only
+//	drift by single precision rounding, this fraction of it over a run
+//--------------------------------------------------------------------------
+#define VERIFY_EROSION_MASS		1e-6
+
+//	One randomized case, everything a failure needs to be reproduced
+//---------------------------------------------------------------------
+typedef struct tagVERIFYCASE
+{
+	DWORD	dwSeed;				// -verify 1 <dwSeed> runs this case alone
+	int		iTileSq;
+	int		iLayout;			// GRIDLAYOUT for the tile level operations
+	int		iIterations;
+	int		iDepthInit;
+	int		iDepthEnd;
+	int		iFixedFaultDepth;
+	int		iMinHeight;
+	int		iMaxHeight;
+	int		iClear;				// Height the faults start from
+	DWORD	dwFaultSeed;		// Places faults, never 0 as that takes the clock
+	BOOL	bLogistic;
+	FLOAT	fLogM;
+	FLOAT	fLogSeed;
+	int		iProfile;			// Smooth FAULTPROFILE for the profile variants
+	FLOAT	fProfileWidth;
+	int		iBlurFactor;
+} VERIFYCASE;
+
+//	Totals for one optimized variant
+//--------------------------------------
+typedef struct tagVERIFYVARIANT
+{
+	TCHAR	szName[32];
+	int		iCases;
+	int		iFailed;
+	double	dWorst;				// Largest difference from the reference
+	double	dRefSeconds;		// Reference time over the same cases
+	double	dSeconds;
+} VERIFYVARIANT;
+
+//------------------------------------------------------------------------------
+//	A differential verifier
+//
+//	Each case draws a tile size, fault run and heights from its seed, runs
+//	the reference for each operation once and every optimized variant of it
+//	from the same start: the fault kernel for each cell type and layout, a
+//	split retained run as checkpoints make, the smooth profiles, the SSE2
+//	threaded quantizer, the layout aware blur, fractal dimension and save,
+//	whole pipelines with synchronous and overlapped writes, and faults run
+//	on a background CGenerationTask, paused, resumed, cancelled and tuned,
+//	and the C interface on padded rasters. A small logistic sweep checks its
+//	exponents against logs summed every step, spectral surfaces against the
+//	fractal dimension asked for, depression filling and flow
+//	are checked against a fill swept to a fixed point, contour lines
+//	against each square's own segments, and batched height queries against
+//	the textbook interpolants and the kernel's own run, and tiled erosion
+//	against the same erosion as one tile.
+//
+//	Integer results and files must match the reference exactly. Smooth
+//	profiles are held to the table's tolerance. A failing case prints its
+//	seed and first differing cell as it happens, and the run ends with a
+//	table of each variant's worst difference and speed against its
+//	reference.
+//------------------------------------------------------------------------------
+class CVerifier
+{
+public:
+	//----------------------------------
+	//	Construction and Destruction
+	//----------------------------------
+	CVerifier();
+	virtual ~CVerifier();
+
+	//-------------------------
+	//	CVerifier Interface
+	//-------------------------
+	BOOL Run( int iCases, DWORD dwSeed );
+	int Failures();
+
+private:
+	void MakeCase( DWORD dwSeed, VERIFYCASE* pCase );
+	void MakePass( const VERIFYCASE& vc, void* pvCells, int iCellType, int iLayout, BOOL bRetain, int iProfile, FAULTPASS* pPass );
+
+	void VerifyFaults( const VERIFYCASE& vc );
+	void VerifyProfiles( const VERIFYCASE& vc );
+	void VerifyQuantize( const VERIFYCASE& vc );
+	void VerifyTerrain( const VERIFYCASE& vc );
+	void VerifyPipeline( const VERIFYCASE& vc, BOOL bAsync );
+	void VerifyTask( const VERIFYCASE& vc );
+	void VerifyTuning( const VERIFYCASE& vc );
+	void VerifyRaster( const VERIFYCASE& vc );
+	void VerifyLogistic( const VERIFYCASE& vc );
+	void VerifySpectral( const VERIFYCASE& vc );
+	void VerifyDrainage( const VERIFYCASE& vc );
+	void VerifyContours( const VERIFYCASE& vc );
+	void VerifySampling( const VERIFYCASE& vc );
+	void VerifyErosion( const VERIFYCASE& vc );
+
+	void Check( LPCSTR szVariant, const VERIFYCASE& vc, const double* pdReference, const double* pdResult, double dTolerance, LONGLONG llRefTicks, LONGLONG llTicks );
+	void CheckFiles( LPCSTR szVariant, const VERIFYCASE& vc, LPCSTR szReference, LPCSTR szResult, LONGLONG llRefTicks, LONGLONG llTicks );
+	void Record( LPCSTR szVariant, const VERIFYCASE& vc, double dDifference, BOOL bFailed, LPCSTR szDetail, LONGLONG llRefTicks, LONGLONG llTicks );
+	void Report();
+
+	static void ToColumns( const void* pvCells, int iCellType, int iLayout, int iTileSq, double* pdColumns );
+	static void FillCells( void* pvCells, int iCellType, int iLayout, int iTileSq, const double* pdColumns );
+	static BOOL CheckPadding( const void* pvCells, int iPitch, int iTileSq, int iCellSize );
+	static void RasterToColumns( const void* pvCells, int iCellType, int iPitch, int iTileSq, double* pdColumns );
+	static void ColumnsToRaster( void* pvCells, int iCellType, int iPitch, int iTileSq, const double* pdColumns );
+	static LONGLONG Ticks();
+
+	VERIFYVARIANT m_aVariants[VERIFY_MAX_VARIANTS];
+	int m_iVariants;
+	int m_iFailures;
+	double m_dTickSeconds;
+
+	CTerrain m_terrain;
+	CRandom m_random;				// Fault streams, restarted by MakePass
+	CLogFunc m_logFunc;
+	TCHAR m_szReferenceFile[MAX_PATH];
+	TCHAR m_szResultFile[MAX_PATH];
+
+	//	Per-case state
+	//--------------------
+	BYTE* m_pbClamped;				// Reference clamped faults, column-major
+	double* m_pdRetained;			// Reference retained faults
+	double* m_pdStart;				// Heights the retained runs start from
+};
+
+#endif
@@ -15,10 +15,22 @@
 //	Includes
 //--------------
 #include <stdio.h>
+#include <ctype.h>
 #include <windows.h>
 
 #include "resource.h"
 #include "Terrain.h"
+#include "Erosion.h"
+#include "Pipeline.h"
+#include "Batch.h"
+#include "Arena.h"
+#include "FaultKernel.h"
+#include "Spectral.h"
+#include "TileServer.h"
+#include "Trace.h"
+#include "Verify.h"
+#include "Generate.h"
+#include "Logistic.h"
 
 //-------------
 //	Globals
@@ -27,7 +39,9 @@ char szWinName[] = "CHAOSWindow";
 HINSTANCE g_hGlobalInstance;
 HWND g_hWnd;
 CTerrain terrTile;
+CGenerationTask g_generation;		// After terrTile, so it is stopped before the tile goes
 CLogFunc g_LogFunc;
+TCHAR g_szTraceFile[MAX_PATH];
 
 //-----------------
 //	Definitions
@@ -38,6 +52,11 @@ BOOL FAR PASCAL SetGridDialog( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 int ProcMenuEvent( HWND hWnd, WPARAM wParam, LPARAM lParam );
 int ProcKeyEvent( HWND hWnd, WPARAM wParam, LPARAM lParam );
 int ProcMouseEvent( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam );
+BOOL ProcCommandLine( LPSTR lpszCmdArguments, int* piExitCode );
+int SplitCommandLine( LPSTR lpszCmdArguments, char** aszArgs, int iMaxArgs );
+void ShowGenerationTitle( HWND hWnd );
+void PrintCacheStats( CResultCache* pCache );
+void FinishTrace();
 
 //---------------------------------------------------------------
 //	Main entry point for the application
@@ -53,6 +72,15 @@ int WINAPI WinMain(	HINSTANCE hThisAppInstance,
 	WNDCLASSEX wndClass;
 	g_hGlobalInstance = hThisAppInstance;
 	TCHAR acBuffer[MAX_PATH];
+	int iExitCode;
+
+	//	Headless modes run and exit without ever opening the window
+	//-----------------------------------------------------------------
+	if ( ProcCommandLine( lpszCmdArguments, &iExitCode ) )
+	{
+		FinishTrace();
+		return iExitCode;
+	}
 	
 	wndClass.cbSize			= sizeof(WNDCLASSEX);
 	wndClass.hInstance		= g_hGlobalInstance;
@@ -93,6 +121,8 @@ int WINAPI WinMain(	HINSTANCE hThisAppInstance,
 		DispatchMessage( &message );
 	}
 
+	FinishTrace();
+
 	return message.wParam;
 }
 
@@ -106,10 +136,30 @@ LRESULT CALLBACK WindowProc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
 	{
 		case WM_PAINT:
 			hdc = BeginPaint( hWnd, &ps );
-			terrTile.Draw( hWnd, hdc, -1, -1 );
+
+			if ( g_generation.Busy() )
+			{
+				g_generation.Draw( hWnd, hdc );
+			}
+			else
+			{
+				terrTile.Draw( hWnd, hdc, -1, -1 );
+			}
+
 			EndPaint( hWnd, &ps );
 		break;
 
+		case WM_GENERATE_SNAPSHOT:
+			ShowGenerationTitle( hWnd );
+			InvalidateRect( hWnd, NULL, FALSE );
+		break;
+
+		case WM_GENERATE_FINISHED:
+			ShowGenerationTitle( hWnd );
+			CheckMenuItem( GetMenu( hWnd ), CHAOS_TERRAIN_PAUSE, MF_BYCOMMAND | MF_UNCHECKED );
+			InvalidateRect( hWnd, NULL, TRUE );
+		break;
+
 		case WM_COMMAND:
 			ProcMenuEvent( hWnd, wParam, lParam );
 		break;
@@ -155,6 +205,27 @@ LRESULT CALLBACK WindowProc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
 //----------------------------------------
 int ProcMenuEvent( HWND hWnd, WPARAM wParam, LPARAM lParam )
 {
+	//	While faults run in the background the tile is theirs, so only
+	//	the commands that leave it alone are taken, and new fault
+	//	settings, which replace the run
+	//---------------------------------------------------------------------
+	if ( g_generation.Busy() )
+	{
+		switch( LOWORD( wParam ) )
+		{
+			case CHAOS_FILE_EXIT:
+			case CHAOS_TERRAIN_PAUSE:
+			case CHAOS_TERRAIN_CANCEL:
+			case CHAOS_TERRAIN_REFRESH:
+			case CHAOS_TERRAIN_FAULTFORMATION:
+			break;
+
+			default:
+				MessageBeep( MB_ICONEXCLAMATION );
+				return 1;
+		}
+	}
+
 	switch( LOWORD( wParam ) )
 	{
 		//-----------------------
@@ -172,6 +243,43 @@ int ProcMenuEvent( HWND hWnd, WPARAM wParam, LPARAM lParam )
 		}
 		break;
 
+		case CHAOS_FILE_PIPELINE:
+		{
+			TCHAR szFilenameBuffer[MAX_PATH];
+			OPENFILENAME ofn;
+
+			szFilenameBuffer[0] = 0;
+			memset( &ofn, 0, sizeof(ofn) );
+
+			ofn.lStructSize			= sizeof(OPENFILENAME);
+			ofn.hwndOwner			= hWnd;
+			ofn.lpstrFilter			= TEXT( "Pipeline (*.txt)\0*.txt\0" );
+			ofn.lpstrFile			= &szFilenameBuffer[0];
+			ofn.nMaxFile			= MAX_PATH;
+			ofn.lpstrTitle			= TEXT( "Run Pipeline" );
+			ofn.Flags				= OFN_FILEMUSTEXIST;
+
+			if ( GetOpenFileName( &ofn ) )
+			{
+				char acBuffer[MAX_PATH];
+				CPipeline pipeline;
+				PIPELINESTATS stats;
+
+				memset( &stats, 0, sizeof(stats) );
+
+				if ( !pipeline.Load( szFilenameBuffer ) || !pipeline.Execute( &terrTile, TRUE, hWnd, &stats ) )
+				{
+					MessageBox( hWnd, pipeline.GetError(), "Pipeline", MB_OK | MB_ICONERROR );
+				}
+				else
+				{
+					sprintf( acBuffer, "%d stages in %d grid passes\nMin %d, Max %d, Mean %.1f", pipeline.StageCount(), stats.iGridPasses, stats.iMin, stats.iMax, stats.fMean );
+					MessageBox( hWnd, acBuffer, "Pipeline", MB_OK );
+				}
+			}
+		}
+		break;
+
 		case CHAOS_FILE_SAVEAS:
 		{
             TCHAR szFilenameBuffer[MAX_PATH];
@@ -249,6 +357,29 @@ int ProcMenuEvent( HWND hWnd, WPARAM wParam, LPARAM lParam )
 			DialogBox( g_hGlobalInstance, MAKEINTRESOURCE(IDD_FAULTDLG), hWnd, (DLGPROC)FaultLineDialog );
 		}
 		break;
+
+		case CHAOS_TERRAIN_PAUSE:
+		{
+			if ( g_generation.State() == GENERATE_PAUSED )
+			{
+				g_generation.Resume();
+				CheckMenuItem( GetMenu( hWnd ), CHAOS_TERRAIN_PAUSE, MF_BYCOMMAND | MF_UNCHECKED );
+			}
+			else if ( g_generation.State() == GENERATE_RUNNING )
+			{
+				g_generation.Pause();
+				CheckMenuItem( GetMenu( hWnd ), CHAOS_TERRAIN_PAUSE, MF_BYCOMMAND | MF_CHECKED );
+			}
+
+			ShowGenerationTitle( hWnd );
+		}
+		break;
+
+		case CHAOS_TERRAIN_CANCEL:
+		{
+			g_generation.Cancel();
+		}
+		break;
 		
 		case CHAOS_TERRAIN_BLUR:
 		{
@@ -261,6 +392,40 @@ int ProcMenuEvent( HWND hWnd, WPARAM wParam, LPARAM lParam )
             terrTile.Blur( 4 );
 		}
 		break;
+
+		case CHAOS_TERRAIN_ERODE:
+		{
+			char acBuffer[MAX_PATH];
+			EROSIONSTATS stats;
+			CErosion erosion;
+
+			erosion.Params().dwSeed = (DWORD)rand();
+
+			if ( !erosion.Erode( &terrTile, &stats ) )
+			{
+				MessageBox( hWnd, erosion.GetError(), "Erosion", MB_OK | MB_ICONERROR );
+				break;
+			}
+
+			sprintf( acBuffer, "Eroded %d tiles on %d threads in %.2fs\n%.0f cells/s per core", stats.iTiles, stats.iThreads, stats.dSeconds, stats.dCellsPerSecPerCore );
+			MessageBox( hWnd, acBuffer, "Erosion", MB_OK );
+		}
+		break;
+
+		case CHAOS_TERRAIN_SPECTRAL:
+		{
+			char acBuffer[MAX_PATH];
+
+			if ( !terrTile.GenerateSpectral( SPECTRAL_DEFAULT_DIMENSION, (DWORD)rand() ) )
+			{
+				MessageBox( hWnd, CSpectralSynth::IsPowerOfTwo( terrTile.TileSize() ) ? "Out of memory for spectral synthesis" : "Spectral synthesis needs a power of two tile size", "Spectral Synthesis", MB_OK | MB_ICONERROR );
+				break;
+			}
+
+			sprintf( acBuffer, "Target Fractal Dimension: %.3f\nMeasured Fractal Dimension: %.3f", SPECTRAL_DEFAULT_DIMENSION, terrTile.CalcFractalDimension() );
+			MessageBox( hWnd, acBuffer, "Spectral Synthesis", MB_OK );
+		}
+		break;
 	}
 	
 	return 1;
@@ -278,6 +443,14 @@ BOOL FAR PASCAL FaultLineDialog( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
 			SendDlgItemMessage( hWnd, IDC_ITERATION_NUM, WM_SETTEXT, 0, (LPARAM)(LPCTSTR)"512" );
 			SendDlgItemMessage( hWnd, IDC_FAULTDEPTH_START, WM_SETTEXT, 0, (LPARAM)(LPCTSTR)"10" );
 			SendDlgItemMessage( hWnd, IDC_FAULTDEPTH_FINISH, WM_SETTEXT, 0, (LPARAM)(LPCTSTR)"1" );
+
+			//	In FAULTPROFILE order
+			//--------------------------
+			SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_ADDSTRING, 0, (LPARAM)(LPCTSTR)"Step" );
+			SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_ADDSTRING, 0, (LPARAM)(LPCTSTR)"Linear" );
+			SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_ADDSTRING, 0, (LPARAM)(LPCTSTR)"Cosine" );
+			SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_ADDSTRING, 0, (LPARAM)(LPCTSTR)"Sigmoid" );
+			SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_SETCURSEL, FAULT_PROFILE_STEP, 0 );
 		}
 		break;
 
@@ -289,6 +462,18 @@ BOOL FAR PASCAL FaultLineDialog( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
 					char acBuffer[64];
 					int iIterations, iFaultDepthStart, iFaultDepthFinish, iFixedFaultDepth, iNumChars;
 					bool bUseLogisticFunc, bRetainAllValues;
+					BOOL bTune = IsDlgButtonChecked( hWnd, IDC_CHK_TUNE ) == BST_CHECKED;
+
+					//	New settings for a run still going stop it where it
+					//	is and tune it to them, rather than start over from
+					//	its half done tile
+					//-----------------------------------------------------------
+					if ( g_generation.Busy() )
+					{
+						g_generation.Cancel();
+						g_generation.Wait( INFINITE );
+						bTune = TRUE;
+					}
 
 					//------------------------------
 					//	Get number of iterations
@@ -343,7 +528,44 @@ BOOL FAR PASCAL FaultLineDialog( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
 					
 					bRetainAllValues = IsDlgButtonChecked( hWnd, IDC_CHK_RETAINALL ) == BST_CHECKED ? true : false;
 
-					terrTile.GenerateFaultLines( iIterations, iFaultDepthStart, iFaultDepthFinish, iFixedFaultDepth, bUseLogisticFunc, bRetainAllValues, hWnd );
+					//	The faults run in the background, drawing as they go,
+					//	so the window carries on while they do. Tuning the
+					//	last run keeps its faults and only redoes the change.
+					//-----------------------------------------------------------
+					FAULTRUN run;
+
+					run.iIterations = iIterations;
+					run.iDepthInit = iFaultDepthStart;
+					run.iDepthEnd = iFaultDepthFinish;
+					run.iFixedFaultDepth = iFixedFaultDepth;
+					run.bUseLogisticFunc = bUseLogisticFunc;
+					run.bRetainAllValues = bRetainAllValues;
+					run.fLogM = g_LogFunc.M();
+					run.fLogSeed = g_LogFunc.Seed();
+					run.iProfile = (int)SendDlgItemMessage( hWnd, IDC_FAULTPROFILE, CB_GETCURSEL, 0, 0 );
+					run.fProfileWidth = FAULT_PROFILE_WIDTH;
+
+					BOOL bStarted;
+
+					//	A rough look in milliseconds, then the real thing
+					//-------------------------------------------------------
+					g_generation.SetPreview( TRUE );
+
+					if ( bTune )
+					{
+						bStarted = g_generation.Tune( &terrTile, run, GENERATE_SNAPSHOT_FAULTS, g_hWnd );
+					}
+					else
+					{
+						bStarted = g_generation.Start( &terrTile, run, GENERATE_SNAPSHOT_FAULTS, g_hWnd );
+					}
+
+					if ( !bStarted )
+					{
+						MessageBox( hWnd, g_generation.GetError(), "Fault line formation", MB_OK | MB_ICONERROR );
+					}
+
+					ShowGenerationTitle( g_hWnd );
 					EndDialog( hWnd, TRUE );
 				}
 				break;
@@ -512,3 +734,309 @@ int ProcMouseEvent( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam )
 
 	return 1;
 }
+
+//-------------------------------------------------------------------------
+//	Split a command line into arguments, honouring double quotes
+//
+//	Note: Modifies the command line in place
+//-------------------------------------------------------------------------
+int SplitCommandLine( LPSTR lpszCmdArguments, char** aszArgs, int iMaxArgs )
+{
+	int iArgs = 0;
+	char* pc = lpszCmdArguments;
+
+	while ( *pc != 0 && iArgs < iMaxArgs )
+	{
+		while ( *pc == ' ' || *pc == '\t' )
+		{
+			pc++;
+		}
+
+		if ( *pc == 0 )
+		{
+			break;
+		}
+
+		char cEnd = ' ';
+
+		if ( *pc == '"' )
+		{
+			cEnd = '"';
+			pc++;
+		}
+
+		aszArgs[iArgs++] = pc;
+
+		while ( *pc != 0 && *pc != cEnd && ( cEnd == '"' || *pc != '\t' ) )
+		{
+			pc++;
+		}
+
+		if ( *pc != 0 )
+		{
+			*pc++ = 0;
+		}
+	}
+
+	return iArgs;
+}
+
+//-------------------------------------------------
+//	Summarise a -cache result cache's use, if any
+//-------------------------------------------------
+void PrintCacheStats( CResultCache* pCache )
+{
+	RESULTCACHESTATS stats;
+
+	if ( pCache != NULL )
+	{
+		pCache->GetStats( &stats );
+
+		printf( "Result cache: %d hits, %d misses, %d stored, %d evicted\n", stats.iHits, stats.iMisses, stats.iStores, stats.iEvictions );
+	}
+}
+
+//---------------------------------------------------------------------
+//	Run any headless mode asked for on the command line
+//
+//	Returns TRUE if the command line was handled and the application
+//	should exit with *piExitCode rather than open its window
+//
+//		-pipeline <config>		Run a pipeline config, see CPipeline
+//		-batch <jobs> [buffers]	Run a list of pipeline configs with their
+//								writes overlapped, see CBatch. A summary
+//								is printed to stdout.
+//		-verify [cases] [seed]	Check the optimized operations against
+//								their references over randomized cases,
+//								see CVerifier. Exits with 1 on any
+//								difference.
+//		-logistic <prefix> [min M] [max M] [columns] [seeds]
+//								Sweep the logistic function, see
+//								CLogisticAnalysis, writing its CSV and
+//								images and printing a summary
+//
+//	Any may be preceded by
+//
+//		-largepages				Back scratch memory with large pages
+//		-trace <file>			Trace the run, written as Chrome trace
+//								JSON when the application exits
+//		-cache <dir> [MB]		Look pipeline generation up in a result
+//								cache kept in dir, see CResultCache
+//---------------------------------------------------------------------
+BOOL ProcCommandLine( LPSTR lpszCmdArguments, int* piExitCode )
+{
+	char* aszArgs[16];
+	int iArgs = SplitCommandLine( lpszCmdArguments, aszArgs, 16 );
+	CResultCache cache;
+	CResultCache* pCache = NULL;
+
+	*piExitCode = 0;
+
+	//	Large pages and tracing apply to whatever runs, headless or not
+	//---------------------------------------------------------------------
+	for ( ;; )
+	{
+		if ( iArgs > 0 && strcmp( aszArgs[0], "-largepages" ) == 0 )
+		{
+			CScratchArena::EnableLargePages();
+
+			iArgs--;
+			memmove( aszArgs, aszArgs + 1, iArgs * sizeof(char*) );
+		}
+		else if ( iArgs > 1 && strcmp( aszArgs[0], "-trace" ) == 0 )
+		{
+			strncpy( g_szTraceFile, aszArgs[1], MAX_PATH - 1 );
+			CTrace::Start( TRACE_DEFAULT_EVENTS );
+
+			iArgs -= 2;
+			memmove( aszArgs, aszArgs + 2, iArgs * sizeof(char*) );
+		}
+		else if ( iArgs > 1 && strcmp( aszArgs[0], "-cache" ) == 0 )
+		{
+			int iUsed = iArgs > 2 && isdigit( aszArgs[2][0] ) ? 3 : 2;
+			DWORD dwBudgetMB = iUsed == 3 ? (DWORD)atoi( aszArgs[2] ) : RESULTCACHE_DEFAULT_SIZE;
+
+			if ( cache.Open( aszArgs[1], dwBudgetMB ) )
+			{
+				pCache = &cache;
+			}
+			else
+			{
+				printf( "%s\n", cache.GetError() );
+			}
+
+			iArgs -= iUsed;
+			memmove( aszArgs, aszArgs + iUsed, iArgs * sizeof(char*) );
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if ( iArgs == 0 )
+	{
+		return FALSE;
+	}
+
+	if ( strcmp( aszArgs[0], "-pipeline" ) == 0 && iArgs == 2 )
+	{
+		CPipeline pipeline;
+
+		pipeline.SetCache( pCache );
+
+		if ( !pipeline.Load( aszArgs[1] ) || !pipeline.Execute( &terrTile, FALSE, NULL, NULL ) )
+		{
+			*piExitCode = 1;
+		}
+
+		PrintCacheStats( pCache );
+
+		return TRUE;
+	}
+
+	if ( strcmp( aszArgs[0], "-batch" ) == 0 && ( iArgs == 2 || iArgs == 3 ) )
+	{
+		CBatch batch;
+		BATCHSTATS stats;
+		int iBuffers = iArgs == 3 ? atoi( aszArgs[2] ) : BATCH_DEFAULT_BUFFERS;
+
+		memset( &stats, 0, sizeof(stats) );
+
+		batch.SetCache( pCache );
+
+		if ( !batch.Run( aszArgs[1], &terrTile, iBuffers, &stats ) )
+		{
+			printf( "%s\n", batch.GetError() );
+			*piExitCode = 1;
+		}
+
+		printf( "%d jobs (%d failed) in %.2fs, compute %.2fs, io %.2fs\n", stats.iJobs, stats.iFailed, stats.dWallSeconds, stats.dComputeSeconds, stats.dIoSeconds );
+
+		PrintCacheStats( pCache );
+
+		return TRUE;
+	}
+
+	if ( strcmp( aszArgs[0], "-verify" ) == 0 && iArgs <= 3 )
+	{
+		CVerifier verifier;
+		int iCases = iArgs >= 2 ? atoi( aszArgs[1] ) : VERIFY_DEFAULT_CASES;
+		DWORD dwSeed = iArgs == 3 ? (DWORD)strtoul( aszArgs[2], NULL, 10 ) : (DWORD)time( NULL );
+
+		if ( !verifier.Run( iCases, dwSeed ) )
+		{
+			*piExitCode = 1;
+		}
+
+		return TRUE;
+	}
+
+	if ( strcmp( aszArgs[0], "-logistic" ) == 0 && iArgs >= 2 && iArgs <= 6 )
+	{
+		CLogisticAnalysis analysis;
+		LOGISTICPARAMS params;
+
+		CLogisticAnalysis::DefaultParams( &params );
+
+		params.fMinM = iArgs >= 3 ? (FLOAT)atof( aszArgs[2] ) : params.fMinM;
+		params.fMaxM = iArgs >= 4 ? (FLOAT)atof( aszArgs[3] ) : params.fMaxM;
+		params.iColumns = iArgs >= 5 ? atoi( aszArgs[4] ) : params.iColumns;
+		params.iSeeds = iArgs == 6 ? atoi( aszArgs[5] ) : params.iSeeds;
+
+		if ( !analysis.Run( params ) || !analysis.Save( aszArgs[1] ) )
+		{
+			printf( "%s\n", analysis.GetError() );
+			*piExitCode = 1;
+
+			return TRUE;
+		}
+
+		//	The steadiest chaos is the column whose least chaotic seed is
+		//	the most chaotic
+		//-------------------------------------------------------------------
+		int iBest = 0;
+		int iChaotic = 0;
+
+		for ( int iColumn = 0; iColumn < analysis.Columns(); iColumn++ )
+		{
+			iBest = analysis.Column( iColumn ).fMinExponent > analysis.Column( iBest ).fMinExponent ? iColumn : iBest;
+			iChaotic += analysis.Column( iColumn ).fChaotic == 1.f;
+		}
+
+		const LOGISTICCOLUMN& best = analysis.Column( iBest );
+
+		printf( "%d of %d values of M are chaotic for every seed\n", iChaotic, analysis.Columns() );
+		printf( "Most chaotic: M %.4f, exponents %.3f to %.3f, covering %.0f%% of [0, 1]\n", best.fM, best.fMinExponent, best.fMaxExponent, best.fCoverage * 100.f );
+
+		return TRUE;
+	}
+
+	if ( strcmp( aszArgs[0], "-serve" ) == 0 && iArgs <= 3 )
+	{
+		CTileServer server;
+		int iPort = iArgs >= 2 ? atoi( aszArgs[1] ) : TILESERVER_DEFAULT_PORT;
+		int iCacheMB = iArgs == 3 ? atoi( aszArgs[2] ) : TILESERVER_DEFAULT_CACHE;
+
+		if ( !server.Start( iPort, 0, (DWORD)iCacheMB * 1024 * 1024 ) )
+		{
+			printf( "%s\n", server.GetError() );
+			*piExitCode = 1;
+
+			return TRUE;
+		}
+
+		printf( "Serving tiles on http://127.0.0.1:%d/\n", iPort );
+
+		server.Wait();
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+//-----------------------------------------------------------------
+//	Show how far background faults have got in the title bar, or
+//	just the filename once they have finished
+//-----------------------------------------------------------------
+void ShowGenerationTitle( HWND hWnd )
+{
+	TCHAR acBuffer[MAX_PATH + 64];
+
+	if ( g_generation.Busy() )
+	{
+		TCHAR acPreview[32] = "";
+		int iScale = g_generation.SnapshotScale();
+
+		if ( iScale > 1 )
+		{
+			sprintf( acPreview, " (preview at 1/%d)", iScale * iScale );
+		}
+
+		sprintf( acBuffer, "Fractal Terrain Generator - [%s] - %d of %d faults%s%s", terrTile.GetFilename(), g_generation.FaultsDone(), g_generation.Iterations(),
+				 acPreview, g_generation.State() == GENERATE_PAUSED ? " (paused)" : "" );
+	}
+	else
+	{
+		sprintf( acBuffer, "Fractal Terrain Generator - [%s]", terrTile.GetFilename() );
+	}
+
+	SetWindowText( hWnd, acBuffer );
+}
+
+//-----------------------------------------------------------------
+//	Write out the trace asked for with -trace, if there was one
+//-----------------------------------------------------------------
+void FinishTrace()
+{
+	if ( g_szTraceFile[0] != 0 )
+	{
+		CTrace::Stop();
+
+		if ( !CTrace::Write( g_szTraceFile ) )
+		{
+			printf( "Unable to write trace to %s\n", g_szTraceFile );
+		}
+	}
+}
@@ -15,6 +15,8 @@
 #define IDC_CHK_RANDOM_SEED             1006
 #define IDC_CHK_RETAINALL               1007
 #define IDC_PROGRESS                    1008
+#define IDC_FAULTPROFILE                1009
+#define IDC_CHK_TUNE                    1010
 #define CHAOS_FILE_EXIT                 40003
 #define CHAOS_TERRAIN_REFRESH           40008
 #define CHAOS_TERRAIN_FRACDIM           40010
@@ -24,13 +26,18 @@
 #define CHAOS_TERRAIN_SETGRID           40014
 #define CHAOS_FILE_SAVE                 40016
 #define CHAOS_TERRAIN_BLURMORE          40017
+#define CHAOS_TERRAIN_ERODE             40018
+#define CHAOS_FILE_PIPELINE             40019
+#define CHAOS_TERRAIN_SPECTRAL          40020
+#define CHAOS_TERRAIN_PAUSE             40021
+#define CHAOS_TERRAIN_CANCEL            40022
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        106
-#define _APS_NEXT_COMMAND_VALUE         40018
+#define _APS_NEXT_COMMAND_VALUE         40023
 #define _APS_NEXT_CONTROL_VALUE         1018
 #define _APS_NEXT_SYMED_VALUE           101
 #endif